@@ -16,28 +16,417 @@
 #include <HIDDriverKit/HIDDriverKit.h>
 
 #include "DeliberateMouseDriver.h"
-
+#include "MouseReportDecoder.h"
+#include "HIDPPDecoder.h"
+#include "HIDPPCommands.h"
+#include "MouseMotionProcessing.h"
+#include "ReportTimingStatistics.h"
+#include "DeliberateMouseShared.h"
+
+#include <mach/mach_time.h>
 #include <time.h>
 
 // To search for logs from this driver, use either: `sudo dmesg | grep DeliberateDriver` or use Console.app search to find messages that start with "DeliberateDriver".
 #define Log(fmt, ...) os_log(OS_LOG_DEFAULT, "DeliberateDriver Mouse - " fmt "\n", ##__VA_ARGS__)
 
+// Records a binary trace point in the report path. This is a single predictable branch while tracing is disabled.
+#define Trace(event, payload0, payload1) do { if (__builtin_expect(ivars->warm->trace != nullptr, 0)) { traceRecord(ivars->warm->trace, (event), uint64_t(payload0), uint64_t(payload1)); } } while (0)
+
+// Whether `handleReport` looks up the route of every input report. The report path benchmark also builds the driver with this set to 0,
+// which decodes every input report as a mouse report, to measure what the lookup costs mouse reports.
+#ifndef DELIBERATE_MOUSE_REPORT_ROUTES
+#define DELIBERATE_MOUSE_REPORT_ROUTES 1
+#endif
+
+/// The name of the dispatch queue that handles reports, which matches the `QUEUENAME` of `ReportAvailable` in DeliberateMouseDriver.iig.
+constexpr const char* kReportQueueName = "ReportQueue";
+/// The personality property that sets the priority of the report queue. The default priority is used when it is missing.
+constexpr const char* kReportQueuePriorityKey = "ReportQueuePriority";
+
+/// Reports are decoded both from the raw bytes and from the elements until every field of their layout has been seen to change.
+/// Fields that never change, such as buttons the mouse does not have, stop being checked after this many reports per report ID,
+/// which is about a minute of motion at 1 kHz.
+constexpr uint32_t kDecodeVerificationReportLimit = 65536;
+
+/// The property that sets the time constant of the pointer smoothing filter, in microseconds. 0 disables smoothing.
+constexpr const char* kMotionSmoothingKey = "MotionSmoothingMicroseconds";
+/// Longer time constants are clamped to this value, which is already far too sluggish to be useful.
+constexpr uint32_t kMotionSmoothingMaxMicroseconds = 1000000;
+
+/// The properties that describe how the sensor is mounted. Rotation is clockwise, in degrees, and scales are in percent.
+constexpr const char* kMotionRotationKey = "MotionRotationDegrees";
+constexpr const char* kMotionSwapAxesKey = "MotionSwapAxes";
+constexpr const char* kMotionInvertXKey = "MotionInvertX";
+constexpr const char* kMotionInvertYKey = "MotionInvertY";
+constexpr const char* kMotionScaleXKey = "MotionScaleXPercent";
+constexpr const char* kMotionScaleYKey = "MotionScaleYPercent";
+
+/// The multiplier that converts sensor counts into 16.16 pointer motion. 1 << 15 is 0.5.
+/// Adjust this so it is appropriate for your mouse and its data output.
+constexpr int32_t kPointerSensitivity = 1 << 15;
+
+/// The properties that select sensitivity layers with buttons. Buttons are numbered from 1, and 0 disables a button.
+/// While the sniper button is held, motion is scaled by the sniper percentage. Each press of the stage button moves to the next stage.
+constexpr const char* kSniperButtonKey = "SniperButton";
+constexpr const char* kSniperSensitivityKey = "SniperSensitivityPercent";
+constexpr const char* kSensitivityStageButtonKey = "SensitivityStageButton";
+constexpr const char* kSensitivityStagesKey = "SensitivityStagesPercent";
+/// The property that hides the sniper and stage buttons from the OS, so they only switch layers.
+constexpr const char* kSwallowSensitivityButtonsKey = "SwallowSensitivityButtons";
+
+/// The properties that turn pointer motion into scrolling while a button is held. The button is numbered from 1, and 0 disables scroll emulation.
+/// The scale is the number of scroll units per 100 units of pointer motion, and the axis lock restricts each scroll to one axis.
+constexpr const char* kScrollEmulationButtonKey = "ScrollEmulationButton";
+constexpr const char* kScrollEmulationScaleKey = "ScrollEmulationPercent";
+constexpr const char* kScrollEmulationAxisLockKey = "ScrollEmulationAxisLock";
+/// The default scale of scroll emulation, 20 percent, in 16.16 fixed point.
+constexpr int32_t kScrollEmulationDefaultScale = (20 << 16) / 100;
+
+/// The property that suppresses isolated wheel ticks against the direction of the previous tick, when they arrive within this many milliseconds of it.
+/// 0 disables the filter.
+constexpr const char* kWheelReverseWindowKey = "WheelReverseWindowMilliseconds";
+/// Longer windows are clamped to this value, beyond which a deliberate change of direction would feel sluggish.
+constexpr uint32_t kWheelReverseWindowMaxMilliseconds = 500;
+
+/// The property that sets a custom scroll acceleration curve, as the gains in percent at evenly spaced wheel velocities,
+/// from 0 to 63 detents per second. An empty array restores plain, unaccelerated scrolling.
+constexpr const char* kScrollAccelerationCurveKey = "ScrollAccelerationCurvePercent";
+/// Wheel motion after this long without any starts again from the gain at rest.
+constexpr uint32_t kScrollAccelerationRestMicroseconds = 250000;
+
+/// The registry properties that publish how much memory the driver instance holds, and the most it has held, in bytes.
+constexpr const char* kMemoryFootprintKey = "MemoryFootprintBytes";
+constexpr const char* kMemoryFootprintPeakKey = "MemoryFootprintPeakBytes";
+
+/// The plan used until the plan of the interface is ready, which decodes nothing.
+static const MouseDecodePlan kEmptyDecodePlan = {};
+
+/// The property that enables merging of stale reports. Reports that are older than this many milliseconds when they reach the driver
+/// are merged into a single pointer event, so the cursor catches up at once instead of replaying the backlog. 0 disables merging.
+constexpr const char* kBacklogMergeKey = "BacklogMergeMilliseconds";
+/// How long merged reports wait for the rest of the backlog before they are dispatched, unless a fresh report dispatches them first.
+/// A backlog is delivered back to back, so the reports that are still stale arrive well within this time.
+constexpr uint64_t kBacklogFlushMicroseconds = 2000;
+
+/// The property that enables the binary trace of the report path.
+constexpr const char* kTraceEnabledKey = "TraceEnabled";
+
+/// How long a HID++ request may take to be sent to the device.
+constexpr uint32_t kHIDPPRequestTimeoutMilliseconds = 100;
+/// How long `Stop` waits for the diverted HID++ controls to be handed back before it stops regardless.
+constexpr uint32_t kHIDPPRestoreTimeoutMilliseconds = 250;
+
+/// The properties that set the report rate and the resolution of HID++ devices, in the personality or at runtime.
+/// Devices are left at their own settings while these are missing or 0.
+constexpr const char* kReportRateKey = "ReportRateHz";
+constexpr const char* kResolutionKey = "PointerResolutionDPI";
+/// The personality property that lists the IDs of the HID++ controls that are diverted and reported as buttons 17 to 32.
+/// Only the high resolution wheel is diverted while it is missing, so every control keeps what it does on the device.
+constexpr const char* kHIDPPDivertedControlsKey = "HIDPPDivertedControls";
+/// The registry property that publishes the report rate and resolution each HID++ device reports after it has been configured.
+constexpr const char* kHIDPPDevicesKey = "HIDPPDevices";
+constexpr const char* kHIDPPDeviceIndexKey = "DeviceIndex";
+
+/// How `handleReport` handles the reports with a report ID.
+enum ReportRoute : uint8_t
+{
+	/// The report carries no mouse fields, and is handed to the superclass
+	kReportRoutePassThrough = 0,
+	/// The report carries mouse fields, and is decoded by the driver
+	kReportRouteMouse,
+	/// The report is a HID++ report, which carries responses to the driver and notifications of diverted controls
+	kReportRouteHIDPP,
+};
+
+/// The property that limits the motion transform properties set alongside it to a single paired device.
+/// Without it, the motion transform of every paired device is changed.
+constexpr const char* kPairedDeviceIndexKey = "PairedDeviceIndex";
+
+/// The binary trace, which only exists while tracing is enabled.
+struct TraceRing
+{
+	/// The total number of records ever written
+	uint64_t writeCount;
+	DeliberateMouseTraceRecord records[kDeliberateMouseTraceCapacity];
+};
+
+/// Appends a record to the binary trace, overwriting the oldest record once the trace is full.
+/// - Parameters:
+///   - trace: The binary trace
+///   - event: One of the `kDeliberateMouseTrace` values
+///   - payload0: The first payload word
+///   - payload1: The second payload word
+static inline void traceRecord(TraceRing* trace, uint32_t event, uint64_t payload0, uint64_t payload1)
+{
+	DeliberateMouseTraceRecord& record = trace->records[trace->writeCount % kDeliberateMouseTraceCapacity];
+	record.timestamp = mach_absolute_time();
+	record.event = event;
+	record.payload0 = payload0;
+	record.payload1 = payload1;
+	++trace->writeCount;
+}
+
+/// The size of a cache line on Apple silicon. Regions written from different queues are kept on separate cache lines.
+constexpr size_t kCacheLineSize = 128;
+
+/// The report path state of a single paired device. Receivers can multiplex several mice on one interface,
+/// and each of them keeps its own buttons and motion, so one mouse never releases a button held on another.
+struct PairedDeviceState
+{
+	/// The current state of the HID buttons of this device
+	uint32_t buttonState;
+	/// The stale reports of this device that have not been dispatched yet
+	BacklogMergeState backlogMerge;
+
+	/// The sub-pixel motion the smoothing filter has not passed on yet
+	MotionSmoothingState smoothing;
+
+	/// The sensitivity layer selected by the buttons of this device, which points into `transforms` in the warm ivars
+	const MotionTransform* transform;
+	/// The sensitivity stage selected by the stage button of this device
+	uint8_t sensitivityStage;
+
+	/// The scroll emulation of this device, which is active while a scroll button is held
+	ScrollEmulationState scrollEmulation;
+	/// The reverse tick filter of the wheel of this device
+	WheelFilterState wheelFilter;
+	/// The velocity and leftover motion of the wheel of this device, for the scroll curve
+	ScrollAccelerationState scrollAcceleration;
+
+	/// The polling interval and jitter of the mouse reports of this device
+	ReportIntervalStatistics intervalStatistics;
+	/// The mouse reports of this device that were lost or delivered late
+	ReportIncidentLog incidents;
+};
+
+static_assert(kMousePairedDeviceSlotCount == kDeliberateMousePairedDeviceSlotCount, "Clients address the paired devices by the same slots as the driver.");
+
+/// Report path state, written on every report by the report queue.
+struct alignas(kCacheLineSize) DeliberateMouseDriver_HotIVars
+{
+	/// The buttons held on any paired device, which is the button state passed to the OS
+	uint32_t buttonState;
+
+	/// The state of every paired device, indexed by the slot returned by `pairedDeviceSlot`
+	PairedDeviceState devices[kMousePairedDeviceSlotCount];
+
+	/// The verification state of the decode plan, which is the only part of the plan this interface changes
+	MouseDecodeState decodeState;
+
+	/// The time the motion timer is set to fire, or 0 while it is not set
+	uint64_t motionTimerDeadline;
+};
+
+/// The configuration snapshot the report path reads on every report, but only configuration changes write.
+struct alignas(kCacheLineSize) DeliberateMouseDriver_WarmIVars
+{
+	/// Whether the interface sends boot protocol reports, which are decoded inline without a decode plan lookup
+	bool bootProtocol;
+	/// Whether the boot protocol reports carry a wheel in their fourth byte
+	bool bootProtocolWheel;
+	/// The buttons present in the first byte of the boot protocol reports
+	uint32_t bootProtocolButtonMask;
+
+	/// Converts between report timestamps and nanoseconds
+	mach_timebase_info_data_t timebase;
+	/// The pointer smoothing stage, which is `passthroughMotion` when smoothing is disabled
+	MotionFilterFunction motionFilter;
+	/// The matrices that convert the sensor counts of each paired device to pointer motion, one for every sensitivity layer,
+	/// built from `transformConfigs`, the sensitivity, and `sensitivityLayers`
+	MotionTransform transforms[kMousePairedDeviceSlotCount][kSensitivityLayerCount];
+	/// The buttons that are hidden from the OS because they only select a sensitivity layer or scroll
+	uint32_t swallowedButtons;
+	/// Whether the buttons that select a sensitivity layer are hidden from the OS
+	bool swallowSensitivityButtons;
+	/// Reports older than this many nanoseconds are merged, or 0 if merging is disabled
+	uint64_t backlogMergeNanoseconds;
+	/// How long merged reports wait for the rest of the backlog, in mach absolute time units
+	uint64_t backlogFlushDelay;
+	/// Reverse wheel ticks within this many timestamp units of the previous tick are suppressed, or 0 if the filter is disabled
+	uint64_t wheelReverseWindow;
+	/// Whether wheel motion is scaled by `scrollCurve`
+	bool scrollAccelerationEnabled;
+
+	/// The `ReportRoute` of each report ID. Reports without mouse fields are handed to the superclass,
+	/// so the non-mouse reports of combo interfaces, such as consumer keys, still reach the OS.
+	uint8_t reportRoutes[256];
+
+	/// The HID++ features of every paired device, which are only written during discovery
+	HIDPPDeviceState hidppDevices[kMousePairedDeviceSlotCount];
+	/// The progress of HID++ feature discovery, which runs on the report queue
+	HIDPPDiscovery hidppDiscovery;
+
+	/// The location of every mouse field in the raw reports of this HID interface.
+	/// The plan is never modified once it is computed, so the report path only reads it.
+	const MouseDecodePlan* decodePlan;
+
+	/// Every dispatched pointer event, for clients that want raw input without WindowServer coalescing
+	DeliberateMouseEventRing* eventRing;
+	/// The binary trace of the report path, or nullptr while tracing is disabled
+	TraceRing* trace;
+
+	/// All of the mouse elements present for this HID interface.
+	/// IOUserHIDEventService keeps the elements alive for as long as the service runs, so they are not retained.
+	IOHIDElement** mouseElements;
+	uint32_t mouseElementCount;
+
+	/// How the sensor of each paired device is mounted, as configured by the user
+	MotionTransformConfig transformConfigs[kMousePairedDeviceSlotCount];
+	/// The buttons that select the sensitivity layers, and their scales, which are the same for every paired device
+	SensitivityLayerConfig sensitivityLayers;
+	/// The buttons that scroll while held, and how motion converts to scrolling
+	ScrollEmulationConfig scrollEmulation;
+	/// The gain of the wheel at each wheel velocity, while scroll acceleration is enabled
+	ScrollCurve scrollCurve;
+};
+
+/// Lifecycle state, which the report path rarely touches, lives in the ivars themselves.
+/// Every other per-device region is carved out of a single arena that is sized in `Start`, once the elements are known,
+/// and released in one step in `free`.
 struct DeliberateMouseDriver_IVars
 {
 	/// The HID interface that the driver is handling
 	IOHIDInterface* interface;
 	/// The retained callback to be called when a HID report is available
 	OSAction* reportAvailableAction;
+	/// The queue that report callbacks run on. Every access to report path state from another queue goes through it.
+	IODispatchQueue* reportQueue;
+	/// Set once `Stop` has started canceling the report queue, after which no more work may be queued on it
+	bool stopping;
+	/// Held while `stopping` is checked and work is queued on the report queue, so `Stop` cannot cancel the queue in between
+	IOLock* reportQueueLock;
+
+	/// The memory shared with user clients that holds the event ring
+	IOBufferMemoryDescriptor* eventRingMemory;
+	/// The output report that carries HID++ requests, and its bytes. Only used on the report queue.
+	IOBufferMemoryDescriptor* hidppRequestMemory;
+	uint8_t* hidppRequest;
+	/// The action that is called on the report queue once a HID++ request has been sent
+	OSAction* hidppRequestAction;
+	/// Set while the device is being sent the request, during which the next one cannot be built in its place
+	bool hidppRequestSending;
+	/// Set when a request had to wait for the previous one to be sent, and is built once it has been
+	bool hidppRequestWaiting;
+	/// The time by which the diverted controls must be handed back, or 0 while they are not being handed back
+	uint64_t hidppRestoreDeadline;
+	/// The retained provider `Stop` was called with, which it finishes stopping once the diverted controls are handed back
+	IOService* stoppingProvider;
+	/// The timer that fires when a HID++ request was not answered in time, and the deadline of the pending request, or 0
+	IOTimerDispatchSource* hidppTimer;
+	OSAction* hidppTimerAction;
+	uint64_t hidppRequestDeadline;
+	/// The HID++ commands that configure the devices, which are sent once discovery has finished
+	HIDPPCommandQueue hidppCommands;
+	/// The timer that releases the motion the smoothing filter holds back once reports stop
+	IOTimerDispatchSource* motionTimer;
+	OSAction* motionTimerAction;
+	/// The report rate and resolution the devices are set to, or 0 to leave them unchanged
+	uint32_t reportRateHz;
+	uint32_t resolutionDPI;
+	/// The decode plan of this interface, which the report path reads through `warm->decodePlan` once it is computed
+	MouseDecodePlan* decodePlanStorage;
+
+	/// The allocation that holds every region below
+	void* arena;
+	size_t arenaSize;
+
+	DeliberateMouseDriver_HotIVars* hot;
+	DeliberateMouseDriver_WarmIVars* warm;
+	/// The storage of the binary trace, which the report path only sees while tracing is enabled
+	TraceRing* traceStorage;
+
+	/// The number of bytes currently allocated by this instance, including the ivars
+	size_t allocatedBytes;
+	/// The most bytes this instance has had allocated at once
+	size_t peakAllocatedBytes;
+};
+
+/// Records an allocation made by a driver instance.
+/// - Parameters:
+///   - ivars: The ivars of the driver instance
+///   - size: The size of the allocation
+static inline void accountAllocation(DeliberateMouseDriver_IVars* ivars, size_t size)
+{
+	ivars->allocatedBytes += size;
+	ivars->peakAllocatedBytes = (ivars->allocatedBytes > ivars->peakAllocatedBytes) ? ivars->allocatedBytes : ivars->peakAllocatedBytes;
+}
 
-	/// All of the mouse elements present for this HID interface
-	OSArray* mouseElements;
+/// Records that an allocation made by a driver instance was released.
+/// - Parameters:
+///   - ivars: The ivars of the driver instance
+///   - size: The size of the allocation
+static inline void accountFree(DeliberateMouseDriver_IVars* ivars, size_t size)
+{
+	ivars->allocatedBytes -= size;
+}
 
-	/// The current state of HID buttons for this HID interface
-	uint32_t buttonState;
-};
+/// Reserves a cache line aligned region at the end of an arena that is being laid out.
+/// - Parameters:
+///   - arenaSize: The size of the arena so far, which is updated to include the region
+///   - regionSize: The size of the region
+/// - Returns: The offset of the region from the start of the arena
+static inline size_t reserveArenaRegion(size_t& arenaSize, size_t regionSize)
+{
+	size_t offset = (arenaSize + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+	arenaSize = offset + regionSize;
+	return offset;
+}
+
+/// Combines the buttons of every paired device.
+/// - Parameters:
+///   - devices: The state of every paired device
+/// - Returns: The buttons held on any paired device
+static inline uint32_t combinePairedDeviceButtons(const PairedDeviceState (&devices)[kMousePairedDeviceSlotCount])
+{
+	uint32_t buttonState = 0;
+	for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+	{
+		buttonState |= devices[device].buttonState;
+	}
+
+	return buttonState;
+}
+
+/// Returns the buttons that are hidden from the OS, because they only select a sensitivity layer or scroll.
+/// - Parameters:
+///   - warm: The configuration of the driver instance
+/// - Returns: The mask of the hidden buttons
+static inline uint32_t swallowedButtonMask(const DeliberateMouseDriver_WarmIVars* warm)
+{
+	uint32_t layerButtons = warm->swallowSensitivityButtons ? (warm->sensitivityLayers.sniperButtons | warm->sensitivityLayers.stageButtons) : 0;
+	return layerButtons | warm->scrollEmulation.buttons;
+}
+
+/// Rebuilds the sensitivity layers of a paired device, and selects the layer that its held buttons select.
+/// - Parameters:
+///   - ivars: The ivars of the driver instance
+///   - device: The paired device slot
+static void rebuildSensitivityLayers(DeliberateMouseDriver_IVars* ivars, uint32_t device)
+{
+	const SensitivityLayerConfig& layers = ivars->warm->sensitivityLayers;
+	PairedDeviceState& deviceState = ivars->hot->devices[device];
+
+	buildSensitivityLayers(ivars->warm->transformConfigs[device], layers, ivars->warm->transforms[device]);
+
+	deviceState.sensitivityStage = (deviceState.sensitivityStage < layers.stageCount) ? deviceState.sensitivityStage : 0;
+	uint32_t layer = selectSensitivityLayer(layers, deviceState.buttonState, deviceState.buttonState, &deviceState.sensitivityStage);
+	deviceState.transform = &ivars->warm->transforms[device][layer];
+}
 
 // MARK: Dext Lifecycle Management
 
+/// Measures how long a lifecycle step took, since docking and undocking make every step visible to the user.
+/// - Parameters:
+///   - begin: When the step began, from `mach_absolute_time`
+/// - Returns: The time since `begin`, in microseconds
+static uint64_t elapsedMicroseconds(uint64_t begin)
+{
+	mach_timebase_info_data_t timebase = {};
+	mach_timebase_info(&timebase);
+
+	return absoluteTimeToNanoseconds(timebase, mach_absolute_time() - begin) / 1000;
+}
+
 /// Called on driver startup. Used to initialize driver memory.
 bool DeliberateMouseDriver::init(void)
 {
@@ -58,12 +447,12 @@ bool DeliberateMouseDriver::init(void)
 		Log("init() - Failed to allocate memory for ivars.");
 		goto Fail;
 	}
+	accountAllocation(ivars, sizeof(DeliberateMouseDriver_IVars));
 
-	// Assuming 8 buttons + 2 axes + 1 wheel as a basic mouse implementation.
-	ivars->mouseElements = OSArray::withCapacity(11);
-	if (ivars->mouseElements == nullptr)
+	ivars->reportQueueLock = IOLockAlloc();
+	if (ivars->reportQueueLock == nullptr)
 	{
-		Log("init() - Failed to allocate memory for mouse elements.");
+		Log("init() - Failed to allocate the report queue lock.");
 		goto Fail;
 	}
 
@@ -82,6 +471,10 @@ kern_return_t DeliberateMouseDriver::Start_Impl(IOService* provider)
 	IOHIDInterface temp = {};
 	kern_return_t ret = kIOReturnSuccess;
 	OSArray* deviceElements = nullptr;
+	IOAddressSegment eventRingRange = {};
+	OSDictionary* properties = nullptr;
+	uint32_t reportQueuePriority = 0;
+	uint64_t startTime = mach_absolute_time();
 	bool result = false;
 
 	Log("Start()");
@@ -93,6 +486,123 @@ kern_return_t DeliberateMouseDriver::Start_Impl(IOService* provider)
 		goto Exit;
 	}
 
+	// IOUserHIDEventService manages the lifecycle of the device elements, so there is no need to release them
+	deviceElements = getElements();
+	if (deviceElements == nullptr)
+	{
+		Log("Start() - Failed to get elements.");
+		ret = kIOReturnInvalid;
+		goto Exit;
+	}
+
+	// All per-device state is allocated at once, with the element table sized for the elements of this interface.
+	ret = createArena(deviceElements->getCount());
+	if (ret != kIOReturnSuccess)
+	{
+		Log("Start() - Failed to allocate the driver state with error: 0x%08x.", ret);
+		goto Exit;
+	}
+
+	// This populates the mouseElements array with all HID elements that refer to a mouse device.
+	// It also prevents matching on other interfaces that may match our matching parameters.
+	// For example, if a mouse also provides a keyboard interface, this will prevent that interface from matching to this driver.
+	// Interfaces that combine mouse reports with other reports are matched, and their other reports are passed through.
+	// The decode plan is ready before the interface is opened, so the first report can already use it.
+	// Interfaces that only carry HID++ are still handled, since they deliver the wheel and buttons that are diverted to HID++.
+	result = prepareDecodePlan(deviceElements);
+	if ((result == false) && (ivars->warm->reportRoutes[kPairedDeviceReportHIDPPLong] != kReportRouteHIDPP))
+	{
+		Log("Start() - Matched interface contains no mouse elements. Exiting.");
+		ret = kIOReturnInvalid;
+		goto Exit;
+	}
+
+	// Boot protocol mice, which KVM switches often present, always send the same fixed layout.
+	// Those reports skip the decode plan entirely and are decoded inline in `handleReport`.
+	ivars->warm->bootProtocol = isBootMouseDecodePlan(*ivars->warm->decodePlan);
+	if (ivars->warm->bootProtocol == true)
+	{
+		ivars->warm->bootProtocolWheel = (ivars->warm->decodePlan->layouts[0].wheel.bitSize != 0);
+		ivars->warm->bootProtocolButtonMask = ivars->warm->decodePlan->layouts[0].buttonMask;
+		Log("Start() - Interface uses the boot protocol layout.");
+	}
+
+	// The event ring is mapped into client processes by the user client, so it needs its own memory descriptor.
+	ret = IOBufferMemoryDescriptor::Create(kIOMemoryDirectionInOut, sizeof(DeliberateMouseEventRing), 0, &ivars->eventRingMemory);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("Start() - Failed to create event ring memory with error: 0x%08x.", ret);
+		goto Exit;
+	}
+	accountAllocation(ivars, sizeof(DeliberateMouseEventRing));
+
+	ret = ivars->eventRingMemory->GetAddressRange(&eventRingRange);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("Start() - Failed to get event ring address with error: 0x%08x.", ret);
+		goto Exit;
+	}
+
+	ivars->warm->eventRing = reinterpret_cast<DeliberateMouseEventRing*>(eventRingRange.address);
+	memset(ivars->warm->eventRing, 0, sizeof(DeliberateMouseEventRing));
+	DeliberateMouseEventRingInitialize(ivars->warm->eventRing);
+
+	if (ivars->warm->reportRoutes[kPairedDeviceReportHIDPPLong] == kReportRouteHIDPP)
+	{
+		ret = createHIDPPRequestMemory();
+		if (ret != kIOReturnSuccess)
+		{
+			Log("Start() - Failed to create HID++ request memory with error: 0x%08x.", ret);
+			goto Exit;
+		}
+	}
+
+	// Reports are handled on their own queue, so they are never delayed behind lifecycle or configuration work on the default queue.
+	if (CopyProperties(&properties) == kIOReturnSuccess)
+	{
+		OSNumber* priority = OSDynamicCast(OSNumber, properties->getObject(kReportQueuePriorityKey));
+		reportQueuePriority = (priority != nullptr) ? priority->unsigned32BitValue() : 0;
+
+		// The sensor settings are sent to HID++ devices once they have been discovered.
+		OSNumber* reportRate = OSDynamicCast(OSNumber, properties->getObject(kReportRateKey));
+		OSNumber* resolution = OSDynamicCast(OSNumber, properties->getObject(kResolutionKey));
+		ivars->reportRateHz = (reportRate != nullptr) ? reportRate->unsigned32BitValue() : 0;
+		if (ivars->reportRateHz > kHIDPPMaxReportRateHz)
+		{
+			Log("Start() - Ignoring a report rate of %u Hz, which is above the %u Hz HID++ devices can be set to.", ivars->reportRateHz, kHIDPPMaxReportRateHz);
+			ivars->reportRateHz = 0;
+		}
+		ivars->resolutionDPI = (resolution != nullptr) ? resolution->unsigned32BitValue() : 0;
+
+		// Controls are only diverted when they are listed, since diverting a control turns off what it does on the device.
+		OSArray* divertedControls = OSDynamicCast(OSArray, properties->getObject(kHIDPPDivertedControlsKey));
+		HIDPPDiscovery& discovery = ivars->warm->hidppDiscovery;
+		for (uint32_t controlIndex = 0; (divertedControls != nullptr) && (controlIndex < divertedControls->getCount()) &&
+			(discovery.divertControlCount < kHIDPPMaxDivertedControls); ++controlIndex)
+		{
+			OSNumber* controlID = OSDynamicCast(OSNumber, divertedControls->getObject(controlIndex));
+			if (controlID != nullptr)
+			{
+				discovery.divertControls[discovery.divertControlCount++] = controlID->unsigned16BitValue();
+			}
+		}
+		OSSafeReleaseNULL(properties);
+	}
+
+	ret = IODispatchQueue::Create(kReportQueueName, 0, reportQueuePriority, &ivars->reportQueue);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("Start() - Failed to create the report queue with error: 0x%08x.", ret);
+		goto Exit;
+	}
+
+	ret = SetDispatchQueue(kReportQueueName, ivars->reportQueue);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("Start() - Failed to set the report queue with error: 0x%08x.", ret);
+		goto Exit;
+	}
+
 	// Create a callback object that allows the driver to be notified when a new packet is received from the device.
 	// This function establishes your `reportAvailable` function as a callback.
 	ret = CreateActionReportAvailable(sizeof(uint64_t), &(ivars->reportAvailableAction));
@@ -102,6 +612,61 @@ kern_return_t DeliberateMouseDriver::Start_Impl(IOService* provider)
 		goto Exit;
 	}
 
+	// HID++ requests that are not answered in time are sent again, or given up on, when this timer fires on the report queue.
+	if (ivars->hidppRequestMemory != nullptr)
+	{
+		ret = IOTimerDispatchSource::Create(ivars->reportQueue, &ivars->hidppTimer);
+		if (ret != kIOReturnSuccess)
+		{
+			Log("Start() - Failed to create the HID++ timer with error: 0x%08x.", ret);
+			goto Exit;
+		}
+
+		ret = CreateActionHIDPPTimerOccurred(0, &ivars->hidppTimerAction);
+		if (ret != kIOReturnSuccess)
+		{
+			Log("Start() - Failed to create action for call to HIDPPTimerOccurred with error: 0x%08x.", ret);
+			goto Exit;
+		}
+
+		ret = ivars->hidppTimer->SetHandler(ivars->hidppTimerAction);
+		if (ret != kIOReturnSuccess)
+		{
+			Log("Start() - Failed to set the HID++ timer handler with error: 0x%08x.", ret);
+			goto Exit;
+		}
+
+		// Requests are sent asynchronously, so the report queue keeps handling reports while the device takes them.
+		ret = CreateActionHIDPPRequestCompleted(0, &ivars->hidppRequestAction);
+		if (ret != kIOReturnSuccess)
+		{
+			Log("Start() - Failed to create action for call to HIDPPRequestCompleted with error: 0x%08x.", ret);
+			goto Exit;
+		}
+	}
+
+	// Smoothing can be enabled at any time, so the timer that drains it always exists.
+	ret = IOTimerDispatchSource::Create(ivars->reportQueue, &ivars->motionTimer);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("Start() - Failed to create the motion timer with error: 0x%08x.", ret);
+		goto Exit;
+	}
+
+	ret = CreateActionMotionTimerOccurred(0, &ivars->motionTimerAction);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("Start() - Failed to create action for call to MotionTimerOccurred with error: 0x%08x.", ret);
+		goto Exit;
+	}
+
+	ret = ivars->motionTimer->SetHandler(ivars->motionTimerAction);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("Start() - Failed to set the motion timer handler with error: 0x%08x.", ret);
+		goto Exit;
+	}
+
 	ivars->interface = OSDynamicCast(IOHIDInterface, provider);
 	if (ivars->interface == nullptr)
 	{
@@ -118,25 +683,15 @@ kern_return_t DeliberateMouseDriver::Start_Impl(IOService* provider)
 		goto Exit;
 	}
 
-	// IOUserHIDEventService manages the lifecycle of the device elements, so there is no need to release them
-	deviceElements = getElements();
-	if (deviceElements == nullptr)
+	// HID++ responses arrive as reports, so discovery starts once the interface is open, and continues on the report queue.
+	if (ivars->hidppRequestMemory != nullptr)
 	{
-		Log("Start() - Failed to get elements.");
-		ret = kIOReturnInvalid;
-		goto Exit;
+		dispatchToReportQueue(^{
+			sendHIDPPDiscoveryRequest();
+		}, false);
 	}
 
-	// This populates the mouseElements array with all HID elements that refer to a mouse device.
-	// It also prevents matching on other interfaces that may match our matching parameters.
-	// For example, if a mouse also provides a keyboard interface, this will prevent that interface from matching to this driver.
-	result = parseMouseElements(deviceElements);
-	if (result == false)
-	{
-		Log("Start() - Matched interface contains no mouse elements. Exiting.");
-		ret = kIOReturnInvalid;
-		goto Exit;
-	}
+	publishMemoryFootprint();
 
 	ret = RegisterService();
 	if (ret != kIOReturnSuccess)
@@ -145,7 +700,7 @@ kern_return_t DeliberateMouseDriver::Start_Impl(IOService* provider)
 		goto Exit;
 	}
 
-	Log("Start() - Finished.");
+	Log("Start() - Finished in %llu us.", elapsedMicroseconds(startTime));
 	ret = kIOReturnSuccess;
 	return ret;
 
@@ -156,14 +711,48 @@ Exit:
 
 /// Called on driver cleanup. Used to stop all driver activity. Cleanup will be handled in `free`.
 kern_return_t DeliberateMouseDriver::Stop_Impl(IOService* provider)
+{
+	Log("Stop()");
+
+	// Controls that stay diverted to HID++ would stop working once the driver is gone, so they are handed back to the device first.
+	// That happens asynchronously on the report queue, which calls `finishStop` once it is done, so `Stop` never waits for a device.
+	if ((ivars != nullptr) && (ivars->hidppRequestAction != nullptr) && (ivars->hidppTimerAction != nullptr) && (ivars->stoppingProvider == nullptr))
+	{
+		provider->retain();
+		ivars->stoppingProvider = provider;
+
+		kern_return_t ret = dispatchToReportQueue(^{
+			restoreHIDPPDevices();
+		}, false);
+		if (ret == kIOReturnSuccess)
+		{
+			return ret;
+		}
+
+		ivars->stoppingProvider = nullptr;
+		provider->release();
+	}
+
+	return finishStop(provider);
+}
+
+/// Stops all driver activity, once the diverted HID++ controls have been handed back.
+/// - Parameters:
+///   - provider: The provider `Stop` was called with
+/// - Returns: The result of `Stop`
+kern_return_t DeliberateMouseDriver::finishStop(IOService* provider)
 {
 	kern_return_t ret = kIOReturnSuccess;
 	__block _Atomic uint32_t cancelCount = 0;
-
-	Log("Stop()");
+	uint64_t stopTime = mach_absolute_time();
 
 	if (ivars != nullptr)
 	{
+		// User clients queue work from their own queues, so stopping is only set once none of them is queuing any.
+		IOLockLock(ivars->reportQueueLock);
+		__atomic_store_n(&ivars->stopping, true, __ATOMIC_RELEASE);
+		IOLockUnlock(ivars->reportQueueLock);
+
 		if (ivars->interface)
 		{
 			ivars->interface->Close(this, 0);
@@ -173,6 +762,36 @@ kern_return_t DeliberateMouseDriver::Stop_Impl(IOService* provider)
 		{
 			++cancelCount;
 		}
+
+		if (ivars->reportQueue != nullptr)
+		{
+			++cancelCount;
+		}
+
+		if (ivars->hidppTimer != nullptr)
+		{
+			++cancelCount;
+		}
+
+		if (ivars->hidppTimerAction != nullptr)
+		{
+			++cancelCount;
+		}
+
+		if (ivars->hidppRequestAction != nullptr)
+		{
+			++cancelCount;
+		}
+
+		if (ivars->motionTimer != nullptr)
+		{
+			++cancelCount;
+		}
+
+		if (ivars->motionTimerAction != nullptr)
+		{
+			++cancelCount;
+		}
 	}
 
 	// If there's somehow nothing to cancel, "Stop" quickly and exit.
@@ -205,7 +824,7 @@ kern_return_t DeliberateMouseDriver::Stop_Impl(IOService* provider)
 				Log("Stop() - super::Stop failed with error: 0x%08x.", status);
 			}
 
-			Log("Stop() - Finished.");
+			Log("Stop() - Finished in %llu us.", elapsedMicroseconds(stopTime));
 
 			this->release();
 			provider->release();
@@ -214,20 +833,43 @@ kern_return_t DeliberateMouseDriver::Stop_Impl(IOService* provider)
 
 	// All of these will call the "finalize" block, but only the final one to finish canceling will stop the dext
 
-	if ((ivars != nullptr) && (ivars->reportAvailableAction != nullptr))
+	if (ivars->reportAvailableAction != nullptr)
 	{
 		ivars->reportAvailableAction->Cancel(finalize);
+	}
 
-		Log("Stop() - Cancels started, they will stop the dext later.");
+	if (ivars->reportQueue != nullptr)
+	{
+		ivars->reportQueue->Cancel(finalize);
 	}
-	else
+
+	if (ivars->hidppTimer != nullptr)
 	{
-		provider->release();
-		this->release();
+		ivars->hidppTimer->Cancel(finalize);
+	}
+
+	if (ivars->hidppTimerAction != nullptr)
+	{
+		ivars->hidppTimerAction->Cancel(finalize);
+	}
 
-		Log("Stop() - Driver stopped.");
+	if (ivars->hidppRequestAction != nullptr)
+	{
+		ivars->hidppRequestAction->Cancel(finalize);
+	}
+
+	if (ivars->motionTimer != nullptr)
+	{
+		ivars->motionTimer->Cancel(finalize);
 	}
 
+	if (ivars->motionTimerAction != nullptr)
+	{
+		ivars->motionTimerAction->Cancel(finalize);
+	}
+
+	Log("Stop() - Cancels started, they will stop the dext later.");
+
 	return ret;
 }
 
@@ -238,130 +880,1492 @@ void DeliberateMouseDriver::free(void)
 
 	if (ivars != nullptr)
 	{
-		OSSafeReleaseNULL(ivars->mouseElements);
+		if (ivars->eventRingMemory != nullptr)
+		{
+			OSSafeReleaseNULL(ivars->eventRingMemory);
+			accountFree(ivars, sizeof(DeliberateMouseEventRing));
+		}
+		if (ivars->hidppRequestMemory != nullptr)
+		{
+			OSSafeReleaseNULL(ivars->hidppRequestMemory);
+			accountFree(ivars, kHIDPPLongReportLength);
+		}
+		OSSafeReleaseNULL(ivars->reportAvailableAction);
+		OSSafeReleaseNULL(ivars->hidppTimer);
+		OSSafeReleaseNULL(ivars->hidppTimerAction);
+		OSSafeReleaseNULL(ivars->hidppRequestAction);
+		OSSafeReleaseNULL(ivars->stoppingProvider);
+		OSSafeReleaseNULL(ivars->motionTimer);
+		OSSafeReleaseNULL(ivars->motionTimerAction);
+		OSSafeReleaseNULL(ivars->reportQueue);
+		if (ivars->reportQueueLock != nullptr)
+		{
+			IOLockFree(ivars->reportQueueLock);
+			ivars->reportQueueLock = nullptr;
+		}
+
+		if (ivars->arena != nullptr)
+		{
+			IOFree(ivars->arena, ivars->arenaSize);
+			ivars->arena = nullptr;
+			accountFree(ivars, ivars->arenaSize);
+		}
+
+		if (ivars->decodePlanStorage != nullptr)
+		{
+			IOSafeDeleteNULL(ivars->decodePlanStorage, MouseDecodePlan, 1);
+			accountFree(ivars, sizeof(MouseDecodePlan));
+		}
+
+		// Only the ivars themselves should be left, otherwise an allocation was not accounted for, or leaked.
+		accountFree(ivars, sizeof(DeliberateMouseDriver_IVars));
+		if (ivars->allocatedBytes != 0)
+		{
+			Log("free() - %zu bytes were not released.", ivars->allocatedBytes);
+		}
 	}
 	IOSafeDeleteNULL(ivars, DeliberateMouseDriver_IVars, 1);
 
 	super::free();
 }
 
-/// Called by the OS when a HID packet is received.
+/// Allocates the arena that holds every per-device region, and sets the defaults of the report path.
 /// - Parameters:
-///   - deviceElements: An array of HID elements that the device provides
-/// - Returns: True if mouse elements are found for this device, otherwise false
-bool DeliberateMouseDriver::parseMouseElements(OSArray* deviceElements)
+///   - elementCount: The number of elements of the interface, which bounds the number of mouse elements
+/// - Returns: kIOReturnSuccess if the arena was allocated
+kern_return_t DeliberateMouseDriver::createArena(uint32_t elementCount)
 {
-	bool foundMouseElements = false;
+	size_t arenaSize = 0;
+	size_t hotOffset = reserveArenaRegion(arenaSize, sizeof(DeliberateMouseDriver_HotIVars));
+	size_t warmOffset = reserveArenaRegion(arenaSize, sizeof(DeliberateMouseDriver_WarmIVars));
+	size_t traceOffset = reserveArenaRegion(arenaSize, sizeof(TraceRing));
+	size_t elementsOffset = reserveArenaRegion(arenaSize, sizeof(IOHIDElement*) * elementCount);
+
+	// IOMallocZero only guarantees 16 byte alignment, so one extra cache line lets the regions start on cache lines.
+	ivars->arenaSize = arenaSize + kCacheLineSize;
+	ivars->arena = IOMallocZero(ivars->arenaSize);
+	if (ivars->arena == nullptr)
+	{
+		return kIOReturnNoMemory;
+	}
+	accountAllocation(ivars, ivars->arenaSize);
+
+	uintptr_t base = (reinterpret_cast<uintptr_t>(ivars->arena) + kCacheLineSize - 1) & ~uintptr_t(kCacheLineSize - 1);
+	ivars->hot = reinterpret_cast<DeliberateMouseDriver_HotIVars*>(base + hotOffset);
+	ivars->warm = reinterpret_cast<DeliberateMouseDriver_WarmIVars*>(base + warmOffset);
+	ivars->traceStorage = reinterpret_cast<TraceRing*>(base + traceOffset);
+	ivars->warm->mouseElements = reinterpret_cast<IOHIDElement**>(base + elementsOffset);
+	ivars->warm->decodePlan = &kEmptyDecodePlan;
+
+	mach_timebase_info(&ivars->warm->timebase);
+	ivars->warm->sensitivityLayers = { 1, { 1 << 16, 1 << 16, 1 << 16, 1 << 16 }, 0, 1 << 16, 0 };
+	ivars->warm->scrollEmulation = { 0, kScrollEmulationDefaultScale, true };
+	for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+	{
+		ivars->warm->motionFilter = configureMotionSmoothing(ivars->hot->devices[device].smoothing, 0);
 
-	Log("parseMouseElements()");
+		ivars->warm->transformConfigs[device] = { 0, false, false, false, 1 << 16, 1 << 16, kPointerSensitivity };
+		rebuildSensitivityLayers(ivars, device);
+	}
+
+	Log("createArena() - Allocated %zu bytes for %u elements.", ivars->arenaSize, elementCount);
+	return kIOReturnSuccess;
+}
+
+/// Publishes the memory held by this instance to the registry, where it can be read with `ioreg`.
+void DeliberateMouseDriver::publishMemoryFootprint(void)
+{
+	OSDictionary* properties = OSDictionary::withCapacity(2);
+	OSNumber* footprint = OSNumber::withNumber(uint64_t(ivars->allocatedBytes), 64);
+	OSNumber* peakFootprint = OSNumber::withNumber(uint64_t(ivars->peakAllocatedBytes), 64);
+
+	if ((properties != nullptr) && (footprint != nullptr) && (peakFootprint != nullptr))
+	{
+		properties->setObject(kMemoryFootprintKey, footprint);
+		properties->setObject(kMemoryFootprintPeakKey, peakFootprint);
+
+		// Runtime configuration goes through the override of SetProperties, so the registry is updated through the superclass.
+		SetProperties(properties, SUPERDISPATCH);
+	}
+
+	Log("publishMemoryFootprint() - %zu bytes, peak %zu bytes.", ivars->allocatedBytes, ivars->peakAllocatedBytes);
+
+	OSSafeReleaseNULL(peakFootprint);
+	OSSafeReleaseNULL(footprint);
+	OSSafeReleaseNULL(properties);
+}
+
+// MARK: User Client
+
+/// Called when a client process opens the driver with `IOServiceOpen`.
+/// - Parameters:
+///   - type: The type passed to `IOServiceOpen`, which is unused
+///   - userClient: The variable that stores the new user client
+/// - Returns: kIOReturnSuccess if the user client was created
+kern_return_t DeliberateMouseDriver::NewUserClient_Impl(uint32_t type, IOUserClient** userClient)
+{
+	kern_return_t ret = kIOReturnSuccess;
+	IOService* client = nullptr;
+
+	Log("NewUserClient()");
+
+	// The user client class is defined by the UserClientProperties dictionary of the driver personality.
+	ret = Create(this, "UserClientProperties", &client);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("NewUserClient() - Failed to create user client with error: 0x%08x.", ret);
+		return ret;
+	}
+
+	*userClient = OSDynamicCast(IOUserClient, client);
+	if (*userClient == nullptr)
+	{
+		Log("NewUserClient() - Created service is not a user client.");
+		client->release();
+		return kIOReturnError;
+	}
+
+	return kIOReturnSuccess;
+}
+
+/// Provides the memory that holds the event ring, so a user client can map it into its client process.
+/// - Parameters:
+///   - memory: The variable that stores the retained memory descriptor
+/// - Returns: kIOReturnSuccess if the event ring exists
+kern_return_t DeliberateMouseDriver::copyEventRingMemory(IOMemoryDescriptor** memory)
+{
+	if (ivars->eventRingMemory == nullptr)
+	{
+		return kIOReturnNotReady;
+	}
+
+	ivars->eventRingMemory->retain();
+	*memory = ivars->eventRingMemory;
+
+	return kIOReturnSuccess;
+}
+
+/// Runs a block on the report queue, unless `Stop` has started canceling it. A canceled queue drops its blocks without running them,
+/// so the lock keeps `Stop` from canceling the queue between the check and the dispatch. The blocks never retain the driver,
+/// since `Stop` keeps it alive until the cancel handler of the report queue has run.
+/// - Parameters:
+///   - block: The block to run
+///   - wait: Whether to wait until the block has run
+/// - Returns: kIOReturnSuccess if the block was queued, or kIOReturnOffline if the driver is stopping
+kern_return_t DeliberateMouseDriver::dispatchToReportQueue(IODispatchBlock block, bool wait)
+{
+	kern_return_t ret = kIOReturnOffline;
+
+	IOLockLock(ivars->reportQueueLock);
+	if ((ivars->reportQueue != nullptr) && (ivars->stopping == false))
+	{
+		// Waiting on the queue the caller already runs on would deadlock, so the block runs at once.
+		if ((wait == true) && (ivars->reportQueue->OnQueue() == true))
+		{
+			block();
+		}
+		else if (wait == true)
+		{
+			ivars->reportQueue->DispatchSync(block);
+		}
+		else
+		{
+			ivars->reportQueue->DispatchAsync(block);
+		}
+		ret = kIOReturnSuccess;
+	}
+	IOLockUnlock(ivars->reportQueueLock);
+
+	return ret;
+}
+
+/// Copies the binary trace, oldest record first.
+/// The copy runs on the report queue, so the report path never has to synchronize with readers.
+/// - Parameters:
+///   - records: The array that receives the records
+///   - capacity: The number of records that fit in `records`
+///   - recordCount: The variable that stores the number of records copied
+///   - writeCount: The variable that stores the total number of records ever written
+/// - Returns: kIOReturnSuccess if tracing is enabled
+kern_return_t DeliberateMouseDriver::copyTrace(DeliberateMouseTraceRecord* records, uint32_t capacity, uint32_t* recordCount, uint64_t* writeCount)
+{
+	__block kern_return_t ret = kIOReturnNotReady;
+
+	*recordCount = 0;
+	*writeCount = 0;
+
+	dispatchToReportQueue(^{
+		TraceRing* trace = ivars->warm->trace;
+		if (trace == nullptr)
+		{
+			return;
+		}
+
+		uint64_t available = (trace->writeCount < kDeliberateMouseTraceCapacity) ? trace->writeCount : kDeliberateMouseTraceCapacity;
+		uint32_t count = (available < capacity) ? uint32_t(available) : capacity;
+
+		for (uint32_t recordIndex = 0; recordIndex < count; ++recordIndex)
+		{
+			uint64_t position = trace->writeCount - count + recordIndex;
+			records[recordIndex] = trace->records[position % kDeliberateMouseTraceCapacity];
+		}
+
+		*recordCount = count;
+		*writeCount = trace->writeCount;
+		ret = kIOReturnSuccess;
+	}, true);
+
+	return ret;
+}
+
+/// Copies the report interval statistics of a paired device.
+/// - Parameters:
+///   - device: The slot of the paired device
+///   - statistics: The variable that stores the copy
+///   - reset: Whether to start over once the statistics are copied
+/// - Returns: kIOReturnSuccess if the statistics were copied, or kIOReturnBadArgument if there is no such slot
+kern_return_t DeliberateMouseDriver::copyIntervalStatistics(uint32_t device, DeliberateMouseIntervalStatistics* statistics, bool reset)
+{
+	if (device >= kMousePairedDeviceSlotCount)
+	{
+		return kIOReturnBadArgument;
+	}
+
+	kern_return_t ret = dispatchToReportQueue(^{
+		snapshotReportIntervalStatistics(ivars->hot->devices[device].intervalStatistics, statistics);
+
+		if (reset == true)
+		{
+			ivars->hot->devices[device].intervalStatistics = {};
+		}
+	}, true);
+
+	return (ret == kIOReturnSuccess) ? kIOReturnSuccess : kIOReturnNotReady;
+}
+
+/// Copies the lost report and stall counters of a paired device.
+/// - Parameters:
+///   - device: The slot of the paired device
+///   - incidents: The variable that stores the copy
+///   - reset: Whether to start over once the counters are copied
+/// - Returns: kIOReturnSuccess if the counters were copied, or kIOReturnBadArgument if there is no such slot
+kern_return_t DeliberateMouseDriver::copyIncidents(uint32_t device, DeliberateMouseIncidentReport* incidents, bool reset)
+{
+	if (device >= kMousePairedDeviceSlotCount)
+	{
+		return kIOReturnBadArgument;
+	}
+
+	kern_return_t ret = dispatchToReportQueue(^{
+		snapshotReportIncidentLog(ivars->hot->devices[device].incidents, incidents);
+
+		if (reset == true)
+		{
+			ivars->hot->devices[device].incidents = {};
+		}
+	}, true);
+
+	return (ret == kIOReturnSuccess) ? kIOReturnSuccess : kIOReturnNotReady;
+}
+
+// MARK: Configuration
+
+/// Converts a duration in microseconds to the units of the report timestamps.
+/// - Parameters:
+///   - timebase: The timebase of the report timestamps
+///   - microseconds: The duration to convert
+/// - Returns: The duration in absolute time units
+static inline uint64_t microsecondsToAbsoluteTime(const mach_timebase_info_data_t& timebase, uint64_t microseconds)
+{
+	return (microseconds * 1000 * timebase.denom) / timebase.numer;
+}
+
+/// Reads a number from a property dictionary.
+/// - Parameters:
+///   - properties: The property dictionary
+///   - key: The key of the property
+///   - value: The variable that stores the number, left unchanged if the property is missing
+/// - Returns: True if the property is present and is a number
+static bool copyNumberProperty(OSDictionary* properties, const char* key, uint32_t* value)
+{
+	OSNumber* number = OSDynamicCast(OSNumber, properties->getObject(key));
+	if (number == nullptr)
+	{
+		return false;
+	}
+
+	*value = number->unsigned32BitValue();
+	return true;
+}
+
+/// Reads a boolean from a property dictionary.
+/// - Parameters:
+///   - properties: The property dictionary
+///   - key: The key of the property
+///   - value: The variable that stores the boolean, left unchanged if the property is missing
+/// - Returns: True if the property is present and is a boolean
+static bool copyBooleanProperty(OSDictionary* properties, const char* key, bool* value)
+{
+	OSBoolean* boolean = OSDynamicCast(OSBoolean, properties->getObject(key));
+	if (boolean == nullptr)
+	{
+		return false;
+	}
+
+	*value = (boolean == kOSBooleanTrue);
+	return true;
+}
+
+/// Converts a percentage into a 16.16 fixed point scale, clamped to the largest scale the motion transform accepts.
+/// - Parameters:
+///   - percent: The scale in percent
+/// - Returns: The scale in 16.16 fixed point
+static inline int32_t percentToFixedScale(uint32_t percent)
+{
+	uint64_t scale = (uint64_t(percent) << 16) / 100;
+	return (scale > uint64_t(kMotionTransformMaxScale)) ? kMotionTransformMaxScale : int32_t(scale);
+}
+
+/// Converts a button number into a button mask.
+/// - Parameters:
+///   - button: The button number, starting from 1, or 0 for no button
+/// - Returns: The mask of the button, or 0 if the number is 0 or out of range
+static inline uint32_t buttonNumberToMask(uint32_t button)
+{
+	return ((button == 0) || (button > 32)) ? 0 : (1U << (button - 1));
+}
+
+/// Called when a client sets properties on the driver, for example with `IORegistryEntrySetCFProperties`.
+/// Used to configure the driver at runtime. Unknown properties are ignored.
+/// The properties are applied on the report queue, between two reports, so the report path never needs a lock.
+/// - Parameters:
+///   - properties: The properties to apply
+/// - Returns: kIOReturnSuccess if the properties were applied, or kIOReturnOffline once the driver is stopping
+kern_return_t DeliberateMouseDriver::SetProperties_Impl(OSDictionary* properties)
+{
+	Log("SetProperties()");
+
+	if (properties == nullptr)
+	{
+		return kIOReturnBadArgument;
+	}
+
+	// Properties can only be applied once `Start` has allocated the state they configure.
+	if (ivars->warm == nullptr)
+	{
+		return kIOReturnNotReady;
+	}
+
+	// A report rate the devices cannot be set to is rejected, rather than silently rounded down.
+	uint32_t reportRate = 0;
+	if ((copyNumberProperty(properties, kReportRateKey, &reportRate) == true) && (reportRate > kHIDPPMaxReportRateHz))
+	{
+		Log("SetProperties() - Rejecting a report rate of %u Hz, which is above the %u Hz HID++ devices can be set to.", reportRate, kHIDPPMaxReportRateHz);
+		return kIOReturnBadArgument;
+	}
+
+	if (ivars->reportQueue == nullptr)
+	{
+		applyProperties(properties);
+		return kIOReturnSuccess;
+	}
+
+	// The caller keeps the properties alive until they are applied, so nothing is retained by a block that might never run.
+	return dispatchToReportQueue(^{
+		applyProperties(properties);
+	}, true);
+}
+
+/// Applies runtime configuration to the report path. Must run on the report queue once reports are being handled.
+/// - Parameters:
+///   - properties: The properties to apply
+void DeliberateMouseDriver::applyProperties(OSDictionary* properties)
+{
+	uint32_t microseconds = 0;
+	if (copyNumberProperty(properties, kMotionSmoothingKey, &microseconds) == true)
+	{
+		microseconds = (microseconds > kMotionSmoothingMaxMicroseconds) ? kMotionSmoothingMaxMicroseconds : microseconds;
+		uint64_t timeConstant = microsecondsToAbsoluteTime(ivars->warm->timebase, microseconds);
+
+		// Passthrough never releases the lag, so the motion every device still holds is dispatched while the smoothing filter is selected.
+		// All devices are released before the filter changes, because it is shared by all of them.
+		if (timeConstant == 0)
+		{
+			uint64_t now = mach_absolute_time();
+			for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+			{
+				flushMergedReport(device);
+				if (motionSmoothingDrainTime(ivars->hot->devices[device].smoothing) == 0)
+				{
+					continue;
+				}
+
+				releaseMotionSmoothing(ivars->hot->devices[device].smoothing);
+
+				MouseReport drainReport = {};
+				drainReport.device = device;
+				dispatchMouseReport(now, &drainReport);
+			}
+		}
+
+		// A new time constant keeps the motion the filter holds, and releases it at the new rate.
+		for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+		{
+			ivars->warm->motionFilter = configureMotionSmoothing(ivars->hot->devices[device].smoothing, timeConstant);
+		}
+		Log("applyProperties() - Motion smoothing time constant set to %u us.", microseconds);
+	}
+
+	// Any change to the mounting is folded, along with the sensitivity, into the single matrix used by the report path.
+	// Each paired device has its own mounting, and only the properties present in the dictionary are changed.
+	uint32_t firstDevice = 0;
+	uint32_t lastDevice = kMousePairedDeviceSlotCount - 1;
+	uint32_t deviceIndex = 0;
+	bool deviceInRange = true;
+	if (copyNumberProperty(properties, kPairedDeviceIndexKey, &deviceIndex) == true)
+	{
+		deviceInRange = (deviceIndex < kMousePairedDeviceSlotCount);
+		firstDevice = deviceIndex;
+		lastDevice = deviceIndex;
+	}
+
+	uint32_t rotation = 0;
+	uint32_t scaleXPercent = 0;
+	uint32_t scaleYPercent = 0;
+	bool swapAxes = false;
+	bool invertX = false;
+	bool invertY = false;
+	bool hasRotation = copyNumberProperty(properties, kMotionRotationKey, &rotation);
+	bool hasScaleX = copyNumberProperty(properties, kMotionScaleXKey, &scaleXPercent);
+	bool hasScaleY = copyNumberProperty(properties, kMotionScaleYKey, &scaleYPercent);
+	bool hasSwapAxes = copyBooleanProperty(properties, kMotionSwapAxesKey, &swapAxes);
+	bool hasInvertX = copyBooleanProperty(properties, kMotionInvertXKey, &invertX);
+	bool hasInvertY = copyBooleanProperty(properties, kMotionInvertYKey, &invertY);
+	bool transformChanged = hasRotation || hasScaleX || hasScaleY || hasSwapAxes || hasInvertX || hasInvertY;
+
+	if ((transformChanged == true) && (deviceInRange == false))
+	{
+		Log("applyProperties() - Paired device %u is out of range, ignoring its motion transform.", deviceIndex);
+	}
+	else if (transformChanged == true)
+	{
+		for (uint32_t device = firstDevice; device <= lastDevice; ++device)
+		{
+			MotionTransformConfig& transformConfig = ivars->warm->transformConfigs[device];
+			transformConfig.rotationDegrees = hasRotation ? int32_t(rotation) : transformConfig.rotationDegrees;
+			transformConfig.scaleX = hasScaleX ? percentToFixedScale(scaleXPercent) : transformConfig.scaleX;
+			transformConfig.scaleY = hasScaleY ? percentToFixedScale(scaleYPercent) : transformConfig.scaleY;
+			transformConfig.swapAxes = hasSwapAxes ? swapAxes : transformConfig.swapAxes;
+			transformConfig.invertX = hasInvertX ? invertX : transformConfig.invertX;
+			transformConfig.invertY = hasInvertY ? invertY : transformConfig.invertY;
+
+			rebuildSensitivityLayers(ivars, device);
+			const MotionTransform& transform = ivars->warm->transforms[device][0];
+			Log("applyProperties() - Motion transform of paired device %u set to [%d %d; %d %d].", device, transform.m00, transform.m01, transform.m10, transform.m11);
+		}
+	}
+
+	// Sensitivity layers are shared by every paired device. Each layer is rebuilt here, so the report path only swaps a pointer.
+	SensitivityLayerConfig& layers = ivars->warm->sensitivityLayers;
+	uint32_t sniperButton = 0;
+	uint32_t sniperPercent = 0;
+	uint32_t stageButton = 0;
+	bool swallowButtons = false;
+	bool hasSniperButton = copyNumberProperty(properties, kSniperButtonKey, &sniperButton);
+	bool hasSniperPercent = copyNumberProperty(properties, kSniperSensitivityKey, &sniperPercent);
+	bool hasStageButton = copyNumberProperty(properties, kSensitivityStageButtonKey, &stageButton);
+	bool hasSwallowButtons = copyBooleanProperty(properties, kSwallowSensitivityButtonsKey, &swallowButtons);
+	OSArray* stages = OSDynamicCast(OSArray, properties->getObject(kSensitivityStagesKey));
+
+	layers.sniperButtons = hasSniperButton ? buttonNumberToMask(sniperButton) : layers.sniperButtons;
+	layers.sniperScale = hasSniperPercent ? percentToFixedScale(sniperPercent) : layers.sniperScale;
+	layers.stageButtons = hasStageButton ? buttonNumberToMask(stageButton) : layers.stageButtons;
+	if (stages != nullptr)
+	{
+		uint32_t stageCount = 0;
+		for (uint32_t stageIndex = 0; (stageIndex < stages->getCount()) && (stageCount < kSensitivityStageMax); ++stageIndex)
+		{
+			OSNumber* stagePercent = OSDynamicCast(OSNumber, stages->getObject(stageIndex));
+			if (stagePercent != nullptr)
+			{
+				layers.stageScales[stageCount++] = percentToFixedScale(stagePercent->unsigned32BitValue());
+			}
+		}
+
+		// Without any stage, every layer falls back to the sensitivity alone.
+		layers.stageCount = (stageCount != 0) ? stageCount : 1;
+		layers.stageScales[0] = (stageCount != 0) ? layers.stageScales[0] : (1 << 16);
+	}
+
+	if (hasSniperButton || hasSniperPercent || hasStageButton || hasSwallowButtons || (stages != nullptr))
+	{
+		ivars->warm->swallowSensitivityButtons = hasSwallowButtons ? swallowButtons : ivars->warm->swallowSensitivityButtons;
+		ivars->warm->swallowedButtons = swallowedButtonMask(ivars->warm);
+
+		for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+		{
+			rebuildSensitivityLayers(ivars, device);
+		}
+		ivars->hot->buttonState = combinePairedDeviceButtons(ivars->hot->devices) & ~ivars->warm->swallowedButtons;
+
+		Log("applyProperties() - Sensitivity layers set to %u stages, sniper buttons 0x%08x, stage buttons 0x%08x, swallowed buttons 0x%08x.",
+			layers.stageCount, layers.sniperButtons, layers.stageButtons, ivars->warm->swallowedButtons);
+	}
+
+	// A scroll button is always hidden from the OS. Scrolling that is in progress is stopped, since its button may no longer scroll.
+	ScrollEmulationConfig& scrollEmulation = ivars->warm->scrollEmulation;
+	uint32_t scrollButton = 0;
+	uint32_t scrollPercent = 0;
+	bool hasScrollButton = copyNumberProperty(properties, kScrollEmulationButtonKey, &scrollButton);
+	bool hasScrollPercent = copyNumberProperty(properties, kScrollEmulationScaleKey, &scrollPercent);
+	bool hasScrollAxisLock = copyBooleanProperty(properties, kScrollEmulationAxisLockKey, &scrollEmulation.axisLock);
+	if (hasScrollButton || hasScrollPercent || hasScrollAxisLock)
+	{
+		scrollEmulation.buttons = hasScrollButton ? buttonNumberToMask(scrollButton) : scrollEmulation.buttons;
+		scrollEmulation.scale = hasScrollPercent ? percentToFixedScale(scrollPercent) : scrollEmulation.scale;
+		ivars->warm->swallowedButtons = swallowedButtonMask(ivars->warm);
+
+		for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+		{
+			ivars->hot->devices[device].scrollEmulation.active = false;
+		}
+		ivars->hot->buttonState = combinePairedDeviceButtons(ivars->hot->devices) & ~ivars->warm->swallowedButtons;
+
+		Log("applyProperties() - Scroll emulation set to buttons 0x%08x, scale 0x%08x, axis lock %s.",
+			scrollEmulation.buttons, scrollEmulation.scale, scrollEmulation.axisLock ? "on" : "off");
+	}
+
+	uint32_t milliseconds = 0;
+	if (copyNumberProperty(properties, kBacklogMergeKey, &milliseconds) == true)
+	{
+		ivars->warm->backlogMergeNanoseconds = uint64_t(milliseconds) * 1000000;
+		ivars->warm->backlogFlushDelay = microsecondsToAbsoluteTime(ivars->warm->timebase, kBacklogFlushMicroseconds);
+		Log("applyProperties() - Backlog merge age set to %u ms.", milliseconds);
+	}
+
+	if (copyNumberProperty(properties, kWheelReverseWindowKey, &milliseconds) == true)
+	{
+		milliseconds = (milliseconds > kWheelReverseWindowMaxMilliseconds) ? kWheelReverseWindowMaxMilliseconds : milliseconds;
+
+		for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+		{
+			ivars->hot->devices[device].wheelFilter = {};
+		}
+		ivars->warm->wheelReverseWindow = microsecondsToAbsoluteTime(ivars->warm->timebase, uint64_t(milliseconds) * 1000);
+		Log("applyProperties() - Wheel reverse tick window set to %u ms.", milliseconds);
+	}
+
+	// The curve is expanded into a table here, so the report path only measures the velocity and looks up its gain.
+	OSArray* curvePoints = OSDynamicCast(OSArray, properties->getObject(kScrollAccelerationCurveKey));
+	if (curvePoints != nullptr)
+	{
+		int32_t points[kScrollCurveMaxPoints] = {};
+		uint32_t pointCount = 0;
+		for (uint32_t pointIndex = 0; (pointIndex < curvePoints->getCount()) && (pointCount < kScrollCurveMaxPoints); ++pointIndex)
+		{
+			OSNumber* pointPercent = OSDynamicCast(OSNumber, curvePoints->getObject(pointIndex));
+			if (pointPercent != nullptr)
+			{
+				points[pointCount++] = percentToFixedScale(pointPercent->unsigned32BitValue());
+			}
+		}
+
+		ScrollCurve& curve = ivars->warm->scrollCurve;
+		curve.timestampFrequency = microsecondsToAbsoluteTime(ivars->warm->timebase, 1000000);
+		curve.restInterval = microsecondsToAbsoluteTime(ivars->warm->timebase, kScrollAccelerationRestMicroseconds);
+		if (pointCount != 0)
+		{
+			buildScrollCurve(points, pointCount, curve);
+		}
+
+		for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+		{
+			ivars->hot->devices[device].scrollAcceleration = {};
+		}
+		ivars->warm->scrollAccelerationEnabled = (pointCount != 0);
+		Log("applyProperties() - Scroll acceleration curve set to %u points.", pointCount);
+	}
+
+	// New sensor settings are sent to every HID++ device. While discovery is running, they are sent once it finishes.
+	bool hasReportRate = copyNumberProperty(properties, kReportRateKey, &ivars->reportRateHz);
+	bool hasResolution = copyNumberProperty(properties, kResolutionKey, &ivars->resolutionDPI);
+	if ((hasReportRate || hasResolution) && (ivars->hidppRequestMemory != nullptr) && (ivars->warm->hidppDiscovery.step == kHIDPPStepFinished))
+	{
+		queueHIDPPConfiguration();
+		sendHIDPPCommandRequest();
+	}
+
+	// The report path only sees the trace while it is enabled, so it costs nothing but a branch otherwise.
+	bool traceEnabled = (ivars->warm->trace != nullptr);
+	if ((copyBooleanProperty(properties, kTraceEnabledKey, &traceEnabled) == true) && (traceEnabled != (ivars->warm->trace != nullptr)))
+	{
+		if (traceEnabled == true)
+		{
+			ivars->traceStorage->writeCount = 0;
+			ivars->warm->trace = ivars->traceStorage;
+		}
+		else
+		{
+			ivars->warm->trace = nullptr;
+		}
+
+		Log("applyProperties() - Tracing %s.", (ivars->warm->trace != nullptr) ? "enabled" : "disabled");
+	}
+}
+
+// MARK: Report Handling
+
+/// Finds the mouse elements of the interface, and computes the decode plan of its reports.
+/// The plan never changes once it is computed, and each report only updates the verification state in the hot ivars.
+/// - Parameters:
+///   - deviceElements: An array of HID elements that the device provides
+/// - Returns: True if mouse elements are found for this device, otherwise false
+bool DeliberateMouseDriver::prepareDecodePlan(OSArray* deviceElements)
+{
+	bool result = false;
+
+	ivars->decodePlanStorage = IONewZero(MouseDecodePlan, 1);
+	if (ivars->decodePlanStorage == nullptr)
+	{
+		Log("prepareDecodePlan() - Failed to allocate memory for the decode plan.");
+		return false;
+	}
+	accountAllocation(ivars, sizeof(MouseDecodePlan));
+
+	result = parseMouseElements(deviceElements, ivars->decodePlanStorage);
+	ivars->warm->decodePlan = ivars->decodePlanStorage;
+	initializeMouseDecodeState(ivars->hot->decodeState, *ivars->warm->decodePlan, kDecodeVerificationReportLimit);
+
+	return result;
+}
+
+/// Called on the report queue when the interface has received a new HID packet.
+/// - Parameters:
+///   - timestamp: The timestamp of the HID report
+///   - reportID: The report ID of the HID report
+///   - reportLength: The length of the HID report
+///   - type: The HID report type
+///   - action: The callback object created in `Start`
+void DeliberateMouseDriver::ReportAvailable_Impl(uint64_t timestamp, uint32_t reportID, uint32_t reportLength, IOHIDReportType type, OSAction* action)
+{
+	// IOUserHIDEventService copies the report out of the interface and calls `handleReport`, which now runs on the report queue.
+	ReportAvailable(timestamp, reportID, reportLength, type, action, SUPERDISPATCH);
+}
+
+/// Called by the OS when a HID packet is received.
+/// - Parameters:
+///   - deviceElements: An array of HID elements that the device provides
+///   - plan: The decode plan to compute
+/// - Returns: True if mouse elements are found for this device, otherwise false
+bool DeliberateMouseDriver::parseMouseElements(OSArray* deviceElements, MouseDecodePlan* plan)
+{
+	bool foundMouseElements = false;
+	// The next free bit of each input report, which is where the next input element of that report starts.
+	uint32_t reportBitOffsets[256] = {};
+	bool reportSeen[256] = {};
+	// Reports with array fields, whose elements do not map one to one onto the report bits, so offsets cannot be summed.
+	bool reportHasArray[256] = {};
+
+	Log("parseMouseElements()");
+
+	*plan = {};
 
 	for (uint_fast32_t deviceElementIndex = 0; deviceElementIndex < deviceElements->getCount(); ++deviceElementIndex)
 	{
-		IOHIDElement* deviceElement = OSDynamicCast(IOHIDElement, deviceElements->getObject(deviceElementIndex));
-		if (deviceElement == nullptr)
+		IOHIDElement* deviceElement = OSDynamicCast(IOHIDElement, deviceElements->getObject(deviceElementIndex));
+		if (deviceElement == nullptr)
+		{
+			continue;
+		}
+
+		bool isMouseElement = false;
+		IOHIDElementType type = deviceElement->getType();
+		uint32_t usagePage = deviceElement->getUsagePage();
+		uint32_t usage = deviceElement->getUsage();
+
+		// Elements are listed in report descriptor order, so the position of every input field,
+		// including padding and non-mouse fields, is the sum of the sizes of the fields before it.
+		uint32_t reportID = deviceElement->getReportID() & 0xFF;
+		uint32_t bitOffset = 0;
+		uint32_t bitSize = 0;
+		if ((type != kIOHIDElementTypeCollection) && (type < kIOHIDElementTypeOutput))
+		{
+			if (reportSeen[reportID] == false)
+			{
+				// Numbered reports start with the report ID byte.
+				reportSeen[reportID] = true;
+				reportBitOffsets[reportID] = (reportID != 0) ? 8 : 0;
+			}
+
+			bitOffset = reportBitOffsets[reportID];
+			bitSize = deviceElement->getReportSize();
+			reportBitOffsets[reportID] += bitSize * deviceElement->getReportCount();
+			reportHasArray[reportID] |= ((deviceElement->getFlags() & kIOHIDElementFlagsVariableMask) == 0);
+		}
+
+		// Logitech devices carry HID++ in vendor defined reports with their own report IDs.
+		if (((reportID == kPairedDeviceReportHIDPPShort) || (reportID == kPairedDeviceReportHIDPPLong)) && (usagePage >= kHIDPage_VendorDefinedStart) &&
+			(ivars->warm->reportRoutes[reportID] == kReportRoutePassThrough))
+		{
+			ivars->warm->reportRoutes[reportID] = kReportRouteHIDPP;
+		}
+
+		if ((type == kIOHIDElementTypeCollection) || (usage == 0))
+		{
+			// These are obviously not going to be mouse elements, so fast fail on them.
+			continue;
+		}
+
+		// Determine whether the element contains mouse-related data.
+		// Note that this implementation is very simplistic, and only supports horizontal scrolling through the AC Pan usage.
+		switch (usagePage)
+		{
+			case kHIDPage_GenericDesktop:
+			{
+				switch (usage)
+				{
+					// The driver assumes one sensor sending data on X/Y and a wheel sending info to the wheel usage.
+					// A mouse with a horizontal scroll wheel might use the Z axis, which would need to be checked for additionally.
+					case kHIDUsage_GD_X:
+					case kHIDUsage_GD_Y:
+					case kHIDUsage_GD_Wheel:
+					{
+						isMouseElement = true;
+					} break;
+				}
+			} break;
+
+			// Accept all buttons as potential mouse inputs
+			case kHIDPage_Button:
+			{
+				isMouseElement = true;
+			} break;
+
+			// Horizontal scroll wheels and tilt wheels usually report through AC Pan
+			case kHIDPage_Consumer:
+			{
+				isMouseElement = (usage == kHIDUsage_Csmr_ACPan);
+			} break;
+		}
+
+		if (isMouseElement == true)
+		{
+			// The element table was sized for every element of the interface, so it always has room.
+			ivars->warm->mouseElements[ivars->warm->mouseElementCount++] = deviceElement;
+			ivars->warm->reportRoutes[reportID] = kReportRouteMouse;
+			foundMouseElements = true;
+
+			if (bitSize != 0)
+			{
+				addToDecodePlan(plan, deviceElement, reportID, bitOffset, bitSize);
+			}
+		}
+	}
+
+	for (uint32_t layoutIndex = 0; layoutIndex < plan->layoutCount; ++layoutIndex)
+	{
+		MouseReportLayout& layout = plan->layouts[layoutIndex];
+		finalizeMouseReportLayout(layout);
+
+		Log("parseMouseElements() - Report %u uses the %s decoder.", layout.reportID, layout.decodeName);
+
+		// A field that ends past the last bit of its report means the computed layout is wrong.
+		if (((layout.minimumLength * 8) > (reportBitOffsets[layout.reportID] + 7)) || reportHasArray[layout.reportID])
+		{
+			Log("parseMouseElements() - Report %u has an inconsistent layout, reading its elements instead.", layout.reportID);
+			layout.disabled = true;
+		}
+	}
+
+	return foundMouseElements;
+}
+
+/// Records the location of a mouse element in the decode plan, so its value can be read directly from the raw report.
+/// - Parameters:
+///   - plan: The decode plan being built
+///   - element: The mouse element
+///   - reportID: The report ID of the report that contains the element
+///   - bitOffset: The offset of the element from the start of the report
+///   - bitSize: The size of a single value of the element
+void DeliberateMouseDriver::addToDecodePlan(MouseDecodePlan* decodePlan, IOHIDElement* element, uint32_t reportID, uint32_t bitOffset, uint32_t bitSize)
+{
+	MouseDecodePlan& plan = *decodePlan;
+	MouseReportLayout* layout = nullptr;
+
+	if ((bitSize > 32) || (bitOffset > UINT16_MAX))
+	{
+		return;
+	}
+
+	for (uint32_t layoutIndex = 0; layoutIndex < plan.layoutCount; ++layoutIndex)
+	{
+		if (plan.layouts[layoutIndex].reportID == reportID)
+		{
+			layout = &plan.layouts[layoutIndex];
+			break;
+		}
+	}
+
+	if (layout == nullptr)
+	{
+		if (plan.layoutCount >= kMouseDecodePlanMaxLayouts)
+		{
+			// Reports without a layout are still handled by reading their elements.
+			return;
+		}
+
+		layout = &plan.layouts[plan.layoutCount++];
+		layout->reportID = reportID;
+	}
+
+	MouseReportField field = { uint16_t(bitOffset), uint8_t(bitSize), uint8_t(element->getLogicalMin() < 0) };
+	uint32_t usage = element->getUsage();
+
+	switch (element->getUsagePage())
+	{
+		case kHIDPage_GenericDesktop:
+		{
+			// When a usage appears more than once, the last field wins, matching the element path.
+			switch (usage)
+			{
+				case kHIDUsage_GD_X:
+				{
+					layout->x = field;
+				} break;
+				case kHIDUsage_GD_Y:
+				{
+					layout->y = field;
+				} break;
+				case kHIDUsage_GD_Wheel:
+				{
+					layout->wheel = field;
+				} break;
+			}
+		} break;
+		case kHIDPage_Button:
+		{
+			if (usage >= kHIDUsage_Button_1)
+			{
+				addMouseReportButton(*layout, usage - kHIDUsage_Button_1, field);
+			}
+		} break;
+		case kHIDPage_Consumer:
+		{
+			if (usage == kHIDUsage_Csmr_ACPan)
+			{
+				layout->pan = field;
+			}
+		} break;
+	}
+}
+
+/// This is a helper function that turns button press information into a bit mask that the OS understands.
+/// - Parameters:
+///   - buttonState: The variable that stores the result of this function
+///   - index: The button index that is being pressed or released
+///   - value: The value of the button, with 0 meaning released, and other values meaning pressed
+/// - Returns: The edited button state
+static inline uint32_t setButtonState(uint32_t& buttonState, uint32_t index, uint32_t value)
+{
+	uint32_t mask = (1 << index);
+
+	if (value == 0)
+	{
+		// Clear bit
+		buttonState &= ~mask;
+	}
+	else
+	{
+		// Set bit
+		buttonState |= mask;
+	}
+
+	return buttonState;
+}
+
+/// Called by the OS when a HID packet is received.
+/// Mouse fields are decoded directly from the report bytes when their layout is known,
+/// otherwise their values are read from the elements that the OS has already updated.
+/// - Parameters:
+///   - timestamp: The timestamp of the HID report
+///   - report: The HID report data for this report
+///   - reportLength: The length of the HID report
+///   - type: The HID report type
+///   - reportID: The report ID of the HID report
+void DeliberateMouseDriver::handleReport(uint64_t timestamp, uint8_t* report, uint32_t reportLength, IOHIDReportType type, uint32_t reportID)
+{
+	MouseReport mouseReport = {};
+	const MouseReportLayout* layout = nullptr;
+	uint32_t layoutIndex = 0;
+	uint32_t device = pairedDeviceSlot(reportID, report, reportLength);
+
+	Trace(kDeliberateMouseTraceReportBegin, timestamp, (uint64_t(reportID) << 32) | reportLength);
+
+	// Reports without mouse fields are handled by the superclass, which dispatches them like it would without this driver.
+	// This costs mouse reports a single load from the warm region, which they read anyway.
+#if DELIBERATE_MOUSE_REPORT_ROUTES
+	uint8_t route = (type == kIOHIDReportTypeInput) ? ivars->warm->reportRoutes[reportID & 0xFF] : uint8_t(kReportRoutePassThrough);
+#else
+	uint8_t route = kReportRouteMouse;
+#endif
+	if (route != kReportRouteMouse)
+	{
+		if ((route == kReportRouteHIDPP) && (handleHIDPPReport(timestamp, report, reportLength) == true))
+		{
+			return;
+		}
+
+		super::handleReport(timestamp, report, reportLength, type, reportID);
+		Trace(kDeliberateMouseTracePassThrough, reportID, type);
+		return;
+	}
+
+	// Boot protocol reports are always buttons, X, Y, and an optional wheel, one byte each.
+	if ((ivars->warm->bootProtocol == true) && (reportLength >= 3))
+	{
+		mouseReport.buttons = report[0] & ivars->warm->bootProtocolButtonMask;
+		mouseReport.buttonMask = ivars->warm->bootProtocolButtonMask;
+		mouseReport.x = int8_t(report[1]);
+		mouseReport.y = int8_t(report[2]);
+		mouseReport.wheel = ((ivars->warm->bootProtocolWheel == true) && (reportLength >= 4)) ? int8_t(report[3]) : 0;
+
+		handleMouseReport(timestamp, &mouseReport, true);
+		return;
+	}
+
+	layout = findMouseReportLayout(*ivars->warm->decodePlan, ivars->hot->decodeState, reportID, &layoutIndex);
+
+	// The decode function is either a kernel specialized for the exact layout of this report, or the generic decoder.
+	if ((layout != nullptr) && layout->decode(*layout, report, reportLength, &mouseReport))
+	{
+		if (mouseReportNeedsVerification(ivars->hot->decodeState, layoutIndex))
+		{
+			// Until every field has been seen to change, confirm the computed layout against the values the OS parsed.
+			MouseReport elementReport = {};
+			readMouseElements(timestamp, reportID, &elementReport);
+
+			if (mouseReportsMatch(*layout, mouseReport, elementReport) == false)
+			{
+				Log("handleReport() - Decoded report %u does not match its elements, reading its elements instead.", reportID);
+				ivars->hot->decodeState.disabled[layoutIndex] = true;
+				mouseReport = elementReport;
+			}
+			else
+			{
+				recordVerifiedMouseReport(ivars->hot->decodeState, *layout, layoutIndex, mouseReport);
+			}
+		}
+	}
+	else
+	{
+		readMouseElements(timestamp, reportID, &mouseReport);
+	}
+
+	mouseReport.device = device;
+	handleMouseReport(timestamp, &mouseReport, true);
+}
+
+// MARK: HID++
+
+/// Allocates the output report that carries HID++ requests.
+/// - Returns: kIOReturnSuccess if the report was allocated
+kern_return_t DeliberateMouseDriver::createHIDPPRequestMemory(void)
+{
+	IOAddressSegment range = {};
+	kern_return_t ret = IOBufferMemoryDescriptor::Create(kIOMemoryDirectionOut, kHIDPPLongReportLength, 0, &ivars->hidppRequestMemory);
+	if (ret != kIOReturnSuccess)
+	{
+		return ret;
+	}
+	accountAllocation(ivars, kHIDPPLongReportLength);
+
+	ret = ivars->hidppRequestMemory->GetAddressRange(&range);
+	if (ret != kIOReturnSuccess)
+	{
+		return ret;
+	}
+
+	ivars->hidppRequest = reinterpret_cast<uint8_t*>(range.address);
+	return kIOReturnSuccess;
+}
+
+/// Starts sending the HID++ request that is in `hidppRequest` to the device. Must run on the report queue.
+/// `HIDPPRequestCompleted` is called once the device has taken it, and `hidppRequest` may not be changed until then.
+/// - Returns: kIOReturnSuccess if the request is being sent
+kern_return_t DeliberateMouseDriver::sendHIDPPRequest(void)
+{
+	// The report ID is passed in the lower byte of the options.
+	kern_return_t ret = ivars->interface->SetReport(ivars->hidppRequestMemory, kIOHIDReportTypeOutput, kPairedDeviceReportHIDPPLong, kHIDPPRequestTimeoutMilliseconds,
+		ivars->hidppRequestAction);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("sendHIDPPRequest() - Failed to send request to device 0x%02x with error: 0x%08x.", ivars->hidppRequest[1], ret);
+		return ret;
+	}
+	ivars->hidppRequestSending = true;
+
+	// Each request moves the deadline, so the timer only ever waits for the newest one.
+	// The responses to handing controls back are not waited for, so the timer keeps the deadline of the restore.
+	if (ivars->hidppRestoreDeadline == 0)
+	{
+		ivars->hidppRequestDeadline = mach_absolute_time() + microsecondsToAbsoluteTime(ivars->warm->timebase, kHIDPPResponseTimeoutNanoseconds / 1000);
+		ivars->hidppTimer->WakeAtTime(kIOTimerClockMachAbsoluteTime, ivars->hidppRequestDeadline, 0);
+	}
+
+	return ret;
+}
+
+/// Sends the next HID++ feature discovery request, if discovery is not finished. Must run on the report queue.
+void DeliberateMouseDriver::sendHIDPPDiscoveryRequest(void)
+{
+	HIDPPDiscovery& discovery = ivars->warm->hidppDiscovery;
+
+	if (__atomic_load_n(&ivars->stopping, __ATOMIC_ACQUIRE) == true)
+	{
+		return;
+	}
+
+	// A device that reconnected is asked once the command that is waiting for its response is answered, since both may ask it the same thing.
+	if (ivars->hidppCommands.requestPending == true)
+	{
+		return;
+	}
+
+	if (ivars->hidppRequestSending == true)
+	{
+		ivars->hidppRequestWaiting = true;
+		return;
+	}
+
+	while (nextHIDPPDiscoveryRequest(discovery, ivars->warm->hidppDevices, ivars->hidppRequest) == true)
+	{
+		if (sendHIDPPRequest() == kIOReturnSuccess)
+		{
+			return;
+		}
+
+		// A device that cannot be reached is skipped, like one that answers with an error.
+		discovery.requestPending = false;
+		discovery.step = kHIDPPStepNextDevice;
+	}
+
+	for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+	{
+		const HIDPPDeviceState& state = ivars->warm->hidppDevices[device];
+		if ((state.hiResWheelIndex != 0) || (state.divertedControlCount != 0))
+		{
+			Log("sendHIDPPDiscoveryRequest() - Device 0x%02x diverts %s and %u controls.", hidppDeviceIndex(device), (state.hiResWheelIndex != 0) ? "its high resolution wheel" : "no wheel", state.divertedControlCount);
+		}
+	}
+
+	// The devices are configured in one batch, now that it is known which of them speak HID++ 2.0.
+	queueHIDPPConfiguration();
+	sendHIDPPCommandRequest();
+}
+
+/// Queues the commands that set the configured report rate and resolution on every HID++ device, and read them back.
+/// Must run on the report queue.
+void DeliberateMouseDriver::queueHIDPPConfiguration(void)
+{
+	for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+	{
+		if (ivars->warm->hidppDevices[device].present == false)
+		{
+			continue;
+		}
+
+		HIDPPCommandQueue& commands = ivars->hidppCommands;
+		bool queued = true;
+		if (ivars->reportRateHz != 0)
+		{
+			queued &= enqueueHIDPPCommand(commands, device, kHIDPPCommandSetReportRate, reportRateToMilliseconds(ivars->reportRateHz));
+		}
+		queued &= enqueueHIDPPCommand(commands, device, kHIDPPCommandReadReportRate, 0);
+
+		if (ivars->resolutionDPI != 0)
+		{
+			uint16_t resolution = (ivars->resolutionDPI > UINT16_MAX) ? UINT16_MAX : uint16_t(ivars->resolutionDPI);
+			queued &= enqueueHIDPPCommand(commands, device, kHIDPPCommandSetResolution, resolution);
+		}
+		queued &= enqueueHIDPPCommand(commands, device, kHIDPPCommandReadResolution, 0);
+
+		if (queued == false)
+		{
+			Log("queueHIDPPConfiguration() - Too many commands are waiting, device 0x%02x may not be configured.", hidppDeviceIndex(device));
+		}
+	}
+}
+
+/// Sends the next queued HID++ command, unless a request is already waiting for its response.
+/// Once every command has been answered, the settings the devices reported are published. Must run on the report queue.
+void DeliberateMouseDriver::sendHIDPPCommandRequest(void)
+{
+	HIDPPCommandQueue& commands = ivars->hidppCommands;
+
+	if ((__atomic_load_n(&ivars->stopping, __ATOMIC_ACQUIRE) == true) || (commands.requestPending == true) ||
+		(ivars->warm->hidppDiscovery.requestPending == true))
+	{
+		return;
+	}
+
+	// A device that reconnected while a command was waiting is discovered before the remaining commands are sent.
+	if (ivars->warm->hidppDiscovery.step != kHIDPPStepFinished)
+	{
+		sendHIDPPDiscoveryRequest();
+		return;
+	}
+
+	if (ivars->hidppRequestSending == true)
+	{
+		ivars->hidppRequestWaiting = true;
+		return;
+	}
+
+	while (nextHIDPPCommandRequest(commands, ivars->hidppRequest) == true)
+	{
+		if (sendHIDPPRequest() == kIOReturnSuccess)
+		{
+			return;
+		}
+
+		// A command that cannot be sent is dropped, like one that the device rejects.
+		popHIDPPCommand(commands);
+	}
+
+	publishHIDPPSettings();
+}
+
+/// Publishes the report rate and resolution of every HID++ device to the registry, where they can be read with `ioreg`.
+void DeliberateMouseDriver::publishHIDPPSettings(void)
+{
+	OSDictionary* properties = OSDictionary::withCapacity(1);
+	OSArray* devices = OSArray::withCapacity(kMousePairedDeviceSlotCount);
+
+	if ((properties == nullptr) || (devices == nullptr))
+	{
+		goto Exit;
+	}
+
+	for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+	{
+		if (ivars->warm->hidppDevices[device].present == false)
 		{
 			continue;
 		}
 
-		bool isMouseElement = false;
-		IOHIDElementType type = deviceElement->getType();
-		uint32_t usagePage = deviceElement->getUsagePage();
-		uint32_t usage = deviceElement->getUsage();
+		const HIDPPDeviceSettings& settings = ivars->hidppCommands.devices[device];
+		uint64_t reportRate = (settings.reportRateMilliseconds != 0) ? (1000 / settings.reportRateMilliseconds) : 0;
 
-		if ((type == kIOHIDElementTypeCollection) || (usage == 0))
+		OSDictionary* entry = OSDictionary::withCapacity(3);
+		OSNumber* deviceIndex = OSNumber::withNumber(uint64_t(hidppDeviceIndex(device)), 8);
+		OSNumber* reportRateHz = OSNumber::withNumber(reportRate, 32);
+		OSNumber* resolutionDPI = OSNumber::withNumber(uint64_t(settings.resolutionDPI), 32);
+
+		if ((entry != nullptr) && (deviceIndex != nullptr) && (reportRateHz != nullptr) && (resolutionDPI != nullptr))
 		{
-			// These are obviously not going to be mouse elements, so fast fail on them.
-			continue;
+			entry->setObject(kHIDPPDeviceIndexKey, deviceIndex);
+			entry->setObject(kReportRateKey, reportRateHz);
+			entry->setObject(kResolutionKey, resolutionDPI);
+			devices->setObject(entry);
 		}
 
-		// Determine whether the element contains mouse-related data.
-		// Note that this implementation is very simplistic and does not support mice with additional features like horizontal scroll wheels.
-		switch (usagePage)
+		Log("publishHIDPPSettings() - Device 0x%02x reports at %llu Hz with %u DPI.", hidppDeviceIndex(device), reportRate, settings.resolutionDPI);
+
+		OSSafeReleaseNULL(resolutionDPI);
+		OSSafeReleaseNULL(reportRateHz);
+		OSSafeReleaseNULL(deviceIndex);
+		OSSafeReleaseNULL(entry);
+	}
+
+	properties->setObject(kHIDPPDevicesKey, devices);
+	SetProperties(properties, SUPERDISPATCH);
+
+Exit:
+	OSSafeReleaseNULL(devices);
+	OSSafeReleaseNULL(properties);
+}
+
+/// Called on the report queue when a HID++ request was not answered in time.
+/// A discovery request moves discovery on to the next device, and a command is sent again, or given up on.
+/// - Parameters:
+///   - action: The callback object created in `Start`
+///   - time: The time the timer fired
+void DeliberateMouseDriver::HIDPPTimerOccurred_Impl(OSAction* action, uint64_t time)
+{
+	// `Stop` only waits so long for the controls to be handed back.
+	if (ivars->hidppRestoreDeadline != 0)
+	{
+		if (mach_absolute_time() >= ivars->hidppRestoreDeadline)
 		{
-			case kHIDPage_GenericDesktop:
-			{
-				switch (usage)
-				{
-					// The driver assumes one sensor sending data on X/Y and a wheel sending info to the wheel usage.
-					// A mouse with a horizontal scroll wheel might use the Z axis, which would need to be checked for additionally.
-					case kHIDUsage_GD_X:
-					case kHIDUsage_GD_Y:
-					case kHIDUsage_GD_Wheel:
-					{
-						isMouseElement = true;
-					} break;
-				}
-			} break;
+			Log("HIDPPTimerOccurred() - Controls were not handed back in time.");
+			finishHIDPPRestore();
+		}
+		return;
+	}
 
-			// Accept all buttons as potential mouse inputs
-			case kHIDPage_Button:
-			{
-				isMouseElement = true;
-			} break;
+	// The timer may fire for a deadline that was already met, or moved by a newer request.
+	if ((ivars->hidppRequestDeadline == 0) || (mach_absolute_time() < ivars->hidppRequestDeadline))
+	{
+		return;
+	}
+	ivars->hidppRequestDeadline = 0;
+
+	HIDPPDiscovery& discovery = ivars->warm->hidppDiscovery;
+	if (discovery.requestPending == true)
+	{
+		Log("HIDPPTimerOccurred() - Device 0x%02x did not answer discovery.", hidppDeviceIndex(discovery.slot));
+		discovery.requestPending = false;
+		discovery.step = kHIDPPStepNextDevice;
+		sendHIDPPDiscoveryRequest();
+	}
+	else if (ivars->hidppCommands.requestPending == true)
+	{
+		Log("HIDPPTimerOccurred() - Device 0x%02x did not answer a command.", ivars->hidppCommands.requestDeviceIndex);
+		timeoutHIDPPCommand(ivars->hidppCommands);
+		sendHIDPPCommandRequest();
+	}
+}
+
+/// Called on the report queue once a HID++ request has been sent, or could not be.
+/// A request the device did not take is handled like one it did not answer, except that it is not sent again.
+/// - Parameters:
+///   - action: The callback object created in `Start`
+///   - status: The result of sending the request
+///   - actualByteCount: The number of bytes that were sent
+void DeliberateMouseDriver::HIDPPRequestCompleted_Impl(OSAction* action, IOReturn status, uint32_t actualByteCount)
+{
+	ivars->hidppRequestSending = false;
+
+	// While controls are handed back, each request is sent once the previous one has been, and a device that is gone ends it.
+	if (ivars->hidppRestoreDeadline != 0)
+	{
+		if (status != kIOReturnSuccess)
+		{
+			Log("HIDPPRequestCompleted() - Failed to hand controls back to device 0x%02x with error: 0x%08x.", ivars->hidppRequest[1], status);
+			finishHIDPPRestore();
+			return;
 		}
 
-		if (isMouseElement == true)
+		sendHIDPPRestoreRequest();
+		return;
+	}
+
+	if (status != kIOReturnSuccess)
+	{
+		Log("HIDPPRequestCompleted() - Failed to send request to device 0x%02x with error: 0x%08x.", ivars->hidppRequest[1], status);
+		ivars->hidppRequestDeadline = 0;
+
+		HIDPPDiscovery& discovery = ivars->warm->hidppDiscovery;
+		if (discovery.requestPending == true)
 		{
-			ivars->mouseElements->setObject(deviceElement);
-			foundMouseElements = true;
+			discovery.requestPending = false;
+			discovery.step = kHIDPPStepNextDevice;
+			ivars->hidppRequestWaiting = true;
+		}
+		else if (ivars->hidppCommands.requestPending == true)
+		{
+			popHIDPPCommand(ivars->hidppCommands);
+			ivars->hidppRequestWaiting = true;
 		}
 	}
 
-	return foundMouseElements;
+	if (ivars->hidppRequestWaiting == false)
+	{
+		return;
+	}
+	ivars->hidppRequestWaiting = false;
+
+	if (ivars->warm->hidppDiscovery.step != kHIDPPStepFinished)
+	{
+		sendHIDPPDiscoveryRequest();
+	}
+	else
+	{
+		sendHIDPPCommandRequest();
+	}
 }
 
-/// Called by the OS when a HID packet is received.
+/// Handles a HID++ report, which is either a response to a request of the driver, a notification of a diverted control,
+/// or the notification of a receiver that a paired device connected.
 /// - Parameters:
 ///   - timestamp: The timestamp of the HID report
 ///   - report: The HID report data for this report
 ///   - reportLength: The length of the HID report
-///   - type: The HID report type
-///   - reportID: The report ID of the HID report
-void DeliberateMouseDriver::handleReport(uint64_t timestamp, uint8_t* report __unused, uint32_t reportLength __unused, IOHIDReportType type __unused, uint32_t reportID)
+/// - Returns: True if the report was handled, otherwise it is handed to the superclass
+bool DeliberateMouseDriver::handleHIDPPReport(uint64_t timestamp, uint8_t* report, uint32_t reportLength)
 {
-	handleMouseReport(timestamp, reportID);
+	HIDPPMessage message = {};
+	MouseReport mouseReport = {};
+	uint32_t slot = 0;
+	uint8_t softwareID = 0;
+
+	if (parseHIDPPReport(report, reportLength, &message) == false)
+	{
+		return false;
+	}
+
+	// A device that connects to its receiver again has reset what was diverted, so it is discovered again.
+	if ((decodeHIDPPDeviceConnection(message, &slot) == true) && (__atomic_load_n(&ivars->stopping, __ATOMIC_ACQUIRE) == false))
+	{
+		Log("handleHIDPPReport() - Device 0x%02x connected, discovering it again.", hidppDeviceIndex(slot));
+		if (rediscoverHIDPPDevice(ivars->warm->hidppDiscovery, slot) == true)
+		{
+			sendHIDPPDiscoveryRequest();
+		}
+		return true;
+	}
+
+	// Notifications carry a software ID of 0, so they can never be taken for a response.
+	softwareID = hidppSoftwareID(message);
+	if (softwareID == 0)
+	{
+		uint32_t device = pairedDeviceSlot(report[0], report, reportLength);
+		const HIDPPDeviceState& state = ivars->warm->hidppDevices[device];
+
+		if ((decodeHIDPPWheel(state, message, &mouseReport) == false) && (decodeHIDPPDivertedButtons(state, message, &mouseReport) == false))
+		{
+			return false;
+		}
+
+		mouseReport.device = device;
+		handleMouseReport(timestamp, &mouseReport, false);
+		return true;
+	}
+
+	// Responses to other software on the host, such as the app of the vendor, are left to the superclass.
+	if (softwareID != kHIDPPSoftwareID)
+	{
+		return false;
+	}
+
+	if (handleHIDPPDiscoveryResponse(ivars->warm->hidppDiscovery, ivars->warm->hidppDevices, message) == true)
+	{
+		ivars->hidppRequestDeadline = 0;
+		sendHIDPPDiscoveryRequest();
+	}
+	else if (handleHIDPPCommandResponse(ivars->hidppCommands, message) == true)
+	{
+		ivars->hidppRequestDeadline = 0;
+		sendHIDPPCommandRequest();
+	}
+
+	return true;
 }
 
-/// This is a helper function that turns button press information into a bit mask that the OS understands.
-/// - Parameters:
-///   - buttonState: The variable that stores the result of this function
-///   - index: The button index that is being pressed or released
-///   - value: The value of the button, with 0 meaning released, and other values meaning pressed
-/// - Returns: The edited button state
-static inline uint32_t setButtonState(uint32_t& buttonState, uint32_t index, uint32_t value)
+/// Starts handing every diverted control back to its device, so the controls keep working once the driver is gone.
+/// Must run on the report queue. The requests are sent one at a time, and `Stop` finishes once they have all been sent,
+/// one of them could not be, or `kHIDPPRestoreTimeoutMilliseconds` have passed. The responses are not waited for.
+void DeliberateMouseDriver::restoreHIDPPDevices(void)
 {
-	uint32_t mask = (1 << index);
+	bool diverted = false;
 
-	if (value == 0)
+	// Responses that arrive from now on are not part of discovery, and no more commands are sent.
+	ivars->warm->hidppDiscovery.step = kHIDPPStepFinished;
+	ivars->warm->hidppDiscovery.requestPending = false;
+	ivars->hidppCommands.count = 0;
+	ivars->hidppCommands.requestPending = false;
+	ivars->hidppRequestWaiting = false;
+	ivars->hidppRequestDeadline = 0;
+
+	for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
 	{
-		// Clear bit
-		buttonState &= ~mask;
+		const HIDPPDeviceState& state = ivars->warm->hidppDevices[device];
+		diverted |= (state.hiResWheelIndex != 0) || (state.divertedControlCount != 0);
 	}
-	else
+
+	if (diverted == false)
 	{
-		// Set bit
-		buttonState |= mask;
+		finishHIDPPRestore();
+		return;
 	}
 
-	return buttonState;
+	ivars->hidppRestoreDeadline = mach_absolute_time() + microsecondsToAbsoluteTime(ivars->warm->timebase, kHIDPPRestoreTimeoutMilliseconds * 1000);
+	ivars->hidppTimer->WakeAtTime(kIOTimerClockMachAbsoluteTime, ivars->hidppRestoreDeadline, 0);
+
+	// The request that is being sent still uses the request buffer, so its completion sends the first one.
+	if (ivars->hidppRequestSending == false)
+	{
+		sendHIDPPRestoreRequest();
+	}
 }
 
-/// Handles mouse reports by passing them on to `dispatchRelativePointerEvent` and `dispatchRelativeScrollWheelEvent`.
-/// Disables acceleration by passing `false` to both of these functions.
-/// Since simply disabling acceleration slows down mouse and scroll inputs, values are multiplied using left shifts.
-/// Consider tuning these shift values to your preference.
+/// Sends the request that hands the next diverted control back to its device, or finishes stopping once there is none.
+/// Must run on the report queue.
+void DeliberateMouseDriver::sendHIDPPRestoreRequest(void)
+{
+	for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+	{
+		HIDPPDeviceState& state = ivars->warm->hidppDevices[device];
+		uint8_t deviceIndex = hidppDeviceIndex(device);
+
+		if (state.hiResWheelIndex != 0)
+		{
+			uint8_t mode = 0;
+			buildHIDPPRequest(ivars->hidppRequest, deviceIndex, state.hiResWheelIndex, kHIDPPHiResWheelSetMode, &mode, 1);
+			state.hiResWheelIndex = 0;
+		}
+		else if (state.divertedControlCount != 0)
+		{
+			uint16_t controlID = state.divertedControls[--state.divertedControlCount];
+			uint8_t parameters[3] = { uint8_t(controlID >> 8), uint8_t(controlID), kHIDPPReportingDivertValid };
+			buildHIDPPRequest(ivars->hidppRequest, deviceIndex, state.reprogControlsIndex, kHIDPPReprogControlsSetReporting, parameters, 3);
+		}
+		else
+		{
+			continue;
+		}
+
+		// Once the device is unplugged, the first request fails, and the rest are not tried.
+		if (sendHIDPPRequest() == kIOReturnSuccess)
+		{
+			return;
+		}
+		break;
+	}
+
+	finishHIDPPRestore();
+}
+
+/// Ends handing the diverted controls back, and finishes stopping on the default queue.
+/// `finishStop` takes the lock that user clients hold while they wait for the report queue, so it cannot run on the report queue.
+void DeliberateMouseDriver::finishHIDPPRestore(void)
+{
+	IOService* provider = ivars->stoppingProvider;
+	IODispatchQueue* queue = nullptr;
+
+	ivars->hidppRestoreDeadline = 0;
+	ivars->stoppingProvider = nullptr;
+	if (provider == nullptr)
+	{
+		return;
+	}
+
+	kern_return_t ret = CopyDispatchQueue(kIODispatchQueueDefaultQueueName, &queue);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("finishHIDPPRestore() - Failed to copy the default queue with error: 0x%08x.", ret);
+		provider->release();
+		return;
+	}
+
+	queue->DispatchAsync(^{
+		finishStop(provider);
+		provider->release();
+	});
+	queue->release();
+}
+
+/// Reads the values of all mouse elements that belong to a report.
+/// This is the slow path for reports whose layout is unknown, and the reference used to verify the decoded layouts.
 /// - Parameters:
 ///   - timestamp: The timestamp of the HID report
 ///   - reportID: The HID report ID for this report
-void DeliberateMouseDriver::handleMouseReport(uint64_t timestamp, uint32_t reportID)
+///   - mouseReport: The variable that stores the element values
+void DeliberateMouseDriver::readMouseElements(uint64_t timestamp, uint32_t reportID, MouseReport* mouseReport)
 {
-	IOFixed dX = 0;
-	IOFixed dY = 0;
-	IOFixed scrollVert = 0;
-
-	for (uint_fast32_t mouseElementIndex = 0; mouseElementIndex < ivars->mouseElements->getCount(); ++mouseElementIndex)
+	for (uint_fast32_t mouseElementIndex = 0; mouseElementIndex < ivars->warm->mouseElementCount; ++mouseElementIndex)
 	{
-		IOHIDElement* element = OSDynamicCast(IOHIDElement, ivars->mouseElements->getObject(mouseElementIndex));
+		IOHIDElement* element = ivars->warm->mouseElements[mouseElementIndex];
 		if (element == nullptr)
 		{
 			continue;
@@ -388,34 +2392,246 @@ void DeliberateMouseDriver::handleMouseReport(uint64_t timestamp, uint32_t repor
 		{
 			case kHIDPage_GenericDesktop:
 			{
-				// All IOFixed values are 16.16 fixed point numbers.
-				// In order to convert our input data into this format, we simply shift
-				// its integer representation into the whole number portion of the representation
-				// Adjust this so it is appropriate for your mouse and its data output.
 				switch (usage)
 				{
 					case kHIDUsage_GD_X:
 					{
-						dX = value << 15;
+						mouseReport->x = value;
 					} break;
 					case kHIDUsage_GD_Y:
 					{
-						dY = value << 15;
+						mouseReport->y = value;
 					} break;
 					case kHIDUsage_GD_Wheel:
 					{
-						scrollVert = IOFixedMultiply(value << 16, -3 << 16);
+						mouseReport->wheel = value;
 					} break;
 				}
 			} break;
 			case kHIDPage_Button:
 			{
-				if ((usage >= kHIDUsage_Button_1) && (usage <= kHIDUsage_Button_255))
+				if ((usage >= kHIDUsage_Button_1) && ((usage - kHIDUsage_Button_1) < kMouseReportMaxButtons))
 				{
-					ivars->buttonState = setButtonState(ivars->buttonState, usage - kHIDUsage_Button_1, value);
+					setButtonState(mouseReport->buttons, usage - kHIDUsage_Button_1, value);
+					mouseReport->buttonMask |= (1U << (usage - kHIDUsage_Button_1));
 				}
-			}
+			} break;
+			case kHIDPage_Consumer:
+			{
+				if (usage == kHIDUsage_Csmr_ACPan)
+				{
+					mouseReport->pan = value;
+				}
+			} break;
+		}
+	}
+}
+
+/// Handles decoded mouse reports. Measures the timing of the device that sent them, then either dispatches them,
+/// or merges them with other stale reports when they are delivered long after they were generated.
+/// - Parameters:
+///   - timestamp: The timestamp of the HID report
+///   - mouseReport: The mouse values decoded from the HID report
+///   - polled: Whether the report was polled. HID++ notifications are only sent on a change, so they are left out of the timing.
+void DeliberateMouseDriver::handleMouseReport(uint64_t timestamp, const MouseReport* mouseReport, bool polled)
+{
+	uint32_t device = mouseReport->device;
+	PairedDeviceState& deviceState = ivars->hot->devices[device];
+
+	// Reports can only be stamped before they are delivered, so a report that is older than it should be waited in a backlog.
+	uint64_t now = mach_absolute_time();
+	uint64_t age = (now > timestamp) ? absoluteTimeToNanoseconds(ivars->warm->timebase, now - timestamp) : 0;
+	if (polled == true)
+	{
+		uint64_t interval = recordReportInterval(deviceState.intervalStatistics, ivars->warm->timebase, timestamp);
+		detectReportIncidents(deviceState.incidents, deviceState.intervalStatistics, interval, timestamp, age, reportMotionCounts(mouseReport->x, mouseReport->y));
+	}
+
+	Trace(kDeliberateMouseTraceDecode, int64_t(mouseReport->x), int64_t(mouseReport->y));
+
+	// Stale motion is summed rather than replayed. A button edge is never merged, so edges are dispatched in order.
+	// Once the driver is stopping, the motion timer might never fire again, so nothing is merged anymore.
+	uint32_t buttonState = (deviceState.buttonState & ~mouseReport->buttonMask) | (mouseReport->buttons & mouseReport->buttonMask);
+	if (shouldMergeStaleReport(ivars->warm->backlogMergeNanoseconds, age, deviceState.buttonState, buttonState) &&
+		(__atomic_load_n(&ivars->stopping, __ATOMIC_ACQUIRE) == false))
+	{
+		// The rest of the backlog may not have reached the report queue yet, so the merged report waits for it,
+		// until the next fresh report or the motion timer dispatches it.
+		if (mergeStaleReport(deviceState.backlogMerge, *mouseReport, timestamp, now + ivars->warm->backlogFlushDelay) == true)
+		{
+			armMotionTimer(deviceState.backlogMerge.flushTime);
+		}
+		return;
+	}
+
+	// Merged motion happened before this report, so it has to be dispatched first.
+	flushMergedReport(device);
+
+	dispatchMouseReport(timestamp, mouseReport);
+}
+
+/// Dispatches the stale reports of a paired device that were merged, if there are any.
+/// - Parameters:
+///   - device: The slot of the paired device
+void DeliberateMouseDriver::flushMergedReport(uint32_t device)
+{
+	MouseReport mergedReport = {};
+	uint64_t mergedTimestamp = 0;
+	if (takeMergedReport(ivars->hot->devices[device].backlogMerge, &mergedReport, &mergedTimestamp) == true)
+	{
+		dispatchMouseReport(mergedTimestamp, &mergedReport);
+	}
+}
+
+/// Makes sure the motion timer fires no later than the given time. Must run on the report queue.
+/// While the mouse keeps moving, the timer stays set for the first deadline, so it fires at most once per time constant.
+/// - Parameters:
+///   - deadline: The latest time the timer should fire, in mach absolute time units
+void DeliberateMouseDriver::armMotionTimer(uint64_t deadline)
+{
+	uint64_t armedDeadline = ivars->hot->motionTimerDeadline;
+	if ((armedDeadline != 0) && (armedDeadline <= deadline))
+	{
+		return;
+	}
+
+	ivars->hot->motionTimerDeadline = deadline;
+	ivars->motionTimer->WakeAtTime(kIOTimerClockMachAbsoluteTime, deadline, 0);
+}
+
+/// Called on the report queue when the motion timer fires.
+/// Merged stale reports whose flush time has passed are dispatched. Then every paired device whose smoothing filter still holds motion,
+/// and has not reported for a time constant, is stepped with a report without motion or buttons, which releases part of the motion,
+/// and all of it after `kMotionSmoothingDrainSteps` steps.
+/// - Parameters:
+///   - action: The callback object created in `Start`
+///   - time: The time the timer fired
+void DeliberateMouseDriver::MotionTimerOccurred_Impl(OSAction* action, uint64_t time)
+{
+	uint64_t now = mach_absolute_time();
+	ivars->hot->motionTimerDeadline = 0;
+
+	for (uint32_t device = 0; device < kMousePairedDeviceSlotCount; ++device)
+	{
+		// Merged stale reports are dispatched once the rest of the backlog had time to arrive, unless a fresh report already dispatched them.
+		const BacklogMergeState& backlogMerge = ivars->hot->devices[device].backlogMerge;
+		if ((backlogMerge.pending == true) && (backlogMerge.flushTime > now))
+		{
+			armMotionTimer(backlogMerge.flushTime);
+		}
+		else
+		{
+			flushMergedReport(device);
+		}
+
+		uint64_t drainTime = motionSmoothingDrainTime(ivars->hot->devices[device].smoothing);
+		if (drainTime == 0)
+		{
+			continue;
+		}
+
+		// A device that reported recently is not drained yet, and the timer is set for its own deadline instead.
+		if (drainTime > now)
+		{
+			armMotionTimer(drainTime);
+			continue;
+		}
+
+		// Merged motion happened before this step, so it goes through the filter first.
+		flushMergedReport(device);
+
+		// The report goes through the rest of the report path like any other, which sets the timer again while motion remains.
+		MouseReport drainReport = {};
+		drainReport.device = device;
+		dispatchMouseReport(now, &drainReport);
+	}
+}
+
+/// Dispatches mouse reports by passing them on to `dispatchRelativePointerEvent` and `dispatchRelativeScrollWheelEvent`.
+/// Disables acceleration by passing `false` to both of these functions.
+/// Since simply disabling acceleration slows down mouse and scroll inputs, values are multiplied using left shifts.
+/// Consider tuning these shift values to your preference.
+/// - Parameters:
+///   - timestamp: The timestamp of the HID report
+///   - mouseReport: The mouse values decoded from the HID report
+void DeliberateMouseDriver::dispatchMouseReport(uint64_t timestamp, const MouseReport* mouseReport)
+{
+	kern_return_t ret = kIOReturnSuccess;
+
+	// All IOFixed values are 16.16 fixed point numbers.
+	// The transform matrix converts the sensor counts straight into this format. It combines the sensitivity
+	// multiplier with the rotation, axis swap, inversion, and scale of the sensor, so this only takes four multiplies.
+	IOFixed dX = 0;
+	IOFixed dY = 0;
+	PairedDeviceState& deviceState = ivars->hot->devices[mouseReport->device];
+
+	// Buttons that are not part of this report keep their previous state.
+	// On a button edge, the sensitivity layer is switched before the motion of this report is transformed, so it applies without delay.
+	// The smoothing lag is kept, so motion that was already measured is released at the sensitivity it was measured with.
+	// The OS sees a button as held while it is held on any paired device, which only needs to be recomputed on a button edge.
+	// A scroll button that is released before the motion leaves the slop was tapped, and clicks once the report has been dispatched.
+	uint32_t buttonState = (deviceState.buttonState & ~mouseReport->buttonMask) | (mouseReport->buttons & mouseReport->buttonMask);
+	uint32_t tappedButtons = 0;
+	if (buttonState != deviceState.buttonState)
+	{
+		const ScrollEmulationConfig& scrollEmulation = ivars->warm->scrollEmulation;
+		uint32_t scrollButtons = buttonState & scrollEmulation.buttons;
+		if ((scrollButtons != 0) && (deviceState.scrollEmulation.active == false))
+		{
+			beginScrollEmulation(deviceState.scrollEmulation);
+		}
+		else if ((scrollButtons == 0) && (deviceState.scrollEmulation.active == true) && (endScrollEmulation(deviceState.scrollEmulation) == true))
+		{
+			tappedButtons = deviceState.buttonState & scrollEmulation.buttons;
 		}
+
+		uint32_t layer = selectSensitivityLayer(ivars->warm->sensitivityLayers, deviceState.buttonState, buttonState, &deviceState.sensitivityStage);
+		deviceState.transform = &ivars->warm->transforms[mouseReport->device][layer];
+		deviceState.buttonState = buttonState;
+		ivars->hot->buttonState = combinePairedDeviceButtons(ivars->hot->devices) & ~ivars->warm->swallowedButtons;
+	}
+
+	applyMotionTransform(*deviceState.transform, mouseReport->x, mouseReport->y, &dX, &dY);
+	ivars->warm->motionFilter(deviceState.smoothing, timestamp, &dX, &dY);
+	// Motion the filter holds back would otherwise only be released by the next report, which may be long after the mouse stopped.
+	uint64_t drainTime = motionSmoothingDrainTime(deviceState.smoothing);
+	if (drainTime != 0)
+	{
+		armMotionTimer(drainTime);
+	}
+	Trace(kDeliberateMouseTraceScale, int64_t(dX), int64_t(dY));
+	// Spurious ticks against the direction the wheel is turning are filtered out before they are scaled.
+	// High resolution wheels report several counts per detent, so their motion is divided down to detents, keeping the fraction.
+	// The custom scroll curve scales the wheel by its own velocity, and keeps whatever is too small to dispatch for the next report.
+	// Merged backlogs and high resolution wheels can carry far more counts than fit in 16.16, so every product saturates.
+	int32_t wheel = filterWheel(ivars->warm->wheelReverseWindow, deviceState.wheelFilter, timestamp, mouseReport->wheel);
+	IOFixed scrollVert = 0;
+	if (ivars->warm->scrollAccelerationEnabled == true)
+	{
+		IOFixed detents = accelerateScroll(ivars->warm->scrollCurve, deviceState.scrollAcceleration, timestamp, wheel, mouseReport->wheelResolution);
+		scrollVert = saturateFixed(int64_t(detents) * -3);
+	}
+	else if (mouseReport->wheelResolution > 1)
+	{
+		scrollVert = saturateFixed((int64_t(wheel) * -(3 << 16)) / int64_t(mouseReport->wheelResolution));
+	}
+	else
+	{
+		scrollVert = saturateFixed(int64_t(wheel) * -(3 << 16));
+	}
+	// macOS treats AC Pan with the opposite sign of the vertical wheel.
+	IOFixed scrollHoriz = saturateFixed(int64_t(mouseReport->pan) * (3 << 16));
+
+	// While a scroll button is held, the pointer stays where it is and its motion scrolls instead.
+	if (deviceState.scrollEmulation.active == true)
+	{
+		IOFixed emulatedVert = 0;
+		IOFixed emulatedHoriz = 0;
+		emulateScroll(ivars->warm->scrollEmulation, deviceState.scrollEmulation, dX, dY, &emulatedVert, &emulatedHoriz);
+		scrollVert = saturateFixed(int64_t(scrollVert) + emulatedVert);
+		scrollHoriz = saturateFixed(int64_t(scrollHoriz) + emulatedHoriz);
+		dX = 0;
+		dY = 0;
 	}
 
 	// Passing kIOHIDPointerEventOptionsNoAcceleration/kIOHIDScrollEventOptionsNoAcceleration
@@ -423,6 +2639,22 @@ void DeliberateMouseDriver::handleMouseReport(uint64_t timestamp, uint32_t repor
 	// It's included in the `dispatchRelativePointerEvent` for completeness,
 	// but if you pass both `kIOHIDScrollEventOptionsNoAcceleration` and `false` to `dispatchRelativeScrollWheelEvent`,
 	// then macOS will simply ignore all scroll input. So don't do that.
-	dispatchRelativePointerEvent(timestamp, dX, dY, ivars->buttonState, kIOHIDPointerEventOptionsNoAcceleration, false);
-	dispatchRelativeScrollWheelEvent(timestamp, scrollVert, 0, 0, 0, false);
+	ret = dispatchRelativePointerEvent(timestamp, dX, dY, ivars->hot->buttonState, kIOHIDPointerEventOptionsNoAcceleration, false);
+	Trace(kDeliberateMouseTraceDispatchPointer, ivars->hot->buttonState, ret);
+
+	dispatchRelativeScrollWheelEvent(timestamp, scrollVert, scrollHoriz, 0, 0, false);
+	Trace(kDeliberateMouseTraceDispatchScroll, int64_t(scrollVert), int64_t(scrollHoriz));
+
+	// A tapped scroll button is pressed and released at once, since the OS never saw it while it was held.
+	if (tappedButtons != 0)
+	{
+		ret = dispatchRelativePointerEvent(timestamp, 0, 0, ivars->hot->buttonState | tappedButtons, kIOHIDPointerEventOptionsNoAcceleration, false);
+		Trace(kDeliberateMouseTraceDispatchPointer, ivars->hot->buttonState | tappedButtons, ret);
+		ret = dispatchRelativePointerEvent(timestamp, 0, 0, ivars->hot->buttonState, kIOHIDPointerEventOptionsNoAcceleration, false);
+		Trace(kDeliberateMouseTraceDispatchPointer, ivars->hot->buttonState, ret);
+	}
+
+	// Publish the same values to clients reading the event ring, along with the values decoded from the report.
+	DeliberateMouseEvent event = { 0, timestamp, dX, dY, scrollVert, ivars->hot->buttonState, mouseReport->x, mouseReport->y, mouseReport->wheel, mouseReport->pan };
+	DeliberateMouseEventRingWrite(ivars->warm->eventRing, &event);
 }
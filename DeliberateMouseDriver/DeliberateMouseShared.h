@@ -0,0 +1,341 @@
+//
+//  DeliberateMouseShared.h
+//  DeliberateMouseDriver
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Definitions shared between the driver and the client processes that open its user client.
+// This header only depends on the C standard library, so it can be included from both the dext and any macOS app or tool.
+//
+
+#ifndef DeliberateMouseShared_h
+#define DeliberateMouseShared_h
+
+#include <stdint.h>
+
+// MARK: User Client Methods
+
+/// The selectors that can be called with `IOConnectCallMethod`.
+enum
+{
+	/// Copies the binary trace into the structure output, oldest record first.
+	/// Returns the number of records copied, and the total number of records ever written, as scalar outputs.
+	kDeliberateMouseMethodCopyTrace = 0,
+	/// Copies the report interval statistics of a paired device into a `DeliberateMouseIntervalStatistics` structure output.
+	/// Takes two scalar inputs: the paired device slot, and a value that resets the statistics after they are copied when it is not 0.
+	kDeliberateMouseMethodCopyIntervalStatistics = 1,
+	/// Copies the lost report and stall counters of a paired device into a `DeliberateMouseIncidentReport` structure output.
+	/// Takes two scalar inputs: the paired device slot, and a value that resets the counters after they are copied when it is not 0.
+	kDeliberateMouseMethodCopyIncidents = 2,
+
+	kDeliberateMouseMethodCount
+};
+
+/// The number of paired device slots. A receiver reports the device with index N in slot N, and slot 0 also holds the reports
+/// of a directly connected mouse, or of any report that carries no device index.
+#define kDeliberateMousePairedDeviceSlotCount 8
+
+// MARK: User Client Memory
+
+/// The memory types that can be mapped with `IOConnectMapMemory64`.
+enum
+{
+	/// The read-only `DeliberateMouseEventRing` that receives every pointer event the driver dispatches
+	kDeliberateMouseMemoryTypeEventRing = 0,
+};
+
+// MARK: Event Ring
+
+/// The number of events in the event ring. This is a power of two, and holds one second of events at 8 kHz.
+#define kDeliberateMouseEventRingCapacity 8192
+/// The version of the event ring layout, which changes whenever the layout changes.
+#define kDeliberateMouseEventRingVersion 2
+
+/// A single pointer event, exactly as the driver dispatched it to the OS, along with the report it came from.
+///
+/// `dX`, `dY`, and `wheel` are post-processed: the motion has been through the transform matrix, sensitivity layer, and smoothing,
+/// and is 0 while a scroll button turns it into scrolling, and the wheel has been through the reverse tick filter, the scroll curve,
+/// and the detent resolution, with scroll emulation added. The `raw` fields are the values decoded from the report, before any of that.
+/// Events that release motion held back by smoothing have no report, so their `raw` fields are 0.
+typedef struct DeliberateMouseEvent
+{
+	/// The number of the event plus one, set once the event is completely written. Used to detect torn reads.
+	uint64_t sequence;
+	/// The timestamp of the HID report, in mach absolute time units
+	uint64_t timestamp;
+	/// The unaccelerated 16.16 fixed point horizontal motion that was dispatched
+	int32_t dX;
+	/// The unaccelerated 16.16 fixed point vertical motion that was dispatched
+	int32_t dY;
+	/// The 16.16 fixed point vertical scroll that was dispatched
+	int32_t wheel;
+	/// The state of every button, with button 1 in bit 0
+	uint32_t buttons;
+	/// The horizontal and vertical sensor counts decoded from the report
+	int32_t rawX;
+	int32_t rawY;
+	/// The wheel and AC Pan counts decoded from the report. High resolution wheels report several counts per detent.
+	int32_t rawWheel;
+	int32_t rawPan;
+} DeliberateMouseEvent;
+
+/// A lock-free ring with a single producer, the driver, and any number of readers that never block it.
+/// When a reader falls more than a full ring behind, the oldest events are overwritten and reported as dropped.
+typedef struct DeliberateMouseEventRing
+{
+	uint32_t version;
+	uint32_t capacity;
+	uint8_t reserved0[120];
+
+	/// The total number of events ever written. Kept on its own cache line, since it is the only field readers poll.
+	uint64_t writeCount;
+	uint8_t reserved1[120];
+
+	DeliberateMouseEvent events[kDeliberateMouseEventRingCapacity];
+} DeliberateMouseEventRing;
+
+/// Initializes an event ring in freshly allocated memory.
+/// - Parameters:
+///   - ring: The event ring
+static inline void DeliberateMouseEventRingInitialize(DeliberateMouseEventRing* ring)
+{
+	ring->version = kDeliberateMouseEventRingVersion;
+	ring->capacity = kDeliberateMouseEventRingCapacity;
+	__atomic_store_n(&ring->writeCount, 0, __ATOMIC_RELEASE);
+}
+
+/// Appends an event to the ring. Must only be called by the single producer.
+/// - Parameters:
+///   - ring: The event ring
+///   - event: The event to append. Its sequence is ignored.
+static inline void DeliberateMouseEventRingWrite(DeliberateMouseEventRing* ring, const DeliberateMouseEvent* event)
+{
+	uint64_t index = __atomic_load_n(&ring->writeCount, __ATOMIC_RELAXED);
+	DeliberateMouseEvent* slot = &ring->events[index & (kDeliberateMouseEventRingCapacity - 1)];
+
+	// Invalidate the slot before changing it, so a reader that is copying it at the same time notices.
+	__atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&slot->timestamp, event->timestamp, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->dX, event->dX, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->dY, event->dY, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->wheel, event->wheel, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->buttons, event->buttons, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->rawX, event->rawX, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->rawY, event->rawY, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->rawWheel, event->rawWheel, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->rawPan, event->rawPan, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&slot->sequence, index + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->writeCount, index + 1, __ATOMIC_RELEASE);
+}
+
+/// Copies the events a reader has not seen yet out of the ring.
+/// - Parameters:
+///   - ring: The event ring, usually mapped read-only
+///   - readCount: The number of events the reader has consumed so far, which is updated. Start at 0, or at `writeCount` to skip history.
+///   - events: The array that receives the events
+///   - maxEvents: The capacity of the `events` array
+///   - droppedEvents: Incremented by the number of events that were overwritten before they could be read
+/// - Returns: The number of events copied into `events`
+static inline uint32_t DeliberateMouseEventRingRead(const DeliberateMouseEventRing* ring, uint64_t* readCount, DeliberateMouseEvent* events, uint32_t maxEvents, uint64_t* droppedEvents)
+{
+	uint64_t writeCount = __atomic_load_n(&ring->writeCount, __ATOMIC_ACQUIRE);
+	uint64_t next = *readCount;
+	uint32_t count = 0;
+
+	while ((next < writeCount) && (count < maxEvents))
+	{
+		// Skip over everything the producer has already overwritten.
+		if ((writeCount - next) > kDeliberateMouseEventRingCapacity)
+		{
+			uint64_t oldest = writeCount - kDeliberateMouseEventRingCapacity;
+			*droppedEvents += oldest - next;
+			next = oldest;
+		}
+
+		const DeliberateMouseEvent* slot = &ring->events[next & (kDeliberateMouseEventRingCapacity - 1)];
+		DeliberateMouseEvent event;
+
+		event.sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		event.timestamp = __atomic_load_n(&slot->timestamp, __ATOMIC_RELAXED);
+		event.dX = __atomic_load_n(&slot->dX, __ATOMIC_RELAXED);
+		event.dY = __atomic_load_n(&slot->dY, __ATOMIC_RELAXED);
+		event.wheel = __atomic_load_n(&slot->wheel, __ATOMIC_RELAXED);
+		event.buttons = __atomic_load_n(&slot->buttons, __ATOMIC_RELAXED);
+		event.rawX = __atomic_load_n(&slot->rawX, __ATOMIC_RELAXED);
+		event.rawY = __atomic_load_n(&slot->rawY, __ATOMIC_RELAXED);
+		event.rawWheel = __atomic_load_n(&slot->rawWheel, __ATOMIC_RELAXED);
+		event.rawPan = __atomic_load_n(&slot->rawPan, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if ((event.sequence != (next + 1)) || (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != event.sequence))
+		{
+			// The producer lapped the reader while the event was being copied. Catch up and try again.
+			writeCount = __atomic_load_n(&ring->writeCount, __ATOMIC_ACQUIRE);
+			if ((writeCount - next) <= kDeliberateMouseEventRingCapacity)
+			{
+				*droppedEvents += 1;
+				next += 1;
+			}
+			continue;
+		}
+
+		events[count] = event;
+		count += 1;
+		next += 1;
+	}
+
+	*readCount = next;
+	return count;
+}
+
+// MARK: Binary Trace
+
+/// The number of records the driver keeps while tracing is enabled.
+#define kDeliberateMouseTraceCapacity 4096
+
+/// The trace points in the report path, and the meaning of their payloads.
+enum
+{
+	/// A report arrived. Payload 0 is the report timestamp, payload 1 is the report ID in the upper 32 bits and the report length in the lower 32 bits.
+	kDeliberateMouseTraceReportBegin = 1,
+	/// The report was decoded. The payloads are the signed X and Y sensor counts.
+	kDeliberateMouseTraceDecode = 2,
+	/// The motion was transformed and filtered. The payloads are the signed 16.16 dX and dY.
+	kDeliberateMouseTraceScale = 3,
+	/// `dispatchRelativePointerEvent` returned. Payload 0 is the button state, payload 1 is the return code.
+	kDeliberateMouseTraceDispatchPointer = 4,
+	/// `dispatchRelativeScrollWheelEvent` returned. The payloads are the signed 16.16 vertical and horizontal scroll.
+	kDeliberateMouseTraceDispatchScroll = 5,
+	/// A report without mouse fields was handed to the superclass, which returned. Payload 0 is the report ID, payload 1 is the report type.
+	kDeliberateMouseTracePassThrough = 6,
+};
+
+/// A single trace record.
+typedef struct DeliberateMouseTraceRecord
+{
+	/// When the trace point was reached, in mach absolute time units
+	uint64_t timestamp;
+	/// One of the `kDeliberateMouseTrace` values
+	uint32_t event;
+	uint32_t reserved;
+	uint64_t payload0;
+	uint64_t payload1;
+} DeliberateMouseTraceRecord;
+
+// MARK: Report Interval Statistics
+
+/// The number of buckets in the report interval histogram.
+#define kDeliberateMouseIntervalBucketCount 128
+/// The shortest interval with its own bucket is 2 to the power of this value, in nanoseconds. Shorter intervals go into bucket 0.
+#define kDeliberateMouseIntervalBucketMinimumShift 10
+/// The number of bits of each interval, after its leading bit, that select its bucket. Each power of two is split into 2 to the power of this value buckets.
+#define kDeliberateMouseIntervalBucketSubShift 3
+/// Intervals longer than this are pauses in motion, rather than polling intervals, and are only counted in the histogram.
+#define kDeliberateMouseIntervalIdleNanoseconds 32000000
+
+/// The report interval statistics of a device.
+typedef struct DeliberateMouseIntervalStatistics
+{
+	/// The number of mouse reports received
+	uint64_t reportCount;
+	/// The number of intervals longer than `kDeliberateMouseIntervalIdleNanoseconds`
+	uint64_t idleCount;
+	/// The number of intervals included in the minimum, maximum, mean, and variance
+	uint64_t intervalCount;
+	uint64_t minimumNanoseconds;
+	uint64_t maximumNanoseconds;
+	uint64_t meanNanoseconds;
+	/// The sample variance, in square nanoseconds. Its square root is the jitter of the polling interval.
+	uint64_t varianceNanoseconds;
+	/// The number of intervals in each bucket. See `DeliberateMouseIntervalBucketLowerBound` for the range of each bucket.
+	uint64_t buckets[kDeliberateMouseIntervalBucketCount];
+} DeliberateMouseIntervalStatistics;
+
+/// Finds the histogram bucket of an interval. Each bucket covers an eighth of a power of two.
+/// - Parameters:
+///   - nanoseconds: The interval
+/// - Returns: The bucket index
+static inline uint32_t DeliberateMouseIntervalBucket(uint64_t nanoseconds)
+{
+	if (nanoseconds < (1ULL << kDeliberateMouseIntervalBucketMinimumShift))
+	{
+		return 0;
+	}
+
+	uint32_t exponent = 63 - __builtin_clzll(nanoseconds);
+	uint32_t fraction = (uint32_t)(nanoseconds >> (exponent - kDeliberateMouseIntervalBucketSubShift)) & ((1U << kDeliberateMouseIntervalBucketSubShift) - 1);
+	uint32_t bucket = ((exponent - kDeliberateMouseIntervalBucketMinimumShift) << kDeliberateMouseIntervalBucketSubShift) + fraction;
+
+	return (bucket < kDeliberateMouseIntervalBucketCount) ? bucket : (kDeliberateMouseIntervalBucketCount - 1);
+}
+
+/// Returns the shortest interval that falls into a histogram bucket. The bucket ends where the next one begins, and the last bucket has no end.
+/// - Parameters:
+///   - bucket: The bucket index
+/// - Returns: The lower bound of the bucket, in nanoseconds
+static inline uint64_t DeliberateMouseIntervalBucketLowerBound(uint32_t bucket)
+{
+	uint32_t exponent = (bucket >> kDeliberateMouseIntervalBucketSubShift) + kDeliberateMouseIntervalBucketMinimumShift;
+	uint64_t fraction = bucket & ((1U << kDeliberateMouseIntervalBucketSubShift) - 1);
+
+	return ((1ULL << kDeliberateMouseIntervalBucketSubShift) + fraction) << (exponent - kDeliberateMouseIntervalBucketSubShift);
+}
+
+// MARK: Report Incidents
+
+/// The number of recent incidents the driver keeps.
+#define kDeliberateMouseIncidentCapacity 32
+/// An interval this many times longer than the polling interval can mean reports were lost.
+#define kDeliberateMouseGapIntervalMultiplier 4
+/// The number of intervals that must be measured before gaps are detected, so the polling interval is meaningful.
+#define kDeliberateMouseGapMinimumIntervals 64
+/// A report that moves at least this many counts, summed over both axes, means the mouse moves fast enough to have motion for every poll.
+#define kDeliberateMouseGapMinimumMotionCounts 2
+/// An interval that ends further than this fraction of the polling interval from a whole number of polls broke the polling schedule.
+#define kDeliberateMouseGapScheduleToleranceDivisor 4
+/// A report that reaches the driver this long after its timestamp was delayed by a backlog.
+#define kDeliberateMouseBacklogNanoseconds 8000000
+
+/// The kinds of incidents.
+enum
+{
+	/// Reports stopped arriving for much longer than the polling interval, while the mouse kept moving fast enough to report at every poll,
+	/// or for an interval that is not a whole number of polls. The duration is the length of the gap.
+	kDeliberateMouseIncidentGap = 1,
+	/// Reports reached the driver long after they were generated. The duration is the age of the oldest report,
+	/// and each backlog is a single incident no matter how many reports it delayed.
+	kDeliberateMouseIncidentBacklog = 2,
+};
+
+/// A single lost report or stall incident.
+typedef struct DeliberateMouseIncident
+{
+	/// The timestamp of the report that revealed the incident, in mach absolute time units
+	uint64_t timestamp;
+	/// One of the `kDeliberateMouseIncident` values
+	uint32_t kind;
+	uint32_t reserved;
+	uint64_t durationNanoseconds;
+} DeliberateMouseIncident;
+
+/// The lost report and stall counters of a device.
+typedef struct DeliberateMouseIncidentReport
+{
+	uint64_t gapCount;
+	uint64_t longestGapNanoseconds;
+	uint64_t backlogCount;
+	/// The number of reports that were delivered late, across all backlogs
+	uint64_t backlogReportCount;
+	uint64_t oldestBacklogNanoseconds;
+	/// The number of valid entries in `incidents`
+	uint32_t incidentCount;
+	uint32_t reserved;
+	/// The most recent incidents, oldest first
+	DeliberateMouseIncident incidents[kDeliberateMouseIncidentCapacity];
+} DeliberateMouseIncidentReport;
+
+#endif /* DeliberateMouseShared_h */
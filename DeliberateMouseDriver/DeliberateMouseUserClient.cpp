@@ -0,0 +1,372 @@
+//
+//  DeliberateMouseUserClient.cpp
+//  DeliberateMouseDriver
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// A user client that gives client processes direct access to the data of a DeliberateMouseDriver instance.
+// Clients open it with `IOServiceOpen` on the driver service, then map the shared memory with `IOConnectMapMemory64`,
+// or call the methods in DeliberateMouseShared.h with `IOConnectCallMethod`.
+//
+
+#include <os/log.h>
+
+#include <DriverKit/DriverKit.h>
+#include <HIDDriverKit/HIDDriverKit.h>
+
+#include "DeliberateMouseUserClient.h"
+#include "DeliberateMouseDriver.h"
+#include "DeliberateMouseShared.h"
+
+// To search for logs from this driver, use either: `sudo dmesg | grep DeliberateDriver` or use Console.app search to find messages that start with "DeliberateDriver".
+#define Log(fmt, ...) os_log(OS_LOG_DEFAULT, "DeliberateDriver UserClient - " fmt "\n", ##__VA_ARGS__)
+
+/// IOKit passes structure outputs of up to this many bytes inline, and larger ones as a memory descriptor.
+constexpr uint32_t kInlineStructureOutputSize = 4096;
+/// The most trace records an inline structure output holds.
+constexpr uint32_t kInlineTraceRecordCount = kInlineStructureOutputSize / sizeof(DeliberateMouseTraceRecord);
+
+/// Forwards a method call to the user client that received it.
+/// - Parameters:
+///   - target: The user client
+///   - reference: Unused
+///   - arguments: The arguments of the method call
+/// - Returns: The result of the method
+static kern_return_t copyTraceMethod(OSObject* target, void* reference, IOUserClientMethodArguments* arguments)
+{
+	DeliberateMouseUserClient* userClient = OSDynamicCast(DeliberateMouseUserClient, target);
+	if (userClient == nullptr)
+	{
+		return kIOReturnBadArgument;
+	}
+
+	return userClient->copyTrace(arguments);
+}
+
+/// Forwards a method call to the user client that received it.
+/// - Parameters:
+///   - target: The user client
+///   - reference: Unused
+///   - arguments: The arguments of the method call
+/// - Returns: The result of the method
+static kern_return_t copyIntervalStatisticsMethod(OSObject* target, void* reference, IOUserClientMethodArguments* arguments)
+{
+	DeliberateMouseUserClient* userClient = OSDynamicCast(DeliberateMouseUserClient, target);
+	if (userClient == nullptr)
+	{
+		return kIOReturnBadArgument;
+	}
+
+	return userClient->copyIntervalStatistics(arguments);
+}
+
+/// Forwards a method call to the user client that received it.
+/// - Parameters:
+///   - target: The user client
+///   - reference: Unused
+///   - arguments: The arguments of the method call
+/// - Returns: The result of the method
+static kern_return_t copyIncidentsMethod(OSObject* target, void* reference, IOUserClientMethodArguments* arguments)
+{
+	DeliberateMouseUserClient* userClient = OSDynamicCast(DeliberateMouseUserClient, target);
+	if (userClient == nullptr)
+	{
+		return kIOReturnBadArgument;
+	}
+
+	return userClient->copyIncidents(arguments);
+}
+
+/// The methods clients can call, indexed by the `kDeliberateMouseMethod` selectors.
+static const IOUserClientMethodDispatch kMethods[kDeliberateMouseMethodCount] =
+{
+	// kDeliberateMouseMethodCopyTrace
+	{
+		.function = copyTraceMethod,
+		.checkCompletionExists = false,
+		.checkScalarInputCount = 0,
+		.checkStructureInputSize = 0,
+		.checkScalarOutputCount = 2,
+		.checkStructureOutputSize = kIOUserClientVariableStructureSize,
+	},
+	// kDeliberateMouseMethodCopyIntervalStatistics
+	{
+		.function = copyIntervalStatisticsMethod,
+		.checkCompletionExists = false,
+		.checkScalarInputCount = 2,
+		.checkStructureInputSize = 0,
+		.checkScalarOutputCount = 0,
+		.checkStructureOutputSize = sizeof(DeliberateMouseIntervalStatistics),
+	},
+	// kDeliberateMouseMethodCopyIncidents
+	{
+		.function = copyIncidentsMethod,
+		.checkCompletionExists = false,
+		.checkScalarInputCount = 2,
+		.checkStructureInputSize = 0,
+		.checkScalarOutputCount = 0,
+		.checkStructureOutputSize = sizeof(DeliberateMouseIncidentReport),
+	},
+};
+
+struct DeliberateMouseUserClient_IVars
+{
+	/// The driver instance that created this user client
+	DeliberateMouseDriver* driver;
+};
+
+// MARK: User Client Lifecycle Management
+
+/// Called when the user client is created. Used to initialize user client memory.
+bool DeliberateMouseUserClient::init(void)
+{
+	bool result = false;
+
+	Log("init()");
+
+	result = super::init();
+	if (result != true)
+	{
+		Log("init() - super::init failed.");
+		goto Fail;
+	}
+
+	ivars = IONewZero(DeliberateMouseUserClient_IVars, 1);
+	if (ivars == nullptr)
+	{
+		Log("init() - Failed to allocate memory for ivars.");
+		goto Fail;
+	}
+
+	Log("init() - Finished.");
+	return true;
+
+Fail:
+	return false;
+}
+
+/// Called when a client process opens the user client.
+kern_return_t DeliberateMouseUserClient::Start_Impl(IOService* provider)
+{
+	kern_return_t ret = kIOReturnSuccess;
+
+	Log("Start()");
+
+	ret = Start(provider, SUPERDISPATCH);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("Start() - super::Start failed with error: 0x%08x.", ret);
+		goto Exit;
+	}
+
+	ivars->driver = OSDynamicCast(DeliberateMouseDriver, provider);
+	if (ivars->driver == nullptr)
+	{
+		Log("Start() - Failed to cast provider to DeliberateMouseDriver.");
+		ret = kIOReturnError;
+		goto Exit;
+	}
+	ivars->driver->retain();
+
+	Log("Start() - Finished.");
+	return kIOReturnSuccess;
+
+Exit:
+	Stop(provider);
+	return ret;
+}
+
+/// Called when the client process closes the user client, or exits.
+kern_return_t DeliberateMouseUserClient::Stop_Impl(IOService* provider)
+{
+	kern_return_t ret = kIOReturnSuccess;
+
+	Log("Stop()");
+
+	ret = Stop(provider, SUPERDISPATCH);
+	if (ret != kIOReturnSuccess)
+	{
+		Log("Stop() - super::Stop failed with error: 0x%08x.", ret);
+	}
+
+	Log("Stop() - Finished.");
+	return ret;
+}
+
+/// Called on user client cleanup. Used to clean up the `ivars`.
+void DeliberateMouseUserClient::free(void)
+{
+	Log("free()");
+
+	if (ivars != nullptr)
+	{
+		OSSafeReleaseNULL(ivars->driver);
+	}
+	IOSafeDeleteNULL(ivars, DeliberateMouseUserClient_IVars, 1);
+
+	super::free();
+}
+
+// MARK: Shared Memory
+
+/// Called when the client process maps memory with `IOConnectMapMemory64`.
+/// - Parameters:
+///   - type: One of the `kDeliberateMouseMemoryType` values
+///   - options: The variable that stores the mapping options
+///   - memory: The variable that stores the retained memory descriptor to map
+/// - Returns: kIOReturnSuccess if the memory can be mapped
+kern_return_t DeliberateMouseUserClient::CopyClientMemoryForType_Impl(uint64_t type, uint64_t* options, IOMemoryDescriptor** memory)
+{
+	kern_return_t ret = kIOReturnSuccess;
+
+	Log("CopyClientMemoryForType() - Type %llu.", type);
+
+	switch (type)
+	{
+		case kDeliberateMouseMemoryTypeEventRing:
+		{
+			// Clients only ever read the ring, so they must not be able to corrupt what the driver writes.
+			ret = ivars->driver->copyEventRingMemory(memory);
+			*options = kIOUserClientMemoryReadOnly;
+		} break;
+
+		default:
+		{
+			ret = kIOReturnBadArgument;
+		} break;
+	}
+
+	return ret;
+}
+
+// MARK: Methods
+
+/// Called when the client process calls a method with `IOConnectCallMethod`.
+/// - Parameters:
+///   - selector: One of the `kDeliberateMouseMethod` values
+///   - arguments: The arguments of the method call
+///   - dispatch: Unused, the dispatch table of this user client is used instead
+///   - target: Unused
+///   - reference: Unused
+/// - Returns: The result of the method
+kern_return_t DeliberateMouseUserClient::ExternalMethod(uint64_t selector, IOUserClientMethodArguments* arguments, const IOUserClientMethodDispatch* dispatch, OSObject* target, void* reference)
+{
+	if (selector >= kDeliberateMouseMethodCount)
+	{
+		return kIOReturnBadArgument;
+	}
+
+	return super::ExternalMethod(selector, arguments, &kMethods[selector], this, nullptr);
+}
+
+/// Copies the binary trace of the driver into the structure output, oldest record first.
+/// Large outputs arrive as a memory descriptor, which is mapped so the records are copied straight into the client buffer.
+/// Small outputs are copied through the stack, so the method never allocates memory that the footprint of the driver does not count.
+/// - Parameters:
+///   - arguments: The arguments of the method call
+/// - Returns: kIOReturnSuccess if the trace was copied, or kIOReturnNotReady if tracing is disabled
+kern_return_t DeliberateMouseUserClient::copyTrace(IOUserClientMethodArguments* arguments)
+{
+	kern_return_t ret = kIOReturnSuccess;
+	IOMemoryMap* map = nullptr;
+	DeliberateMouseTraceRecord inlineRecords[kInlineTraceRecordCount];
+	DeliberateMouseTraceRecord* records = inlineRecords;
+	uint32_t capacity = 0;
+	uint32_t recordCount = 0;
+	uint64_t writeCount = 0;
+
+	if (arguments->structureOutputDescriptor != nullptr)
+	{
+		ret = arguments->structureOutputDescriptor->CreateMapping(0, 0, 0, 0, 0, &map);
+		if (ret != kIOReturnSuccess)
+		{
+			Log("copyTrace() - Failed to map the structure output with error: 0x%08x.", ret);
+			goto Exit;
+		}
+
+		records = reinterpret_cast<DeliberateMouseTraceRecord*>(map->GetAddress());
+		capacity = uint32_t(map->GetLength() / sizeof(DeliberateMouseTraceRecord));
+	}
+	else
+	{
+		uint64_t requested = arguments->structureOutputMaximumSize / sizeof(DeliberateMouseTraceRecord);
+		capacity = (requested < kInlineTraceRecordCount) ? uint32_t(requested) : kInlineTraceRecordCount;
+	}
+
+	ret = ivars->driver->copyTrace(records, capacity, &recordCount, &writeCount);
+	if (ret != kIOReturnSuccess)
+	{
+		goto Exit;
+	}
+
+	if ((map == nullptr) && (recordCount > 0))
+	{
+		arguments->structureOutput = OSData::withBytes(records, recordCount * sizeof(DeliberateMouseTraceRecord));
+	}
+
+	arguments->scalarOutput[0] = recordCount;
+	arguments->scalarOutput[1] = writeCount;
+
+Exit:
+	OSSafeReleaseNULL(map);
+	return ret;
+}
+
+/// Copies the report interval statistics of a paired device into the structure output.
+/// - Parameters:
+///   - arguments: The arguments of the method call
+/// - Returns: kIOReturnSuccess if the statistics were copied, or kIOReturnBadArgument if there is no such slot
+kern_return_t DeliberateMouseUserClient::copyIntervalStatistics(IOUserClientMethodArguments* arguments)
+{
+	kern_return_t ret = kIOReturnSuccess;
+	DeliberateMouseIntervalStatistics statistics = {};
+
+	if (arguments->scalarInput[0] >= kDeliberateMousePairedDeviceSlotCount)
+	{
+		return kIOReturnBadArgument;
+	}
+
+	ret = ivars->driver->copyIntervalStatistics(uint32_t(arguments->scalarInput[0]), &statistics, arguments->scalarInput[1] != 0);
+	if (ret != kIOReturnSuccess)
+	{
+		return ret;
+	}
+
+	arguments->structureOutput = OSData::withBytes(&statistics, sizeof(statistics));
+	if (arguments->structureOutput == nullptr)
+	{
+		return kIOReturnNoMemory;
+	}
+
+	return kIOReturnSuccess;
+}
+
+/// Copies the lost report and stall counters of a paired device into the structure output.
+/// - Parameters:
+///   - arguments: The arguments of the method call
+/// - Returns: kIOReturnSuccess if the counters were copied, or kIOReturnBadArgument if there is no such slot
+kern_return_t DeliberateMouseUserClient::copyIncidents(IOUserClientMethodArguments* arguments)
+{
+	kern_return_t ret = kIOReturnSuccess;
+	DeliberateMouseIncidentReport incidents = {};
+
+	if (arguments->scalarInput[0] >= kDeliberateMousePairedDeviceSlotCount)
+	{
+		return kIOReturnBadArgument;
+	}
+
+	ret = ivars->driver->copyIncidents(uint32_t(arguments->scalarInput[0]), &incidents, arguments->scalarInput[1] != 0);
+	if (ret != kIOReturnSuccess)
+	{
+		return ret;
+	}
+
+	arguments->structureOutput = OSData::withBytes(&incidents, sizeof(incidents));
+	if (arguments->structureOutput == nullptr)
+	{
+		return kIOReturnNoMemory;
+	}
+
+	return kIOReturnSuccess;
+}
@@ -0,0 +1,328 @@
+//
+//  HIDPPCommands.h
+//  DeliberateMouseDriver
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Queues the HID++ commands that configure a device, such as its report rate and resolution,
+// and sends them one at a time as the responses of the previous commands arrive, so the driver never waits for a device.
+// The index of every feature a command needs is looked up the first time it is used.
+// Like HIDPPDecoder.h, everything here works on plain bytes, so it does not depend on DriverKit.
+//
+
+#ifndef HIDPPCommands_h
+#define HIDPPCommands_h
+
+#include <stdint.h>
+
+#include "HIDPPDecoder.h"
+
+/// The features that configure the sensor of a device, and their functions.
+constexpr uint16_t kHIDPPFeatureReportRate = 0x8060;
+constexpr uint16_t kHIDPPFeatureAdjustableDPI = 0x2201;
+
+constexpr uint8_t kHIDPPReportRateGet = 1;
+constexpr uint8_t kHIDPPReportRateSet = 2;
+constexpr uint8_t kHIDPPAdjustableDPIGet = 2;
+constexpr uint8_t kHIDPPAdjustableDPISet = 3;
+
+/// The number of commands that can wait to be sent, which fits a full configuration of every paired device.
+constexpr uint32_t kHIDPPCommandCapacity = 32;
+/// How many times a command is sent before it is given up on, when the device does not answer.
+constexpr uint8_t kHIDPPCommandAttempts = 2;
+/// How long to wait for the response to a HID++ request before sending it again, or giving up on it.
+constexpr uint64_t kHIDPPResponseTimeoutNanoseconds = 250000000;
+
+/// The commands that can be queued.
+enum HIDPPCommandKind : uint8_t
+{
+	/// Sets the report rate to `value` milliseconds per report
+	kHIDPPCommandSetReportRate,
+	/// Reads the report rate back from the device
+	kHIDPPCommandReadReportRate,
+	/// Sets the resolution of the first sensor to `value` DPI
+	kHIDPPCommandSetResolution,
+	/// Reads the resolution of the first sensor back from the device
+	kHIDPPCommandReadResolution,
+};
+
+/// A command that waits to be sent.
+struct HIDPPCommand
+{
+	/// The paired device slot the command is sent to
+	uint8_t slot;
+	HIDPPCommandKind kind;
+	uint16_t value;
+};
+
+/// Whether the index of a feature has been looked up on a device.
+enum HIDPPFeatureLookup : uint8_t
+{
+	kHIDPPFeatureUnknown,
+	kHIDPPFeatureFound,
+	kHIDPPFeatureMissing,
+};
+
+/// The sensor settings of a device, as last read back from it.
+struct HIDPPDeviceSettings
+{
+	HIDPPFeatureLookup reportRateLookup;
+	uint8_t reportRateIndex;
+	HIDPPFeatureLookup adjustableDPILookup;
+	uint8_t adjustableDPIIndex;
+
+	/// The report interval in milliseconds, or 0 if it has not been read
+	uint8_t reportRateMilliseconds;
+	/// The resolution of the first sensor, or 0 if it has not been read
+	uint16_t resolutionDPI;
+};
+
+/// The commands waiting to be sent, and the request that is waiting for its response.
+struct HIDPPCommandQueue
+{
+	HIDPPCommand commands[kHIDPPCommandCapacity];
+	uint32_t head;
+	uint32_t count;
+
+	/// Whether a request is waiting for its response, and the header it was sent with
+	bool requestPending;
+	uint8_t requestDeviceIndex;
+	uint8_t requestFeatureIndex;
+	uint8_t requestFunctionAndSoftwareID;
+	/// Whether the pending request looks up the feature of the first command, rather than being the command itself
+	bool requestIsLookup;
+	/// The number of times the first command, or its lookup, has been sent
+	uint8_t attempts;
+
+	HIDPPDeviceSettings devices[kMousePairedDeviceSlotCount];
+};
+
+/// Adds a command to the end of the queue.
+/// - Parameters:
+///   - queue: The command queue
+///   - slot: The paired device slot the command is sent to
+///   - kind: The command
+///   - value: The value the command sets, if any
+/// - Returns: False if the queue is full
+static inline bool enqueueHIDPPCommand(HIDPPCommandQueue& queue, uint32_t slot, HIDPPCommandKind kind, uint16_t value)
+{
+	if (queue.count >= kHIDPPCommandCapacity)
+	{
+		return false;
+	}
+
+	queue.commands[(queue.head + queue.count) % kHIDPPCommandCapacity] = { uint8_t(slot), kind, value };
+	++queue.count;
+
+	return true;
+}
+
+/// Removes the first command from the queue.
+static inline void popHIDPPCommand(HIDPPCommandQueue& queue)
+{
+	queue.head = (queue.head + 1) % kHIDPPCommandCapacity;
+	--queue.count;
+	queue.attempts = 0;
+	queue.requestPending = false;
+}
+
+/// Finds the feature a command needs.
+/// - Parameters:
+///   - settings: The settings of the device the command is sent to
+///   - kind: The command
+///   - lookup: The variable that stores the lookup state of the feature
+///   - featureIndex: The variable that stores the index of the feature
+/// - Returns: The feature ID
+static inline uint16_t hidppCommandFeature(HIDPPDeviceSettings& settings, HIDPPCommandKind kind, HIDPPFeatureLookup** lookup, uint8_t** featureIndex)
+{
+	if ((kind == kHIDPPCommandSetReportRate) || (kind == kHIDPPCommandReadReportRate))
+	{
+		*lookup = &settings.reportRateLookup;
+		*featureIndex = &settings.reportRateIndex;
+		return kHIDPPFeatureReportRate;
+	}
+
+	*lookup = &settings.adjustableDPILookup;
+	*featureIndex = &settings.adjustableDPIIndex;
+	return kHIDPPFeatureAdjustableDPI;
+}
+
+/// Builds the request for the first command, or the lookup of its feature.
+/// Commands whose feature the device does not have are dropped.
+/// - Parameters:
+///   - queue: The command queue
+///   - request: The buffer of `kHIDPPLongReportLength` bytes that receives the request
+/// - Returns: True if `request` holds a request to send, or false once the queue is empty
+static inline bool nextHIDPPCommandRequest(HIDPPCommandQueue& queue, uint8_t* request)
+{
+	while (queue.count > 0)
+	{
+		const HIDPPCommand& command = queue.commands[queue.head];
+		HIDPPDeviceSettings& settings = queue.devices[command.slot];
+		HIDPPFeatureLookup* lookup = nullptr;
+		uint8_t* featureIndex = nullptr;
+		uint16_t feature = hidppCommandFeature(settings, command.kind, &lookup, &featureIndex);
+		uint8_t deviceIndex = hidppDeviceIndex(command.slot);
+		uint8_t parameters[3] = {};
+
+		switch (*lookup)
+		{
+			case kHIDPPFeatureMissing:
+			{
+				popHIDPPCommand(queue);
+				continue;
+			}
+			case kHIDPPFeatureUnknown:
+			{
+				parameters[0] = uint8_t(feature >> 8);
+				parameters[1] = uint8_t(feature);
+				buildHIDPPRequest(request, deviceIndex, kHIDPPRootFeatureIndex, kHIDPPRootGetFeature, parameters, 2);
+				queue.requestIsLookup = true;
+			} break;
+			case kHIDPPFeatureFound:
+			{
+				switch (command.kind)
+				{
+					case kHIDPPCommandSetReportRate:
+					{
+						parameters[0] = uint8_t(command.value);
+						buildHIDPPRequest(request, deviceIndex, *featureIndex, kHIDPPReportRateSet, parameters, 1);
+					} break;
+					case kHIDPPCommandReadReportRate:
+					{
+						buildHIDPPRequest(request, deviceIndex, *featureIndex, kHIDPPReportRateGet, parameters, 0);
+					} break;
+					case kHIDPPCommandSetResolution:
+					{
+						parameters[1] = uint8_t(command.value >> 8);
+						parameters[2] = uint8_t(command.value);
+						buildHIDPPRequest(request, deviceIndex, *featureIndex, kHIDPPAdjustableDPISet, parameters, 3);
+					} break;
+					case kHIDPPCommandReadResolution:
+					{
+						buildHIDPPRequest(request, deviceIndex, *featureIndex, kHIDPPAdjustableDPIGet, parameters, 1);
+					} break;
+				}
+				queue.requestIsLookup = false;
+			} break;
+		}
+
+		queue.requestPending = true;
+		queue.requestDeviceIndex = request[1];
+		queue.requestFeatureIndex = request[2];
+		queue.requestFunctionAndSoftwareID = request[3];
+		++queue.attempts;
+
+		return true;
+	}
+
+	return false;
+}
+
+/// Handles the response to the pending request. A failed command is dropped, and the queue moves on.
+/// - Parameters:
+///   - queue: The command queue
+///   - message: A HID++ report
+/// - Returns: True if the message answered the pending request, in which case `nextHIDPPCommandRequest` should be called
+static inline bool handleHIDPPCommandResponse(HIDPPCommandQueue& queue, const HIDPPMessage& message)
+{
+	if ((queue.requestPending == false) || (message.deviceIndex != queue.requestDeviceIndex) || (message.parameterLength < 3))
+	{
+		return false;
+	}
+
+	bool error = ((message.featureIndex == kHIDPPErrorFeatureIndex) || (message.featureIndex == kHIDPP10ErrorSubID)) &&
+		(message.functionAndSoftwareID == queue.requestFeatureIndex) && (message.parameters[0] == queue.requestFunctionAndSoftwareID);
+	bool response = (message.featureIndex == queue.requestFeatureIndex) && (message.functionAndSoftwareID == queue.requestFunctionAndSoftwareID);
+	if ((error == false) && (response == false))
+	{
+		return false;
+	}
+
+	const HIDPPCommand& command = queue.commands[queue.head];
+	HIDPPDeviceSettings& settings = queue.devices[command.slot];
+	const uint8_t* parameters = message.parameters;
+
+	queue.requestPending = false;
+
+	if (queue.requestIsLookup == true)
+	{
+		// The command itself is sent next, unless the device does not have the feature.
+		HIDPPFeatureLookup* lookup = nullptr;
+		uint8_t* featureIndex = nullptr;
+		hidppCommandFeature(settings, command.kind, &lookup, &featureIndex);
+
+		*featureIndex = (error == true) ? 0 : parameters[0];
+		*lookup = (*featureIndex != 0) ? kHIDPPFeatureFound : kHIDPPFeatureMissing;
+		queue.attempts = 0;
+		return true;
+	}
+
+	if (error == false)
+	{
+		switch (command.kind)
+		{
+			case kHIDPPCommandReadReportRate:
+			{
+				settings.reportRateMilliseconds = parameters[0];
+			} break;
+			case kHIDPPCommandReadResolution:
+			{
+				settings.resolutionDPI = readHIDPPUInt16(parameters + 1);
+			} break;
+			case kHIDPPCommandSetReportRate:
+			case kHIDPPCommandSetResolution:
+			{
+			} break;
+		}
+	}
+
+	popHIDPPCommand(queue);
+	return true;
+}
+
+/// Handles a request that was not answered in time. The request is sent again until it runs out of attempts,
+/// and a lookup that runs out of attempts marks the feature as missing, so the other commands for that device are not waited for.
+/// - Parameters:
+///   - queue: The command queue
+static inline void timeoutHIDPPCommand(HIDPPCommandQueue& queue)
+{
+	if ((queue.requestPending == false) || (queue.count == 0))
+	{
+		return;
+	}
+
+	queue.requestPending = false;
+	if (queue.attempts < kHIDPPCommandAttempts)
+	{
+		return;
+	}
+
+	const HIDPPCommand& command = queue.commands[queue.head];
+	if (queue.requestIsLookup == true)
+	{
+		HIDPPFeatureLookup* lookup = nullptr;
+		uint8_t* featureIndex = nullptr;
+		hidppCommandFeature(queue.devices[command.slot], command.kind, &lookup, &featureIndex);
+		*lookup = kHIDPPFeatureMissing;
+	}
+
+	popHIDPPCommand(queue);
+}
+
+/// The highest report rate the report rate feature can set, since it sets the report interval in whole milliseconds.
+/// Faster rates need the extended report rate feature (0x8061), which is not supported, so they are rejected rather than rounded down.
+constexpr uint32_t kHIDPPMaxReportRateHz = 1000;
+
+/// Converts a report rate into the report interval used by the report rate feature.
+/// - Parameters:
+///   - hertz: The report rate in reports per second, at most `kHIDPPMaxReportRateHz`
+/// - Returns: The report interval in milliseconds, from 1 to 8
+static inline uint16_t reportRateToMilliseconds(uint32_t hertz)
+{
+	uint32_t milliseconds = (hertz != 0) ? ((1000 + (hertz / 2)) / hertz) : 8;
+	return uint16_t((milliseconds < 1) ? 1 : ((milliseconds > 8) ? 8 : milliseconds));
+}
+
+#endif /* HIDPPCommands_h */
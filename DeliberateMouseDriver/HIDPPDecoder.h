@@ -0,0 +1,571 @@
+//
+//  HIDPPDecoder.h
+//  DeliberateMouseDriver
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Speaks enough of the Logitech HID++ 2.0 protocol to receive the high resolution wheel and the extra buttons
+// that many Logitech mice only report through HID++ vendor reports.
+// When the driver starts, it discovers the feature indices of each device and diverts the wheel, and the controls it was asked to, to HID++.
+// Afterwards, their notifications are decoded in the report path with a few loads, like any other mouse report.
+// Everything here works on plain bytes, so it does not depend on DriverKit.
+//
+
+#ifndef HIDPPDecoder_h
+#define HIDPPDecoder_h
+
+#include <stdint.h>
+
+#include "MouseReportDecoder.h"
+
+/// The length of HID++ short and long reports, including the report ID byte.
+constexpr uint32_t kHIDPPShortReportLength = 7;
+constexpr uint32_t kHIDPPLongReportLength = 20;
+/// The number of parameter bytes of a long report.
+constexpr uint32_t kHIDPPLongParameterLength = kHIDPPLongReportLength - 4;
+
+/// The device index of a device that is connected directly, rather than through a receiver.
+constexpr uint8_t kHIDPPDeviceIndexDirect = 0xFF;
+/// The software ID the driver puts in its requests, which tells its responses apart from notifications, which use 0.
+constexpr uint8_t kHIDPPSoftwareID = 0x0A;
+
+/// The feature index of HID++ 2.0 error responses, and the sub ID of HID++ 1.0 error responses.
+/// Both carry the feature index and function of the failed request in the next two bytes.
+constexpr uint8_t kHIDPPErrorFeatureIndex = 0xFF;
+constexpr uint8_t kHIDPP10ErrorSubID = 0x8F;
+
+/// The sub ID of the HID++ 1.0 notification a receiver sends when a paired device connects or disconnects.
+/// Its third byte is the protocol of the link rather than a function and software ID.
+constexpr uint8_t kHIDPP10DeviceConnectionSubID = 0x41;
+/// Set in the first parameter of a device connection notification while the link to the device is not established.
+constexpr uint8_t kHIDPP10ConnectionLinkNotEstablished = 0x40;
+
+/// The features the driver uses, and their functions.
+constexpr uint16_t kHIDPPFeatureHiResWheel = 0x2121;
+constexpr uint16_t kHIDPPFeatureReprogControls = 0x1B04;
+
+/// The root feature always has index 0, and maps a feature ID to its index on the device.
+constexpr uint8_t kHIDPPRootFeatureIndex = 0x00;
+constexpr uint8_t kHIDPPRootGetFeature = 0;
+
+constexpr uint8_t kHIDPPHiResWheelGetCapability = 0;
+constexpr uint8_t kHIDPPHiResWheelSetMode = 2;
+/// The notification sent for wheel motion once the wheel is diverted.
+constexpr uint8_t kHIDPPHiResWheelMovementEvent = 0;
+/// Sends wheel motion as HID++ notifications rather than standard HID reports, in high resolution.
+constexpr uint8_t kHIDPPHiResWheelModeDivert = 0x01;
+constexpr uint8_t kHIDPPHiResWheelModeHighResolution = 0x02;
+/// Set in the first byte of a wheel notification when the motion is in high resolution counts.
+constexpr uint8_t kHIDPPHiResWheelEventHighResolution = 0x10;
+
+constexpr uint8_t kHIDPPReprogControlsGetCount = 0;
+constexpr uint8_t kHIDPPReprogControlsGetInfo = 1;
+constexpr uint8_t kHIDPPReprogControlsSetReporting = 3;
+/// The notification that lists the diverted controls that are currently held.
+constexpr uint8_t kHIDPPReprogControlsDivertedButtonsEvent = 0;
+/// The control flag that allows a control to be diverted to HID++.
+constexpr uint8_t kHIDPPControlFlagDivertable = 0x20;
+/// The reporting flags that divert a control, and that mark the divert flag as valid.
+constexpr uint8_t kHIDPPReportingDivert = 0x01;
+constexpr uint8_t kHIDPPReportingDivertValid = 0x02;
+
+/// The controls that are also reported in the standard mouse reports, which stay there even if they are asked to be diverted.
+/// These are the left, right, middle, back, and forward buttons.
+constexpr uint16_t kHIDPPStandardControls[] = { 0x0050, 0x0051, 0x0052, 0x0053, 0x0056 };
+
+/// The number of controls a device can divert, which are reported as buttons 17 to 32 so they never collide with HID buttons.
+constexpr uint32_t kHIDPPMaxDivertedControls = 16;
+constexpr uint32_t kHIDPPDivertedButtonShift = 16;
+
+/// A HID++ report, split into its header and parameters.
+struct HIDPPMessage
+{
+	uint8_t deviceIndex;
+	uint8_t featureIndex;
+	/// The function in the upper four bits, and the software ID in the lower four bits
+	uint8_t functionAndSoftwareID;
+	const uint8_t* parameters;
+	uint32_t parameterLength;
+};
+
+/// The HID++ features discovered on a single device.
+struct HIDPPDeviceState
+{
+	/// Whether the device answered in HID++ 2.0, so it can be configured with HID++ commands
+	bool present;
+	/// The index of the high resolution wheel feature, or 0 if the wheel is not diverted to HID++
+	uint8_t hiResWheelIndex;
+	/// The number of high resolution counts per wheel detent
+	uint8_t wheelMultiplier;
+	/// The index of the reprogrammable controls feature, or 0 if the device does not have it
+	uint8_t reprogControlsIndex;
+	uint8_t divertedControlCount;
+	/// The control IDs of the diverted controls. The control at index N is reported as button 17 + N.
+	uint16_t divertedControls[kHIDPPMaxDivertedControls];
+};
+
+/// The steps of feature discovery on a device.
+enum HIDPPDiscoveryStep : uint8_t
+{
+	kHIDPPStepFindWheel,
+	kHIDPPStepWheelCapability,
+	kHIDPPStepWheelMode,
+	kHIDPPStepFindControls,
+	kHIDPPStepControlCount,
+	kHIDPPStepControlInfo,
+	kHIDPPStepDivertControl,
+	kHIDPPStepNextDevice,
+	kHIDPPStepFinished,
+};
+
+/// The progress of feature discovery. Devices are discovered one request at a time, starting with a directly connected device,
+/// and moving on to every device index a receiver can pair when the interface turns out to belong to a receiver.
+struct HIDPPDiscovery
+{
+	/// The paired device slot being discovered. Slot 0 is the directly connected device.
+	uint8_t slot;
+	HIDPPDiscoveryStep step;
+	/// Set when the directly connected device speaks HID++ 2.0, so there is no receiver to look behind
+	bool directDevice;
+	/// Set once every slot has been discovered, after which only the devices in `reconnectedSlots` are discovered again
+	bool slotsDiscovered;
+	/// A bit for every paired device slot that connected to its receiver again, and is discovered again once the current slot is finished
+	uint8_t reconnectedSlots;
+
+	uint8_t controlCount;
+	uint8_t controlIndex;
+	/// The control that is being diverted
+	uint16_t controlID;
+
+	/// The controls that are diverted on every device that has them. Controls such as SmartShift or a DPI button do something on the device
+	/// itself, which diverting would turn off, so nothing is diverted unless it is listed here.
+	uint16_t divertControls[kHIDPPMaxDivertedControls];
+	uint8_t divertControlCount;
+
+	/// Whether a request is waiting for its response, and the header it was sent with
+	bool requestPending;
+	uint8_t requestFeatureIndex;
+	uint8_t requestFunctionAndSoftwareID;
+};
+
+static_assert(kMousePairedDeviceSlotCount <= 8, "Every paired device slot needs a bit in `reconnectedSlots`.");
+
+/// Converts a paired device slot into the HID++ device index that addresses it.
+static inline uint8_t hidppDeviceIndex(uint32_t slot)
+{
+	return (slot == 0) ? kHIDPPDeviceIndexDirect : uint8_t(slot);
+}
+
+/// Reads a big endian 16-bit value, which is the byte order of every HID++ parameter.
+static inline uint16_t readHIDPPUInt16(const uint8_t* bytes)
+{
+	return uint16_t((uint16_t(bytes[0]) << 8) | bytes[1]);
+}
+
+/// Splits a HID++ report into its header and parameters.
+/// - Parameters:
+///   - report: The raw HID report, starting with the report ID
+///   - reportLength: The length of the HID report
+///   - message: The variable that stores the message
+/// - Returns: True if the report is a complete HID++ short or long report
+static inline bool parseHIDPPReport(const uint8_t* report, uint32_t reportLength, HIDPPMessage* message)
+{
+	uint32_t expectedLength = (report[0] == kPairedDeviceReportHIDPPShort) ? kHIDPPShortReportLength : kHIDPPLongReportLength;
+	if (((report[0] != kPairedDeviceReportHIDPPShort) && (report[0] != kPairedDeviceReportHIDPPLong)) || (reportLength < expectedLength))
+	{
+		return false;
+	}
+
+	message->deviceIndex = report[1];
+	message->featureIndex = report[2];
+	message->functionAndSoftwareID = report[3];
+	message->parameters = report + 4;
+	message->parameterLength = expectedLength - 4;
+
+	return true;
+}
+
+/// Returns the software ID of a message, which is 0 for notifications, and the ID of the software that sent the request for responses.
+/// Error responses carry the header of the failed request after the error feature index, so their software ID is one byte later.
+/// - Parameters:
+///   - message: The HID++ report
+static inline uint8_t hidppSoftwareID(const HIDPPMessage& message)
+{
+	bool error = (message.featureIndex == kHIDPPErrorFeatureIndex) || (message.featureIndex == kHIDPP10ErrorSubID);
+	if ((error == true) && (message.parameterLength > 0))
+	{
+		return message.parameters[0] & 0x0F;
+	}
+
+	return message.functionAndSoftwareID & 0x0F;
+}
+
+/// Decodes the notification a receiver sends when a paired device connects.
+/// The device has reset the wheel and controls that were diverted by then, so it has to be discovered again.
+/// - Parameters:
+///   - message: The HID++ report
+///   - slot: The variable that stores the paired device slot of the device
+/// - Returns: True if the message tells that a paired device connected
+static inline bool decodeHIDPPDeviceConnection(const HIDPPMessage& message, uint32_t* slot)
+{
+	if ((message.featureIndex != kHIDPP10DeviceConnectionSubID) || (message.deviceIndex == 0) || (message.deviceIndex >= kMousePairedDeviceSlotCount) ||
+		(message.parameterLength < 1) || ((message.parameters[0] & kHIDPP10ConnectionLinkNotEstablished) != 0))
+	{
+		return false;
+	}
+
+	*slot = message.deviceIndex;
+	return true;
+}
+
+/// Fills a HID++ long request.
+/// - Parameters:
+///   - request: The buffer of `kHIDPPLongReportLength` bytes that receives the report
+///   - deviceIndex: The device index the request is addressed to
+///   - featureIndex: The index of the feature on the device
+///   - function: The function of the feature
+///   - parameters: The parameters of the function
+///   - parameterLength: The number of parameters, up to `kHIDPPLongParameterLength`
+static inline void buildHIDPPRequest(uint8_t* request, uint8_t deviceIndex, uint8_t featureIndex, uint8_t function, const uint8_t* parameters, uint32_t parameterLength)
+{
+	request[0] = kPairedDeviceReportHIDPPLong;
+	request[1] = deviceIndex;
+	request[2] = featureIndex;
+	request[3] = uint8_t((function << 4) | kHIDPPSoftwareID);
+
+	for (uint32_t parameterIndex = 0; parameterIndex < kHIDPPLongParameterLength; ++parameterIndex)
+	{
+		request[4 + parameterIndex] = (parameterIndex < parameterLength) ? parameters[parameterIndex] : 0;
+	}
+}
+
+/// Decodes a wheel notification of a device whose wheel is diverted to HID++.
+/// - Parameters:
+///   - device: The HID++ features of the device
+///   - message: The HID++ report
+///   - mouseReport: The variable that stores the wheel motion
+/// - Returns: True if the message is a wheel notification
+static inline bool decodeHIDPPWheel(const HIDPPDeviceState& device, const HIDPPMessage& message, MouseReport* mouseReport)
+{
+	if ((device.hiResWheelIndex == 0) || (message.featureIndex != device.hiResWheelIndex) ||
+		(message.functionAndSoftwareID != (kHIDPPHiResWheelMovementEvent << 4)) || (message.parameterLength < 3))
+	{
+		return false;
+	}
+
+	// The wheel reports up as positive, like the standard wheel usage.
+	mouseReport->wheel = int16_t(readHIDPPUInt16(message.parameters + 1));
+	mouseReport->wheelResolution = (message.parameters[0] & kHIDPPHiResWheelEventHighResolution) ? device.wheelMultiplier : 1;
+
+	return true;
+}
+
+/// Decodes a diverted buttons notification into buttons 17 to 32.
+/// - Parameters:
+///   - device: The HID++ features of the device
+///   - message: The HID++ report
+///   - mouseReport: The variable that stores the buttons
+/// - Returns: True if the message is a diverted buttons notification
+static inline bool decodeHIDPPDivertedButtons(const HIDPPDeviceState& device, const HIDPPMessage& message, MouseReport* mouseReport)
+{
+	if ((device.reprogControlsIndex == 0) || (message.featureIndex != device.reprogControlsIndex) ||
+		(message.functionAndSoftwareID != (kHIDPPReprogControlsDivertedButtonsEvent << 4)))
+	{
+		return false;
+	}
+
+	// The notification lists up to four held controls, followed by zeros. Every diverted control that is not listed is released.
+	uint32_t buttons = 0;
+	for (uint32_t offset = 0; ((offset + 1) < message.parameterLength) && (offset < 8); offset += 2)
+	{
+		uint16_t controlID = readHIDPPUInt16(message.parameters + offset);
+		for (uint32_t controlIndex = 0; (controlID != 0) && (controlIndex < device.divertedControlCount); ++controlIndex)
+		{
+			if (device.divertedControls[controlIndex] == controlID)
+			{
+				buttons |= (1U << (kHIDPPDivertedButtonShift + controlIndex));
+			}
+		}
+	}
+
+	mouseReport->buttonMask = ((1U << device.divertedControlCount) - 1) << kHIDPPDivertedButtonShift;
+	mouseReport->buttons = buttons;
+
+	return true;
+}
+
+/// Builds the next request of feature discovery.
+/// - Parameters:
+///   - discovery: The progress of feature discovery
+///   - devices: The HID++ features of every paired device slot
+///   - request: The buffer of `kHIDPPLongReportLength` bytes that receives the request
+/// - Returns: True if `request` holds a request to send, or false once discovery is finished
+static inline bool nextHIDPPDiscoveryRequest(HIDPPDiscovery& discovery, HIDPPDeviceState (&devices)[kMousePairedDeviceSlotCount], uint8_t* request)
+{
+	while (true)
+	{
+		HIDPPDeviceState& device = devices[discovery.slot];
+		uint8_t deviceIndex = hidppDeviceIndex(discovery.slot);
+		uint8_t featureIndex = 0;
+		uint8_t function = 0;
+		uint8_t parameters[3] = {};
+		uint32_t parameterLength = 0;
+
+		switch (discovery.step)
+		{
+			case kHIDPPStepFindWheel:
+			{
+				featureIndex = kHIDPPRootFeatureIndex;
+				function = kHIDPPRootGetFeature;
+				parameters[0] = uint8_t(kHIDPPFeatureHiResWheel >> 8);
+				parameters[1] = uint8_t(kHIDPPFeatureHiResWheel);
+				parameterLength = 2;
+			} break;
+			case kHIDPPStepWheelCapability:
+			{
+				featureIndex = device.hiResWheelIndex;
+				function = kHIDPPHiResWheelGetCapability;
+			} break;
+			case kHIDPPStepWheelMode:
+			{
+				featureIndex = device.hiResWheelIndex;
+				function = kHIDPPHiResWheelSetMode;
+				parameters[0] = kHIDPPHiResWheelModeDivert | kHIDPPHiResWheelModeHighResolution;
+				parameterLength = 1;
+			} break;
+			case kHIDPPStepFindControls:
+			{
+				// Without any control to divert, the controls of the device are not even listed.
+				if (discovery.divertControlCount == 0)
+				{
+					discovery.step = kHIDPPStepNextDevice;
+					continue;
+				}
+
+				featureIndex = kHIDPPRootFeatureIndex;
+				function = kHIDPPRootGetFeature;
+				parameters[0] = uint8_t(kHIDPPFeatureReprogControls >> 8);
+				parameters[1] = uint8_t(kHIDPPFeatureReprogControls);
+				parameterLength = 2;
+			} break;
+			case kHIDPPStepControlCount:
+			{
+				featureIndex = device.reprogControlsIndex;
+				function = kHIDPPReprogControlsGetCount;
+			} break;
+			case kHIDPPStepControlInfo:
+			{
+				if ((discovery.controlIndex >= discovery.controlCount) || (device.divertedControlCount >= kHIDPPMaxDivertedControls))
+				{
+					discovery.step = kHIDPPStepNextDevice;
+					continue;
+				}
+
+				featureIndex = device.reprogControlsIndex;
+				function = kHIDPPReprogControlsGetInfo;
+				parameters[0] = discovery.controlIndex;
+				parameterLength = 1;
+			} break;
+			case kHIDPPStepDivertControl:
+			{
+				featureIndex = device.reprogControlsIndex;
+				function = kHIDPPReprogControlsSetReporting;
+				parameters[0] = uint8_t(discovery.controlID >> 8);
+				parameters[1] = uint8_t(discovery.controlID);
+				parameters[2] = kHIDPPReportingDivert | kHIDPPReportingDivertValid;
+				parameterLength = 3;
+			} break;
+			case kHIDPPStepNextDevice:
+			{
+				// A directly connected device has no paired devices behind it.
+				if ((discovery.slotsDiscovered == false) && (discovery.directDevice == false) && ((discovery.slot + 1U) < kMousePairedDeviceSlotCount))
+				{
+					++discovery.slot;
+					discovery.step = kHIDPPStepFindWheel;
+					continue;
+				}
+				discovery.slotsDiscovered = true;
+
+				// A device that reconnected starts over, since it no longer diverts anything.
+				if (discovery.reconnectedSlots != 0)
+				{
+					discovery.slot = uint8_t(__builtin_ctz(discovery.reconnectedSlots));
+					discovery.reconnectedSlots &= uint8_t(discovery.reconnectedSlots - 1);
+					devices[discovery.slot] = {};
+					discovery.step = kHIDPPStepFindWheel;
+					continue;
+				}
+
+				discovery.step = kHIDPPStepFinished;
+				continue;
+			}
+			case kHIDPPStepFinished:
+			{
+				return false;
+			}
+		}
+
+		buildHIDPPRequest(request, deviceIndex, featureIndex, function, parameters, parameterLength);
+		discovery.requestPending = true;
+		discovery.requestFeatureIndex = request[2];
+		discovery.requestFunctionAndSoftwareID = request[3];
+
+		return true;
+	}
+}
+
+/// Discovers a paired device again once the device that is being discovered is finished.
+/// - Parameters:
+///   - discovery: The progress of feature discovery
+///   - slot: The paired device slot of a device that connected to its receiver again
+/// - Returns: True if discovery had finished, so `nextHIDPPDiscoveryRequest` has to be called to start it again
+static inline bool rediscoverHIDPPDevice(HIDPPDiscovery& discovery, uint32_t slot)
+{
+	discovery.reconnectedSlots |= uint8_t(1U << slot);
+	if (discovery.step != kHIDPPStepFinished)
+	{
+		return false;
+	}
+
+	discovery.step = kHIDPPStepNextDevice;
+	return true;
+}
+
+/// Checks whether a control is also reported in the standard mouse reports.
+static inline bool isHIDPPStandardControl(uint16_t controlID)
+{
+	for (uint16_t standardControl : kHIDPPStandardControls)
+	{
+		if (standardControl == controlID)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/// Checks whether a control should be diverted. Only the controls that discovery was asked to divert are, and never a standard control.
+/// - Parameters:
+///   - discovery: The progress of feature discovery
+///   - controlID: The ID of a divertable control
+static inline bool shouldDivertHIDPPControl(const HIDPPDiscovery& discovery, uint16_t controlID)
+{
+	if (isHIDPPStandardControl(controlID) == true)
+	{
+		return false;
+	}
+
+	for (uint32_t controlIndex = 0; controlIndex < discovery.divertControlCount; ++controlIndex)
+	{
+		if (discovery.divertControls[controlIndex] == controlID)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/// Handles the response to the pending discovery request, and moves discovery on to its next step.
+/// - Parameters:
+///   - discovery: The progress of feature discovery
+///   - devices: The HID++ features of every paired device slot
+///   - message: A HID++ report
+/// - Returns: True if the message answered the pending request, in which case `nextHIDPPDiscoveryRequest` should be called
+static inline bool handleHIDPPDiscoveryResponse(HIDPPDiscovery& discovery, HIDPPDeviceState (&devices)[kMousePairedDeviceSlotCount], const HIDPPMessage& message)
+{
+	if ((discovery.requestPending == false) || (message.deviceIndex != hidppDeviceIndex(discovery.slot)) || (message.parameterLength < 3))
+	{
+		return false;
+	}
+
+	// HID++ 1.0 errors come from receivers, about devices that are not paired or not connected.
+	bool error = ((message.featureIndex == kHIDPPErrorFeatureIndex) || (message.featureIndex == kHIDPP10ErrorSubID)) &&
+		(message.functionAndSoftwareID == discovery.requestFeatureIndex) && (message.parameters[0] == discovery.requestFunctionAndSoftwareID);
+	bool response = (message.featureIndex == discovery.requestFeatureIndex) && (message.functionAndSoftwareID == discovery.requestFunctionAndSoftwareID);
+	if ((error == false) && (response == false))
+	{
+		return false;
+	}
+
+	discovery.requestPending = false;
+
+	HIDPPDeviceState& device = devices[discovery.slot];
+	const uint8_t* parameters = message.parameters;
+
+	switch (discovery.step)
+	{
+		case kHIDPPStepFindWheel:
+		{
+			// The first request to a device also tells whether it speaks HID++ 2.0 at all.
+			if (error == true)
+			{
+				discovery.step = kHIDPPStepNextDevice;
+				break;
+			}
+
+			discovery.directDevice |= (discovery.slot == 0);
+			device.present = true;
+			device.hiResWheelIndex = parameters[0];
+			discovery.step = (parameters[0] != 0) ? kHIDPPStepWheelCapability : kHIDPPStepFindControls;
+		} break;
+		case kHIDPPStepWheelCapability:
+		{
+			if (error == true)
+			{
+				device.hiResWheelIndex = 0;
+				discovery.step = kHIDPPStepFindControls;
+				break;
+			}
+
+			device.wheelMultiplier = (parameters[0] != 0) ? parameters[0] : 1;
+			discovery.step = kHIDPPStepWheelMode;
+		} break;
+		case kHIDPPStepWheelMode:
+		{
+			// Wheel notifications are only decoded once the wheel is known to be diverted.
+			device.hiResWheelIndex = (error == true) ? 0 : device.hiResWheelIndex;
+			discovery.step = kHIDPPStepFindControls;
+		} break;
+		case kHIDPPStepFindControls:
+		{
+			device.reprogControlsIndex = (error == true) ? 0 : parameters[0];
+			discovery.step = (device.reprogControlsIndex != 0) ? kHIDPPStepControlCount : kHIDPPStepNextDevice;
+		} break;
+		case kHIDPPStepControlCount:
+		{
+			discovery.controlCount = (error == true) ? 0 : parameters[0];
+			discovery.controlIndex = 0;
+			discovery.step = kHIDPPStepControlInfo;
+		} break;
+		case kHIDPPStepControlInfo:
+		{
+			// The control info starts with the control ID and task ID, followed by the control flags.
+			++discovery.controlIndex;
+			if ((error == false) && (message.parameterLength >= 5) && (parameters[4] & kHIDPPControlFlagDivertable) &&
+				(shouldDivertHIDPPControl(discovery, readHIDPPUInt16(parameters)) == true))
+			{
+				discovery.controlID = readHIDPPUInt16(parameters);
+				discovery.step = kHIDPPStepDivertControl;
+			}
+		} break;
+		case kHIDPPStepDivertControl:
+		{
+			if (error == false)
+			{
+				device.divertedControls[device.divertedControlCount++] = discovery.controlID;
+			}
+			discovery.step = kHIDPPStepControlInfo;
+		} break;
+		case kHIDPPStepNextDevice:
+		case kHIDPPStepFinished:
+		{
+		} break;
+	}
+
+	return true;
+}
+
+#endif /* HIDPPDecoder_h */
@@ -0,0 +1,688 @@
+//
+//  MouseMotionProcessing.h
+//  DeliberateMouseDriver
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Processing applied to pointer and wheel motion between decoding a report and dispatching it to the OS.
+// Every stage works on 16.16 fixed point values, never allocates, and keeps its state in the driver ivars.
+//
+
+#ifndef MouseMotionProcessing_h
+#define MouseMotionProcessing_h
+
+#include <stdint.h>
+
+#include "MouseReportDecoder.h"
+
+/// Clamps a 64-bit intermediate value to the range of a 16.16 fixed point value.
+/// - Parameters:
+///   - value: The value to clamp
+/// - Returns: The clamped value
+static inline int32_t saturateFixed(int64_t value)
+{
+	return (value > INT32_MAX) ? INT32_MAX : ((value < INT32_MIN) ? INT32_MIN : int32_t(value));
+}
+
+// MARK: Motion Smoothing
+
+/// After this many time constants without a report, the filter has fully settled and passes motion through unchanged.
+constexpr uint64_t kMotionSmoothingSettleFactor = 8;
+/// After this many consecutive steps without motion, the filter releases all of its lag at once.
+/// The driver steps the filter once per time constant after motion stops, so the tail of every motion ends within this many time constants.
+constexpr uint32_t kMotionSmoothingDrainSteps = 4;
+
+/// The state of the exponential motion smoothing filter.
+///
+/// The filter smooths the pointer position rather than the individual deltas, so no motion is ever lost:
+/// the motion that has not been passed on yet is kept as a lag, which is released as later reports arrive,
+/// or by steps without motion once reports stop. For a constant report rate, the added latency is on average one time constant.
+struct MotionSmoothingState
+{
+	/// The time constant of the filter, in the same units as the report timestamps
+	uint64_t timeConstant;
+	/// The timestamp of the previous step
+	uint64_t lastTimestamp;
+	/// The 16.16 motion that has been received but not yet passed on
+	int64_t lagX;
+	int64_t lagY;
+	/// The number of consecutive steps without motion
+	uint32_t idleSteps;
+};
+
+/// A stage that adjusts pointer motion. The driver selects a function when it is configured,
+/// so a disabled stage costs a call to `passthroughMotion` rather than checking the configuration on every report.
+/// - Parameters:
+///   - state: The state of the filter
+///   - timestamp: The timestamp of the HID report
+///   - dX: The 16.16 horizontal motion, which is updated in place
+///   - dY: The 16.16 vertical motion, which is updated in place
+typedef void (*MotionFilterFunction)(MotionSmoothingState& state, uint64_t timestamp, int32_t* dX, int32_t* dY);
+
+/// Passes motion through unchanged. Used when smoothing is disabled.
+static void passthroughMotion(MotionSmoothingState&, uint64_t, int32_t*, int32_t*)
+{
+}
+
+/// Smooths motion with an exponentially weighted moving average whose weight depends on the time since the previous report,
+/// so the filter behaves the same at any polling rate.
+static void smoothMotion(MotionSmoothingState& state, uint64_t timestamp, int32_t* dX, int32_t* dY)
+{
+	uint64_t elapsed = timestamp - state.lastTimestamp;
+	state.lastTimestamp = timestamp;
+	state.idleSteps = ((*dX == 0) && (*dY == 0)) ? (state.idleSteps + 1) : 0;
+
+	// The weight of the new position is elapsed / (timeConstant + elapsed), in 16.16 fixed point.
+	// Long pauses, timestamps that go backwards, and the last of the steps after motion stopped release all of the remaining lag at once.
+	uint64_t weight = 1 << 16;
+	if ((elapsed < (state.timeConstant * kMotionSmoothingSettleFactor)) && (state.idleSteps < kMotionSmoothingDrainSteps))
+	{
+		weight = (elapsed << 16) / (state.timeConstant + elapsed);
+	}
+
+	int64_t pendingX = state.lagX + *dX;
+	int64_t pendingY = state.lagY + *dY;
+	int32_t outX = saturateFixed((pendingX * int64_t(weight)) >> 16);
+	int32_t outY = saturateFixed((pendingY * int64_t(weight)) >> 16);
+
+	state.lagX = pendingX - outX;
+	state.lagY = pendingY - outY;
+	*dX = outX;
+	*dY = outY;
+}
+
+/// Returns when the filter should next be stepped without motion, so the motion it holds back is released after reports stop.
+/// - Parameters:
+///   - state: The state of the filter
+/// - Returns: The timestamp one time constant after the previous step, or 0 if the filter holds no motion
+static inline uint64_t motionSmoothingDrainTime(const MotionSmoothingState& state)
+{
+	if ((state.lagX == 0) && (state.lagY == 0))
+	{
+		return 0;
+	}
+
+	return state.lastTimestamp + state.timeConstant;
+}
+
+/// Makes the next step of the filter release all of the motion it holds, whatever the time since the previous step.
+/// Used before smoothing is disabled, since `passthroughMotion` never releases the lag.
+/// - Parameters:
+///   - state: The state of the filter
+static inline void releaseMotionSmoothing(MotionSmoothingState& state)
+{
+	state.idleSteps = kMotionSmoothingDrainSteps;
+}
+
+/// Configures the smoothing filter. The motion the filter holds is kept, and released with the new time constant.
+/// - Parameters:
+///   - state: The state of the filter
+///   - timeConstant: The time constant of the filter in timestamp units, or 0 to disable smoothing
+/// - Returns: The filter function that the report path should call
+static inline MotionFilterFunction configureMotionSmoothing(MotionSmoothingState& state, uint64_t timeConstant)
+{
+	state.timeConstant = timeConstant;
+
+	return (timeConstant != 0) ? smoothMotion : passthroughMotion;
+}
+
+// MARK: Motion Transform
+
+/// The sine of every whole degree from 0 to 90, in 16.16 fixed point.
+static const int32_t kSineTable[91] =
+{
+	0, 1144, 2287, 3430, 4572, 5712, 6850, 7987, 9121, 10252,
+	11380, 12505, 13626, 14742, 15855, 16962, 18064, 19161, 20252, 21336,
+	22415, 23486, 24550, 25607, 26656, 27697, 28729, 29753, 30767, 31772,
+	32768, 33754, 34729, 35693, 36647, 37590, 38521, 39441, 40348, 41243,
+	42126, 42995, 43852, 44695, 45525, 46341, 47143, 47930, 48703, 49461,
+	50203, 50931, 51643, 52339, 53020, 53684, 54332, 54963, 55578, 56175,
+	56756, 57319, 57865, 58393, 58903, 59396, 59870, 60326, 60764, 61183,
+	61584, 61966, 62328, 62672, 62997, 63303, 63589, 63856, 64104, 64332,
+	64540, 64729, 64898, 65048, 65177, 65287, 65376, 65446, 65496, 65526,
+	65536,
+};
+
+/// The largest scale that can be configured for an axis, in 16.16 fixed point.
+constexpr int32_t kMotionTransformMaxScale = 64 << 16;
+
+/// The user facing description of how sensor motion maps to pointer motion.
+struct MotionTransformConfig
+{
+	/// The clockwise rotation of the sensor, in degrees
+	int32_t rotationDegrees;
+	/// Whether the X and Y axes of the sensor are swapped before rotating
+	bool swapAxes;
+	/// Whether the pointer X motion is inverted after rotating
+	bool invertX;
+	/// Whether the pointer Y motion is inverted after rotating
+	bool invertY;
+	/// The 16.16 scale of the pointer X motion, on top of the sensitivity
+	int32_t scaleX;
+	/// The 16.16 scale of the pointer Y motion, on top of the sensitivity
+	int32_t scaleY;
+	/// The 16.16 multiplier that converts sensor counts into pointer motion
+	int32_t sensitivity;
+};
+
+/// A 2x2 matrix in 16.16 fixed point that converts sensor counts directly into pointer motion.
+/// Every part of `MotionTransformConfig` is folded into it, so applying it takes four multiplies.
+struct MotionTransform
+{
+	int32_t m00;
+	int32_t m01;
+	int32_t m10;
+	int32_t m11;
+};
+
+/// Returns the sine and cosine of an angle.
+/// - Parameters:
+///   - degrees: The angle, in degrees
+///   - sine: The variable that stores the 16.16 sine of the angle
+///   - cosine: The variable that stores the 16.16 cosine of the angle
+static inline void sineAndCosine(int32_t degrees, int32_t* sine, int32_t* cosine)
+{
+	int32_t angle = degrees % 360;
+	angle = (angle < 0) ? (angle + 360) : angle;
+
+	int32_t quadrant = angle / 90;
+	int32_t offset = angle % 90;
+	int32_t rising = kSineTable[offset];
+	int32_t falling = kSineTable[90 - offset];
+
+	switch (quadrant)
+	{
+		case 0: { *sine = rising; *cosine = falling; } break;
+		case 1: { *sine = falling; *cosine = -rising; } break;
+		case 2: { *sine = -rising; *cosine = -falling; } break;
+		default: { *sine = -falling; *cosine = rising; } break;
+	}
+}
+
+/// Multiplies two 16.16 fixed point values, rounding to the nearest value.
+static inline int64_t multiplyFixed(int64_t a, int64_t b)
+{
+	return ((a * b) + (1 << 15)) >> 16;
+}
+
+/// Folds a transform configuration into a single matrix.
+/// The sensor motion is swapped, then rotated, then inverted, and finally scaled.
+/// - Parameters:
+///   - config: The transform configuration
+/// - Returns: The matrix to apply to every report
+static inline MotionTransform buildMotionTransform(const MotionTransformConfig& config)
+{
+	int32_t sine = 0;
+	int32_t cosine = 0;
+	sineAndCosine(config.rotationDegrees, &sine, &cosine);
+
+	// A clockwise rotation in screen coordinates, where Y points down.
+	int64_t r00 = cosine;
+	int64_t r01 = -sine;
+	int64_t r10 = sine;
+	int64_t r11 = cosine;
+
+	// Swapping the input axes swaps the columns of the matrix.
+	if (config.swapAxes)
+	{
+		int64_t swap = r00; r00 = r01; r01 = swap;
+		swap = r10; r10 = r11; r11 = swap;
+	}
+
+	int32_t scaleX = (config.scaleX > kMotionTransformMaxScale) ? kMotionTransformMaxScale : ((config.scaleX < 0) ? 0 : config.scaleX);
+	int32_t scaleY = (config.scaleY > kMotionTransformMaxScale) ? kMotionTransformMaxScale : ((config.scaleY < 0) ? 0 : config.scaleY);
+	int64_t rowX = multiplyFixed(config.invertX ? -scaleX : scaleX, config.sensitivity);
+	int64_t rowY = multiplyFixed(config.invertY ? -scaleY : scaleY, config.sensitivity);
+
+	// Keeping every entry within 30 bits guarantees that applying the matrix cannot overflow 64 bits, whatever the sensitivity.
+	auto entry = [](int64_t value)
+	{
+		return int32_t((value > (1 << 30)) ? (1 << 30) : ((value < -(1 << 30)) ? -(1 << 30) : value));
+	};
+
+	return
+	{
+		entry(multiplyFixed(rowX, r00)),
+		entry(multiplyFixed(rowX, r01)),
+		entry(multiplyFixed(rowY, r10)),
+		entry(multiplyFixed(rowY, r11)),
+	};
+}
+
+/// Converts sensor counts into 16.16 pointer motion.
+/// - Parameters:
+///   - transform: The matrix built by `buildMotionTransform`
+///   - x: The horizontal sensor counts from the report
+///   - y: The vertical sensor counts from the report
+///   - dX: The variable that stores the 16.16 horizontal pointer motion
+///   - dY: The variable that stores the 16.16 vertical pointer motion
+static inline void applyMotionTransform(const MotionTransform& transform, int32_t x, int32_t y, int32_t* dX, int32_t* dY)
+{
+	*dX = saturateFixed((int64_t(transform.m00) * x) + (int64_t(transform.m01) * y));
+	*dY = saturateFixed((int64_t(transform.m10) * x) + (int64_t(transform.m11) * y));
+}
+
+// MARK: Sensitivity Layers
+
+/// The number of sensitivity stages that a stage button cycles through.
+constexpr uint32_t kSensitivityStageMax = 4;
+/// Every stage has a layer for when no sniper button is held, and one for when a sniper button is held.
+constexpr uint32_t kSensitivityLayerCount = kSensitivityStageMax * 2;
+
+/// The buttons that select a sensitivity layer, and the scale of each layer.
+/// A layer is a complete motion transform, built in advance, so switching layers on a button edge only swaps a pointer.
+struct SensitivityLayerConfig
+{
+	/// The number of stages that a stage button cycles through, from 1 to `kSensitivityStageMax`
+	uint32_t stageCount;
+	/// The 16.16 scale of each stage, on top of the sensitivity
+	int32_t stageScales[kSensitivityStageMax];
+	/// The buttons that move to the next stage when they are pressed
+	uint32_t stageButtons;
+	/// The 16.16 scale applied on top of the stage while a sniper button is held
+	int32_t sniperScale;
+	/// The buttons that apply the sniper scale while they are held
+	uint32_t sniperButtons;
+};
+
+/// Returns the index of a layer in the array built by `buildSensitivityLayers`.
+static inline uint32_t sensitivityLayerIndex(uint32_t stage, bool sniper)
+{
+	return stage + (sniper ? kSensitivityStageMax : 0);
+}
+
+/// Builds the matrix of every sensitivity layer.
+/// - Parameters:
+///   - config: The transform configuration of the device
+///   - layers: The sensitivity layer configuration
+///   - transforms: The array that stores the matrix of every layer
+static inline void buildSensitivityLayers(const MotionTransformConfig& config, const SensitivityLayerConfig& layers, MotionTransform (&transforms)[kSensitivityLayerCount])
+{
+	for (uint32_t stage = 0; stage < kSensitivityStageMax; ++stage)
+	{
+		for (uint32_t sniper = 0; sniper < 2; ++sniper)
+		{
+			// The combined scale is kept within 32 bits, so folding it into the sensitivity cannot overflow whatever the scales are.
+			int64_t scale = (sniper != 0) ? saturateFixed(multiplyFixed(layers.stageScales[stage], layers.sniperScale)) : layers.stageScales[stage];
+
+			MotionTransformConfig layerConfig = config;
+			layerConfig.sensitivity = saturateFixed(multiplyFixed(config.sensitivity, scale));
+			transforms[sensitivityLayerIndex(stage, sniper != 0)] = buildMotionTransform(layerConfig);
+		}
+	}
+}
+
+/// Selects the sensitivity layer for a new button state. Pressing a stage button moves to the next stage,
+/// and the sniper layer of the stage is selected for as long as a sniper button is held.
+/// - Parameters:
+///   - layers: The sensitivity layer configuration
+///   - previousButtons: The button state before the report
+///   - buttons: The button state after the report
+///   - stage: The current stage of the device, which is updated in place
+/// - Returns: The index of the layer to use from this report on
+static inline uint32_t selectSensitivityLayer(const SensitivityLayerConfig& layers, uint32_t previousButtons, uint32_t buttons, uint8_t* stage)
+{
+	if (((buttons & ~previousButtons) & layers.stageButtons) != 0)
+	{
+		*stage = uint8_t((*stage + 1) % layers.stageCount);
+	}
+
+	return sensitivityLayerIndex(*stage, (buttons & layers.sniperButtons) != 0);
+}
+
+// MARK: Scroll Emulation
+
+/// Pointer motion within this 16.16 distance of where the scroll button was pressed does not scroll yet, so a tap still clicks.
+constexpr int32_t kScrollEmulationSlop = 4 << 16;
+
+/// The buttons that turn pointer motion into scrolling while they are held, such as on trackballs without a wheel.
+struct ScrollEmulationConfig
+{
+	/// The buttons that scroll while held, or 0 if scroll emulation is disabled
+	uint32_t buttons;
+	/// The 16.16 number of scroll units per unit of pointer motion
+	int32_t scale;
+	/// Whether scrolling is locked to the axis that moved the most once the motion left the slop
+	bool axisLock;
+};
+
+/// The axes that an emulated scroll moves along.
+enum ScrollEmulationAxis : uint8_t
+{
+	/// The motion has not left the slop, so nothing scrolls yet
+	kScrollEmulationAxisNone,
+	kScrollEmulationAxisBoth,
+	kScrollEmulationAxisVertical,
+	kScrollEmulationAxisHorizontal,
+};
+
+/// The state of the scroll emulation of a device.
+struct ScrollEmulationState
+{
+	/// Whether a scroll button is held
+	bool active;
+	ScrollEmulationAxis axis;
+	/// The 16.16 motion since the scroll button was pressed, while it has not left the slop
+	int32_t slopX;
+	int32_t slopY;
+	/// The 16.16 scroll that has not been dispatched yet because it is less than a whole unit
+	int32_t remainderVertical;
+	int32_t remainderHorizontal;
+};
+
+/// Starts scroll emulation when a scroll button is pressed.
+static inline void beginScrollEmulation(ScrollEmulationState& state)
+{
+	state = { true, kScrollEmulationAxisNone, 0, 0, 0, 0 };
+}
+
+/// Ends scroll emulation when the scroll buttons are released.
+/// - Parameters:
+///   - state: The state of the scroll emulation
+/// - Returns: True if the motion never left the slop, in which case the button was tapped and should click
+static inline bool endScrollEmulation(ScrollEmulationState& state)
+{
+	state.active = false;
+	return (state.axis == kScrollEmulationAxisNone);
+}
+
+/// Splits a 16.16 value into whole units, and the fraction that carries over to the next report.
+static inline int32_t takeWholeScrollUnits(int64_t value, int32_t* remainder)
+{
+	int64_t whole = (value / (1 << 16)) * (1 << 16);
+	*remainder = int32_t(value - whole);
+	return saturateFixed(whole);
+}
+
+/// Converts pointer motion into scrolling while a scroll button is held.
+/// Only whole scroll units are dispatched, like the detents of a wheel, so slow motion still scrolls evenly.
+/// - Parameters:
+///   - config: The scroll emulation configuration
+///   - state: The state of the scroll emulation
+///   - dX: The 16.16 horizontal pointer motion
+///   - dY: The 16.16 vertical pointer motion
+///   - scrollVertical: The variable that stores the 16.16 vertical scroll, with the sign of the vertical wheel
+///   - scrollHorizontal: The variable that stores the 16.16 horizontal scroll
+static inline void emulateScroll(const ScrollEmulationConfig& config, ScrollEmulationState& state, int32_t dX, int32_t dY, int32_t* scrollVertical, int32_t* scrollHorizontal)
+{
+	*scrollVertical = 0;
+	*scrollHorizontal = 0;
+
+	if (state.axis == kScrollEmulationAxisNone)
+	{
+		state.slopX = saturateFixed(int64_t(state.slopX) + dX);
+		state.slopY = saturateFixed(int64_t(state.slopY) + dY);
+
+		int64_t distanceX = (state.slopX < 0) ? -int64_t(state.slopX) : state.slopX;
+		int64_t distanceY = (state.slopY < 0) ? -int64_t(state.slopY) : state.slopY;
+		if ((distanceX < kScrollEmulationSlop) && (distanceY < kScrollEmulationSlop))
+		{
+			return;
+		}
+
+		state.axis = (config.axisLock == false) ? kScrollEmulationAxisBoth :
+			((distanceY >= distanceX) ? kScrollEmulationAxisVertical : kScrollEmulationAxisHorizontal);
+
+		// The motion within the slop is scrolled as well, so the scroll covers the whole motion since the button was pressed.
+		dX = state.slopX;
+		dY = state.slopY;
+	}
+
+	// Moving away from the user scrolls like rolling the wheel away, and moving right scrolls like panning right.
+	if (state.axis != kScrollEmulationAxisHorizontal)
+	{
+		*scrollVertical = takeWholeScrollUnits(multiplyFixed(dY, config.scale) + state.remainderVertical, &state.remainderVertical);
+	}
+
+	if (state.axis != kScrollEmulationAxisVertical)
+	{
+		*scrollHorizontal = takeWholeScrollUnits(multiplyFixed(dX, config.scale) + state.remainderHorizontal, &state.remainderHorizontal);
+	}
+}
+
+// MARK: Wheel Filtering
+
+/// The state of the filter that suppresses spurious reverse ticks of a worn or noisy wheel encoder.
+///
+/// A tick against the direction the wheel was turning, within the window of the previous tick, is held back.
+/// It is dropped if the wheel carries on in its direction, and dispatched along with the next tick if that tick confirms the reversal.
+struct WheelFilterState
+{
+	/// The timestamp of the last wheel motion that was dispatched
+	uint64_t lastTimestamp;
+	/// The direction of the last wheel motion that was dispatched, or 0 if the wheel has not moved
+	int32_t direction;
+	/// The reverse motion held back until the next tick shows whether it was spurious, or 0
+	int32_t heldWheel;
+	/// The timestamp of the held motion
+	uint64_t heldTimestamp;
+};
+
+/// Filters the wheel motion of a report. Takes constant time, and only touches its own state.
+/// - Parameters:
+///   - window: The window in timestamp units, or 0 to pass every tick through
+///   - state: The state of the filter
+///   - timestamp: The timestamp of the HID report
+///   - wheel: The wheel counts from the report
+/// - Returns: The wheel counts to dispatch
+static inline int32_t filterWheel(uint64_t window, WheelFilterState& state, uint64_t timestamp, int32_t wheel)
+{
+	if ((wheel == 0) || (window == 0))
+	{
+		return wheel;
+	}
+
+	int32_t direction = (wheel > 0) ? 1 : -1;
+
+	if (state.heldWheel != 0)
+	{
+		int32_t heldWheel = state.heldWheel;
+		state.heldWheel = 0;
+
+		// A second reverse tick soon after the first means the wheel really was turned back.
+		if ((direction != state.direction) && ((timestamp - state.heldTimestamp) < window))
+		{
+			state.direction = direction;
+			state.lastTimestamp = timestamp;
+			return saturateFixed(int64_t(heldWheel) + wheel);
+		}
+	}
+
+	if ((state.direction != 0) && (direction != state.direction) && ((timestamp - state.lastTimestamp) < window))
+	{
+		state.heldWheel = wheel;
+		state.heldTimestamp = timestamp;
+		return 0;
+	}
+
+	state.direction = direction;
+	state.lastTimestamp = timestamp;
+	return wheel;
+}
+
+// MARK: Scroll Acceleration
+
+/// The number of entries in the scroll curve, one for every whole detent per second, from 0 detents per second.
+/// Faster scrolling uses the last entry.
+constexpr uint32_t kScrollCurveEntries = 64;
+/// The number of points that can describe a scroll curve. They are spaced evenly across the entries.
+constexpr uint32_t kScrollCurveMaxPoints = 16;
+/// Wheel motion is clamped to this many counts per report, which keeps every intermediate value within 64 bits.
+constexpr int32_t kScrollCurveMaxCounts = 1 << 15;
+
+/// The gain applied to wheel motion at each wheel velocity, built in advance so the report path only takes a table lookup.
+struct ScrollCurve
+{
+	/// The number of timestamp units per second
+	uint64_t timestampFrequency;
+	/// Wheel motion after this many timestamp units without any starts again from the gain at rest
+	uint64_t restInterval;
+	/// The 16.16 gain at each whole detent per second
+	int32_t gains[kScrollCurveEntries];
+};
+
+/// The state of the scroll acceleration of a wheel.
+struct ScrollAccelerationState
+{
+	/// The timestamp of the previous wheel motion
+	uint64_t lastTimestamp;
+	/// The direction of the previous wheel motion, or 0 if the wheel has not moved
+	int32_t direction;
+	/// The 16.16 velocity of the wheel, in detents per second
+	uint64_t velocity;
+	/// The 16.16 accelerated counts that were too few to make up the smallest step of a 16.16 detent, and have not been dispatched yet
+	int64_t remainder;
+};
+
+/// Builds a scroll curve from its points, interpolating linearly between them.
+/// - Parameters:
+///   - points: The 16.16 gains, spaced evenly from 0 detents per second to the last entry of the curve
+///   - pointCount: The number of points, from 1 to `kScrollCurveMaxPoints`
+///   - curve: The curve that stores the gains
+static inline void buildScrollCurve(const int32_t* points, uint32_t pointCount, ScrollCurve& curve)
+{
+	for (uint32_t entry = 0; entry < kScrollCurveEntries; ++entry)
+	{
+		uint32_t position = entry * (pointCount - 1);
+		uint32_t segment = position / (kScrollCurveEntries - 1);
+		uint32_t offset = position % (kScrollCurveEntries - 1);
+
+		if (segment >= (pointCount - 1))
+		{
+			curve.gains[entry] = points[pointCount - 1];
+			continue;
+		}
+
+		int64_t span = int64_t(points[segment + 1]) - points[segment];
+		curve.gains[entry] = int32_t(points[segment] + ((span * offset) / (kScrollCurveEntries - 1)));
+	}
+}
+
+/// Applies the scroll curve to the wheel motion of a report.
+/// The velocity is measured from the time since the previous wheel motion, and averaged with the previous velocity,
+/// since high resolution wheels send many small reports whose spacing varies. The result only depends on the reports themselves.
+/// - Parameters:
+///   - curve: The scroll curve
+///   - state: The state of the scroll acceleration
+///   - timestamp: The timestamp of the HID report
+///   - wheel: The wheel counts from the report
+///   - resolution: The number of counts per detent, or 0 if every count is a detent
+/// - Returns: The 16.16 wheel motion in detents, after the gain
+static inline int32_t accelerateScroll(const ScrollCurve& curve, ScrollAccelerationState& state, uint64_t timestamp, int32_t wheel, uint32_t resolution)
+{
+	if (wheel == 0)
+	{
+		return 0;
+	}
+
+	int64_t counts = (wheel > kScrollCurveMaxCounts) ? kScrollCurveMaxCounts : ((wheel < -kScrollCurveMaxCounts) ? -kScrollCurveMaxCounts : wheel);
+	uint64_t magnitude = uint64_t((counts < 0) ? -counts : counts);
+	uint64_t detentCounts = (resolution > 1) ? resolution : 1;
+	int32_t direction = (wheel > 0) ? 1 : -1;
+	uint64_t interval = timestamp - state.lastTimestamp;
+
+	// A change of direction, or a pause, starts from rest, and drops the motion left over from before.
+	if ((direction != state.direction) || (interval >= curve.restInterval) || (interval == 0))
+	{
+		state.velocity = 0;
+		state.remainder = 0;
+	}
+	else
+	{
+		uint64_t velocity = ((magnitude << 16) * curve.timestampFrequency) / (interval * detentCounts);
+		state.velocity = (state.velocity + velocity) / 2;
+	}
+
+	state.lastTimestamp = timestamp;
+	state.direction = direction;
+
+	uint64_t entry = state.velocity >> 16;
+	int64_t gain = curve.gains[(entry < kScrollCurveEntries) ? entry : (kScrollCurveEntries - 1)];
+
+	// What the division by the resolution cannot express is carried over, so slow scrolling never loses motion to rounding.
+	int64_t scaled = (counts * gain) + state.remainder;
+	int64_t detents = scaled / int64_t(detentCounts);
+	state.remainder = scaled - (detents * int64_t(detentCounts));
+
+	return saturateFixed(detents);
+}
+
+// MARK: Backlog Merging
+
+/// The stale reports of a paired device that were merged, and not dispatched yet.
+/// After a stall, reports reach the driver long after they were generated. Their motion is summed into one report,
+/// so the cursor catches up at once instead of replaying the stall.
+struct BacklogMergeState
+{
+	/// Whether `report` holds motion that has not been dispatched yet
+	bool pending;
+	/// The sum of the stale reports
+	MouseReport report;
+	/// The timestamp of the newest stale report in `report`
+	uint64_t timestamp;
+	/// When `report` is dispatched, unless a fresh report dispatches it first, in mach absolute time units
+	uint64_t flushTime;
+};
+
+/// Decides whether a report is merged with the other stale reports of its device.
+/// A report that presses or releases a button is never merged, so button edges are always dispatched in order, after the motion before them.
+/// - Parameters:
+///   - mergeAge: Reports older than this many nanoseconds are merged, or 0 if merging is disabled
+///   - age: How long ago the report was generated, in nanoseconds
+///   - buttonState: The buttons held on the device before the report
+///   - newButtonState: The buttons held on the device after the report
+/// - Returns: True if the report is merged, otherwise false
+static inline bool shouldMergeStaleReport(uint64_t mergeAge, uint64_t age, uint32_t buttonState, uint32_t newButtonState)
+{
+	return (mergeAge != 0) && (age > mergeAge) && (buttonState == newButtonState);
+}
+
+/// Adds a stale report to the merged report of its device.
+/// - Parameters:
+///   - state: The merged report of the device
+///   - report: The stale report
+///   - timestamp: The timestamp of the stale report
+///   - flushTime: When the merged report should be dispatched, if this is the first report merged into it
+/// - Returns: True if this is the first report merged, and the merged report has to be dispatched at `state.flushTime`
+static inline bool mergeStaleReport(BacklogMergeState& state, const MouseReport& report, uint64_t timestamp, uint64_t flushTime)
+{
+	MouseReport& merged = state.report;
+	merged.x = saturateFixed(int64_t(merged.x) + report.x);
+	merged.y = saturateFixed(int64_t(merged.y) + report.y);
+	merged.wheel = saturateFixed(int64_t(merged.wheel) + report.wheel);
+	merged.wheelResolution = (report.wheel != 0) ? report.wheelResolution : merged.wheelResolution;
+	merged.pan = saturateFixed(int64_t(merged.pan) + report.pan);
+	merged.device = report.device;
+	state.timestamp = timestamp;
+
+	if (state.pending == true)
+	{
+		return false;
+	}
+
+	state.pending = true;
+	state.flushTime = flushTime;
+	return true;
+}
+
+/// Takes the merged report of a device, if there is one. The merged report carries no buttons, since a report that changes them is never merged.
+/// - Parameters:
+///   - state: The merged report of the device
+///   - report: The variable that stores the merged report
+///   - timestamp: The variable that stores the timestamp of the newest stale report in it
+/// - Returns: True if there was a merged report, otherwise false
+static inline bool takeMergedReport(BacklogMergeState& state, MouseReport* report, uint64_t* timestamp)
+{
+	if (state.pending == false)
+	{
+		return false;
+	}
+
+	*report = state.report;
+	*timestamp = state.timestamp;
+	state = {};
+	return true;
+}
+
+#endif /* MouseMotionProcessing_h */
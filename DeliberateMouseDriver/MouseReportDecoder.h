@@ -0,0 +1,575 @@
+//
+//  MouseReportDecoder.h
+//  DeliberateMouseDriver
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Decodes mouse fields directly from the raw bytes of a HID input report.
+// The layout of each mouse report is computed once from the device elements, so the report path
+// only needs to perform a few loads and shifts instead of asking every `IOHIDElement` for its value.
+//
+
+#ifndef MouseReportDecoder_h
+#define MouseReportDecoder_h
+
+#include <stdint.h>
+#include <string.h>
+
+// HID reports are little endian, and the decoder reads them with native loads.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The report decoder assumes a little endian host.");
+
+/// The maximum number of buttons that fit in the button state passed to the OS.
+constexpr uint32_t kMouseReportMaxButtons = 32;
+/// The maximum number of distinct mouse report IDs that a single interface can provide.
+constexpr uint32_t kMouseDecodePlanMaxLayouts = 4;
+/// The number of devices a receiver can multiplex on a single interface, plus slot 0 for reports that carry no device index.
+/// Logitech receivers pair up to six devices, numbered from 1.
+constexpr uint32_t kMousePairedDeviceSlotCount = 8;
+
+/// The location of a single field inside a HID input report.
+struct MouseReportField
+{
+	/// The offset of the first bit of the field from the start of the report, including the report ID byte if present
+	uint16_t bitOffset;
+	/// The number of bits in the field, from 1 to 32. A size of 0 means the report does not contain the field.
+	uint8_t bitSize;
+	/// Whether the field holds a two's complement value that needs to be sign extended
+	uint8_t isSigned;
+};
+
+/// The mouse data decoded from a single HID report.
+struct MouseReport
+{
+	int32_t x;
+	int32_t y;
+	int32_t wheel;
+	int32_t pan;
+	/// The number of wheel counts per detent, for high resolution wheels. 0 means every count is a detent.
+	uint32_t wheelResolution;
+	/// The state of every button carried by the report, with button 1 in bit 0
+	uint32_t buttons;
+	/// The buttons that are present in the report. Buttons outside of this mask keep their previous state.
+	uint32_t buttonMask;
+	/// The paired device that sent the report, which is 0 unless the receiver multiplexes several devices
+	uint32_t device;
+};
+
+struct MouseReportLayout;
+
+/// A function that decodes every mouse field of a report.
+/// - Parameters:
+///   - layout: The layout of the report
+///   - report: The raw HID report
+///   - reportLength: The length of the HID report
+///   - mouseReport: The variable that stores the decoded values
+/// - Returns: True if the report was long enough to be decoded, otherwise false
+typedef bool (*MouseDecodeFunction)(const MouseReportLayout& layout, const uint8_t* report, uint32_t reportLength, MouseReport* mouseReport);
+
+/// Describes where the mouse fields of one report ID live in the report.
+struct MouseReportLayout
+{
+	uint32_t reportID;
+	/// The number of bytes a report must contain for every field to be decoded
+	uint32_t minimumLength;
+
+	MouseReportField x;
+	MouseReportField y;
+	MouseReportField wheel;
+	MouseReportField pan;
+
+	/// When all buttons are stored as consecutive single bits, they are decoded as one field
+	MouseReportField packedButtons;
+	/// The buttons that are present in the report, with button 1 in bit 0
+	uint32_t buttonMask;
+	/// The individual button fields, used when the buttons are not packed
+	MouseReportField buttonFields[kMouseReportMaxButtons];
+	uint8_t buttonIndices[kMouseReportMaxButtons];
+	uint8_t buttonCount;
+
+	/// Set when X and Y are adjacent, byte aligned, signed 16-bit fields, which are decoded with the specialized fast path
+	bool alignedAxes16;
+	/// The decode function selected for this layout, which is either a kernel specialized for a well known layout or the generic decoder
+	MouseDecodeFunction decode;
+	/// The name of the selected decode function, for logging
+	const char* decodeName;
+	/// Set when the computed layout does not fit in the report, which makes the driver read elements instead
+	bool disabled;
+};
+
+/// All mouse report layouts of a HID interface.
+/// A plan never changes once it is computed. What verification learns about each layout is kept in a `MouseDecodeState`.
+struct MouseDecodePlan
+{
+	MouseReportLayout layouts[kMouseDecodePlanMaxLayouts];
+	uint32_t layoutCount;
+};
+
+/// The fields of a layout, as bits of a field mask. Buttons use bits 0 to 31, with button 1 in bit 0.
+constexpr uint64_t kMouseReportFieldX = 1ULL << 32;
+constexpr uint64_t kMouseReportFieldY = 1ULL << 33;
+constexpr uint64_t kMouseReportFieldWheel = 1ULL << 34;
+constexpr uint64_t kMouseReportFieldPan = 1ULL << 35;
+
+/// The state of a decode plan that belongs to a single interface, indexed like the layouts of the plan.
+struct MouseDecodeState
+{
+	/// The fields of each layout that have not been seen to change yet. A field is only proven to be at the right location
+	/// once its value has changed and still matched the value the OS parsed, so reports are cross-checked until this is 0.
+	uint64_t unverifiedFields[kMouseDecodePlanMaxLayouts];
+	/// The number of upcoming reports that may still be cross-checked, which bounds the cost of fields that never change
+	uint32_t verifyReportsRemaining[kMouseDecodePlanMaxLayouts];
+	/// The previous cross-checked report of each layout, which the next one is compared with to find the fields that changed
+	MouseReport lastVerifiedReport[kMouseDecodePlanMaxLayouts];
+	/// Set when the decoded values disagreed with the OS, which makes the driver fall back to reading elements
+	bool disabled[kMouseDecodePlanMaxLayouts];
+};
+
+/// Returns the number of bytes a report must contain for the field to be read.
+/// - Parameters:
+///   - field: The field to measure
+/// - Returns: The minimum report length, or 0 if the field is absent
+static inline uint32_t mouseReportFieldEnd(MouseReportField field)
+{
+	if (field.bitSize == 0)
+	{
+		return 0;
+	}
+
+	return (uint32_t(field.bitOffset) + field.bitSize + 7) / 8;
+}
+
+/// Reads a field of any alignment and any size from 1 to 32 bits.
+/// A single unaligned 64-bit load always covers the field, since at most 7 leading bits need to be skipped.
+/// Sign extension is selected with a mask rather than a branch.
+/// - Parameters:
+///   - report: The raw HID report
+///   - reportLength: The length of the HID report
+///   - field: The field to read, which must not be absent
+/// - Returns: The field value, sign extended if the field is signed
+static inline int32_t extractReportField(const uint8_t* report, uint32_t reportLength, MouseReportField field)
+{
+	uint32_t byteOffset = field.bitOffset >> 3;
+	uint64_t word = 0;
+
+	if ((byteOffset + sizeof(word)) <= reportLength)
+	{
+		memcpy(&word, report + byteOffset, sizeof(word));
+	}
+	else if (byteOffset < reportLength)
+	{
+		// Near the end of the report, only copy the bytes that exist so the load never reads past the buffer.
+		memcpy(&word, report + byteOffset, reportLength - byteOffset);
+	}
+
+	// Move the field to the top of the word, then shift it back down either logically or arithmetically.
+	uint32_t discardBits = 64 - field.bitSize;
+	uint64_t raised = word << (discardBits - (field.bitOffset & 7));
+	uint64_t logical = raised >> discardBits;
+	uint64_t arithmetic = uint64_t(int64_t(raised) >> discardBits);
+	uint64_t signMask = 0 - uint64_t(field.isSigned != 0);
+
+	return int32_t((arithmetic & signMask) | (logical & ~signMask));
+}
+
+/// Reads a field whose location is known at compile time.
+/// The compiler reduces this to a single load for byte aligned 8-bit and 16-bit fields, such as the common 16-bit X/Y layout.
+/// The caller must have checked that the report is long enough.
+/// - Parameters:
+///   - report: The raw HID report
+/// - Returns: The field value, sign extended if the field is signed
+template <uint32_t BitOffset, uint32_t BitSize, bool IsSigned>
+static inline int32_t extractFixedReportField(const uint8_t* report)
+{
+	static_assert((BitSize >= 1) && (BitSize <= 32), "Report fields must be between 1 and 32 bits.");
+
+	constexpr uint32_t kByteOffset = BitOffset / 8;
+	constexpr uint32_t kShift = BitOffset % 8;
+	constexpr uint32_t kByteCount = (kShift + BitSize + 7) / 8;
+
+	uint64_t word = 0;
+	memcpy(&word, report + kByteOffset, kByteCount);
+
+	uint64_t raised = word << (64 - BitSize - kShift);
+	if constexpr (IsSigned)
+	{
+		return int32_t(int64_t(raised) >> (64 - BitSize));
+	}
+	else
+	{
+		return int32_t(raised >> (64 - BitSize));
+	}
+}
+
+/// Adds a button to a report layout.
+/// - Parameters:
+///   - layout: The layout being built
+///   - buttonIndex: The zero based index of the button
+///   - field: The location of the button in the report
+static inline void addMouseReportButton(MouseReportLayout& layout, uint32_t buttonIndex, MouseReportField field)
+{
+	if ((buttonIndex >= kMouseReportMaxButtons) || (layout.buttonCount >= kMouseReportMaxButtons) || (field.bitSize == 0))
+	{
+		return;
+	}
+
+	layout.buttonFields[layout.buttonCount] = field;
+	layout.buttonIndices[layout.buttonCount] = uint8_t(buttonIndex);
+	++layout.buttonCount;
+	layout.buttonMask |= (1U << buttonIndex);
+}
+
+/// Decodes every mouse field of a report using its layout. This handles any layout the plan can describe.
+/// - Parameters:
+///   - layout: The layout of the report
+///   - report: The raw HID report
+///   - reportLength: The length of the HID report
+///   - mouseReport: The variable that stores the decoded values
+/// - Returns: True if the report was long enough to be decoded, otherwise false
+static bool decodeGenericMouseReport(const MouseReportLayout& layout, const uint8_t* report, uint32_t reportLength, MouseReport* mouseReport)
+{
+	if (reportLength < layout.minimumLength)
+	{
+		return false;
+	}
+
+	if (layout.alignedAxes16)
+	{
+		const uint8_t* axes = report + (layout.x.bitOffset >> 3);
+		mouseReport->x = extractFixedReportField<0, 16, true>(axes);
+		mouseReport->y = extractFixedReportField<16, 16, true>(axes);
+	}
+	else
+	{
+		mouseReport->x = (layout.x.bitSize != 0) ? extractReportField(report, reportLength, layout.x) : 0;
+		mouseReport->y = (layout.y.bitSize != 0) ? extractReportField(report, reportLength, layout.y) : 0;
+	}
+
+	mouseReport->wheel = (layout.wheel.bitSize != 0) ? extractReportField(report, reportLength, layout.wheel) : 0;
+	mouseReport->pan = (layout.pan.bitSize != 0) ? extractReportField(report, reportLength, layout.pan) : 0;
+
+	uint32_t buttons = 0;
+	if (layout.packedButtons.bitSize != 0)
+	{
+		buttons = uint32_t(extractReportField(report, reportLength, layout.packedButtons));
+	}
+	else
+	{
+		for (uint32_t buttonIndex = 0; buttonIndex < layout.buttonCount; ++buttonIndex)
+		{
+			uint32_t pressed = (extractReportField(report, reportLength, layout.buttonFields[buttonIndex]) != 0);
+			buttons |= (pressed << layout.buttonIndices[buttonIndex]);
+		}
+	}
+
+	mouseReport->buttons = buttons & layout.buttonMask;
+	mouseReport->buttonMask = layout.buttonMask;
+
+	return true;
+}
+
+/// A well known report layout, where every field location is a compile-time constant.
+/// Buttons are packed from the start of the report, followed by signed X and Y, then optionally an 8-bit signed wheel and pan.
+/// - Parameters:
+///   - ReportIDBits: 8 if the report starts with a report ID byte, otherwise 0
+///   - ButtonBits: The size of the button field, including any padding after the buttons
+///   - AxisBits: The size of each of the X and Y fields
+///   - HasWheel: Whether an 8-bit wheel follows the Y field
+///   - HasPan: Whether an 8-bit AC Pan field follows the wheel
+template <uint32_t ReportIDBits, uint32_t ButtonBits, uint32_t AxisBits, bool HasWheel, bool HasPan>
+struct FixedMouseReportLayout
+{
+	static_assert(HasWheel || !HasPan, "A pan field is only expected after a wheel field.");
+
+	static constexpr uint32_t kXOffset = ReportIDBits + ButtonBits;
+	static constexpr uint32_t kYOffset = kXOffset + AxisBits;
+	static constexpr uint32_t kWheelOffset = kYOffset + AxisBits;
+	static constexpr uint32_t kPanOffset = kWheelOffset + 8;
+	static constexpr uint32_t kLength = (kWheelOffset + (HasWheel ? 8 : 0) + (HasPan ? 8 : 0)) / 8;
+
+	/// Checks whether a layout computed from the device elements is exactly this layout.
+	/// - Parameters:
+	///   - layout: The finalized layout of a report
+	/// - Returns: True if the fixed decode function produces the same values as the generic decoder
+	static bool matches(const MouseReportLayout& layout)
+	{
+		auto fieldIs = [](MouseReportField field, uint32_t bitOffset, uint32_t bitSize)
+		{
+			return (field.bitOffset == bitOffset) && (field.bitSize == bitSize) && (field.isSigned != 0);
+		};
+
+		return ((layout.reportID != 0) == (ReportIDBits != 0)) &&
+			(layout.packedButtons.bitSize != 0) && (layout.packedButtons.bitOffset == ReportIDBits) && (layout.packedButtons.bitSize <= ButtonBits) &&
+			fieldIs(layout.x, kXOffset, AxisBits) && fieldIs(layout.y, kYOffset, AxisBits) &&
+			(HasWheel ? fieldIs(layout.wheel, kWheelOffset, 8) : (layout.wheel.bitSize == 0)) &&
+			(HasPan ? fieldIs(layout.pan, kPanOffset, 8) : (layout.pan.bitSize == 0));
+	}
+
+	/// Decodes a report with every offset, size, and sign extension folded into constants.
+	/// Matches the `MouseDecodeFunction` signature.
+	static bool decode(const MouseReportLayout& layout, const uint8_t* report, uint32_t reportLength, MouseReport* mouseReport)
+	{
+		if (reportLength < kLength)
+		{
+			return false;
+		}
+
+		// Padding after the buttons is read along with them, and removed by the button mask.
+		mouseReport->buttons = uint32_t(extractFixedReportField<ReportIDBits, ButtonBits, false>(report)) & layout.buttonMask;
+		mouseReport->buttonMask = layout.buttonMask;
+		mouseReport->x = extractFixedReportField<kXOffset, AxisBits, true>(report);
+		mouseReport->y = extractFixedReportField<kYOffset, AxisBits, true>(report);
+		mouseReport->wheel = HasWheel ? extractFixedReportField<kWheelOffset, 8, true>(report) : 0;
+		mouseReport->pan = HasPan ? extractFixedReportField<kPanOffset, 8, true>(report) : 0;
+
+		return true;
+	}
+};
+
+/// Boot protocol mice, with 3 to 8 buttons in the first byte, followed by 8-bit X/Y and an optional wheel.
+template <uint32_t ReportIDBits, bool HasWheel>
+using BootMouseReportLayout = FixedMouseReportLayout<ReportIDBits, 8, 8, HasWheel, false>;
+/// 8-bit buttons followed by 12-bit X/Y packed into three bytes.
+template <uint32_t ReportIDBits, bool HasWheel, bool HasPan>
+using Packed12MouseReportLayout = FixedMouseReportLayout<ReportIDBits, 8, 12, HasWheel, HasPan>;
+/// 16-bit buttons followed by 12-bit X/Y packed into three bytes, used by most Logitech receivers.
+template <uint32_t ReportIDBits, bool HasWheel, bool HasPan>
+using Wide12MouseReportLayout = FixedMouseReportLayout<ReportIDBits, 16, 12, HasWheel, HasPan>;
+/// 16-bit buttons followed by 16-bit X/Y, used by most high resolution gaming mice.
+template <uint32_t ReportIDBits, bool HasWheel, bool HasPan>
+using Wide16MouseReportLayout = FixedMouseReportLayout<ReportIDBits, 16, 16, HasWheel, HasPan>;
+
+/// Picks the first of the fixed layouts that matches.
+/// - Parameters:
+///   - layout: The finalized layout of a report
+///   - names: The name of each fixed layout, in the same order as the template parameters
+///   - decodeName: The variable that stores the name of the selected layout
+/// - Returns: The decode function of the matching fixed layout, or nullptr if none of them match
+template <typename... FixedLayouts>
+static MouseDecodeFunction selectFixedMouseDecodeFunction(const MouseReportLayout& layout, const char* const (&names)[sizeof...(FixedLayouts)], const char** decodeName)
+{
+	MouseDecodeFunction decode = nullptr;
+	uint32_t index = 0;
+
+	bool found = ((FixedLayouts::matches(layout) ? (decode = FixedLayouts::decode, true) : (++index, false)) || ...);
+	if (found)
+	{
+		*decodeName = names[index];
+	}
+
+	return decode;
+}
+
+/// Checks whether an interface only sends boot protocol mouse reports, which have a fixed 3 or 4 byte layout without a report ID.
+/// - Parameters:
+///   - plan: The decode plan of the interface
+/// - Returns: True if the interface only has a single, boot protocol, mouse report
+static inline bool isBootMouseDecodePlan(const MouseDecodePlan& plan)
+{
+	if ((plan.layoutCount != 1) || plan.layouts[0].disabled)
+	{
+		return false;
+	}
+
+	return BootMouseReportLayout<0, false>::matches(plan.layouts[0]) || BootMouseReportLayout<0, true>::matches(plan.layouts[0]);
+}
+
+/// Selects the fastest decode function that produces correct values for a layout.
+/// - Parameters:
+///   - layout: The finalized layout of a report
+static inline void selectMouseDecodeFunction(MouseReportLayout& layout)
+{
+	// Every fixed layout is instantiated with and without a report ID byte, and with each optional scroll field.
+	static const char* const names[] =
+	{
+		"boot", "boot + wheel", "boot (report ID)", "boot + wheel (report ID)",
+		"8-bit buttons + 12-bit X/Y", "8-bit buttons + 12-bit X/Y + wheel", "8-bit buttons + 12-bit X/Y + wheel + pan",
+		"8-bit buttons + 12-bit X/Y (report ID)", "8-bit buttons + 12-bit X/Y + wheel (report ID)", "8-bit buttons + 12-bit X/Y + wheel + pan (report ID)",
+		"16-bit buttons + 12-bit X/Y + wheel + pan", "16-bit buttons + 12-bit X/Y + wheel + pan (report ID)",
+		"16-bit buttons + 16-bit X/Y + wheel + pan", "16-bit buttons + 16-bit X/Y + wheel + pan (report ID)",
+	};
+
+	const char* decodeName = "generic";
+	MouseDecodeFunction decode = selectFixedMouseDecodeFunction<
+		BootMouseReportLayout<0, false>, BootMouseReportLayout<0, true>, BootMouseReportLayout<8, false>, BootMouseReportLayout<8, true>,
+		Packed12MouseReportLayout<0, false, false>, Packed12MouseReportLayout<0, true, false>, Packed12MouseReportLayout<0, true, true>,
+		Packed12MouseReportLayout<8, false, false>, Packed12MouseReportLayout<8, true, false>, Packed12MouseReportLayout<8, true, true>,
+		Wide12MouseReportLayout<0, true, true>, Wide12MouseReportLayout<8, true, true>,
+		Wide16MouseReportLayout<0, true, true>, Wide16MouseReportLayout<8, true, true>
+	>(layout, names, &decodeName);
+
+	layout.decode = (decode != nullptr) ? decode : decodeGenericMouseReport;
+	layout.decodeName = decodeName;
+}
+
+/// Computes the derived values of a layout once all of its fields have been added.
+/// - Parameters:
+///   - layout: The layout being built
+static inline void finalizeMouseReportLayout(MouseReportLayout& layout)
+{
+	uint32_t minimumLength = mouseReportFieldEnd(layout.x);
+	minimumLength = (mouseReportFieldEnd(layout.y) > minimumLength) ? mouseReportFieldEnd(layout.y) : minimumLength;
+	minimumLength = (mouseReportFieldEnd(layout.wheel) > minimumLength) ? mouseReportFieldEnd(layout.wheel) : minimumLength;
+	minimumLength = (mouseReportFieldEnd(layout.pan) > minimumLength) ? mouseReportFieldEnd(layout.pan) : minimumLength;
+
+	// Buttons 1 to N stored as consecutive single bits can be read as one N-bit field that already matches the button state.
+	bool packed = (layout.buttonCount > 0);
+	for (uint32_t buttonIndex = 0; buttonIndex < layout.buttonCount; ++buttonIndex)
+	{
+		const MouseReportField& field = layout.buttonFields[buttonIndex];
+		minimumLength = (mouseReportFieldEnd(field) > minimumLength) ? mouseReportFieldEnd(field) : minimumLength;
+
+		packed = packed && (layout.buttonIndices[buttonIndex] == buttonIndex) && (field.bitSize == 1) &&
+			(field.bitOffset == (layout.buttonFields[0].bitOffset + buttonIndex));
+	}
+
+	layout.packedButtons = {};
+	if (packed)
+	{
+		layout.packedButtons = { layout.buttonFields[0].bitOffset, layout.buttonCount, false };
+	}
+
+	// 16-bit, byte aligned axes are by far the most common layout, so they get a dedicated decode path.
+	layout.alignedAxes16 = (layout.x.bitSize == 16) && (layout.y.bitSize == 16) && layout.x.isSigned && layout.y.isSigned &&
+		((layout.x.bitOffset & 7) == 0) && (layout.y.bitOffset == (layout.x.bitOffset + 16));
+
+	layout.minimumLength = minimumLength;
+	layout.disabled = false;
+
+	selectMouseDecodeFunction(layout);
+}
+
+/// Returns the fields a layout decodes.
+/// - Parameters:
+///   - layout: The finalized layout of a report
+/// - Returns: A mask of `kMouseReportField` values and button bits
+static inline uint64_t mouseReportLayoutFields(const MouseReportLayout& layout)
+{
+	uint64_t fields = layout.buttonMask;
+	fields |= (layout.x.bitSize != 0) ? kMouseReportFieldX : 0;
+	fields |= (layout.y.bitSize != 0) ? kMouseReportFieldY : 0;
+	fields |= (layout.wheel.bitSize != 0) ? kMouseReportFieldWheel : 0;
+	fields |= (layout.pan.bitSize != 0) ? kMouseReportFieldPan : 0;
+
+	return fields;
+}
+
+/// Prepares the state an interface keeps for a decode plan.
+/// - Parameters:
+///   - state: The state of the interface
+///   - plan: The decode plan of the interface
+///   - verifyReportLimit: The maximum number of reports per layout to cross-check against the values the OS parsed
+static inline void initializeMouseDecodeState(MouseDecodeState& state, const MouseDecodePlan& plan, uint32_t verifyReportLimit)
+{
+	state = {};
+
+	for (uint32_t layoutIndex = 0; layoutIndex < plan.layoutCount; ++layoutIndex)
+	{
+		state.unverifiedFields[layoutIndex] = mouseReportLayoutFields(plan.layouts[layoutIndex]);
+		state.verifyReportsRemaining[layoutIndex] = verifyReportLimit;
+	}
+}
+
+/// Checks whether the next report of a layout should be cross-checked against the values the OS parsed.
+/// - Parameters:
+///   - state: The state the interface keeps for the plan
+///   - layoutIndex: The index of the layout in the plan
+/// - Returns: True while some field of the layout has not been seen to change, and the report limit is not reached
+static inline bool mouseReportNeedsVerification(const MouseDecodeState& state, uint32_t layoutIndex)
+{
+	return (state.unverifiedFields[layoutIndex] != 0) && (state.verifyReportsRemaining[layoutIndex] != 0);
+}
+
+/// Records a decoded report that matched the values the OS parsed, marking every field whose value changed as verified.
+/// The first report is compared with an idle report, where every field is 0.
+/// - Parameters:
+///   - state: The state the interface keeps for the plan
+///   - layout: The layout of the report
+///   - layoutIndex: The index of the layout in the plan
+///   - report: The decoded report
+static inline void recordVerifiedMouseReport(MouseDecodeState& state, const MouseReportLayout& layout, uint32_t layoutIndex, const MouseReport& report)
+{
+	MouseReport& last = state.lastVerifiedReport[layoutIndex];
+
+	uint64_t changed = (report.buttons ^ last.buttons) & layout.buttonMask;
+	changed |= (report.x != last.x) ? kMouseReportFieldX : 0;
+	changed |= (report.y != last.y) ? kMouseReportFieldY : 0;
+	changed |= (report.wheel != last.wheel) ? kMouseReportFieldWheel : 0;
+	changed |= (report.pan != last.pan) ? kMouseReportFieldPan : 0;
+
+	state.unverifiedFields[layoutIndex] &= ~changed;
+	--state.verifyReportsRemaining[layoutIndex];
+	last = report;
+}
+
+/// Finds the layout for a report ID.
+/// - Parameters:
+///   - plan: The decode plan of the interface
+///   - state: The state the interface keeps for the plan
+///   - reportID: The report ID of the HID report
+///   - layoutIndex: The variable that stores the index of the layout in the plan
+/// - Returns: The layout, or nullptr if the report carries no mouse data or cannot be decoded directly
+static inline const MouseReportLayout* findMouseReportLayout(const MouseDecodePlan& plan, const MouseDecodeState& state, uint32_t reportID, uint32_t* layoutIndex)
+{
+	for (uint32_t index = 0; index < plan.layoutCount; ++index)
+	{
+		const MouseReportLayout& layout = plan.layouts[index];
+		if (layout.reportID == reportID)
+		{
+			*layoutIndex = index;
+			return (layout.disabled || state.disabled[index]) ? nullptr : &layout;
+		}
+	}
+
+	return nullptr;
+}
+
+/// Compares a decoded report with the same report built from element values, only looking at the bits each field carries.
+/// - Parameters:
+///   - layout: The layout of the report
+///   - decoded: The report decoded from the raw bytes
+///   - expected: The report built from the element values
+/// - Returns: True if both reports agree
+static inline bool mouseReportsMatch(const MouseReportLayout& layout, const MouseReport& decoded, const MouseReport& expected)
+{
+	auto fieldMatches = [](MouseReportField field, int32_t a, int32_t b)
+	{
+		uint32_t mask = (field.bitSize >= 32) ? UINT32_MAX : ((1U << field.bitSize) - 1);
+		return ((uint32_t(a) ^ uint32_t(b)) & mask) == 0;
+	};
+
+	return fieldMatches(layout.x, decoded.x, expected.x) &&
+		fieldMatches(layout.y, decoded.y, expected.y) &&
+		fieldMatches(layout.wheel, decoded.wheel, expected.wheel) &&
+		fieldMatches(layout.pan, decoded.pan, expected.pan) &&
+		(((decoded.buttons ^ expected.buttons) & layout.buttonMask) == 0);
+}
+
+/// The Logitech receiver report IDs that carry the index of the paired device in their second byte:
+/// HID++ short, long, and very long reports, and DJ short and long reports.
+constexpr uint8_t kPairedDeviceReportHIDPPShort = 0x10;
+constexpr uint8_t kPairedDeviceReportHIDPPLong = 0x11;
+constexpr uint8_t kPairedDeviceReportHIDPPVeryLong = 0x12;
+constexpr uint8_t kPairedDeviceReportDJShort = 0x20;
+constexpr uint8_t kPairedDeviceReportDJLong = 0x21;
+
+/// Finds the paired device that sent a report.
+/// - Parameters:
+///   - reportID: The report ID of the HID report
+///   - report: The raw HID report
+///   - reportLength: The length of the HID report
+/// - Returns: The slot of the paired device, or 0 if the report carries no device index, or one that is out of range
+static inline uint32_t pairedDeviceSlot(uint32_t reportID, const uint8_t* report, uint32_t reportLength)
+{
+	bool hasDeviceIndex = (reportID == kPairedDeviceReportHIDPPShort) || (reportID == kPairedDeviceReportHIDPPLong) ||
+		(reportID == kPairedDeviceReportHIDPPVeryLong) || (reportID == kPairedDeviceReportDJShort) || (reportID == kPairedDeviceReportDJLong);
+	if ((hasDeviceIndex == false) || (reportLength < 2))
+	{
+		return 0;
+	}
+
+	// The receiver itself uses index 0xFF, which shares slot 0 with reports that carry no index.
+	return (report[1] < kMousePairedDeviceSlotCount) ? report[1] : 0;
+}
+
+#endif /* MouseReportDecoder_h */
@@ -0,0 +1,257 @@
+//
+//  ReportTimingStatistics.h
+//  DeliberateMouseDriver
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Measures the interval between consecutive reports, which shows the polling rate a device actually delivers and how much it jitters,
+// and detects reports that were lost or delivered late.
+// Everything is integer only and constant time, so it can run on every report.
+//
+
+#ifndef ReportTimingStatistics_h
+#define ReportTimingStatistics_h
+
+#include <stdint.h>
+#include <mach/mach_time.h>
+
+#include "DeliberateMouseShared.h"
+
+/// The running interval statistics of a device.
+struct ReportIntervalStatistics
+{
+	/// The timestamp of the previous report, in mach absolute time units, or 0 before the first report
+	uint64_t lastTimestamp;
+
+	uint64_t reportCount;
+	uint64_t idleCount;
+	uint64_t intervalCount;
+	uint64_t minimumNanoseconds;
+	uint64_t maximumNanoseconds;
+
+	/// The running mean of Welford's algorithm, as 48.16 fixed point nanoseconds
+	uint64_t mean;
+	/// The running sum of squared differences from the mean, as 96.32 fixed point square nanoseconds
+	unsigned __int128 m2;
+
+	uint64_t buckets[kDeliberateMouseIntervalBucketCount];
+};
+
+/// The lost report and stall incidents of a device.
+struct ReportIncidentLog
+{
+	/// Whether the previous report was delivered late, so a backlog is only counted once
+	bool inBacklog;
+	/// The motion of the previous report, in counts summed over both axes
+	uint32_t lastMotionCounts;
+	/// The interval of a single poll, in nanoseconds, or 0 before it is measured
+	uint64_t pollingNanoseconds;
+
+	uint64_t gapCount;
+	uint64_t longestGapNanoseconds;
+	uint64_t backlogCount;
+	uint64_t backlogReportCount;
+	uint64_t oldestBacklogNanoseconds;
+
+	/// The total number of incidents ever recorded
+	uint64_t incidentCount;
+	DeliberateMouseIncident incidents[kDeliberateMouseIncidentCapacity];
+};
+
+/// The number of fractional bits of the running mean. Intervals in the moments are at most 2^25 nanoseconds,
+/// so each sample fits in 41 bits, and each squared difference in 82 bits.
+constexpr uint32_t kReportIntervalMeanFractionBits = 16;
+
+/// Converts a duration in mach absolute time units to nanoseconds.
+/// - Parameters:
+///   - timebase: The timebase of the timestamps
+///   - absoluteTime: The duration to convert
+/// - Returns: The duration in nanoseconds
+static inline uint64_t absoluteTimeToNanoseconds(const mach_timebase_info_data_t& timebase, uint64_t absoluteTime)
+{
+	if (timebase.numer == timebase.denom)
+	{
+		return absoluteTime;
+	}
+
+	return (absoluteTime * timebase.numer) / timebase.denom;
+}
+
+/// Adds the interval since the previous report to the statistics.
+/// Intervals longer than `kDeliberateMouseIntervalIdleNanoseconds` are only counted in the histogram,
+/// since mice stop reporting while they are not moving, and those pauses say nothing about the polling rate.
+/// - Parameters:
+///   - statistics: The interval statistics of the device
+///   - timebase: The timebase of the report timestamps
+///   - timestamp: The timestamp of the report
+/// - Returns: The interval in nanoseconds, or 0 if there is no previous report to measure from
+static inline uint64_t recordReportInterval(ReportIntervalStatistics& statistics, const mach_timebase_info_data_t& timebase, uint64_t timestamp)
+{
+	uint64_t lastTimestamp = statistics.lastTimestamp;
+
+	statistics.lastTimestamp = timestamp;
+	++statistics.reportCount;
+
+	// Reports can arrive with the same or an older timestamp when they are queued, which is not a measurable interval.
+	if ((lastTimestamp == 0) || (timestamp <= lastTimestamp))
+	{
+		return 0;
+	}
+
+	uint64_t interval = absoluteTimeToNanoseconds(timebase, timestamp - lastTimestamp);
+	++statistics.buckets[DeliberateMouseIntervalBucket(interval)];
+
+	if (interval > kDeliberateMouseIntervalIdleNanoseconds)
+	{
+		++statistics.idleCount;
+		return interval;
+	}
+
+	uint64_t count = ++statistics.intervalCount;
+	statistics.minimumNanoseconds = ((count == 1) || (interval < statistics.minimumNanoseconds)) ? interval : statistics.minimumNanoseconds;
+	statistics.maximumNanoseconds = (interval > statistics.maximumNanoseconds) ? interval : statistics.maximumNanoseconds;
+
+	// Welford's algorithm in fixed point. The step of the mean is rounded to nearest, since truncating it toward the sample
+	// biases the mean whenever the samples stay on one side of it, which adds up to microseconds after a change of polling rate.
+	// The mean never moves past the new sample, so both differences have the same sign and their product is never negative.
+	int64_t sample = int64_t(interval << kReportIntervalMeanFractionBits);
+	int64_t delta = sample - int64_t(statistics.mean);
+	int64_t halfCount = int64_t(count / 2);
+	statistics.mean = uint64_t(int64_t(statistics.mean) + (((delta < 0) ? (delta - halfCount) : (delta + halfCount)) / int64_t(count)));
+	int64_t deltaAfter = sample - int64_t(statistics.mean);
+	statistics.m2 += (unsigned __int128)(__int128(delta) * deltaAfter);
+
+	return interval;
+}
+
+/// Appends an incident to the log, overwriting the oldest incident once the log is full.
+/// - Parameters:
+///   - log: The incident log of the device
+///   - kind: One of the `kDeliberateMouseIncident` values
+///   - timestamp: The timestamp of the report that revealed the incident
+///   - durationNanoseconds: The length of the gap, or the age of the report
+static inline void recordReportIncident(ReportIncidentLog& log, uint32_t kind, uint64_t timestamp, uint64_t durationNanoseconds)
+{
+	DeliberateMouseIncident& incident = log.incidents[log.incidentCount % kDeliberateMouseIncidentCapacity];
+	incident = { timestamp, kind, 0, durationNanoseconds };
+	++log.incidentCount;
+}
+
+/// Measures the motion of a report for gap detection.
+/// - Parameters:
+///   - x: The X motion of the report, in counts
+///   - y: The Y motion of the report, in counts
+/// - Returns: The sum of the magnitudes of both axes, saturated to 32 bits
+static inline uint32_t reportMotionCounts(int32_t x, int32_t y)
+{
+	uint64_t counts = uint64_t((x < 0) ? -int64_t(x) : int64_t(x)) + uint64_t((y < 0) ? -int64_t(y) : int64_t(y));
+	return (counts > UINT32_MAX) ? UINT32_MAX : uint32_t(counts);
+}
+
+/// Checks a report for lost reports before it, and for delivery delays.
+/// A mouse that is at rest or moving slowly skips polls without losing anything, but its next report still arrives after a whole number of polls.
+/// So a long interval is only a gap when the reports on both sides of it moved at least `kDeliberateMouseGapMinimumMotionCounts`,
+/// or when it ends off the polling schedule. Gaps are only detected up to `kDeliberateMouseIntervalIdleNanoseconds`,
+/// since any longer interval is indistinguishable from the mouse being at rest.
+/// - Parameters:
+///   - log: The incident log of the device
+///   - statistics: The interval statistics of the device, already updated with this report
+///   - interval: The interval since the previous report in nanoseconds, as returned by `recordReportInterval`
+///   - timestamp: The timestamp of the report
+///   - ageNanoseconds: How long ago the report was generated
+///   - motionCounts: The motion of the report, in counts summed over both axes
+static inline void detectReportIncidents(ReportIncidentLog& log, const ReportIntervalStatistics& statistics, uint64_t interval, uint64_t timestamp, uint64_t ageNanoseconds, uint32_t motionCounts)
+{
+	uint32_t lastMotionCounts = log.lastMotionCounts;
+	log.lastMotionCounts = motionCounts;
+
+	// The mean counts every skipped poll, so the polling interval is tracked separately, from the intervals that are close to a single poll.
+	// Longer intervals never move it, and it settles on the shortest interval the device keeps repeating.
+	uint64_t pollingInterval = log.pollingNanoseconds;
+	if ((interval != 0) && ((pollingInterval == 0) || (interval < (pollingInterval + (pollingInterval / 2)))))
+	{
+		log.pollingNanoseconds = (pollingInterval == 0) ? interval : uint64_t(int64_t(pollingInterval) + ((int64_t(interval) - int64_t(pollingInterval)) / 8));
+	}
+
+	if ((pollingInterval != 0) && (statistics.intervalCount >= kDeliberateMouseGapMinimumIntervals) && (interval <= kDeliberateMouseIntervalIdleNanoseconds) &&
+		(interval > (pollingInterval * kDeliberateMouseGapIntervalMultiplier)))
+	{
+		uint64_t phase = interval % pollingInterval;
+		uint64_t scheduleOffset = (phase < (pollingInterval - phase)) ? phase : (pollingInterval - phase);
+		bool offSchedule = scheduleOffset > (pollingInterval / kDeliberateMouseGapScheduleToleranceDivisor);
+		bool motionContinues = (lastMotionCounts >= kDeliberateMouseGapMinimumMotionCounts) && (motionCounts >= kDeliberateMouseGapMinimumMotionCounts);
+
+		if (offSchedule || motionContinues)
+		{
+			++log.gapCount;
+			log.longestGapNanoseconds = (interval > log.longestGapNanoseconds) ? interval : log.longestGapNanoseconds;
+			recordReportIncident(log, kDeliberateMouseIncidentGap, timestamp, interval);
+		}
+	}
+
+	if (ageNanoseconds <= kDeliberateMouseBacklogNanoseconds)
+	{
+		log.inBacklog = false;
+		return;
+	}
+
+	++log.backlogReportCount;
+	log.oldestBacklogNanoseconds = (ageNanoseconds > log.oldestBacklogNanoseconds) ? ageNanoseconds : log.oldestBacklogNanoseconds;
+
+	// The first late report is the oldest one of its backlog, so it describes the whole backlog.
+	if (log.inBacklog == false)
+	{
+		log.inBacklog = true;
+		++log.backlogCount;
+		recordReportIncident(log, kDeliberateMouseIncidentBacklog, timestamp, ageNanoseconds);
+	}
+}
+
+/// Copies the interval statistics into the layout shared with clients.
+/// - Parameters:
+///   - statistics: The interval statistics of the device
+///   - snapshot: The variable that stores the copy
+static inline void snapshotReportIntervalStatistics(const ReportIntervalStatistics& statistics, DeliberateMouseIntervalStatistics* snapshot)
+{
+	snapshot->reportCount = statistics.reportCount;
+	snapshot->idleCount = statistics.idleCount;
+	snapshot->intervalCount = statistics.intervalCount;
+	snapshot->minimumNanoseconds = statistics.minimumNanoseconds;
+	snapshot->maximumNanoseconds = statistics.maximumNanoseconds;
+	snapshot->meanNanoseconds = statistics.mean >> kReportIntervalMeanFractionBits;
+
+	// The sample variance, rounded down to whole square nanoseconds.
+	snapshot->varianceNanoseconds = 0;
+	if (statistics.intervalCount > 1)
+	{
+		snapshot->varianceNanoseconds = uint64_t((statistics.m2 / (statistics.intervalCount - 1)) >> (2 * kReportIntervalMeanFractionBits));
+	}
+
+	for (uint32_t bucketIndex = 0; bucketIndex < kDeliberateMouseIntervalBucketCount; ++bucketIndex)
+	{
+		snapshot->buckets[bucketIndex] = statistics.buckets[bucketIndex];
+	}
+}
+
+/// Copies the incident log into the layout shared with clients.
+/// - Parameters:
+///   - log: The incident log of the device
+///   - snapshot: The variable that stores the copy
+static inline void snapshotReportIncidentLog(const ReportIncidentLog& log, DeliberateMouseIncidentReport* snapshot)
+{
+	snapshot->gapCount = log.gapCount;
+	snapshot->longestGapNanoseconds = log.longestGapNanoseconds;
+	snapshot->backlogCount = log.backlogCount;
+	snapshot->backlogReportCount = log.backlogReportCount;
+	snapshot->oldestBacklogNanoseconds = log.oldestBacklogNanoseconds;
+
+	uint64_t count = (log.incidentCount < kDeliberateMouseIncidentCapacity) ? log.incidentCount : kDeliberateMouseIncidentCapacity;
+	for (uint64_t incidentIndex = 0; incidentIndex < count; ++incidentIndex)
+	{
+		snapshot->incidents[incidentIndex] = log.incidents[(log.incidentCount - count + incidentIndex) % kDeliberateMouseIncidentCapacity];
+	}
+	snapshot->incidentCount = uint32_t(count);
+}
+
+#endif /* ReportTimingStatistics_h */
@@ -0,0 +1,213 @@
+//
+//  BacklogMergeTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Replays the backlog of a stalled mouse through the same steps as `handleMouseReport` and the motion timer,
+// and checks that stale motion is merged until the backlog has drained, that no motion is lost,
+// and that button edges are dispatched in order, after the motion that came before them.
+//
+
+#include <vector>
+
+#include "TestSupport.h"
+#include "MouseMotionProcessing.h"
+
+/// Reports older than this are merged, as set by `BacklogMergeMilliseconds`.
+constexpr uint64_t kMergeAge = 8000000;
+/// The flush delay of the driver, with a timebase of 1/1.
+constexpr uint64_t kFlushDelay = 2000000;
+
+/// An event as it was dispatched to the OS.
+struct DispatchedEvent
+{
+	uint64_t timestamp;
+	int32_t x;
+	uint32_t buttonState;
+};
+
+/// The report path of one paired device, from `handleMouseReport` to the dispatch, and the motion timer.
+struct MergeReplay
+{
+	BacklogMergeState backlogMerge;
+	uint32_t buttonState;
+	uint64_t timerDeadline;
+	std::vector<DispatchedEvent> dispatched;
+
+	void dispatch(uint64_t timestamp, const MouseReport& report)
+	{
+		buttonState = (buttonState & ~report.buttonMask) | (report.buttons & report.buttonMask);
+		dispatched.push_back({ timestamp, report.x, buttonState });
+	}
+
+	void flush(void)
+	{
+		MouseReport mergedReport = {};
+		uint64_t mergedTimestamp = 0;
+		if (takeMergedReport(backlogMerge, &mergedReport, &mergedTimestamp) == true)
+		{
+			dispatch(mergedTimestamp, mergedReport);
+		}
+	}
+
+	/// Handles a report that reaches the driver at `now`, like `handleMouseReport`.
+	void report(uint64_t now, uint64_t timestamp, int32_t x, uint32_t buttons)
+	{
+		MouseReport mouseReport = { x, 0, 0, 0, 0, buttons, 0x1, 0 };
+		uint32_t newButtonState = (buttonState & ~mouseReport.buttonMask) | (mouseReport.buttons & mouseReport.buttonMask);
+
+		if (shouldMergeStaleReport(kMergeAge, now - timestamp, buttonState, newButtonState))
+		{
+			if (mergeStaleReport(backlogMerge, mouseReport, timestamp, now + kFlushDelay) == true)
+			{
+				timerDeadline = backlogMerge.flushTime;
+			}
+			return;
+		}
+
+		flush();
+		dispatch(timestamp, mouseReport);
+	}
+
+	/// Fires the motion timer if it is due by `now`, like `MotionTimerOccurred`.
+	void advance(uint64_t now)
+	{
+		if ((timerDeadline == 0) || (timerDeadline > now))
+		{
+			return;
+		}
+
+		timerDeadline = 0;
+		if ((backlogMerge.pending == true) && (backlogMerge.flushTime > now))
+		{
+			timerDeadline = backlogMerge.flushTime;
+		}
+		else
+		{
+			flush();
+		}
+	}
+};
+
+static void testBacklogKeepsButtonEdgesInOrder(void)
+{
+	MergeReplay replay = {};
+	int32_t totalMotion = 0;
+
+	// A 1 kHz mouse stalls for 70 ms. It moves one count in every report, presses the button in report 20, and releases it in report 35.
+	// The backlog reaches the driver in two bursts, 1 ms apart, so the rest of the backlog is still on its way when the first burst is handled.
+	for (uint32_t reportIndex = 0; reportIndex < 50; ++reportIndex)
+	{
+		uint64_t timestamp = 1000000000 + (uint64_t(reportIndex) * 1000000);
+		uint64_t now = 1000000000 + 70000000 + ((reportIndex < 40) ? 0 : 1000000) + (reportIndex * 10000);
+		uint32_t buttons = ((reportIndex >= 20) && (reportIndex < 35)) ? 1 : 0;
+
+		replay.advance(now);
+		replay.report(now, timestamp, 1, buttons);
+		totalMotion += 1;
+	}
+
+	// Fresh reports resume only after the timer dispatched the rest of the backlog.
+	for (uint32_t reportIndex = 0; reportIndex < 10; ++reportIndex)
+	{
+		uint64_t now = 1000000000 + 80000000 + (uint64_t(reportIndex) * 1000000);
+		replay.advance(now);
+		replay.report(now, now - 100000, 2, 0);
+		totalMotion += 2;
+	}
+
+	// The backlog becomes one merged event before the press, the press, one merged event while the button is held, the release,
+	// and one merged event after the release, which waited for the second burst.
+	const std::vector<DispatchedEvent>& events = replay.dispatched;
+	CHECK_EQUAL(events.size(), 5 + 10);
+	if (events.size() < 5)
+	{
+		return;
+	}
+
+	CHECK_EQUAL(events[0].x, 20);
+	CHECK_EQUAL(events[0].buttonState, 0);
+	CHECK_EQUAL(events[1].x, 1);
+	CHECK_EQUAL(events[1].buttonState, 1);
+	CHECK_EQUAL(events[2].x, 14);
+	CHECK_EQUAL(events[2].buttonState, 1);
+	CHECK_EQUAL(events[3].x, 1);
+	CHECK_EQUAL(events[3].buttonState, 0);
+	CHECK_EQUAL(events[4].x, 14);
+	CHECK_EQUAL(events[4].buttonState, 0);
+
+	// Every event is dispatched in the order its motion was generated, and no motion is lost.
+	int32_t dispatchedMotion = 0;
+	uint32_t buttonEdges = 0;
+	for (size_t eventIndex = 0; eventIndex < events.size(); ++eventIndex)
+	{
+		dispatchedMotion += events[eventIndex].x;
+		if (eventIndex > 0)
+		{
+			CHECK(events[eventIndex].timestamp > events[eventIndex - 1].timestamp);
+			buttonEdges += (events[eventIndex].buttonState != events[eventIndex - 1].buttonState);
+		}
+	}
+	CHECK_EQUAL(dispatchedMotion, totalMotion);
+	CHECK_EQUAL(buttonEdges, 2);
+}
+
+static void testFreshReportFlushesBeforeTimer(void)
+{
+	MergeReplay replay = {};
+
+	replay.report(100000000, 80000000, 3, 0);
+	replay.report(100010000, 81000000, 4, 0);
+	CHECK(replay.backlogMerge.pending);
+	CHECK_EQUAL(replay.timerDeadline, 100000000 + kFlushDelay);
+	CHECK(replay.dispatched.empty());
+
+	// A fresh report before the flush time dispatches the merged motion first.
+	replay.report(100500000, 100400000, 5, 0);
+	CHECK_EQUAL(replay.dispatched.size(), 2);
+	if (replay.dispatched.size() == 2)
+	{
+		CHECK_EQUAL(replay.dispatched[0].x, 7);
+		CHECK_EQUAL(replay.dispatched[0].timestamp, 81000000);
+		CHECK_EQUAL(replay.dispatched[1].x, 5);
+	}
+
+	// The timer then finds nothing to dispatch.
+	replay.advance(100000000 + kFlushDelay);
+	CHECK_EQUAL(replay.dispatched.size(), 2);
+	CHECK(replay.backlogMerge.pending == false);
+}
+
+static void testMergedMotionSaturates(void)
+{
+	BacklogMergeState backlogMerge = {};
+	MouseReport report = { INT32_MAX, INT32_MIN, 1, -1, 120, 0, 0, 3 };
+
+	CHECK(mergeStaleReport(backlogMerge, report, 10, 20));
+	CHECK(mergeStaleReport(backlogMerge, report, 11, 30) == false);
+	CHECK_EQUAL(backlogMerge.flushTime, 20);
+
+	MouseReport merged = {};
+	uint64_t timestamp = 0;
+	CHECK(takeMergedReport(backlogMerge, &merged, &timestamp));
+	CHECK_EQUAL(merged.x, INT32_MAX);
+	CHECK_EQUAL(merged.y, INT32_MIN);
+	CHECK_EQUAL(merged.wheel, 2);
+	CHECK_EQUAL(merged.pan, -2);
+	CHECK_EQUAL(merged.wheelResolution, 120);
+	CHECK_EQUAL(merged.device, 3);
+	CHECK_EQUAL(merged.buttonMask, 0);
+	CHECK_EQUAL(timestamp, 11);
+	CHECK(takeMergedReport(backlogMerge, &merged, &timestamp) == false);
+}
+
+int main(void)
+{
+	RUN_TEST(testBacklogKeepsButtonEdgesInOrder);
+	RUN_TEST(testFreshReportFlushesBeforeTimer);
+	RUN_TEST(testMergedMotionSaturates);
+
+	return finishTests();
+}
@@ -0,0 +1,675 @@
+//
+//  DriverLifecycleTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Starts and stops the driver against the mock DriverKit, and checks with the counting allocator of the mock that the
+// memory footprint the driver publishes is every byte it allocated, and that Start/Stop cycles release everything.
+// Also checks that a HID++ device that is slow to take requests does not hold up the reports of the mouse,
+// and that handing its diverted controls back never holds up `Stop`, even once the device is gone,
+// that wheel and pan motion of any size is scaled without overflowing, and that changing the smoothing never drops the motion it holds.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "TestSupport.h"
+#include "MockDriverSupport.h"
+#include "HIDPPDecoder.h"
+#include "DeliberateMouseShared.h"
+
+/// The number of Start/Stop cycles that must not leak.
+constexpr uint32_t kLifecycleCycleCount = 10000;
+
+/// Reads a number property of a service.
+static uint64_t copyNumberProperty(IOService* service, const char* key)
+{
+	OSDictionary* properties = nullptr;
+	uint64_t value = 0;
+	if (service->CopyProperties(&properties) == kIOReturnSuccess)
+	{
+		OSNumber* number = OSDynamicCast(OSNumber, properties->getObject(key));
+		value = (number != nullptr) ? number->unsigned64BitValue() : 0;
+		properties->release();
+	}
+	return value;
+}
+
+/// Starts a driver on a new interface, sends it a few reports, then stops it and releases everything.
+/// - Parameters:
+///   - hidpp: Whether the interface carries HID++ reports
+/// - Returns: True if the driver started and stopped
+static bool runLifecycleCycle(bool hidpp)
+{
+	IOHIDInterface* interface = createMockInterface(hidpp);
+	MockMouse mouse = {};
+	bool result = (startMockMouse(interface, {}, &mouse) == kIOReturnSuccess);
+
+	for (int16_t motion = -2; motion <= 2; ++motion)
+	{
+		uint8_t report[kMockMouseReportLength];
+		buildMockMouseReport(0, motion, motion, 0, report);
+		interface->mockDeliverReport(mach_absolute_time(), report, kMockMouseReportLength);
+	}
+
+	result &= stopMockMouse(&mouse);
+	interface->release();
+	return result;
+}
+
+static void testMemoryFootprintMatchesAllocations(void)
+{
+	for (bool hidpp : { false, true })
+	{
+		uint64_t objects = mockLiveObjectCount();
+
+		IOHIDInterface* interface = createMockInterface(hidpp);
+		uint64_t bytesBefore = mockAllocatedBytes();
+		MockMouse mouse = {};
+		CHECK_EQUAL(startMockMouse(interface, {}, &mouse), kIOReturnSuccess);
+
+		// Every byte the driver holds comes from the counting allocator, the ivars through IONew and the buffers through IOBufferMemoryDescriptor.
+		uint64_t footprint = copyNumberProperty(mouse.driver, "MemoryFootprintBytes");
+		CHECK(footprint > 0);
+		CHECK_EQUAL(mockAllocatedBytes() - bytesBefore, footprint);
+		CHECK(copyNumberProperty(mouse.driver, "MemoryFootprintPeakBytes") >= footprint);
+
+		CHECK(stopMockMouse(&mouse));
+		interface->release();
+		CHECK(waitForLiveObjectCount(objects));
+		CHECK_EQUAL(mockAllocatedBytes(), bytesBefore);
+	}
+}
+
+static void testStartStopCyclesDoNotGrow(void)
+{
+	// Every cycle must return to the same counts.
+	uint64_t bytes = mockAllocatedBytes();
+	uint64_t allocations = mockAllocationCount();
+	uint64_t objects = mockLiveObjectCount();
+	uint32_t failedCycles = 0;
+
+	for (uint32_t cycle = 0; cycle < kLifecycleCycleCount; ++cycle)
+	{
+		failedCycles += (runLifecycleCycle((cycle & 1) != 0) == false);
+		if (waitForLiveObjectCount(objects) == false)
+		{
+			CHECK(false);
+			printf("  cycle %u left %llu objects\n", cycle, (unsigned long long)(mockLiveObjectCount() - objects));
+			mockPrintLiveObjects();
+			return;
+		}
+	}
+
+	CHECK_EQUAL(failedCycles, 0);
+	CHECK_EQUAL(mockAllocatedBytes(), bytes);
+	CHECK_EQUAL(mockAllocationCount(), allocations);
+	CHECK_EQUAL(mockLiveObjectCount(), objects);
+}
+
+static void testSlowHIDPPDeviceDoesNotDelayReports(void)
+{
+	uint64_t objects = mockLiveObjectCount();
+	std::atomic<uint32_t> requestCount { 0 };
+	std::atomic<uint32_t> eventCount { 0 };
+
+	// The device takes half a second to accept each request, and never answers, like a receiver whose mouse is asleep.
+	IOHIDInterface* interface = createMockInterface(true);
+	interface->mockSetOutputReportHandler([&](const uint8_t* report, uint32_t reportLength)
+	{
+		++requestCount;
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		return kIOReturnSuccess;
+	});
+
+	MockMouse mouse = {};
+	CHECK_EQUAL(startMockMouse(interface, {}, &mouse), kIOReturnSuccess);
+	mouse.driver->mockSetEventHandler([&](const MockHIDEvent& event)
+	{
+		++eventCount;
+	});
+
+	for (uint32_t attempt = 0; (attempt < 20000) && (requestCount.load() == 0); ++attempt)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	CHECK_EQUAL(requestCount.load(), 1);
+
+	// The report arrives while the first discovery request is still being sent.
+	uint8_t report[kMockMouseReportLength];
+	buildMockMouseReport(0, 8, 8, 0, report);
+	auto reportTime = std::chrono::steady_clock::now();
+	interface->mockDeliverReport(mach_absolute_time(), report, kMockMouseReportLength);
+	while ((eventCount.load() == 0) && ((std::chrono::steady_clock::now() - reportTime) < std::chrono::seconds(2)))
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - reportTime).count();
+	printf("  report handled after %lld ms\n", (long long)latency);
+	CHECK(eventCount.load() > 0);
+	CHECK(latency < 100);
+
+	CHECK(stopMockMouse(&mouse));
+	interface->release();
+	CHECK(waitForLiveObjectCount(objects));
+}
+
+/// The feature indices of the mock HID++ device.
+constexpr uint8_t kMockHIDPPWheelIndex = 2;
+constexpr uint8_t kMockHIDPPControlsIndex = 3;
+/// The number of divertable controls of the mock HID++ device, whose IDs start at 0x00C3, so the second one is SmartShift.
+constexpr uint8_t kMockHIDPPControlCount = 8;
+constexpr uint16_t kMockHIDPPFirstControlID = 0x00C3;
+
+/// A directly connected HID++ 2.0 mouse with a high resolution wheel and divertable controls, and no sensor settings.
+struct MockHIDPPDevice
+{
+	std::atomic<bool> wheelDiverted;
+	std::atomic<int32_t> divertedControlCount;
+	std::atomic<uint32_t> restoreRequestCount;
+};
+
+/// Answers a HID++ request like the mock device, by delivering the response as an input report.
+static kern_return_t answerHIDPPRequest(IOHIDInterface* interface, MockHIDPPDevice* device, const uint8_t* request, uint32_t requestLength)
+{
+	uint8_t response[kHIDPPLongReportLength] = { request[0], request[1], request[2], request[3] };
+	uint8_t* parameters = response + 4;
+	uint8_t function = request[3] >> 4;
+
+	if (request[2] == kHIDPPRootFeatureIndex)
+	{
+		uint16_t feature = readHIDPPUInt16(request + 4);
+		parameters[0] = (feature == kHIDPPFeatureHiResWheel) ? kMockHIDPPWheelIndex : ((feature == kHIDPPFeatureReprogControls) ? kMockHIDPPControlsIndex : 0);
+	}
+	else if ((request[2] == kMockHIDPPWheelIndex) && (function == kHIDPPHiResWheelGetCapability))
+	{
+		parameters[0] = 8;
+	}
+	else if ((request[2] == kMockHIDPPWheelIndex) && (function == kHIDPPHiResWheelSetMode))
+	{
+		device->wheelDiverted.store((request[4] & kHIDPPHiResWheelModeDivert) != 0);
+		device->restoreRequestCount += ((request[4] & kHIDPPHiResWheelModeDivert) == 0);
+		parameters[0] = request[4];
+	}
+	else if ((request[2] == kMockHIDPPControlsIndex) && (function == kHIDPPReprogControlsGetCount))
+	{
+		parameters[0] = kMockHIDPPControlCount;
+	}
+	else if ((request[2] == kMockHIDPPControlsIndex) && (function == kHIDPPReprogControlsGetInfo))
+	{
+		parameters[1] = uint8_t(kMockHIDPPFirstControlID + request[4]);
+		parameters[4] = kHIDPPControlFlagDivertable;
+	}
+	else if ((request[2] == kMockHIDPPControlsIndex) && (function == kHIDPPReprogControlsSetReporting))
+	{
+		bool divert = ((request[6] & kHIDPPReportingDivert) != 0);
+		device->divertedControlCount += divert ? 1 : -1;
+		device->restoreRequestCount += (divert == false);
+		memcpy(parameters, request + 4, 3);
+	}
+
+	interface->mockDeliverReport(mach_absolute_time(), response, kHIDPPLongReportLength);
+	return kIOReturnSuccess;
+}
+
+/// Starts a driver on the mock HID++ device, and waits until it has diverted the controls it was asked to and published the device settings.
+/// - Parameters:
+///   - divertedControls: The `HIDPPDivertedControls` of the driver, every control of the mock device by default
+/// - Returns: True if discovery finished within a second
+static bool startMockHIDPPMouse(IOHIDInterface* interface, MockHIDPPDevice* device, MockMouse* mouse,
+	std::vector<uint32_t> divertedControls = { 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7, 0x00C8, 0x00C9, 0x00CA })
+{
+	interface->mockSetOutputReportHandler([=](const uint8_t* request, uint32_t requestLength)
+	{
+		return answerHIDPPRequest(interface, device, request, requestLength);
+	});
+	if (startMockMouse(interface, { { "HIDPPDivertedControls", 0, divertedControls } }, mouse) != kIOReturnSuccess)
+	{
+		return false;
+	}
+
+	for (uint32_t attempt = 0; attempt < 20000; ++attempt)
+	{
+		OSDictionary* properties = nullptr;
+		mouse->driver->CopyProperties(&properties);
+		bool published = (properties->getObject("HIDPPDevices") != nullptr);
+		properties->release();
+		if (published == true)
+		{
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	return false;
+}
+
+static void testStopHandsHIDPPControlsBack(void)
+{
+	uint64_t objects = mockLiveObjectCount();
+	MockHIDPPDevice device = {};
+	IOHIDInterface* interface = createMockInterface(true);
+	MockMouse mouse = {};
+
+	CHECK(startMockHIDPPMouse(interface, &device, &mouse));
+	CHECK(device.wheelDiverted.load());
+	CHECK_EQUAL(device.divertedControlCount.load(), kMockHIDPPControlCount);
+
+	CHECK(stopMockMouse(&mouse));
+	CHECK_EQUAL(device.wheelDiverted.load(), false);
+	CHECK_EQUAL(device.divertedControlCount.load(), 0);
+	CHECK_EQUAL(device.restoreRequestCount.load(), kMockHIDPPControlCount + 1);
+
+	interface->release();
+	CHECK(waitForLiveObjectCount(objects));
+}
+
+static void testHIDPPControlsAreOnlyDivertedWhenListed(void)
+{
+	MockHIDPPDevice device = {};
+	IOHIDInterface* interface = createMockInterface(true);
+	MockMouse mouse = {};
+
+	// Without a list, only the wheel is diverted, and every control keeps what it does on the device.
+	CHECK(startMockHIDPPMouse(interface, &device, &mouse, {}));
+	CHECK(device.wheelDiverted.load());
+	CHECK_EQUAL(device.divertedControlCount.load(), 0);
+	CHECK(stopMockMouse(&mouse));
+	CHECK_EQUAL(device.restoreRequestCount.load(), 1);
+
+	// SmartShift is left alone when it is not listed, as is a standard button, and a control the device does not have changes nothing.
+	device.restoreRequestCount.store(0);
+	CHECK(startMockHIDPPMouse(interface, &device, &mouse, { 0x00C3, 0x0050, 0x00C6, 0x1234 }));
+	CHECK_EQUAL(device.divertedControlCount.load(), 2);
+	CHECK(stopMockMouse(&mouse));
+	CHECK_EQUAL(device.divertedControlCount.load(), 0);
+	CHECK_EQUAL(device.restoreRequestCount.load(), 3);
+
+	interface->release();
+}
+
+static void testStopDoesNotWaitForUnpluggedHIDPPDevice(void)
+{
+	uint64_t objects = mockLiveObjectCount();
+	MockHIDPPDevice device = {};
+	IOHIDInterface* interface = createMockInterface(true);
+	MockMouse mouse = {};
+	CHECK(startMockHIDPPMouse(interface, &device, &mouse));
+
+	// Once the mouse is unplugged, each request takes the full completion timeout to fail.
+	std::atomic<uint32_t> failedRequestCount { 0 };
+	interface->mockSetOutputReportHandler([&](const uint8_t* request, uint32_t requestLength)
+	{
+		++failedRequestCount;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		return kIOReturnOffline;
+	});
+
+	auto stopTime = std::chrono::steady_clock::now();
+	CHECK(stopMockMouse(&mouse));
+	auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - stopTime).count();
+	printf("  stopped after %lld ms and %u failed requests\n", (long long)duration, failedRequestCount.load());
+	CHECK_EQUAL(failedRequestCount.load(), 1);
+	CHECK(duration < 200);
+
+	interface->release();
+	CHECK(waitForLiveObjectCount(objects));
+}
+
+/// Waits until a counter of the mock HID++ device reaches a value, since the device is configured on the report queue.
+static bool waitForHIDPPCount(const std::atomic<int32_t>& count, int32_t value)
+{
+	for (uint32_t attempt = 0; attempt < 20000; ++attempt)
+	{
+		if (count.load() == value)
+		{
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	return false;
+}
+
+static void testHIDPPReportsOfOthersPassThrough(void)
+{
+	MockHIDPPDevice device = {};
+	IOHIDInterface* interface = createMockInterface(true);
+	MockMouse mouse = {};
+	CHECK(startMockHIDPPMouse(interface, &device, &mouse));
+	CHECK_EQUAL(device.divertedControlCount.load(), kMockHIDPPControlCount);
+
+	// A response to the app of the vendor, which uses another software ID, an error response to it,
+	// and the notification that a paired device disconnected are all handed to the superclass.
+	uint8_t response[kHIDPPLongReportLength] = { kPairedDeviceReportHIDPPLong, kHIDPPDeviceIndexDirect, kHIDPPRootFeatureIndex, 0x01, kMockHIDPPWheelIndex };
+	uint8_t error[kHIDPPLongReportLength] = { kPairedDeviceReportHIDPPLong, kHIDPPDeviceIndexDirect, kHIDPPErrorFeatureIndex, kHIDPPRootFeatureIndex, 0x01, 0x05 };
+	uint8_t disconnected[kHIDPPShortReportLength] = { kPairedDeviceReportHIDPPShort, 0x01, kHIDPP10DeviceConnectionSubID, 0x04, kHIDPP10ConnectionLinkNotEstablished };
+	// A late response to the driver itself is not.
+	uint8_t ownResponse[kHIDPPLongReportLength] = { kPairedDeviceReportHIDPPLong, kHIDPPDeviceIndexDirect, kHIDPPRootFeatureIndex, kHIDPPSoftwareID, kMockHIDPPWheelIndex };
+
+	uint64_t passThroughCount = mouse.driver->mockPassThroughCount();
+	interface->mockDeliverReport(mach_absolute_time(), response, kHIDPPLongReportLength);
+	interface->mockDeliverReport(mach_absolute_time(), error, kHIDPPLongReportLength);
+	interface->mockDeliverReport(mach_absolute_time(), disconnected, kHIDPPShortReportLength);
+	interface->mockDeliverReport(mach_absolute_time(), ownResponse, kHIDPPLongReportLength);
+
+	// Copying waits for the report queue, which has handled every report by then.
+	DeliberateMouseIntervalStatistics statistics = {};
+	CHECK_EQUAL(mouse.driver->copyIntervalStatistics(0, &statistics, false), kIOReturnSuccess);
+	CHECK_EQUAL(mouse.driver->mockPassThroughCount() - passThroughCount, 3);
+
+	CHECK(stopMockMouse(&mouse));
+	interface->release();
+}
+
+static void testReconnectedHIDPPDeviceIsDiscoveredAgain(void)
+{
+	MockHIDPPDevice device = {};
+	IOHIDInterface* interface = createMockInterface(true);
+	MockMouse mouse = {};
+	CHECK(startMockHIDPPMouse(interface, &device, &mouse));
+	CHECK_EQUAL(device.divertedControlCount.load(), kMockHIDPPControlCount);
+
+	// The mock device answers at every device index, so the device that connects behind the receiver diverts its controls too.
+	uint64_t passThroughCount = mouse.driver->mockPassThroughCount();
+	uint8_t connected[kHIDPPShortReportLength] = { kPairedDeviceReportHIDPPShort, 0x02, kHIDPP10DeviceConnectionSubID, 0x04, 0x00 };
+	interface->mockDeliverReport(mach_absolute_time(), connected, kHIDPPShortReportLength);
+	CHECK(waitForHIDPPCount(device.divertedControlCount, 2 * kMockHIDPPControlCount));
+	CHECK_EQUAL(mouse.driver->mockPassThroughCount(), passThroughCount);
+
+	// Both devices get everything back.
+	CHECK(stopMockMouse(&mouse));
+	CHECK_EQUAL(device.divertedControlCount.load(), 0);
+	CHECK_EQUAL(device.restoreRequestCount.load(), 2 * (kMockHIDPPControlCount + 1));
+
+	interface->release();
+}
+
+static void testIntervalStatisticsArePerPairedDevice(void)
+{
+	MockHIDPPDevice device = {};
+	IOHIDInterface* interface = createMockInterface(true);
+	MockMouse mouse = {};
+	CHECK(startMockHIDPPMouse(interface, &device, &mouse));
+
+	for (uint32_t reportIndex = 0; reportIndex < 5; ++reportIndex)
+	{
+		uint8_t report[kMockMouseReportLength];
+		buildMockMouseReport(0, 4, 4, 0, report);
+		interface->mockDeliverReport(mach_absolute_time(), report, kMockMouseReportLength);
+	}
+
+	// Wheel notifications of the diverted wheel are dispatched, but are not polled reports.
+	for (uint32_t notificationIndex = 0; notificationIndex < 3; ++notificationIndex)
+	{
+		uint8_t notification[kHIDPPLongReportLength] = { kPairedDeviceReportHIDPPLong, kHIDPPDeviceIndexDirect, kMockHIDPPWheelIndex, 0, 0, 0, 8 };
+		interface->mockDeliverReport(mach_absolute_time(), notification, kHIDPPLongReportLength);
+	}
+
+	// Copying waits for the report queue, which has handled every report by then.
+	DeliberateMouseIntervalStatistics statistics = {};
+	DeliberateMouseIncidentReport incidents = {};
+	CHECK_EQUAL(mouse.driver->copyIntervalStatistics(0, &statistics, false), kIOReturnSuccess);
+	CHECK_EQUAL(statistics.reportCount, 5);
+	CHECK_EQUAL(mouse.driver->copyIntervalStatistics(1, &statistics, true), kIOReturnSuccess);
+	CHECK_EQUAL(statistics.reportCount, 0);
+	CHECK_EQUAL(mouse.driver->copyIntervalStatistics(kDeliberateMousePairedDeviceSlotCount, &statistics, false), kIOReturnBadArgument);
+	CHECK_EQUAL(mouse.driver->copyIncidents(kDeliberateMousePairedDeviceSlotCount - 1, &incidents, false), kIOReturnSuccess);
+	CHECK_EQUAL(mouse.driver->copyIncidents(kDeliberateMousePairedDeviceSlotCount, &incidents, false), kIOReturnBadArgument);
+
+	CHECK(stopMockMouse(&mouse));
+	interface->release();
+}
+
+static void testWheelAndPanScaleWithoutOverflow(void)
+{
+	IOHIDInterface* interface = createMockInterface(false);
+	MockMouse mouse = {};
+	CHECK_EQUAL(startMockMouse(interface, {}, &mouse), kIOReturnSuccess);
+
+	OSDictionary* properties = OSDictionary::withCapacity(1);
+	OSNumber* mergeAge = OSNumber::withNumber(10, 32);
+	properties->setObject("BacklogMergeMilliseconds", mergeAge);
+	mockCallOnDefaultQueue(mouse.driver, [&]()
+	{
+		CHECK_EQUAL(mouse.driver->SetProperties(properties), kIOReturnSuccess);
+	});
+	mergeAge->release();
+	properties->release();
+
+	std::mutex scrollMutex;
+	std::vector<MockHIDEvent> scrolls;
+	mouse.driver->mockSetEventHandler([&](const MockHIDEvent& event)
+	{
+		if ((event.scroll == true) && ((event.dx != 0) || (event.dy != 0)))
+		{
+			std::lock_guard<std::mutex> lock(scrollMutex);
+			scrolls.push_back(event);
+		}
+	});
+
+	// A backlog of full wheel reports is merged into one report with more counts than fit in 16.16.
+	uint8_t report[kMockMouseReportLength];
+	uint64_t stale = mach_absolute_time() - 1000000000ULL;
+	for (uint32_t reportIndex = 0; reportIndex < 300; ++reportIndex)
+	{
+		buildMockMouseReport(0, 0, 0, 127, report);
+		interface->mockDeliverReport(stale + reportIndex, report, kMockMouseReportLength);
+	}
+
+	// The fresh report dispatches the merged one first. Turning the wheel towards the user, and panning left, are negative counts.
+	buildMockMouseReport(0, 0, 0, -1, report);
+	report[8] = uint8_t(int8_t(-2));
+	interface->mockDeliverReport(mach_absolute_time(), report, kMockMouseReportLength);
+
+	// Copying waits for the report queue, which has handled every report by then.
+	DeliberateMouseIntervalStatistics statistics = {};
+	CHECK_EQUAL(mouse.driver->copyIntervalStatistics(0, &statistics, false), kIOReturnSuccess);
+
+	{
+		std::lock_guard<std::mutex> lock(scrollMutex);
+		CHECK_EQUAL(scrolls.size(), 2);
+		if (scrolls.size() == 2)
+		{
+			CHECK_EQUAL(scrolls[0].dx, INT32_MIN);
+			CHECK_EQUAL(scrolls[0].dy, 0);
+			CHECK_EQUAL(scrolls[1].dx, 3 << 16);
+			CHECK_EQUAL(scrolls[1].dy, -(6 << 16));
+		}
+	}
+
+	CHECK(stopMockMouse(&mouse));
+	interface->release();
+}
+
+/// Sets a number property of the driver the way a client does, from the default queue.
+static void setDriverNumberProperty(MockMouse& mouse, const char* key, uint32_t value)
+{
+	OSDictionary* properties = OSDictionary::withCapacity(1);
+	OSNumber* number = OSNumber::withNumber(value, 32);
+	properties->setObject(key, number);
+	mockCallOnDefaultQueue(mouse.driver, [&]()
+	{
+		CHECK_EQUAL(mouse.driver->SetProperties(properties), kIOReturnSuccess);
+	});
+	number->release();
+	properties->release();
+}
+
+static void testSmoothingChangesKeepHeldMotion(void)
+{
+	IOHIDInterface* interface = createMockInterface(false);
+	MockMouse mouse = {};
+	CHECK_EQUAL(startMockMouse(interface, {}, &mouse), kIOReturnSuccess);
+
+	// A time constant this long keeps the drain timer from releasing the lag while the test runs.
+	setDriverNumberProperty(mouse, "MotionSmoothingMicroseconds", 1000000);
+
+	std::atomic<int64_t> pointerX { 0 };
+	mouse.driver->mockSetEventHandler([&](const MockHIDEvent& event)
+	{
+		if (event.scroll == false)
+		{
+			pointerX += event.dx;
+		}
+	});
+
+	// The first report after a long pause passes through, and the filter holds almost all of the second one.
+	uint8_t report[kMockMouseReportLength];
+	uint64_t timestamp = mach_absolute_time();
+	buildMockMouseReport(0, 50, 0, 0, report);
+	interface->mockDeliverReport(timestamp, report, kMockMouseReportLength);
+	interface->mockDeliverReport(timestamp + 1000000, report, kMockMouseReportLength);
+
+	// Copying waits for the report queue, which has handled every report by then.
+	DeliberateMouseIntervalStatistics statistics = {};
+	CHECK_EQUAL(mouse.driver->copyIntervalStatistics(0, &statistics, false), kIOReturnSuccess);
+	CHECK(pointerX.load() < (75 << 16));
+
+	// A new time constant keeps the held motion, and disabling smoothing dispatches all of it at once.
+	setDriverNumberProperty(mouse, "MotionSmoothingMicroseconds", 500000);
+	setDriverNumberProperty(mouse, "MotionSmoothingMicroseconds", 0);
+	CHECK_EQUAL(mouse.driver->copyIntervalStatistics(0, &statistics, false), kIOReturnSuccess);
+	CHECK_EQUAL(pointerX.load(), 2 * 50 * (1 << 15));
+
+	CHECK(stopMockMouse(&mouse));
+	interface->release();
+}
+
+static void testReportRateAboveHIDPPLimitIsRejected(void)
+{
+	IOHIDInterface* interface = createMockInterface(true);
+	MockMouse mouse = {};
+	CHECK_EQUAL(startMockMouse(interface, {}, &mouse), kIOReturnSuccess);
+
+	for (uint32_t rate : { 1000U, 1001U, 8000U })
+	{
+		OSDictionary* properties = OSDictionary::withCapacity(1);
+		OSNumber* value = OSNumber::withNumber(rate, 32);
+		properties->setObject("ReportRateHz", value);
+
+		kern_return_t ret = kIOReturnSuccess;
+		mockCallOnDefaultQueue(mouse.driver, [&]()
+		{
+			ret = mouse.driver->SetProperties(properties);
+		});
+		CHECK_EQUAL(ret, (rate <= 1000) ? kIOReturnSuccess : kIOReturnBadArgument);
+
+		value->release();
+		properties->release();
+	}
+
+	CHECK(stopMockMouse(&mouse));
+	interface->release();
+}
+
+static void testScrollButtonKeepsPointerStill(void)
+{
+	IOHIDInterface* interface = createMockInterface(false);
+	MockMouse mouse = {};
+	CHECK_EQUAL(startMockMouse(interface, {}, &mouse), kIOReturnSuccess);
+
+	// The first button scrolls a quarter of a unit per unit of pointer motion, since the elements of the mock mouse only cover the first button.
+	setDriverNumberProperty(mouse, "ScrollEmulationButton", 1);
+	setDriverNumberProperty(mouse, "ScrollEmulationPercent", 25);
+
+	std::mutex eventMutex;
+	std::vector<MockHIDEvent> pointers;
+	std::vector<MockHIDEvent> scrolls;
+	mouse.driver->mockSetEventHandler([&](const MockHIDEvent& event)
+	{
+		std::lock_guard<std::mutex> lock(eventMutex);
+		if (event.scroll == false)
+		{
+			pointers.push_back(event);
+		}
+		else if ((event.dx != 0) || (event.dy != 0))
+		{
+			scrolls.push_back(event);
+		}
+	});
+
+	// Press, scroll down 10 and then 6 units of pointer motion, which are twice as many counts, with a little sideways drift, and release.
+	// Then tap without leaving the slop, and move once the button is up.
+	static const int16_t kReports[][3] =
+	{
+		{ 1, 0, 0 },
+		{ 1, 0, 20 },
+		{ 1, 6, 12 },
+		{ 0, 0, 0 },
+		{ 1, 0, 0 },
+		{ 1, 1, 1 },
+		{ 0, 0, 0 },
+		{ 0, 10, 0 },
+	};
+	uint64_t timestamp = mach_absolute_time();
+	for (const int16_t* values : kReports)
+	{
+		uint8_t report[kMockMouseReportLength];
+		buildMockMouseReport(uint16_t(values[0]), values[1], values[2], 0, report);
+		timestamp += 1000000;
+		interface->mockDeliverReport(timestamp, report, kMockMouseReportLength);
+	}
+
+	// Copying waits for the report queue, which has handled every report by then.
+	DeliberateMouseIntervalStatistics statistics = {};
+	CHECK_EQUAL(mouse.driver->copyIntervalStatistics(0, &statistics, false), kIOReturnSuccess);
+
+	{
+		std::lock_guard<std::mutex> lock(eventMutex);
+
+		// The pointer never moves while the button is held, and the OS only sees the button as the click of the tap, after the report that released it.
+		static const MockHIDEvent kPointers[] =
+		{
+			{ false, 0, 0, 0, 0 }, { false, 0, 0, 0, 0 }, { false, 0, 0, 0, 0 }, { false, 0, 0, 0, 0 },
+			{ false, 0, 0, 0, 0 }, { false, 0, 0, 0, 0 }, { false, 0, 0, 0, 0 }, { false, 0, 0, 0, 1 }, { false, 0, 0, 0, 0 },
+			{ false, 0, 5 << 16, 0, 0 },
+		};
+		CHECK_EQUAL(pointers.size(), sizeof(kPointers) / sizeof(kPointers[0]));
+		for (uint32_t index = 0; (index < pointers.size()) && (index < sizeof(kPointers) / sizeof(kPointers[0])); ++index)
+		{
+			if ((pointers[index].dx != kPointers[index].dx) || (pointers[index].dy != kPointers[index].dy) ||
+				(pointers[index].buttonState != kPointers[index].buttonState))
+			{
+				CHECK(false);
+				printf("  pointer event %u: %d, %d, buttons 0x%x\n", index, pointers[index].dx, pointers[index].dy, pointers[index].buttonState);
+			}
+		}
+
+		// 2.5 units, then 1.5 plus the half unit left over, locked to the vertical axis the scroll started on.
+		CHECK_EQUAL(scrolls.size(), 2);
+		if (scrolls.size() == 2)
+		{
+			CHECK_EQUAL(scrolls[0].dx, 2 << 16);
+			CHECK_EQUAL(scrolls[0].dy, 0);
+			CHECK_EQUAL(scrolls[1].dx, 2 << 16);
+			CHECK_EQUAL(scrolls[1].dy, 0);
+		}
+	}
+
+	mouse.driver->mockSetEventHandler(nullptr);
+	CHECK(stopMockMouse(&mouse));
+	interface->release();
+}
+
+int main(void)
+{
+	RUN_TEST(testMemoryFootprintMatchesAllocations);
+	RUN_TEST(testStartStopCyclesDoNotGrow);
+	RUN_TEST(testSlowHIDPPDeviceDoesNotDelayReports);
+	RUN_TEST(testStopHandsHIDPPControlsBack);
+	RUN_TEST(testHIDPPControlsAreOnlyDivertedWhenListed);
+	RUN_TEST(testStopDoesNotWaitForUnpluggedHIDPPDevice);
+	RUN_TEST(testHIDPPReportsOfOthersPassThrough);
+	RUN_TEST(testReconnectedHIDPPDeviceIsDiscoveredAgain);
+	RUN_TEST(testReportRateAboveHIDPPLimitIsRejected);
+	RUN_TEST(testIntervalStatisticsArePerPairedDevice);
+	RUN_TEST(testWheelAndPanScaleWithoutOverflow);
+	RUN_TEST(testSmoothingChangesKeepHeldMotion);
+	RUN_TEST(testScrollButtonKeepsPointerStill);
+
+	return finishTests();
+}
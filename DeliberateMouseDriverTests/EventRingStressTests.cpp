@@ -0,0 +1,134 @@
+//
+//  EventRingStressTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Runs the producer of the event ring on one thread through hundreds of wraps of the ring while a reader polls it on another,
+// the way a client polls the mapped ring while the driver writes it. Built with the thread sanitizer where the compiler has it.
+// Checks that every event the reader gets is intact and in order, that the gaps it sees are exactly the events reported as dropped,
+// and measures how many events per second go through the ring.
+//
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "TestSupport.h"
+#include "DeliberateMouseShared.h"
+
+/// The number of times the producer wraps around the ring.
+constexpr uint32_t kStressWrapCount = 256;
+/// The number of events the reader copies at a time, like the polling loop of a client.
+constexpr uint32_t kStressReadBatch = 256;
+/// Every this many reads, the reader waits until it has been lapped, so dropped events are always exercised.
+constexpr uint32_t kStressLapInterval = 64;
+
+/// Returns the event the producer writes as event number `index`. Every field depends on the index, so a torn read is noticed.
+static DeliberateMouseEvent makeStressEvent(uint64_t index)
+{
+	int32_t value = int32_t(uint32_t(index));
+	return { 0, index * 3, value, ~value, value ^ 0x5A5A5A5A, uint32_t(value) * 2654435761U, -value, value + 1, value - 1, ~(value + 1) };
+}
+
+static bool eventsEqual(const DeliberateMouseEvent& a, const DeliberateMouseEvent& b)
+{
+	return (a.timestamp == b.timestamp) && (a.dX == b.dX) && (a.dY == b.dY) && (a.wheel == b.wheel) && (a.buttons == b.buttons) &&
+		(a.rawX == b.rawX) && (a.rawY == b.rawY) && (a.rawWheel == b.rawWheel) && (a.rawPan == b.rawPan);
+}
+
+/// What the reader saw.
+struct StressReader
+{
+	/// The number of events copied out of the ring
+	uint64_t readEvents;
+	/// The number of events the ring reported as dropped
+	uint64_t droppedEvents;
+	/// The number of events missing between consecutive events the reader got, and before the first one
+	uint64_t gapEvents;
+	/// The number of events that were not the event the producer wrote with that sequence
+	uint64_t tornEvents;
+	/// The number of events whose sequence was not after the previous one
+	uint64_t outOfOrderEvents;
+};
+
+static void testConcurrentReaderSeesIntactEventsInOrder(void)
+{
+	std::unique_ptr<DeliberateMouseEventRing> ring(new DeliberateMouseEventRing());
+	DeliberateMouseEventRingInitialize(ring.get());
+
+	const uint64_t eventCount = uint64_t(kStressWrapCount) * kDeliberateMouseEventRingCapacity;
+	std::atomic<bool> writing { true };
+	StressReader reader = {};
+
+	std::thread readerThread([&]()
+	{
+		std::unique_ptr<DeliberateMouseEvent[]> events(new DeliberateMouseEvent[kStressReadBatch]);
+		uint64_t readCount = 0;
+		uint64_t lastSequence = 0;
+
+		for (uint32_t poll = 0; ; ++poll)
+		{
+			// Once the producer is done, one more read takes whatever is left.
+			bool finished = (writing.load(std::memory_order_acquire) == false);
+
+			// Fall a full ring behind once in a while, like a client that was descheduled.
+			while (((poll % kStressLapInterval) == 0) && (writing.load(std::memory_order_acquire) == true) &&
+				((__atomic_load_n(&ring->writeCount, __ATOMIC_ACQUIRE) - readCount) <= kDeliberateMouseEventRingCapacity))
+			{
+				std::this_thread::yield();
+			}
+
+			uint32_t count = DeliberateMouseEventRingRead(ring.get(), &readCount, events.get(), kStressReadBatch, &reader.droppedEvents);
+			for (uint32_t index = 0; index < count; ++index)
+			{
+				const DeliberateMouseEvent& event = events[index];
+				reader.outOfOrderEvents += (event.sequence <= lastSequence);
+				reader.gapEvents += (event.sequence > lastSequence) ? (event.sequence - lastSequence - 1) : 0;
+				reader.tornEvents += (eventsEqual(event, makeStressEvent(event.sequence - 1)) == false);
+				lastSequence = event.sequence;
+			}
+			reader.readEvents += count;
+
+			if (finished && (count == 0))
+			{
+				break;
+			}
+		}
+
+		// Events dropped after the last one the reader got are not a gap between two events, but they are still missing.
+		reader.gapEvents += readCount - lastSequence;
+	});
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t index = 0; index < eventCount; ++index)
+	{
+		DeliberateMouseEvent event = makeStressEvent(index);
+		DeliberateMouseEventRingWrite(ring.get(), &event);
+	}
+	auto writeEnd = std::chrono::steady_clock::now();
+	writing.store(false, std::memory_order_release);
+	readerThread.join();
+
+	double seconds = std::chrono::duration<double>(writeEnd - start).count();
+	printf("  %llu events through %u wraps in %.3f s: %.1f million events/s written, %.1f million events/s read, %llu dropped\n",
+		(unsigned long long)eventCount, kStressWrapCount, seconds, (eventCount / seconds) / 1e6, (reader.readEvents / seconds) / 1e6,
+		(unsigned long long)reader.droppedEvents);
+
+	// Every event was either read intact, in order, or reported as dropped, and the reader ends up at the producer.
+	CHECK_EQUAL(reader.tornEvents, 0);
+	CHECK_EQUAL(reader.outOfOrderEvents, 0);
+	CHECK_EQUAL(reader.gapEvents, reader.droppedEvents);
+	CHECK_EQUAL(reader.readEvents + reader.droppedEvents, eventCount);
+	CHECK(reader.droppedEvents > 0);
+	CHECK(reader.readEvents >= kDeliberateMouseEventRingCapacity);
+}
+
+int main(void)
+{
+	RUN_TEST(testConcurrentReaderSeesIntactEventsInOrder);
+
+	return finishTests();
+}
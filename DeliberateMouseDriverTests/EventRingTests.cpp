@@ -0,0 +1,86 @@
+//
+//  EventRingTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Checks that events, including their raw report values, come out of the event ring as they went in,
+// and that a reader that falls behind is told how many events it missed.
+//
+
+#include <memory>
+
+#include "TestSupport.h"
+#include "DeliberateMouseShared.h"
+
+static DeliberateMouseEvent makeEvent(uint32_t index)
+{
+	int32_t value = int32_t(index);
+	return { 0, 1000 + index, value << 16, -(value << 16), value, index & 0x1F, value, -value, value * 120, -value * 120 };
+}
+
+static bool eventsEqual(const DeliberateMouseEvent& a, const DeliberateMouseEvent& b)
+{
+	return (a.timestamp == b.timestamp) && (a.dX == b.dX) && (a.dY == b.dY) && (a.wheel == b.wheel) && (a.buttons == b.buttons) &&
+		(a.rawX == b.rawX) && (a.rawY == b.rawY) && (a.rawWheel == b.rawWheel) && (a.rawPan == b.rawPan);
+}
+
+static void testEventsRoundTrip(void)
+{
+	std::unique_ptr<DeliberateMouseEventRing> ring(new DeliberateMouseEventRing());
+	DeliberateMouseEventRingInitialize(ring.get());
+	CHECK_EQUAL(ring->version, kDeliberateMouseEventRingVersion);
+
+	for (uint32_t index = 0; index < 100; ++index)
+	{
+		DeliberateMouseEvent event = makeEvent(index);
+		DeliberateMouseEventRingWrite(ring.get(), &event);
+	}
+
+	DeliberateMouseEvent events[64];
+	uint64_t readCount = 0;
+	uint64_t dropped = 0;
+	uint32_t total = 0;
+	uint32_t count = 0;
+	while ((count = DeliberateMouseEventRingRead(ring.get(), &readCount, events, 64, &dropped)) != 0)
+	{
+		for (uint32_t index = 0; index < count; ++index)
+		{
+			CHECK(eventsEqual(events[index], makeEvent(total + index)));
+			CHECK_EQUAL(events[index].sequence, total + index + 1);
+		}
+		total += count;
+	}
+
+	CHECK_EQUAL(total, 100);
+	CHECK_EQUAL(dropped, 0);
+}
+
+static void testLappedReaderCountsDroppedEvents(void)
+{
+	std::unique_ptr<DeliberateMouseEventRing> ring(new DeliberateMouseEventRing());
+	DeliberateMouseEventRingInitialize(ring.get());
+
+	uint32_t written = kDeliberateMouseEventRingCapacity + 500;
+	for (uint32_t index = 0; index < written; ++index)
+	{
+		DeliberateMouseEvent event = makeEvent(index);
+		DeliberateMouseEventRingWrite(ring.get(), &event);
+	}
+
+	DeliberateMouseEvent event = {};
+	uint64_t readCount = 0;
+	uint64_t dropped = 0;
+	CHECK_EQUAL(DeliberateMouseEventRingRead(ring.get(), &readCount, &event, 1, &dropped), 1);
+	CHECK_EQUAL(dropped, 500);
+	CHECK(eventsEqual(event, makeEvent(500)));
+}
+
+int main(void)
+{
+	RUN_TEST(testEventsRoundTrip);
+	RUN_TEST(testLappedReaderCountsDroppedEvents);
+
+	return finishTests();
+}
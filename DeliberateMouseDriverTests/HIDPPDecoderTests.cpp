@@ -0,0 +1,436 @@
+//
+//  HIDPPDecoderTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Replays recorded HID++ exchanges through feature discovery, byte for byte: the request the driver sends, the response of the device,
+// and the step discovery moves on to. Covers a directly connected mouse, a receiver with paired, unpaired, and reconnecting devices,
+// and the HID++ 1.0 and 2.0 error responses in between. Then decodes wheel and diverted button notifications into mouse reports,
+// and checks every field of each report.
+//
+
+#include <cstring>
+#include <initializer_list>
+
+#include "TestSupport.h"
+#include "HIDPPDecoder.h"
+
+/// One request of discovery, and the response of the device to it.
+struct HIDPPExchange
+{
+	/// The report ID, device index, feature index, function and software ID, and first three parameters of the request.
+	/// The rest of the request is always zero.
+	uint8_t request[7];
+	/// The response, as the device sent it
+	uint8_t response[kHIDPPLongReportLength];
+	uint32_t responseLength;
+	/// The step discovery is at after the response
+	HIDPPDiscoveryStep step;
+};
+
+/// A HID++ 1.0 error from a receiver, about a request to a device index that has no connected device.
+#define RECEIVER_ERROR(deviceIndex, featureIndex, functionAndSoftwareID) \
+	{ kPairedDeviceReportHIDPPShort, (deviceIndex), kHIDPP10ErrorSubID, (featureIndex), (functionAndSoftwareID), 0x09 }, kHIDPPShortReportLength
+/// A HID++ 2.0 error from a device, which does not support the function.
+#define DEVICE_ERROR(deviceIndex, featureIndex, functionAndSoftwareID) \
+	{ kPairedDeviceReportHIDPPLong, (deviceIndex), kHIDPPErrorFeatureIndex, (featureIndex), (functionAndSoftwareID), 0x07 }, kHIDPPLongReportLength
+
+/// Replays exchanges through discovery, and checks each request and the step after each response.
+/// - Parameters:
+///   - discovery: The progress of feature discovery
+///   - devices: The HID++ features of every paired device slot
+///   - exchanges: The exchanges, in the order the device answered them
+///   - exchangeCount: The number of exchanges
+static void replayHIDPPDiscovery(HIDPPDiscovery& discovery, HIDPPDeviceState (&devices)[kMousePairedDeviceSlotCount],
+	const HIDPPExchange* exchanges, uint32_t exchangeCount)
+{
+	for (uint32_t index = 0; index < exchangeCount; ++index)
+	{
+		const HIDPPExchange& exchange = exchanges[index];
+		uint8_t request[kHIDPPLongReportLength];
+		memset(request, 0xEE, sizeof(request));
+
+		if (nextHIDPPDiscoveryRequest(discovery, devices, request) == false)
+		{
+			CHECK(false);
+			printf("  exchange %u: discovery finished early\n", index);
+			return;
+		}
+
+		static const uint8_t kZeros[kHIDPPLongReportLength] = {};
+		if ((memcmp(request, exchange.request, sizeof(exchange.request)) != 0) ||
+			(memcmp(request + sizeof(exchange.request), kZeros, kHIDPPLongReportLength - sizeof(exchange.request)) != 0))
+		{
+			CHECK(false);
+			printf("  exchange %u: request %02x %02x %02x %02x %02x %02x %02x\n", index,
+				request[0], request[1], request[2], request[3], request[4], request[5], request[6]);
+		}
+		CHECK(discovery.requestPending);
+
+		HIDPPMessage message = {};
+		CHECK(parseHIDPPReport(exchange.response, exchange.responseLength, &message));
+		CHECK(handleHIDPPDiscoveryResponse(discovery, devices, message));
+		CHECK_EQUAL(discovery.requestPending, false);
+		if (discovery.step != exchange.step)
+		{
+			CHECK_EQUAL(discovery.step, exchange.step);
+			printf("  exchange %u\n", index);
+		}
+	}
+}
+
+/// Checks that discovery has nothing left to send.
+static void checkHIDPPDiscoveryFinished(HIDPPDiscovery& discovery, HIDPPDeviceState (&devices)[kMousePairedDeviceSlotCount])
+{
+	uint8_t request[kHIDPPLongReportLength] = {};
+	CHECK_EQUAL(nextHIDPPDiscoveryRequest(discovery, devices, request), false);
+	CHECK_EQUAL(discovery.step, kHIDPPStepFinished);
+	CHECK_EQUAL(discovery.requestPending, false);
+}
+
+/// Checks every field of a decoded mouse report.
+static void checkMouseReport(const MouseReport& report, int32_t wheel, uint32_t wheelResolution, uint32_t buttons, uint32_t buttonMask)
+{
+	CHECK_EQUAL(report.x, 0);
+	CHECK_EQUAL(report.y, 0);
+	CHECK_EQUAL(report.wheel, wheel);
+	CHECK_EQUAL(report.pan, 0);
+	CHECK_EQUAL(report.wheelResolution, wheelResolution);
+	CHECK_EQUAL(report.buttons, buttons);
+	CHECK_EQUAL(report.buttonMask, buttonMask);
+	CHECK_EQUAL(report.device, 0);
+}
+
+/// Asks discovery to divert a list of controls.
+static void setDivertControls(HIDPPDiscovery& discovery, std::initializer_list<uint16_t> controls)
+{
+	discovery.divertControlCount = 0;
+	for (uint16_t control : controls)
+	{
+		discovery.divertControls[discovery.divertControlCount++] = control;
+	}
+}
+
+static void testDirectDeviceDiscovery(void)
+{
+	HIDPPDiscovery discovery = {};
+	HIDPPDeviceState devices[kMousePairedDeviceSlotCount] = {};
+	// The left button is listed, but is a standard control, and 0x00D0 is listed, but cannot be diverted.
+	setDivertControls(discovery, { 0x0050, 0x00C3, 0x00D0, 0x00D7, 0x00FD });
+
+	// A mouse with the high resolution wheel at index 5, 8 counts per detent, and six controls behind the reprogrammable controls at index 6.
+	static const HIDPPExchange kExchanges[] =
+	{
+		{ { 0x11, 0xFF, 0x00, 0x0A, 0x21, 0x21, 0x00 }, { 0x11, 0xFF, 0x00, 0x0A, 0x05, 0x00, 0x01 }, kHIDPPLongReportLength, kHIDPPStepWheelCapability },
+		{ { 0x11, 0xFF, 0x05, 0x0A, 0x00, 0x00, 0x00 }, { 0x11, 0xFF, 0x05, 0x0A, 0x08, 0x0C }, kHIDPPLongReportLength, kHIDPPStepWheelMode },
+		{ { 0x11, 0xFF, 0x05, 0x2A, 0x03, 0x00, 0x00 }, { 0x11, 0xFF, 0x05, 0x2A, 0x03 }, kHIDPPLongReportLength, kHIDPPStepFindControls },
+		{ { 0x11, 0xFF, 0x00, 0x0A, 0x1B, 0x04, 0x00 }, { 0x11, 0xFF, 0x00, 0x0A, 0x06, 0x00, 0x04 }, kHIDPPLongReportLength, kHIDPPStepControlCount },
+		{ { 0x11, 0xFF, 0x06, 0x0A, 0x00, 0x00, 0x00 }, { 0x11, 0xFF, 0x06, 0x0A, 0x06 }, kHIDPPLongReportLength, kHIDPPStepControlInfo },
+		// Control 0 is the left button.
+		{ { 0x11, 0xFF, 0x06, 0x1A, 0x00, 0x00, 0x00 }, { 0x11, 0xFF, 0x06, 0x1A, 0x00, 0x50, 0x00, 0x38, 0x21 }, kHIDPPLongReportLength, kHIDPPStepControlInfo },
+		// Control 1 is listed and divertable, and is diverted.
+		{ { 0x11, 0xFF, 0x06, 0x1A, 0x01, 0x00, 0x00 }, { 0x11, 0xFF, 0x06, 0x1A, 0x00, 0xC3, 0x00, 0x38, 0x30 }, kHIDPPLongReportLength, kHIDPPStepDivertControl },
+		{ { 0x11, 0xFF, 0x06, 0x3A, 0x00, 0xC3, 0x03 }, { 0x11, 0xFF, 0x06, 0x3A, 0x00, 0xC3, 0x03 }, kHIDPPLongReportLength, kHIDPPStepControlInfo },
+		// Control 2 is SmartShift, which is divertable, but not listed.
+		{ { 0x11, 0xFF, 0x06, 0x1A, 0x02, 0x00, 0x00 }, { 0x11, 0xFF, 0x06, 0x1A, 0x00, 0xC4, 0x00, 0x9D, 0x20 }, kHIDPPLongReportLength, kHIDPPStepControlInfo },
+		{ { 0x11, 0xFF, 0x06, 0x1A, 0x03, 0x00, 0x00 }, { 0x11, 0xFF, 0x06, 0x1A, 0x00, 0xD0, 0x00, 0xA9, 0x00 }, kHIDPPLongReportLength, kHIDPPStepControlInfo },
+		// Control 4 refuses to be diverted, so it is not reported as a button.
+		{ { 0x11, 0xFF, 0x06, 0x1A, 0x04, 0x00, 0x00 }, { 0x11, 0xFF, 0x06, 0x1A, 0x00, 0xD7, 0x00, 0xB4, 0x20 }, kHIDPPLongReportLength, kHIDPPStepDivertControl },
+		{ { 0x11, 0xFF, 0x06, 0x3A, 0x00, 0xD7, 0x03 }, DEVICE_ERROR(0xFF, 0x06, 0x3A), kHIDPPStepControlInfo },
+		{ { 0x11, 0xFF, 0x06, 0x1A, 0x05, 0x00, 0x00 }, { 0x11, 0xFF, 0x06, 0x1A, 0x00, 0xFD, 0x00, 0xC4, 0x20 }, kHIDPPLongReportLength, kHIDPPStepDivertControl },
+		{ { 0x11, 0xFF, 0x06, 0x3A, 0x00, 0xFD, 0x03 }, { 0x11, 0xFF, 0x06, 0x3A, 0x00, 0xFD, 0x03 }, kHIDPPLongReportLength, kHIDPPStepControlInfo },
+	};
+	replayHIDPPDiscovery(discovery, devices, kExchanges, sizeof(kExchanges) / sizeof(kExchanges[0]));
+
+	// A directly connected device has no receiver, so no other device index is asked.
+	checkHIDPPDiscoveryFinished(discovery, devices);
+	CHECK(discovery.directDevice);
+
+	const HIDPPDeviceState& device = devices[0];
+	CHECK(device.present);
+	CHECK_EQUAL(device.hiResWheelIndex, 0x05);
+	CHECK_EQUAL(device.wheelMultiplier, 8);
+	CHECK_EQUAL(device.reprogControlsIndex, 0x06);
+	CHECK_EQUAL(device.divertedControlCount, 2);
+	CHECK_EQUAL(device.divertedControls[0], 0x00C3);
+	CHECK_EQUAL(device.divertedControls[1], 0x00FD);
+	for (uint32_t slot = 1; slot < kMousePairedDeviceSlotCount; ++slot)
+	{
+		CHECK_EQUAL(devices[slot].present, false);
+	}
+}
+
+static void testControlsAreNotListedWithoutDivertedControls(void)
+{
+	HIDPPDiscovery discovery = {};
+	HIDPPDeviceState devices[kMousePairedDeviceSlotCount] = {};
+
+	// Once the wheel is diverted, discovery finishes without asking for the reprogrammable controls.
+	static const HIDPPExchange kExchanges[] =
+	{
+		{ { 0x11, 0xFF, 0x00, 0x0A, 0x21, 0x21, 0x00 }, { 0x11, 0xFF, 0x00, 0x0A, 0x05 }, kHIDPPLongReportLength, kHIDPPStepWheelCapability },
+		{ { 0x11, 0xFF, 0x05, 0x0A, 0x00, 0x00, 0x00 }, { 0x11, 0xFF, 0x05, 0x0A, 0x00 }, kHIDPPLongReportLength, kHIDPPStepWheelMode },
+		{ { 0x11, 0xFF, 0x05, 0x2A, 0x03, 0x00, 0x00 }, { 0x11, 0xFF, 0x05, 0x2A, 0x03 }, kHIDPPLongReportLength, kHIDPPStepFindControls },
+	};
+	replayHIDPPDiscovery(discovery, devices, kExchanges, sizeof(kExchanges) / sizeof(kExchanges[0]));
+	checkHIDPPDiscoveryFinished(discovery, devices);
+
+	// A wheel without a multiplier counts every count as a detent.
+	CHECK_EQUAL(devices[0].hiResWheelIndex, 0x05);
+	CHECK_EQUAL(devices[0].wheelMultiplier, 1);
+	CHECK_EQUAL(devices[0].reprogControlsIndex, 0);
+	CHECK_EQUAL(devices[0].divertedControlCount, 0);
+}
+
+static void testReceiverDiscovery(void)
+{
+	HIDPPDiscovery discovery = {};
+	HIDPPDeviceState devices[kMousePairedDeviceSlotCount] = {};
+	setDivertControls(discovery, { 0x00C3 });
+
+	// A receiver answers for itself with a HID++ 1.0 error, and for device indices without a connected device too.
+	// Device 2 has a wheel whose capability cannot be read, and device 3 a wheel that cannot be diverted, and no controls.
+	static const HIDPPExchange kExchanges[] =
+	{
+		{ { 0x11, 0xFF, 0x00, 0x0A, 0x21, 0x21, 0x00 }, RECEIVER_ERROR(0xFF, 0x00, 0x0A), kHIDPPStepNextDevice },
+		{ { 0x11, 0x01, 0x00, 0x0A, 0x21, 0x21, 0x00 }, RECEIVER_ERROR(0x01, 0x00, 0x0A), kHIDPPStepNextDevice },
+		{ { 0x11, 0x02, 0x00, 0x0A, 0x21, 0x21, 0x00 }, { 0x11, 0x02, 0x00, 0x0A, 0x04 }, kHIDPPLongReportLength, kHIDPPStepWheelCapability },
+		{ { 0x11, 0x02, 0x04, 0x0A, 0x00, 0x00, 0x00 }, DEVICE_ERROR(0x02, 0x04, 0x0A), kHIDPPStepFindControls },
+		{ { 0x11, 0x02, 0x00, 0x0A, 0x1B, 0x04, 0x00 }, { 0x11, 0x02, 0x00, 0x0A, 0x05 }, kHIDPPLongReportLength, kHIDPPStepControlCount },
+		{ { 0x11, 0x02, 0x05, 0x0A, 0x00, 0x00, 0x00 }, { 0x11, 0x02, 0x05, 0x0A, 0x01 }, kHIDPPLongReportLength, kHIDPPStepControlInfo },
+		{ { 0x11, 0x02, 0x05, 0x1A, 0x00, 0x00, 0x00 }, { 0x11, 0x02, 0x05, 0x1A, 0x00, 0xC3, 0x00, 0x38, 0x20 }, kHIDPPLongReportLength, kHIDPPStepDivertControl },
+		{ { 0x11, 0x02, 0x05, 0x3A, 0x00, 0xC3, 0x03 }, { 0x11, 0x02, 0x05, 0x3A, 0x00, 0xC3, 0x03 }, kHIDPPLongReportLength, kHIDPPStepControlInfo },
+		{ { 0x11, 0x03, 0x00, 0x0A, 0x21, 0x21, 0x00 }, { 0x11, 0x03, 0x00, 0x0A, 0x04 }, kHIDPPLongReportLength, kHIDPPStepWheelCapability },
+		{ { 0x11, 0x03, 0x04, 0x0A, 0x00, 0x00, 0x00 }, { 0x11, 0x03, 0x04, 0x0A, 0x0F }, kHIDPPLongReportLength, kHIDPPStepWheelMode },
+		{ { 0x11, 0x03, 0x04, 0x2A, 0x03, 0x00, 0x00 }, DEVICE_ERROR(0x03, 0x04, 0x2A), kHIDPPStepFindControls },
+		{ { 0x11, 0x03, 0x00, 0x0A, 0x1B, 0x04, 0x00 }, { 0x11, 0x03, 0x00, 0x0A, 0x00 }, kHIDPPLongReportLength, kHIDPPStepNextDevice },
+		{ { 0x11, 0x04, 0x00, 0x0A, 0x21, 0x21, 0x00 }, RECEIVER_ERROR(0x04, 0x00, 0x0A), kHIDPPStepNextDevice },
+		{ { 0x11, 0x05, 0x00, 0x0A, 0x21, 0x21, 0x00 }, RECEIVER_ERROR(0x05, 0x00, 0x0A), kHIDPPStepNextDevice },
+		{ { 0x11, 0x06, 0x00, 0x0A, 0x21, 0x21, 0x00 }, RECEIVER_ERROR(0x06, 0x00, 0x0A), kHIDPPStepNextDevice },
+		{ { 0x11, 0x07, 0x00, 0x0A, 0x21, 0x21, 0x00 }, RECEIVER_ERROR(0x07, 0x00, 0x0A), kHIDPPStepNextDevice },
+	};
+	replayHIDPPDiscovery(discovery, devices, kExchanges, sizeof(kExchanges) / sizeof(kExchanges[0]));
+	checkHIDPPDiscoveryFinished(discovery, devices);
+	CHECK_EQUAL(discovery.directDevice, false);
+	CHECK(discovery.slotsDiscovered);
+
+	CHECK_EQUAL(devices[0].present, false);
+	CHECK_EQUAL(devices[1].present, false);
+	CHECK(devices[2].present);
+	CHECK_EQUAL(devices[2].hiResWheelIndex, 0);
+	CHECK_EQUAL(devices[2].reprogControlsIndex, 0x05);
+	CHECK_EQUAL(devices[2].divertedControlCount, 1);
+	CHECK_EQUAL(devices[2].divertedControls[0], 0x00C3);
+	CHECK(devices[3].present);
+	CHECK_EQUAL(devices[3].hiResWheelIndex, 0);
+	CHECK_EQUAL(devices[3].wheelMultiplier, 15);
+	CHECK_EQUAL(devices[3].reprogControlsIndex, 0);
+	CHECK_EQUAL(devices[3].divertedControlCount, 0);
+
+	// Device 2 disconnects, which changes nothing, then connects again, and is discovered from scratch.
+	uint32_t slot = 0;
+	HIDPPMessage message = {};
+	static const uint8_t kDisconnected[kHIDPPShortReportLength] = { 0x10, 0x02, kHIDPP10DeviceConnectionSubID, 0x04, 0x40 };
+	static const uint8_t kConnected[kHIDPPShortReportLength] = { 0x10, 0x02, kHIDPP10DeviceConnectionSubID, 0x04, 0x00 };
+	CHECK(parseHIDPPReport(kDisconnected, kHIDPPShortReportLength, &message));
+	CHECK_EQUAL(decodeHIDPPDeviceConnection(message, &slot), false);
+	CHECK(parseHIDPPReport(kConnected, kHIDPPShortReportLength, &message));
+	CHECK(decodeHIDPPDeviceConnection(message, &slot));
+	CHECK_EQUAL(slot, 2);
+	CHECK(rediscoverHIDPPDevice(discovery, slot));
+
+	static const HIDPPExchange kRediscovery[] =
+	{
+		{ { 0x11, 0x02, 0x00, 0x0A, 0x21, 0x21, 0x00 }, { 0x11, 0x02, 0x00, 0x0A, 0x00 }, kHIDPPLongReportLength, kHIDPPStepFindControls },
+		{ { 0x11, 0x02, 0x00, 0x0A, 0x1B, 0x04, 0x00 }, { 0x11, 0x02, 0x00, 0x0A, 0x05 }, kHIDPPLongReportLength, kHIDPPStepControlCount },
+		{ { 0x11, 0x02, 0x05, 0x0A, 0x00, 0x00, 0x00 }, { 0x11, 0x02, 0x05, 0x0A, 0x01 }, kHIDPPLongReportLength, kHIDPPStepControlInfo },
+		{ { 0x11, 0x02, 0x05, 0x1A, 0x00, 0x00, 0x00 }, { 0x11, 0x02, 0x05, 0x1A, 0x00, 0xC3, 0x00, 0x38, 0x20 }, kHIDPPLongReportLength, kHIDPPStepDivertControl },
+		{ { 0x11, 0x02, 0x05, 0x3A, 0x00, 0xC3, 0x03 }, { 0x11, 0x02, 0x05, 0x3A, 0x00, 0xC3, 0x03 }, kHIDPPLongReportLength, kHIDPPStepControlInfo },
+	};
+	replayHIDPPDiscovery(discovery, devices, kRediscovery, sizeof(kRediscovery) / sizeof(kRediscovery[0]));
+	checkHIDPPDiscoveryFinished(discovery, devices);
+
+	// The control is diverted once, not appended to what the device diverted before, and the other devices are untouched.
+	CHECK_EQUAL(devices[2].divertedControlCount, 1);
+	CHECK_EQUAL(devices[3].wheelMultiplier, 15);
+
+	// Devices that reconnect while discovery runs are discovered once it is done with the current device, in order of their slot.
+	CHECK(rediscoverHIDPPDevice(discovery, 3));
+	CHECK_EQUAL(rediscoverHIDPPDevice(discovery, 2), false);
+	CHECK_EQUAL(discovery.reconnectedSlots, (1 << 2) | (1 << 3));
+	uint8_t request[kHIDPPLongReportLength] = {};
+	CHECK(nextHIDPPDiscoveryRequest(discovery, devices, request));
+	CHECK_EQUAL(request[1], 0x02);
+	CHECK_EQUAL(discovery.reconnectedSlots, 1 << 3);
+	CHECK_EQUAL(devices[2].present, false);
+}
+
+static void testUnrelatedReportsDoNotAnswerDiscovery(void)
+{
+	HIDPPDiscovery discovery = {};
+	HIDPPDeviceState devices[kMousePairedDeviceSlotCount] = {};
+	uint8_t request[kHIDPPLongReportLength] = {};
+	CHECK(nextHIDPPDiscoveryRequest(discovery, devices, request));
+
+	// A notification, a response to another app, a response from another device, an error about another request,
+	// and a report too short to carry a response, all while the first request is pending.
+	static const uint8_t kReports[][kHIDPPLongReportLength] =
+	{
+		{ 0x11, 0xFF, 0x00, 0x00, 0x05 },
+		{ 0x11, 0xFF, 0x00, 0x01, 0x05 },
+		{ 0x11, 0x01, 0x00, 0x0A, 0x05 },
+		{ 0x11, 0xFF, kHIDPPErrorFeatureIndex, 0x00, 0x1A, 0x02 },
+		{ 0x10, 0xFF, kHIDPP10ErrorSubID, 0x00, 0x01, 0x09 },
+	};
+	for (const uint8_t* report : kReports)
+	{
+		HIDPPMessage message = {};
+		CHECK(parseHIDPPReport(report, kHIDPPLongReportLength, &message));
+		CHECK_EQUAL(handleHIDPPDiscoveryResponse(discovery, devices, message), false);
+		CHECK(discovery.requestPending);
+		CHECK_EQUAL(discovery.step, kHIDPPStepFindWheel);
+	}
+
+	// Responses carry the software ID of the request, in the header of the failed request for errors, and notifications 0.
+	static const uint8_t kResponse[kHIDPPLongReportLength] = { 0x11, 0xFF, 0x00, 0x0A, 0x05 };
+	static const uint8_t kError[kHIDPPLongReportLength] = { 0x11, 0xFF, kHIDPPErrorFeatureIndex, 0x00, 0x0A, 0x05 };
+	static const uint8_t kReceiverError[kHIDPPShortReportLength] = { 0x10, 0xFF, kHIDPP10ErrorSubID, 0x00, 0x01, 0x09 };
+	HIDPPMessage message = {};
+	CHECK(parseHIDPPReport(kResponse, kHIDPPLongReportLength, &message));
+	CHECK_EQUAL(hidppSoftwareID(message), kHIDPPSoftwareID);
+	CHECK(parseHIDPPReport(kError, kHIDPPLongReportLength, &message));
+	CHECK_EQUAL(hidppSoftwareID(message), kHIDPPSoftwareID);
+	CHECK(parseHIDPPReport(kReceiverError, kHIDPPShortReportLength, &message));
+	CHECK_EQUAL(hidppSoftwareID(message), 0x01);
+
+	// Short reports are shorter than long ones, and neither is accepted truncated.
+	CHECK_EQUAL(parseHIDPPReport(kResponse, kHIDPPLongReportLength - 1, &message), false);
+	CHECK_EQUAL(parseHIDPPReport(kReceiverError, kHIDPPShortReportLength - 1, &message), false);
+	CHECK(parseHIDPPReport(kReceiverError, kHIDPPShortReportLength, &message));
+	CHECK_EQUAL(message.parameterLength, 3);
+}
+
+/// The device of `testDirectDeviceDiscovery` once it is discovered.
+static const HIDPPDeviceState kDiscoveredDevice = { true, 0x05, 8, 0x06, 2, { 0x00C3, 0x00FD } };
+
+static void testWheelNotifications(void)
+{
+	struct WheelNotification
+	{
+		uint8_t report[kHIDPPLongReportLength];
+		int32_t wheel;
+		uint32_t wheelResolution;
+	};
+
+	// Up is positive, and the resolution follows the flag of each notification, since the wheel can switch to low resolution by itself.
+	static const WheelNotification kNotifications[] =
+	{
+		{ { 0x11, 0xFF, 0x05, 0x00, 0x10, 0x00, 0x10 }, 16, 8 },
+		{ { 0x11, 0xFF, 0x05, 0x00, 0x10, 0xFF, 0xF8 }, -8, 8 },
+		{ { 0x11, 0xFF, 0x05, 0x00, 0x10, 0x80, 0x00 }, -32768, 8 },
+		{ { 0x11, 0xFF, 0x05, 0x00, 0x00, 0x00, 0x01 }, 1, 1 },
+		{ { 0x11, 0xFF, 0x05, 0x00, 0x00, 0xFF, 0xFF }, -1, 1 },
+	};
+	for (const WheelNotification& notification : kNotifications)
+	{
+		HIDPPMessage message = {};
+		MouseReport report = {};
+		CHECK(parseHIDPPReport(notification.report, kHIDPPLongReportLength, &message));
+		CHECK(decodeHIDPPWheel(kDiscoveredDevice, message, &report));
+		checkMouseReport(report, notification.wheel, notification.wheelResolution, 0, 0);
+	}
+
+	// A response to the driver on the wheel feature, another event of the wheel, and a notification of another feature are not wheel motion.
+	static const uint8_t kOthers[][kHIDPPLongReportLength] =
+	{
+		{ 0x11, 0xFF, 0x05, 0x2A, 0x03 },
+		{ 0x11, 0xFF, 0x05, 0x10, 0x01 },
+		{ 0x11, 0xFF, 0x06, 0x00, 0x10, 0x00, 0x10 },
+	};
+	for (const uint8_t* other : kOthers)
+	{
+		HIDPPMessage message = {};
+		MouseReport report = {};
+		CHECK(parseHIDPPReport(other, kHIDPPLongReportLength, &message));
+		CHECK_EQUAL(decodeHIDPPWheel(kDiscoveredDevice, message, &report), false);
+		checkMouseReport(report, 0, 0, 0, 0);
+	}
+
+	// A device whose wheel was not diverted has no wheel notifications, even on index 0.
+	HIDPPDeviceState undiverted = kDiscoveredDevice;
+	undiverted.hiResWheelIndex = 0;
+	static const uint8_t kRootNotification[kHIDPPLongReportLength] = { 0x11, 0xFF, 0x00, 0x00, 0x10, 0x00, 0x10 };
+	HIDPPMessage message = {};
+	MouseReport report = {};
+	CHECK(parseHIDPPReport(kRootNotification, kHIDPPLongReportLength, &message));
+	CHECK_EQUAL(decodeHIDPPWheel(undiverted, message, &report), false);
+}
+
+static void testDivertedButtonNotifications(void)
+{
+	struct ButtonNotification
+	{
+		uint8_t report[kHIDPPLongReportLength];
+		uint32_t buttons;
+	};
+
+	// 0x00C3 is button 17 and 0x00FD button 18, in the order they were diverted.
+	// Every notification covers both buttons, so a button that is no longer listed is released.
+	static const ButtonNotification kNotifications[] =
+	{
+		{ { 0x11, 0xFF, 0x06, 0x00, 0x00, 0xFD }, 1U << 17 },
+		{ { 0x11, 0xFF, 0x06, 0x00, 0x00, 0xFD, 0x00, 0xC3 }, (1U << 16) | (1U << 17) },
+		{ { 0x11, 0xFF, 0x06, 0x00, 0x00, 0xC3 }, 1U << 16 },
+		// A control that was not diverted, such as SmartShift, is not a button.
+		{ { 0x11, 0xFF, 0x06, 0x00, 0x00, 0xC4, 0x00, 0xC3 }, 1U << 16 },
+		{ { 0x11, 0xFF, 0x06, 0x00 }, 0 },
+		// Only four controls are listed, so anything after them is not.
+		{ { 0x11, 0xFF, 0x06, 0x00, 0x00, 0xC4, 0x00, 0xC4, 0x00, 0xC4, 0x00, 0xC4, 0x00, 0xFD }, 0 },
+	};
+	for (const ButtonNotification& notification : kNotifications)
+	{
+		HIDPPMessage message = {};
+		MouseReport report = {};
+		CHECK(parseHIDPPReport(notification.report, kHIDPPLongReportLength, &message));
+		CHECK(decodeHIDPPDivertedButtons(kDiscoveredDevice, message, &report));
+		checkMouseReport(report, 0, 0, notification.buttons, (1U << 16) | (1U << 17));
+	}
+
+	// Every diverted control fits in the buttons above the standard ones, up to button 32.
+	HIDPPDeviceState full = kDiscoveredDevice;
+	full.divertedControlCount = kHIDPPMaxDivertedControls;
+	for (uint32_t controlIndex = 0; controlIndex < kHIDPPMaxDivertedControls; ++controlIndex)
+	{
+		full.divertedControls[controlIndex] = uint16_t(0x0100 + controlIndex);
+	}
+	static const uint8_t kLastControl[kHIDPPLongReportLength] = { 0x11, 0xFF, 0x06, 0x00, 0x01, 0x0F };
+	HIDPPMessage message = {};
+	MouseReport report = {};
+	CHECK(parseHIDPPReport(kLastControl, kHIDPPLongReportLength, &message));
+	CHECK(decodeHIDPPDivertedButtons(full, message, &report));
+	checkMouseReport(report, 0, 0, 1U << 31, 0xFFFF0000);
+
+	// A response on the controls feature is not a notification, and a device without the feature has none.
+	static const uint8_t kResponse[kHIDPPLongReportLength] = { 0x11, 0xFF, 0x06, 0x3A, 0x00, 0xC3, 0x03 };
+	report = {};
+	CHECK(parseHIDPPReport(kResponse, kHIDPPLongReportLength, &message));
+	CHECK_EQUAL(decodeHIDPPDivertedButtons(kDiscoveredDevice, message, &report), false);
+	HIDPPDeviceState noControls = {};
+	CHECK(parseHIDPPReport(kNotifications[0].report, kHIDPPLongReportLength, &message));
+	CHECK_EQUAL(decodeHIDPPDivertedButtons(noControls, message, &report), false);
+	checkMouseReport(report, 0, 0, 0, 0);
+}
+
+int main(void)
+{
+	RUN_TEST(testDirectDeviceDiscovery);
+	RUN_TEST(testControlsAreNotListedWithoutDivertedControls);
+	RUN_TEST(testReceiverDiscovery);
+	RUN_TEST(testUnrelatedReportsDoNotAnswerDiscovery);
+	RUN_TEST(testWheelNotifications);
+	RUN_TEST(testDivertedButtonNotifications);
+
+	return finishTests();
+}
@@ -0,0 +1,125 @@
+//
+//  HandleReportBenchmark.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Measures the time `handleReport` takes for a mouse report, from the raw bytes to the dispatched pointer event.
+// The benchmark is built twice: against the driver, and against the driver built with `DELIBERATE_MOUSE_REPORT_ROUTES` set to 0,
+// which decodes every input report as a mouse report without looking up its route, so the two runs show what the lookup costs.
+// With the lookup, it also measures a report that is handed to the superclass.
+//
+
+#include <vector>
+
+#include "TestSupport.h"
+#include "MockDriverSupport.h"
+#include "DeliberateMouseShared.h"
+
+// The driver looks up routes unless the library it is built in says otherwise.
+#ifndef DELIBERATE_MOUSE_REPORT_ROUTES
+#define DELIBERATE_MOUSE_REPORT_ROUTES 1
+#endif
+
+/// The number of distinct reports handled in a loop.
+constexpr uint32_t kBenchmarkReportCount = 4096;
+/// How long each measurement runs.
+constexpr uint64_t kBenchmarkNanoseconds = 500000000;
+/// A report ID the mock mouse has no elements in, like the consumer keys of a combo interface.
+constexpr uint8_t kPassThroughReportID = 5;
+
+/// Measures `handleReport` over a buffer of reports, called directly on the thread of the benchmark.
+/// Nothing else runs on the report queue meanwhile, since smoothing, backlog merging, and HID++ are off.
+/// - Parameters:
+///   - driver: The started driver, which has verified the layout of its mouse reports
+///   - reports: The reports, `kMockMouseReportLength` bytes each
+///   - calls: The variable that stores the number of calls
+/// - Returns: The average duration of one call, in nanoseconds
+static double measureHandleReport(DeliberateMouseDriver* driver, std::vector<uint8_t>& reports, uint64_t* calls)
+{
+	uint64_t timestamp = mach_absolute_time();
+	uint64_t iterations = 0;
+	double nanoseconds = measureNanoseconds(kBenchmarkNanoseconds, [&](uint64_t iteration)
+	{
+		uint8_t* report = &reports[(iteration % kBenchmarkReportCount) * kMockMouseReportLength];
+		timestamp += 1000000;
+		driver->handleReport(timestamp, report, kMockMouseReportLength, kIOHIDReportTypeInput, report[0]);
+		++iterations;
+	});
+
+	*calls = iterations;
+	return nanoseconds;
+}
+
+static void benchmarkHandleReport(void)
+{
+	IOHIDInterface* interface = createMockInterface(false);
+	MockMouse mouse = {};
+	CHECK_EQUAL(startMockMouse(interface, {}, &mouse), kIOReturnSuccess);
+
+	uint64_t pointerEvents = 0;
+	mouse.driver->mockSetEventHandler([&](const MockHIDEvent& event)
+	{
+		pointerEvents += ((event.scroll == false) && ((event.dx != 0) || (event.dy != 0)));
+	});
+
+	// Every field changes during the warm up, so the layout is verified and later reports never read the elements.
+	TestRandom random = { 0x9E3779B97F4A7C15ULL };
+	uint8_t report[kMockMouseReportLength];
+	for (uint32_t reportIndex = 0; reportIndex < 256; ++reportIndex)
+	{
+		buildMockMouseReport(uint16_t(random.next()), int16_t(random.next()), int16_t(random.next()), int8_t(random.next()), report);
+		report[8] = uint8_t(random.next());
+		interface->mockDeliverReport(mach_absolute_time(), report, kMockMouseReportLength);
+	}
+	buildMockMouseReport(0, 0, 0, 0, report);
+	interface->mockDeliverReport(mach_absolute_time(), report, kMockMouseReportLength);
+
+	// Copying waits for the report queue, which has handled every report by then.
+	DeliberateMouseIntervalStatistics statistics = {};
+	CHECK_EQUAL(mouse.driver->copyIntervalStatistics(0, &statistics, false), kIOReturnSuccess);
+
+	// Motion only, so every report dispatches exactly one pointer event.
+	std::vector<uint8_t> reports(kBenchmarkReportCount * kMockMouseReportLength);
+	for (uint32_t reportIndex = 0; reportIndex < kBenchmarkReportCount; ++reportIndex)
+	{
+		int16_t x = int16_t(random.below(200) + 1);
+		int16_t y = int16_t(-int32_t(random.below(200)) - 1);
+		buildMockMouseReport(0, x, y, 0, &reports[reportIndex * kMockMouseReportLength]);
+	}
+
+	pointerEvents = 0;
+	uint64_t calls = 0;
+	double mouseNanoseconds = measureHandleReport(mouse.driver, reports, &calls);
+	CHECK_EQUAL(pointerEvents, calls);
+
+#if DELIBERATE_MOUSE_REPORT_ROUTES
+	printf("  mouse report, with the route lookup:       %6.1f ns\n", mouseNanoseconds);
+
+	for (uint32_t reportIndex = 0; reportIndex < kBenchmarkReportCount; ++reportIndex)
+	{
+		reports[reportIndex * kMockMouseReportLength] = kPassThroughReportID;
+	}
+
+	uint64_t passThroughBefore = mouse.driver->mockPassThroughCount();
+	pointerEvents = 0;
+	double passThroughNanoseconds = measureHandleReport(mouse.driver, reports, &calls);
+	printf("  report handed to the superclass:           %6.1f ns\n", passThroughNanoseconds);
+	CHECK_EQUAL(mouse.driver->mockPassThroughCount() - passThroughBefore, calls);
+	CHECK_EQUAL(pointerEvents, 0);
+#else
+	printf("  mouse report, without the route lookup:    %6.1f ns\n", mouseNanoseconds);
+#endif
+
+	mouse.driver->mockSetEventHandler(nullptr);
+	CHECK(stopMockMouse(&mouse));
+	interface->release();
+}
+
+int main(void)
+{
+	RUN_TEST(benchmarkHandleReport);
+
+	return finishTests();
+}
@@ -0,0 +1,234 @@
+//
+//  HotplugStressTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Plugs and unplugs a mouse thousands of times while reports keep arriving and a client keeps reconfiguring the driver
+// and calling its user client, so `Stop` races with every queue that can reach the report queue. Built with the thread
+// sanitizer where the compiler has it. Measures how long `Start` and `Stop` take, and checks that the cycles leak nothing.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "TestSupport.h"
+#include "MockDriverSupport.h"
+#include "DeliberateMouseShared.h"
+
+/// The number of times the mouse is plugged in and unplugged.
+constexpr uint32_t kHotplugCycleCount = 2000;
+
+/// The work the other queues do while a driver instance starts and stops.
+struct HotplugLoad
+{
+	std::atomic<bool> running;
+	std::atomic<uint64_t> reportCount;
+	std::atomic<uint64_t> clientCallCount;
+};
+
+/// The percentiles of a set of durations.
+struct DurationPercentiles
+{
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t max;
+};
+
+/// Sorts durations and returns their percentiles.
+static DurationPercentiles durationPercentiles(std::vector<uint64_t>& durations)
+{
+	DurationPercentiles result = {};
+	std::sort(durations.begin(), durations.end());
+	if (durations.empty() == false)
+	{
+		result.p50 = durations[durations.size() / 2];
+		result.p99 = durations[(durations.size() * 99) / 100];
+		result.max = durations.back();
+	}
+	return result;
+}
+
+/// Calls a method of a user client on its default queue, like a client process would with `IOConnectCallMethod`.
+/// - Parameters:
+///   - client: The user client
+///   - selector: One of the `kDeliberateMouseMethod` values
+///   - reset: Whether the counters of slot 0 the method copies start over
+/// - Returns: The result of the method
+static kern_return_t callUserClientMethod(IOUserClient* client, uint64_t selector, bool reset)
+{
+	uint64_t scalarInput[2] = { 0, reset ? 1ULL : 0ULL };
+	uint64_t scalarOutput[2] = {};
+	IOUserClientMethodArguments arguments = {};
+	arguments.selector = selector;
+	arguments.scalarOutput = scalarOutput;
+
+	switch (selector)
+	{
+		case kDeliberateMouseMethodCopyTrace:
+		{
+			arguments.scalarOutputCount = 2;
+			arguments.structureOutputMaximumSize = 64 * sizeof(DeliberateMouseTraceRecord);
+		} break;
+
+		case kDeliberateMouseMethodCopyIntervalStatistics:
+		{
+			arguments.scalarInput = scalarInput;
+			arguments.scalarInputCount = 2;
+			arguments.structureOutputMaximumSize = sizeof(DeliberateMouseIntervalStatistics);
+		} break;
+
+		default:
+		{
+			arguments.scalarInput = scalarInput;
+			arguments.scalarInputCount = 2;
+			arguments.structureOutputMaximumSize = sizeof(DeliberateMouseIncidentReport);
+		} break;
+	}
+
+	kern_return_t ret = kIOReturnSuccess;
+	mockCallOnDefaultQueue(client, [&]()
+	{
+		ret = client->ExternalMethod(selector, &arguments, nullptr, nullptr, nullptr);
+	});
+	OSSafeReleaseNULL(arguments.structureOutput);
+	return ret;
+}
+
+/// Reconfigures the driver with a property its report path reads.
+static void sendConfiguration(DeliberateMouseDriver* driver, uint32_t iteration)
+{
+	OSDictionary* properties = OSDictionary::withCapacity(1);
+	OSNumber* rotation = OSNumber::withNumber(((iteration & 1) != 0) ? 180 : 0, 32);
+	properties->setObject("MotionRotationDegrees", rotation);
+
+	mockCallOnDefaultQueue(driver, [=]()
+	{
+		driver->SetProperties(properties);
+	});
+
+	rotation->release();
+	properties->release();
+}
+
+/// Opens a user client, then calls its methods and reconfigures the driver until the load stops, and closes the user client.
+static void runClient(DeliberateMouseDriver* driver, HotplugLoad* load)
+{
+	IOUserClient* client = nullptr;
+	mockCallOnDefaultQueue(driver, [&]()
+	{
+		driver->NewUserClient(0, &client);
+	});
+
+	for (uint32_t iteration = 0; load->running.load() == true; ++iteration)
+	{
+		if (client != nullptr)
+		{
+			callUserClientMethod(client, iteration % kDeliberateMouseMethodCount, (iteration & 4) != 0);
+		}
+		if ((iteration % 4) == 0)
+		{
+			sendConfiguration(driver, iteration);
+		}
+		++load->clientCallCount;
+		std::this_thread::yield();
+	}
+
+	if (client != nullptr)
+	{
+		mockCallOnDefaultQueue(client, [=]()
+		{
+			client->Stop(driver);
+		});
+		client->release();
+	}
+}
+
+/// Delivers reports until the load stops, including after the driver closed the interface.
+static void runReporter(IOHIDInterface* interface, HotplugLoad* load)
+{
+	for (int16_t motion = 1; load->running.load() == true; motion = -motion)
+	{
+		uint8_t report[kMockMouseReportLength];
+		buildMockMouseReport(0, motion, motion, 0, report);
+		interface->mockDeliverReport(mach_absolute_time(), report, kMockMouseReportLength);
+		++load->reportCount;
+		std::this_thread::yield();
+	}
+}
+
+static void testHotplugUnderLoad(void)
+{
+	uint64_t bytes = mockAllocatedBytes();
+	uint64_t objects = mockLiveObjectCount();
+	std::vector<uint64_t> startDurations;
+	std::vector<uint64_t> stopDurations;
+	uint32_t failedCycles = 0;
+	uint64_t reportCount = 0;
+	uint64_t clientCallCount = 0;
+
+	for (uint32_t cycle = 0; cycle < kHotplugCycleCount; ++cycle)
+	{
+		IOHIDInterface* interface = createMockInterface((cycle & 1) != 0);
+		MockMouse mouse = {};
+
+		uint64_t startTime = mach_absolute_time();
+		failedCycles += (startMockMouse(interface, {}, &mouse) != kIOReturnSuccess);
+		startDurations.push_back(mach_absolute_time() - startTime);
+
+		// The client keeps its own reference to the driver, since it keeps calling it after the driver is released below.
+		HotplugLoad load = {};
+		load.running.store(true);
+		mouse.driver->retain();
+		std::thread reporter(runReporter, interface, &load);
+		std::thread client(runClient, mouse.driver, &load);
+
+		// The driver is only unplugged once both queues are busy with it.
+		while ((load.reportCount.load() == 0) || (load.clientCallCount.load() == 0))
+		{
+			std::this_thread::yield();
+		}
+
+		DeliberateMouseDriver* driver = mouse.driver;
+		uint64_t stopTime = mach_absolute_time();
+		failedCycles += (stopMockMouse(&mouse) == false);
+		stopDurations.push_back(mach_absolute_time() - stopTime);
+
+		load.running.store(false);
+		reporter.join();
+		client.join();
+		driver->release();
+		interface->release();
+
+		reportCount += load.reportCount.load();
+		clientCallCount += load.clientCallCount.load();
+		if (waitForLiveObjectCount(objects) == false)
+		{
+			CHECK(false);
+			printf("  cycle %u left %llu objects\n", cycle, (unsigned long long)(mockLiveObjectCount() - objects));
+			mockPrintLiveObjects();
+			return;
+		}
+	}
+
+	DurationPercentiles start = durationPercentiles(startDurations);
+	DurationPercentiles stop = durationPercentiles(stopDurations);
+	printf("  %u cycles, %llu reports, %llu client calls\n", kHotplugCycleCount, (unsigned long long)reportCount, (unsigned long long)clientCallCount);
+	printf("  Start: p50 %llu us, p99 %llu us, max %llu us\n",
+		(unsigned long long)(start.p50 / 1000), (unsigned long long)(start.p99 / 1000), (unsigned long long)(start.max / 1000));
+	printf("  Stop:  p50 %llu us, p99 %llu us, max %llu us\n",
+		(unsigned long long)(stop.p50 / 1000), (unsigned long long)(stop.p99 / 1000), (unsigned long long)(stop.max / 1000));
+
+	CHECK_EQUAL(failedCycles, 0);
+	CHECK_EQUAL(mockAllocatedBytes(), bytes);
+	CHECK_EQUAL(mockLiveObjectCount(), objects);
+}
+
+int main(void)
+{
+	RUN_TEST(testHotplugUnderLoad);
+
+	return finishTests();
+}
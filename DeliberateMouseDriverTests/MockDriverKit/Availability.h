@@ -0,0 +1,14 @@
+//
+//  Availability.h
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Stands in for <Availability.h>, which the generated driver headers include.
+//
+
+#ifndef MockDriverKit_Availability_h
+#define MockDriverKit_Availability_h
+
+#endif /* MockDriverKit_Availability_h */
@@ -0,0 +1,562 @@
+//
+//  DriverKit.h
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// A host implementation of the parts of DriverKit the driver uses, so the real driver sources run on Linux in the lifecycle tests.
+// Objects are reference counted and freed like in a dext, every dispatch queue is a thread, timers fire from a timer thread,
+// and actions are delivered on the queue their target names. Queues follow the strictest DriverKit rules: once canceled,
+// a queue drops every block it has not started, and any block queued later, so work that leaks on a real system leaks here too.
+//
+// RPC methods are split as the iig compiler splits them: calling `Start(provider)` runs the `Start_Impl` override,
+// and calling `Start(provider, SUPERDISPATCH)` runs the implementation of the superclass.
+//
+
+#ifndef MockDriverKit_DriverKit_h
+#define MockDriverKit_DriverKit_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <any>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mach/mach_time.h>
+
+typedef int kern_return_t;
+typedef kern_return_t IOReturn;
+typedef uint32_t IOOptionBits;
+typedef int32_t IOFixed;
+
+#define kIOReturnSuccess 0
+#define kIOReturnError ((IOReturn)0xe00002bc)
+#define kIOReturnNoMemory ((IOReturn)0xe00002bd)
+#define kIOReturnBadArgument ((IOReturn)0xe00002c2)
+#define kIOReturnUnsupported ((IOReturn)0xe00002c7)
+#define kIOReturnInvalid ((IOReturn)0xe00002c1)
+#define kIOReturnNotReady ((IOReturn)0xe00002d8)
+#define kIOReturnOffline ((IOReturn)0xe00002e3)
+#define kIOReturnNotOpen ((IOReturn)0xe00002cd)
+#define kIOReturnNotFound ((IOReturn)0xe00002f0)
+#define kIOReturnBusy ((IOReturn)0xe00002d5)
+#define kIOReturnTimeout ((IOReturn)0xe00002d6)
+#define kIOReturnAborted ((IOReturn)0xe00002eb)
+
+static inline IOFixed IOFixedMultiply(IOFixed a, IOFixed b)
+{
+	return IOFixed((int64_t(a) * int64_t(b)) >> 16);
+}
+
+// MARK: Memory
+
+/// Allocates memory that the mock allocator keeps count of, so tests can check that every allocation is released with its size.
+void* mockAllocate(size_t size, bool zero);
+/// Releases memory from `mockAllocate`. The size must be the size it was allocated with, like `IOFree` requires.
+void mockFree(void* address, size_t size);
+
+static inline void* IOMallocZero(size_t size)
+{
+	return mockAllocate(size, true);
+}
+
+static inline void* IOMalloc(size_t size)
+{
+	return mockAllocate(size, false);
+}
+
+static inline void IOFree(void* address, size_t size)
+{
+	mockFree(address, size);
+}
+
+#define IONew(type, count) (static_cast<type*>(mockAllocate(sizeof(type) * (count), false)))
+#define IONewZero(type, count) (static_cast<type*>(mockAllocate(sizeof(type) * (count), true)))
+#define IOSafeDeleteNULL(pointer, type, count) do { if ((pointer) != nullptr) { mockFree((pointer), sizeof(type) * (count)); (pointer) = nullptr; } } while (0)
+
+// MARK: Locks
+
+/// A mutex, like the IOLock of DriverKit. Locks are not counted by the mock allocator, since drivers cannot know their size.
+struct IOLock
+{
+	std::mutex mutex;
+};
+
+static inline IOLock* IOLockAlloc(void)
+{
+	return new IOLock;
+}
+
+static inline void IOLockFree(IOLock* lock)
+{
+	delete lock;
+}
+
+static inline void IOLockLock(IOLock* lock)
+{
+	lock->mutex.lock();
+}
+
+static inline void IOLockUnlock(IOLock* lock)
+{
+	lock->mutex.unlock();
+}
+
+// MARK: Objects
+
+/// Selects the superclass implementation of an RPC method.
+typedef const void* OSDispatchMethod;
+#define SUPERDISPATCH (reinterpret_cast<OSDispatchMethod>(1))
+
+class IODispatchQueue;
+class OSAction;
+typedef std::function<void(void)> IODispatchBlock;
+
+class OSObject
+{
+public:
+	OSObject(void);
+	virtual ~OSObject(void);
+
+	virtual bool init(void);
+	virtual void free(void);
+
+	void retain(void) const;
+	void release(void) const;
+
+	/// The current reference count, for tests.
+	uint32_t mockRetainCount(void) const;
+
+private:
+	mutable std::atomic<uint32_t> mockReferences;
+};
+
+#define OSDynamicCast(type, object) (dynamic_cast<type*>(static_cast<OSObject*>(object)))
+#define OSRequiredCast(type, object) (dynamic_cast<type*>(static_cast<OSObject*>(object)))
+#define OSSafeReleaseNULL(object) do { if ((object) != nullptr) { (object)->release(); (object) = nullptr; } } while (0)
+
+/// The number of objects that exist, which returns to its previous value once everything a test created has been freed.
+uint64_t mockLiveObjectCount(void);
+/// The number of bytes and allocations from `mockAllocate` that were not freed yet.
+uint64_t mockAllocatedBytes(void);
+uint64_t mockAllocationCount(void);
+/// Prints the type and reference count of every object that exists.
+void mockPrintLiveObjects(void);
+
+/// Holds a reference to an object for as long as it exists, like OSSharedPtr. Only used by the mock itself.
+template <typename Type>
+class MockRetained
+{
+public:
+	MockRetained(void) = default;
+	explicit MockRetained(Type* object) : object(object) { if (object != nullptr) { object->retain(); } }
+	MockRetained(const MockRetained& other) : MockRetained(other.object) {}
+	MockRetained& operator=(const MockRetained& other) { MockRetained copy(other); std::swap(object, copy.object); return *this; }
+	~MockRetained(void) { if (object != nullptr) { object->release(); } }
+
+	Type* get(void) const { return object; }
+	Type* operator->(void) const { return object; }
+
+private:
+	Type* object = nullptr;
+};
+
+class OSBoolean : public OSObject
+{
+public:
+	explicit OSBoolean(bool value) : value(value) {}
+	bool getValue(void) const { return value; }
+	bool isTrue(void) const { return value; }
+	bool isFalse(void) const { return !value; }
+
+private:
+	bool value;
+};
+
+extern OSBoolean* const kOSBooleanTrue;
+extern OSBoolean* const kOSBooleanFalse;
+
+class OSNumber : public OSObject
+{
+public:
+	static OSNumber* withNumber(uint64_t value, size_t numberOfBits);
+
+	uint16_t unsigned16BitValue(void) const { return uint16_t(value); }
+	uint32_t unsigned32BitValue(void) const { return uint32_t(value); }
+	uint64_t unsigned64BitValue(void) const { return value; }
+	int32_t signed32BitValue(void) const { return int32_t(value); }
+	int64_t signed64BitValue(void) const { return int64_t(value); }
+
+private:
+	uint64_t value = 0;
+};
+
+class OSString : public OSObject
+{
+public:
+	static OSString* withCString(const char* string);
+
+	const char* getCStringNoCopy(void) const { return string.c_str(); }
+	size_t getLength(void) const { return string.size(); }
+	bool isEqualTo(const char* other) const { return string == other; }
+
+private:
+	std::string string;
+};
+
+class OSData : public OSObject
+{
+public:
+	static OSData* withBytes(const void* bytes, size_t length);
+
+	const void* getBytesNoCopy(void) const { return bytes.data(); }
+	size_t getLength(void) const { return bytes.size(); }
+
+private:
+	std::vector<uint8_t> bytes;
+};
+
+class OSArray : public OSObject
+{
+public:
+	static OSArray* withCapacity(uint32_t capacity);
+	virtual void free(void) override;
+
+	uint32_t getCount(void) const { return uint32_t(objects.size()); }
+	OSObject* getObject(uint32_t index) const { return (index < objects.size()) ? objects[index] : nullptr; }
+	bool setObject(const OSObject* object);
+
+private:
+	std::vector<OSObject*> objects;
+};
+
+class OSDictionary : public OSObject
+{
+public:
+	static OSDictionary* withCapacity(uint32_t capacity);
+	virtual void free(void) override;
+
+	OSObject* getObject(const char* key) const;
+	bool setObject(const char* key, const OSObject* object);
+	uint32_t getCount(void) const { return uint32_t(objects.size()); }
+
+	/// Adds every entry of another dictionary, replacing entries with the same key.
+	void mockMerge(const OSDictionary* other);
+
+private:
+	std::map<std::string, OSObject*> objects;
+};
+
+// MARK: Dispatch
+
+constexpr const char* kIODispatchQueueDefaultQueueName = "Default";
+
+class IODispatchQueue : public OSObject
+{
+public:
+	static kern_return_t Create(const char* name, uint64_t options, uint64_t priority, IODispatchQueue** queue);
+	virtual void free(void) override;
+
+	void DispatchAsync(IODispatchBlock block);
+	void DispatchSync(IODispatchBlock block);
+	kern_return_t Cancel(IODispatchBlock handler);
+	bool OnQueue(void);
+
+	/// The queue the cancel handlers run on, which stands in for the kernel side of DriverKit.
+	static IODispatchQueue* mockRuntimeQueue(void);
+	/// Whether `Cancel` was called.
+	bool mockCanceled(void);
+	/// Makes `Create` return the queue it is called on, so a driver that creates its own queue runs as if it used its default queue.
+	static void mockSetCreateReturnsCurrentQueue(bool enabled);
+
+	/// A block waiting to run on the queue.
+	struct Item
+	{
+		IODispatchBlock block;
+		/// Set for `DispatchSync`, which waits until the block has run or has been dropped
+		std::shared_ptr<std::atomic<bool>> done;
+		/// Internal items still run once the queue is canceled
+		bool internal;
+	};
+
+private:
+	void run(void);
+	void enqueue(Item item);
+
+	std::string name;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::condition_variable syncCondition;
+	std::deque<Item> items;
+	bool canceled = false;
+	bool exiting = false;
+	std::thread thread;
+	std::thread::id threadID;
+};
+
+class IOService;
+
+class OSAction : public OSObject
+{
+public:
+	/// Creates an action that calls a method of its target on the target queue with the given name.
+	/// The generated `CreateAction` methods call this, with a handler that takes the action followed by the arguments of the method.
+	static kern_return_t mockCreate(OSObject* target, size_t referenceSize, const char* queueName, std::any handler, OSAction** action);
+	virtual void free(void) override;
+
+	kern_return_t Cancel(IODispatchBlock handler);
+	void* GetReference(void) { return reference; }
+
+	/// Queues a call of the action on its target queue. `prologue` runs on the queue just before the call.
+	/// Calls are dropped once the action or the queue is canceled.
+	template <typename... Arguments>
+	void mockInvoke(std::function<void(void)> prologue, Arguments... arguments);
+
+	bool mockCanceled(void) { return canceled.load(std::memory_order_acquire); }
+
+private:
+	/// Copies the target queue, and the target that keeps it alive, which `Cancel` clears from the runtime queue.
+	IODispatchQueue* copyTargetQueue(MockRetained<OSObject>* targetReference);
+
+	OSObject* target = nullptr;
+	std::mutex mutex;
+	std::string queueName;
+	std::any handler;
+	std::atomic<bool> canceled { false };
+	void* reference = nullptr;
+	size_t referenceSize = 0;
+};
+
+/// Aborts a test that calls an action with arguments that do not match the method it was created for.
+void mockActionTypeMismatch(const char* queueName);
+
+template <typename... Arguments>
+void OSAction::mockInvoke(std::function<void(void)> prologue, Arguments... arguments)
+{
+	MockRetained<OSObject> targetReference;
+	IODispatchQueue* queue = copyTargetQueue(&targetReference);
+	if (queue == nullptr)
+	{
+		return;
+	}
+
+	MockRetained<OSAction> action(this);
+	queue->DispatchAsync([action, targetReference, prologue, arguments...]()
+	{
+		if (action->mockCanceled() == true)
+		{
+			return;
+		}
+
+		const std::function<void(OSAction*, Arguments...)>* function = std::any_cast<std::function<void(OSAction*, Arguments...)>>(&action->handler);
+		if (function == nullptr)
+		{
+			mockActionTypeMismatch(action->queueName.c_str());
+			return;
+		}
+
+		if (prologue)
+		{
+			prologue();
+		}
+		(*function)(action.get(), arguments...);
+	});
+	queue->release();
+}
+
+// MARK: Memory Descriptors
+
+struct IOAddressSegment
+{
+	uint64_t address;
+	uint64_t length;
+};
+
+enum
+{
+	kIOMemoryDirectionIn = 0x1,
+	kIOMemoryDirectionOut = 0x2,
+	kIOMemoryDirectionInOut = 0x3,
+};
+
+class IOMemoryMap : public OSObject
+{
+public:
+	uint64_t GetAddress(void) { return address; }
+	uint64_t GetLength(void) { return length; }
+
+	uint64_t address = 0;
+	uint64_t length = 0;
+};
+
+class IOMemoryDescriptor : public OSObject
+{
+public:
+	kern_return_t CreateMapping(uint64_t options, uint64_t address, uint64_t offset, uint64_t length, uint64_t alignment, IOMemoryMap** map);
+	kern_return_t GetLength(uint64_t* returnLength);
+
+protected:
+	uint8_t* bytes = nullptr;
+	uint64_t length = 0;
+};
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor
+{
+public:
+	static kern_return_t Create(uint64_t options, uint64_t capacity, uint64_t alignment, IOBufferMemoryDescriptor** memory);
+	virtual void free(void) override;
+
+	kern_return_t GetAddressRange(IOAddressSegment* range);
+	kern_return_t SetLength(uint64_t newLength);
+
+private:
+	uint64_t capacity = 0;
+};
+
+// MARK: Services
+
+class IOUserClient;
+
+class IOService : public OSObject
+{
+public:
+	virtual bool init(void) override;
+	virtual void free(void) override;
+
+	kern_return_t Start(IOService* provider, OSDispatchMethod supermethod = nullptr) { return Start_Impl(provider); }
+	virtual kern_return_t Start_Impl(IOService* provider);
+	kern_return_t Stop(IOService* provider, OSDispatchMethod supermethod = nullptr) { return Stop_Impl(provider); }
+	virtual kern_return_t Stop_Impl(IOService* provider);
+	kern_return_t SetProperties(OSDictionary* properties, OSDispatchMethod supermethod = nullptr) { return SetProperties_Impl(properties); }
+	virtual kern_return_t SetProperties_Impl(OSDictionary* properties);
+	kern_return_t NewUserClient(uint32_t type, IOUserClient** userClient, OSDispatchMethod supermethod = nullptr) { return NewUserClient_Impl(type, userClient); }
+	virtual kern_return_t NewUserClient_Impl(uint32_t type, IOUserClient** userClient);
+
+	IOService* GetProvider(void) { return provider; }
+	kern_return_t RegisterService(void) { return kIOReturnSuccess; }
+	kern_return_t CopyProperties(OSDictionary** properties);
+	kern_return_t Create(IOService* provider, const char* propertiesKey, IOService** result);
+	kern_return_t SetDispatchQueue(const char* name, IODispatchQueue* queue);
+	kern_return_t CopyDispatchQueue(const char* name, IODispatchQueue** queue);
+
+	/// Sets a property before the service starts, like a property of its personality.
+	void mockSetProperty(const char* key, OSObject* value);
+	/// Sets the function that creates the service `Create` returns for a key of the personality.
+	void mockSetServiceFactory(const char* propertiesKey, std::function<IOService*(void)> factory);
+	/// Waits until the superclass `Stop` has run, which is when the OS would let go of the service.
+	/// - Returns: True if it ran before the timeout
+	bool mockWaitForStop(uint64_t timeoutNanoseconds);
+	bool mockStopped(void);
+
+private:
+	std::mutex mutex;
+	std::condition_variable stopCondition;
+	bool stopped = false;
+	IOService* provider = nullptr;
+	OSDictionary* properties = nullptr;
+	std::map<std::string, IODispatchQueue*> queues;
+	std::map<std::string, std::function<IOService*(void)>> factories;
+};
+
+/// Creates and initializes a service, like the OS does before it starts one.
+template <typename Type>
+static inline Type* mockCreateService(void)
+{
+	Type* service = new Type();
+	if (service->init() == false)
+	{
+		service->release();
+		return nullptr;
+	}
+	return service;
+}
+
+/// Runs a block on the default queue of a service and waits for it, like an RPC from the OS or a client.
+void mockCallOnDefaultQueue(IOService* service, IODispatchBlock block);
+
+// MARK: User Clients
+
+struct IOUserClientMethodArguments
+{
+	uint64_t version;
+	uint64_t selector;
+	OSAction* completion;
+	const uint64_t* scalarInput;
+	uint32_t scalarInputCount;
+	OSData* structureInput;
+	IOMemoryDescriptor* structureInputDescriptor;
+	uint64_t* scalarOutput;
+	uint32_t scalarOutputCount;
+	OSData* structureOutput;
+	IOMemoryDescriptor* structureOutputDescriptor;
+	uint64_t structureOutputMaximumSize;
+};
+
+typedef kern_return_t (*IOUserClientMethodFunction)(OSObject* target, void* reference, IOUserClientMethodArguments* arguments);
+
+struct IOUserClientMethodDispatch
+{
+	IOUserClientMethodFunction function;
+	uint32_t checkCompletionExists;
+	uint32_t checkScalarInputCount;
+	uint32_t checkStructureInputSize;
+	uint32_t checkScalarOutputCount;
+	uint32_t checkStructureOutputSize;
+};
+
+constexpr uint32_t kIOUserClientVariableStructureSize = 0xffffffff;
+
+enum
+{
+	kIOUserClientMemoryReadOnly = 0x00000001,
+};
+
+class IOUserClient : public IOService
+{
+public:
+	kern_return_t CopyClientMemoryForType(uint64_t type, uint64_t* options, IOMemoryDescriptor** memory, OSDispatchMethod supermethod = nullptr) { return CopyClientMemoryForType_Impl(type, options, memory); }
+	virtual kern_return_t CopyClientMemoryForType_Impl(uint64_t type, uint64_t* options, IOMemoryDescriptor** memory);
+
+	/// Checks the arguments against the dispatch entry, then calls its function.
+	virtual kern_return_t ExternalMethod(uint64_t selector, IOUserClientMethodArguments* arguments, const IOUserClientMethodDispatch* dispatch, OSObject* target, void* reference);
+};
+
+// MARK: Timers
+
+enum
+{
+	kIOTimerClockMachAbsoluteTime = 0x00000004,
+};
+
+class IOTimerDispatchSource : public OSObject
+{
+public:
+	static kern_return_t Create(IODispatchQueue* queue, IOTimerDispatchSource** source);
+	virtual void free(void) override;
+
+	kern_return_t SetHandler(OSAction* action);
+	kern_return_t WakeAtTime(uint64_t options, uint64_t deadline, uint64_t leeway);
+	kern_return_t Cancel(IODispatchBlock handler);
+
+	/// Fires the timer from the timer thread.
+	void mockFire(uint64_t time);
+
+private:
+	std::mutex mutex;
+	IODispatchQueue* queue = nullptr;
+	OSAction* action = nullptr;
+	bool canceled = false;
+};
+
+#endif /* MockDriverKit_DriverKit_h */
@@ -0,0 +1,175 @@
+//
+//  HIDDriverKit.h
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// A host implementation of the parts of HIDDriverKit the driver uses. The mock interface parses the reports a test delivers
+// into its elements, the way the OS does before it calls `ReportAvailable`, and hands every dispatched event to the test.
+//
+
+#ifndef MockDriverKit_HIDDriverKit_h
+#define MockDriverKit_HIDDriverKit_h
+
+#include <DriverKit/DriverKit.h>
+
+typedef uint32_t IOHIDElementType;
+typedef uint32_t IOHIDReportType;
+
+enum
+{
+	kIOHIDElementTypeInput_Misc = 1,
+	kIOHIDElementTypeInput_Button = 2,
+	kIOHIDElementTypeInput_Axis = 3,
+	kIOHIDElementTypeInput_ScanCodes = 4,
+	kIOHIDElementTypeInput_NULL = 5,
+	kIOHIDElementTypeOutput = 129,
+	kIOHIDElementTypeFeature = 257,
+	kIOHIDElementTypeCollection = 513,
+};
+
+enum
+{
+	kIOHIDReportTypeInput = 0,
+	kIOHIDReportTypeOutput,
+	kIOHIDReportTypeFeature,
+};
+
+enum
+{
+	kHIDPage_GenericDesktop = 0x01,
+	kHIDPage_Button = 0x09,
+	kHIDPage_Consumer = 0x0C,
+	kHIDPage_VendorDefinedStart = 0xFF00,
+};
+
+enum
+{
+	kHIDUsage_GD_Mouse = 0x02,
+	kHIDUsage_GD_X = 0x30,
+	kHIDUsage_GD_Y = 0x31,
+	kHIDUsage_GD_Wheel = 0x38,
+	kHIDUsage_Button_1 = 0x01,
+	kHIDUsage_Csmr_ACPan = 0x238,
+};
+
+enum
+{
+	kIOHIDElementFlagsVariableMask = 0x0002,
+};
+
+enum
+{
+	kIOHIDPointerEventOptionsNoAcceleration = 1 << 8,
+};
+
+#define kIOHIDReportDescriptorKey "ReportDescriptor"
+
+/// Describes an element of a mock interface. Input elements are laid out in order, like the fields of a report descriptor.
+struct MockHIDElementDescription
+{
+	IOHIDElementType type;
+	uint32_t usagePage;
+	uint32_t usage;
+	uint32_t reportID;
+	uint32_t reportSize;
+	uint32_t reportCount;
+	int32_t logicalMin;
+	int32_t logicalMax;
+	uint32_t flags;
+};
+
+class IOHIDElement : public OSObject
+{
+public:
+	IOHIDElementType getType(void) { return description.type; }
+	uint32_t getUsagePage(void) { return description.usagePage; }
+	uint32_t getUsage(void) { return description.usage; }
+	uint32_t getReportID(void) { return description.reportID; }
+	uint32_t getReportSize(void) { return description.reportSize; }
+	uint32_t getReportCount(void) { return description.reportCount; }
+	int32_t getLogicalMin(void) { return description.logicalMin; }
+	int32_t getLogicalMax(void) { return description.logicalMax; }
+	uint32_t getFlags(void) { return description.flags; }
+	uint64_t getTimeStamp(void) { return timestamp; }
+	uint32_t getValue(IOOptionBits options) { return value; }
+
+	MockHIDElementDescription description;
+	/// The position of the first value of the element in its report
+	uint32_t bitOffset = 0;
+	uint32_t value = 0;
+	uint64_t timestamp = 0;
+};
+
+class IOHIDInterface : public IOService
+{
+public:
+	/// Creates an interface with the given elements, and publishes the report descriptor like the OS does.
+	static IOHIDInterface* mockCreate(const MockHIDElementDescription* elements, uint32_t elementCount, const uint8_t* descriptor, size_t descriptorLength);
+	virtual void free(void) override;
+
+	kern_return_t Open(IOService* forClient, IOOptionBits options, OSAction* action);
+	kern_return_t Close(IOService* forClient, IOOptionBits options);
+	kern_return_t SetReport(IOMemoryDescriptor* report, IOHIDReportType reportType, IOOptionBits options, uint32_t completionTimeout, OSAction* action = nullptr);
+
+	/// Delivers an input report to the client that opened the interface, as if the device had sent it.
+	/// - Returns: False if the interface is not open, and the report was dropped
+	bool mockDeliverReport(uint64_t timestamp, const uint8_t* report, uint32_t reportLength);
+	/// Called with every output report the client sends. The result is returned by `SetReport`, or passed to its completion.
+	/// Asynchronous requests call it on the default queue of the interface, so it may block like a slow device without blocking the client.
+	void mockSetOutputReportHandler(std::function<kern_return_t(const uint8_t* report, uint32_t reportLength)> handler);
+
+	OSArray* mockElements(void) { return elements; }
+
+	/// The bytes of the report the current `ReportAvailable` call is for, which only exist on the queue that call runs on.
+	static const std::vector<uint8_t>* mockCurrentReport(void);
+
+private:
+	void updateElements(uint64_t timestamp, const std::vector<uint8_t>& report);
+	/// Calls the output report handler with the bytes of a report.
+	static kern_return_t sendOutputReport(IOMemoryDescriptor* report, const std::function<kern_return_t(const uint8_t*, uint32_t)>& handler, uint32_t* reportLength);
+
+	std::mutex mutex;
+	OSArray* elements = nullptr;
+	bool numberedReports = false;
+	OSAction* reportAction = nullptr;
+	IOService* client = nullptr;
+	std::function<kern_return_t(const uint8_t*, uint32_t)> outputReportHandler;
+};
+
+/// A pointer or scroll event the driver dispatched.
+struct MockHIDEvent
+{
+	bool scroll;
+	uint64_t timestamp;
+	IOFixed dx;
+	IOFixed dy;
+	uint32_t buttonState;
+};
+
+class IOUserHIDEventService : public IOService
+{
+public:
+	virtual kern_return_t Start_Impl(IOService* provider) override;
+
+	void ReportAvailable(uint64_t timestamp, uint32_t reportID, uint32_t reportLength, IOHIDReportType type, OSAction* action, OSDispatchMethod supermethod = nullptr) { ReportAvailable_Impl(timestamp, reportID, reportLength, type, action); }
+	/// Copies the report out of the interface and calls `handleReport`.
+	virtual void ReportAvailable_Impl(uint64_t timestamp, uint32_t reportID, uint32_t reportLength, IOHIDReportType type, OSAction* action);
+	virtual void handleReport(uint64_t timestamp, uint8_t* report, uint32_t reportLength, IOHIDReportType type, uint32_t reportID);
+
+	OSArray* getElements(void);
+	kern_return_t dispatchRelativePointerEvent(uint64_t timeStamp, IOFixed dx, IOFixed dy, uint32_t buttonState, IOOptionBits options, bool accelerate);
+	kern_return_t dispatchRelativeScrollWheelEvent(uint64_t timeStamp, IOFixed dx, IOFixed dy, IOFixed dz, IOOptionBits options, bool accelerate);
+
+	/// Called with every dispatched event, on the queue that dispatched it.
+	void mockSetEventHandler(std::function<void(const MockHIDEvent& event)> handler) { eventHandler = handler; }
+	/// The number of reports handed to the superclass `handleReport`.
+	uint64_t mockPassThroughCount(void) { return passThroughCount.load(); }
+
+private:
+	std::function<void(const MockHIDEvent&)> eventHandler;
+	std::atomic<uint64_t> passThroughCount { 0 };
+};
+
+#endif /* MockDriverKit_HIDDriverKit_h */
@@ -0,0 +1,1242 @@
+//
+//  MockDriverKit.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// The runtime behind the mock DriverKit and HIDDriverKit headers: reference counting, the counting allocator,
+// dispatch queues backed by threads, the timer thread, actions, and the mock HID interface.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <set>
+#include <typeinfo>
+
+#include <os/log.h>
+#include <DriverKit/DriverKit.h>
+#include <HIDDriverKit/HIDDriverKit.h>
+
+// MARK: Logging
+
+void mockLog(const char* format, ...)
+{
+	static const bool enabled = (getenv("DELIBERATE_MOUSE_LOG") != nullptr);
+	if (enabled == false)
+	{
+		return;
+	}
+
+	va_list arguments;
+	va_start(arguments, format);
+	vprintf(format, arguments);
+	va_end(arguments);
+}
+
+/// Stops a test on a misuse of DriverKit that would hang or crash a dext, so it is reported where it happens.
+[[noreturn]] static void mockFatal(const char* message, const char* detail)
+{
+	fprintf(stderr, "MockDriverKit: %s%s%s\n", message, (detail != nullptr) ? ": " : "", (detail != nullptr) ? detail : "");
+	abort();
+}
+
+// MARK: Memory
+
+static std::atomic<uint64_t> sAllocatedBytes { 0 };
+static std::atomic<uint64_t> sAllocationCount { 0 };
+static std::atomic<uint64_t> sLiveObjects { 0 };
+
+/// Each allocation is preceded by its size, so `mockFree` can check the size the driver passes.
+constexpr size_t kAllocationHeaderSize = 16;
+
+void* mockAllocate(size_t size, bool zero)
+{
+	uint8_t* block = static_cast<uint8_t*>(zero ? calloc(1, size + kAllocationHeaderSize) : malloc(size + kAllocationHeaderSize));
+	if (block == nullptr)
+	{
+		return nullptr;
+	}
+
+	memcpy(block, &size, sizeof(size));
+	sAllocatedBytes += size;
+	++sAllocationCount;
+	return block + kAllocationHeaderSize;
+}
+
+void mockFree(void* address, size_t size)
+{
+	if (address == nullptr)
+	{
+		return;
+	}
+
+	uint8_t* block = static_cast<uint8_t*>(address) - kAllocationHeaderSize;
+	size_t allocatedSize = 0;
+	memcpy(&allocatedSize, block, sizeof(allocatedSize));
+	if (allocatedSize != size)
+	{
+		char detail[64];
+		snprintf(detail, sizeof(detail), "allocated %zu bytes, freed %zu", allocatedSize, size);
+		mockFatal("IOFree size does not match the allocation", detail);
+	}
+
+	sAllocatedBytes -= size;
+	--sAllocationCount;
+	::free(block);
+}
+
+uint64_t mockAllocatedBytes(void)
+{
+	return sAllocatedBytes.load();
+}
+
+uint64_t mockAllocationCount(void)
+{
+	return sAllocationCount.load();
+}
+
+uint64_t mockLiveObjectCount(void)
+{
+	return sLiveObjects.load();
+}
+
+// MARK: Objects
+
+/// Every object that exists, so a test that leaks can print what it leaked.
+static std::mutex sObjectsMutex;
+static std::set<const OSObject*> sObjects;
+
+OSObject::OSObject(void) : mockReferences(1)
+{
+	++sLiveObjects;
+	std::lock_guard<std::mutex> lock(sObjectsMutex);
+	sObjects.insert(this);
+}
+
+OSObject::~OSObject(void)
+{
+	--sLiveObjects;
+	std::lock_guard<std::mutex> lock(sObjectsMutex);
+	sObjects.erase(this);
+}
+
+void mockPrintLiveObjects(void)
+{
+	std::lock_guard<std::mutex> lock(sObjectsMutex);
+	for (const OSObject* object : sObjects)
+	{
+		printf("  live %s with %u references\n", typeid(*object).name(), object->mockRetainCount());
+	}
+}
+
+bool OSObject::init(void)
+{
+	return true;
+}
+
+void OSObject::free(void)
+{
+}
+
+void OSObject::retain(void) const
+{
+	mockReferences.fetch_add(1, std::memory_order_relaxed);
+}
+
+void OSObject::release(void) const
+{
+	uint32_t previous = mockReferences.fetch_sub(1, std::memory_order_acq_rel);
+	if (previous == 0)
+	{
+		mockFatal("Released an object that was already freed", nullptr);
+	}
+
+	if (previous == 1)
+	{
+		OSObject* object = const_cast<OSObject*>(this);
+		object->free();
+		delete object;
+	}
+}
+
+uint32_t OSObject::mockRetainCount(void) const
+{
+	return mockReferences.load();
+}
+
+static OSBoolean sTrue(true);
+static OSBoolean sFalse(false);
+OSBoolean* const kOSBooleanTrue = &sTrue;
+OSBoolean* const kOSBooleanFalse = &sFalse;
+
+OSNumber* OSNumber::withNumber(uint64_t value, size_t numberOfBits)
+{
+	OSNumber* number = new OSNumber();
+	number->value = (numberOfBits < 64) ? (value & ((1ULL << numberOfBits) - 1)) : value;
+	return number;
+}
+
+OSString* OSString::withCString(const char* string)
+{
+	OSString* result = new OSString();
+	result->string = string;
+	return result;
+}
+
+OSData* OSData::withBytes(const void* bytes, size_t length)
+{
+	OSData* data = new OSData();
+	data->bytes.assign(static_cast<const uint8_t*>(bytes), static_cast<const uint8_t*>(bytes) + length);
+	return data;
+}
+
+OSArray* OSArray::withCapacity(uint32_t capacity)
+{
+	OSArray* array = new OSArray();
+	array->objects.reserve(capacity);
+	return array;
+}
+
+void OSArray::free(void)
+{
+	for (OSObject* object : objects)
+	{
+		object->release();
+	}
+	objects.clear();
+	OSObject::free();
+}
+
+bool OSArray::setObject(const OSObject* object)
+{
+	if (object == nullptr)
+	{
+		return false;
+	}
+
+	object->retain();
+	objects.push_back(const_cast<OSObject*>(object));
+	return true;
+}
+
+OSDictionary* OSDictionary::withCapacity(uint32_t capacity)
+{
+	return new OSDictionary();
+}
+
+void OSDictionary::free(void)
+{
+	for (auto& entry : objects)
+	{
+		entry.second->release();
+	}
+	objects.clear();
+	OSObject::free();
+}
+
+OSObject* OSDictionary::getObject(const char* key) const
+{
+	auto entry = objects.find(key);
+	return (entry != objects.end()) ? entry->second : nullptr;
+}
+
+bool OSDictionary::setObject(const char* key, const OSObject* object)
+{
+	if (object == nullptr)
+	{
+		return false;
+	}
+
+	object->retain();
+	auto entry = objects.find(key);
+	if (entry != objects.end())
+	{
+		entry->second->release();
+		entry->second = const_cast<OSObject*>(object);
+	}
+	else
+	{
+		objects.emplace(key, const_cast<OSObject*>(object));
+	}
+	return true;
+}
+
+void OSDictionary::mockMerge(const OSDictionary* other)
+{
+	for (auto& entry : other->objects)
+	{
+		setObject(entry.first.c_str(), entry.second);
+	}
+}
+
+// MARK: Dispatch Queues
+
+/// The queue the current thread is running, if it is a queue thread.
+static thread_local IODispatchQueue* tCurrentQueue = nullptr;
+
+static std::atomic<bool> sCreateReturnsCurrentQueue { false };
+
+kern_return_t IODispatchQueue::Create(const char* name, uint64_t options, uint64_t priority, IODispatchQueue** queue)
+{
+	if ((sCreateReturnsCurrentQueue.load() == true) && (tCurrentQueue != nullptr))
+	{
+		tCurrentQueue->retain();
+		*queue = tCurrentQueue;
+		return kIOReturnSuccess;
+	}
+
+	IODispatchQueue* created = new IODispatchQueue();
+	created->name = name;
+	created->thread = std::thread([created]() { created->run(); });
+	created->threadID = created->thread.get_id();
+
+	*queue = created;
+	return kIOReturnSuccess;
+}
+
+void IODispatchQueue::free(void)
+{
+	std::deque<Item> dropped;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		exiting = true;
+		dropped.swap(items);
+	}
+	condition.notify_all();
+
+	// The last reference can be released by a block running on the queue itself, which cannot wait for its own thread.
+	// The thread then stops as soon as that block returns, without touching the queue again.
+	if (thread.joinable())
+	{
+		if (std::this_thread::get_id() == threadID)
+		{
+			tCurrentQueue = nullptr;
+			thread.detach();
+		}
+		else
+		{
+			thread.join();
+		}
+	}
+	dropped.clear();
+
+	OSObject::free();
+}
+
+void IODispatchQueue::run(void)
+{
+	tCurrentQueue = this;
+
+	for (;;)
+	{
+		Item item;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return (items.empty() == false) || exiting; });
+			if (exiting == true)
+			{
+				return;
+			}
+
+			item = std::move(items.front());
+			items.pop_front();
+		}
+
+		item.block();
+		// The block is destroyed before the queue moves on, so everything it captured is released in order.
+		item.block = nullptr;
+
+		if (tCurrentQueue != this)
+		{
+			// The block released the last reference to the queue.
+			return;
+		}
+
+		if (item.done != nullptr)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			item.done->store(true);
+			syncCondition.notify_all();
+		}
+	}
+}
+
+/// Marks the blocks a queue dropped as done, so `DispatchSync` calls waiting for them return. Must be called with the queue locked.
+static void finishDroppedItems(std::deque<IODispatchQueue::Item>& dropped)
+{
+	for (IODispatchQueue::Item& item : dropped)
+	{
+		if (item.done != nullptr)
+		{
+			item.done->store(true);
+		}
+	}
+}
+
+void IODispatchQueue::enqueue(Item item)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (((canceled == false) || (item.internal == true)) && (exiting == false))
+		{
+			items.push_back(std::move(item));
+			condition.notify_one();
+			return;
+		}
+	}
+
+	// A canceled queue drops the block without running it. Whatever it captured is released here.
+	if (item.done != nullptr)
+	{
+		item.done->store(true);
+	}
+}
+
+void IODispatchQueue::DispatchAsync(IODispatchBlock block)
+{
+	enqueue({ std::move(block), nullptr, false });
+}
+
+void IODispatchQueue::DispatchSync(IODispatchBlock block)
+{
+	if (OnQueue() == true)
+	{
+		mockFatal("DispatchSync onto the current queue would deadlock", name.c_str());
+	}
+
+	// The caller keeps the queue alive while it waits on it.
+	MockRetained<IODispatchQueue> queue(this);
+	std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+	enqueue({ std::move(block), done, false });
+
+	std::unique_lock<std::mutex> lock(mutex);
+	syncCondition.wait(lock, [&done]() { return done->load(); });
+}
+
+kern_return_t IODispatchQueue::Cancel(IODispatchBlock handler)
+{
+	std::deque<Item> dropped;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		canceled = true;
+		dropped.swap(items);
+		finishDroppedItems(dropped);
+	}
+	syncCondition.notify_all();
+	dropped.clear();
+
+	// The handler runs once the block that is running now has finished.
+	if (handler)
+	{
+		MockRetained<IODispatchQueue> queue(this);
+		enqueue({ [queue, handler]()
+		{
+			mockRuntimeQueue()->DispatchAsync(handler);
+		}, nullptr, true });
+	}
+
+	return kIOReturnSuccess;
+}
+
+void IODispatchQueue::mockSetCreateReturnsCurrentQueue(bool enabled)
+{
+	sCreateReturnsCurrentQueue.store(enabled);
+}
+
+bool IODispatchQueue::OnQueue(void)
+{
+	return tCurrentQueue == this;
+}
+
+bool IODispatchQueue::mockCanceled(void)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return canceled;
+}
+
+IODispatchQueue* IODispatchQueue::mockRuntimeQueue(void)
+{
+	static IODispatchQueue* sRuntimeQueue = []()
+	{
+		IODispatchQueue* queue = nullptr;
+		Create("Runtime", 0, 0, &queue);
+		// The runtime queue lives as long as the process, and is not counted as an object a test leaked.
+		--sLiveObjects;
+		std::lock_guard<std::mutex> lock(sObjectsMutex);
+		sObjects.erase(queue);
+		return queue;
+	}();
+
+	return sRuntimeQueue;
+}
+
+// MARK: Actions
+
+kern_return_t OSAction::mockCreate(OSObject* target, size_t referenceSize, const char* queueName, std::any handler, OSAction** action)
+{
+	OSAction* created = new OSAction();
+
+	// An action keeps its target alive until it is canceled, so a driver that never cancels its actions is never freed.
+	target->retain();
+	created->target = target;
+	created->queueName = (queueName != nullptr) ? queueName : kIODispatchQueueDefaultQueueName;
+	created->handler = std::move(handler);
+	created->referenceSize = referenceSize;
+	created->reference = (referenceSize > 0) ? calloc(1, referenceSize) : nullptr;
+
+	*action = created;
+	return kIOReturnSuccess;
+}
+
+void OSAction::free(void)
+{
+	OSSafeReleaseNULL(target);
+	::free(reference);
+	reference = nullptr;
+	OSObject::free();
+}
+
+kern_return_t OSAction::Cancel(IODispatchBlock handler)
+{
+	canceled.store(true, std::memory_order_release);
+
+	MockRetained<OSAction> action(this);
+	IODispatchQueue::mockRuntimeQueue()->DispatchAsync([action, handler]()
+	{
+		OSObject* target = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(action->mutex);
+			target = action->target;
+			action->target = nullptr;
+		}
+
+		if (handler)
+		{
+			handler();
+		}
+		OSSafeReleaseNULL(target);
+	});
+
+	return kIOReturnSuccess;
+}
+
+IODispatchQueue* OSAction::copyTargetQueue(MockRetained<OSObject>* targetReference)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	IOService* service = OSDynamicCast(IOService, target);
+	IODispatchQueue* queue = nullptr;
+
+	if ((service == nullptr) || (service->CopyDispatchQueue(queueName.c_str(), &queue) != kIOReturnSuccess))
+	{
+		return nullptr;
+	}
+	*targetReference = MockRetained<OSObject>(target);
+	return queue;
+}
+
+void mockActionTypeMismatch(const char* queueName)
+{
+	mockFatal("An action was called with arguments that do not match its method", queueName);
+}
+
+// MARK: Memory Descriptors
+
+kern_return_t IOMemoryDescriptor::CreateMapping(uint64_t options, uint64_t address, uint64_t offset, uint64_t mappingLength, uint64_t alignment, IOMemoryMap** map)
+{
+	IOMemoryMap* created = new IOMemoryMap();
+	created->address = reinterpret_cast<uint64_t>(bytes + offset);
+	created->length = (mappingLength != 0) ? mappingLength : (length - offset);
+	*map = created;
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOMemoryDescriptor::GetLength(uint64_t* returnLength)
+{
+	*returnLength = length;
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOBufferMemoryDescriptor::Create(uint64_t options, uint64_t capacity, uint64_t alignment, IOBufferMemoryDescriptor** memory)
+{
+	IOBufferMemoryDescriptor* created = new IOBufferMemoryDescriptor();
+	// The buffer comes from the counting allocator, so the tests see the memory the driver accounts for its buffers.
+	created->bytes = static_cast<uint8_t*>(mockAllocate(capacity, true));
+	if (created->bytes == nullptr)
+	{
+		created->release();
+		return kIOReturnNoMemory;
+	}
+	created->capacity = capacity;
+	created->length = capacity;
+
+	*memory = created;
+	return kIOReturnSuccess;
+}
+
+void IOBufferMemoryDescriptor::free(void)
+{
+	mockFree(bytes, capacity);
+	bytes = nullptr;
+	IOMemoryDescriptor::free();
+}
+
+kern_return_t IOBufferMemoryDescriptor::GetAddressRange(IOAddressSegment* range)
+{
+	range->address = reinterpret_cast<uint64_t>(bytes);
+	range->length = length;
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOBufferMemoryDescriptor::SetLength(uint64_t newLength)
+{
+	if (newLength > capacity)
+	{
+		return kIOReturnBadArgument;
+	}
+	length = newLength;
+	return kIOReturnSuccess;
+}
+
+// MARK: Services
+
+bool IOService::init(void)
+{
+	properties = OSDictionary::withCapacity(8);
+	return OSObject::init();
+}
+
+void IOService::free(void)
+{
+	std::map<std::string, IODispatchQueue*> releasedQueues;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		releasedQueues.swap(queues);
+	}
+
+	for (auto& entry : releasedQueues)
+	{
+		if (entry.first == kIODispatchQueueDefaultQueueName)
+		{
+			entry.second->Cancel(nullptr);
+		}
+		entry.second->release();
+	}
+
+	OSSafeReleaseNULL(provider);
+	OSSafeReleaseNULL(properties);
+	OSObject::free();
+}
+
+kern_return_t IOService::Start_Impl(IOService* newProvider)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (provider == nullptr)
+	{
+		newProvider->retain();
+		provider = newProvider;
+	}
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOService::Stop_Impl(IOService* stoppedProvider)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	stopped = true;
+	stopCondition.notify_all();
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOService::SetProperties_Impl(OSDictionary* newProperties)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	properties->mockMerge(newProperties);
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOService::NewUserClient_Impl(uint32_t type, IOUserClient** userClient)
+{
+	return kIOReturnUnsupported;
+}
+
+kern_return_t IOService::CopyProperties(OSDictionary** copy)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	OSDictionary* result = OSDictionary::withCapacity(properties->getCount());
+	result->mockMerge(properties);
+	*copy = result;
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOService::Create(IOService* createProvider, const char* propertiesKey, IOService** result)
+{
+	std::function<IOService*(void)> factory;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto entry = factories.find(propertiesKey);
+		if (entry == factories.end())
+		{
+			return kIOReturnNotFound;
+		}
+		factory = entry->second;
+	}
+
+	IOService* service = factory();
+	if (service == nullptr)
+	{
+		return kIOReturnNoMemory;
+	}
+
+	kern_return_t ret = kIOReturnSuccess;
+	mockCallOnDefaultQueue(service, [&]()
+	{
+		ret = service->Start(createProvider);
+	});
+
+	if (ret != kIOReturnSuccess)
+	{
+		service->release();
+		return ret;
+	}
+
+	*result = service;
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOService::SetDispatchQueue(const char* name, IODispatchQueue* queue)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	queue->retain();
+
+	auto entry = queues.find(name);
+	if (entry != queues.end())
+	{
+		entry->second->release();
+		entry->second = queue;
+	}
+	else
+	{
+		queues.emplace(name, queue);
+	}
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOService::CopyDispatchQueue(const char* name, IODispatchQueue** queue)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto entry = queues.find(name);
+	if (entry == queues.end())
+	{
+		if (strcmp(name, kIODispatchQueueDefaultQueueName) != 0)
+		{
+			return kIOReturnNotFound;
+		}
+
+		// Every service has a default queue, which runs its RPC methods.
+		IODispatchQueue* defaultQueue = nullptr;
+		IODispatchQueue::Create(kIODispatchQueueDefaultQueueName, 0, 0, &defaultQueue);
+		entry = queues.emplace(name, defaultQueue).first;
+	}
+
+	entry->second->retain();
+	*queue = entry->second;
+	return kIOReturnSuccess;
+}
+
+void IOService::mockSetProperty(const char* key, OSObject* value)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	properties->setObject(key, value);
+}
+
+void IOService::mockSetServiceFactory(const char* propertiesKey, std::function<IOService*(void)> factory)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	factories[propertiesKey] = factory;
+}
+
+bool IOService::mockWaitForStop(uint64_t timeoutNanoseconds)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	return stopCondition.wait_for(lock, std::chrono::nanoseconds(timeoutNanoseconds), [this]() { return stopped; });
+}
+
+bool IOService::mockStopped(void)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stopped;
+}
+
+void mockCallOnDefaultQueue(IOService* service, IODispatchBlock block)
+{
+	IODispatchQueue* queue = nullptr;
+	service->CopyDispatchQueue(kIODispatchQueueDefaultQueueName, &queue);
+	queue->DispatchSync(block);
+	queue->release();
+}
+
+// MARK: User Clients
+
+kern_return_t IOUserClient::CopyClientMemoryForType_Impl(uint64_t type, uint64_t* options, IOMemoryDescriptor** memory)
+{
+	return kIOReturnUnsupported;
+}
+
+kern_return_t IOUserClient::ExternalMethod(uint64_t selector, IOUserClientMethodArguments* arguments, const IOUserClientMethodDispatch* dispatch, OSObject* target, void* reference)
+{
+	if ((dispatch == nullptr) || (dispatch->function == nullptr))
+	{
+		return kIOReturnUnsupported;
+	}
+
+	if (((dispatch->checkCompletionExists != 0) != (arguments->completion != nullptr)) ||
+		(dispatch->checkScalarInputCount != arguments->scalarInputCount) ||
+		(dispatch->checkScalarOutputCount != arguments->scalarOutputCount))
+	{
+		return kIOReturnBadArgument;
+	}
+
+	size_t structureInputSize = (arguments->structureInput != nullptr) ? arguments->structureInput->getLength() : 0;
+	if ((dispatch->checkStructureInputSize != kIOUserClientVariableStructureSize) && (dispatch->checkStructureInputSize != structureInputSize))
+	{
+		return kIOReturnBadArgument;
+	}
+
+	if ((dispatch->checkStructureOutputSize != kIOUserClientVariableStructureSize) && (dispatch->checkStructureOutputSize != arguments->structureOutputMaximumSize))
+	{
+		return kIOReturnBadArgument;
+	}
+
+	return dispatch->function(target, reference, arguments);
+}
+
+// MARK: Timers
+
+/// The timers that are set, each retained until it fires or is canceled.
+struct MockTimerThread
+{
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::map<IOTimerDispatchSource*, uint64_t> deadlines;
+	std::thread thread;
+
+	MockTimerThread(void)
+	{
+		thread = std::thread([this]() { run(); });
+		thread.detach();
+	}
+
+	void run(void)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;)
+		{
+			if (deadlines.empty() == true)
+			{
+				condition.wait(lock);
+				continue;
+			}
+
+			auto earliest = deadlines.begin();
+			for (auto entry = deadlines.begin(); entry != deadlines.end(); ++entry)
+			{
+				earliest = (entry->second < earliest->second) ? entry : earliest;
+			}
+
+			uint64_t now = mach_absolute_time();
+			if (earliest->second > now)
+			{
+				condition.wait_for(lock, std::chrono::nanoseconds(earliest->second - now));
+				continue;
+			}
+
+			IOTimerDispatchSource* source = earliest->first;
+			deadlines.erase(earliest);
+			lock.unlock();
+
+			source->mockFire(now);
+			source->release();
+
+			lock.lock();
+		}
+	}
+
+	static MockTimerThread& shared(void)
+	{
+		static MockTimerThread* sTimerThread = new MockTimerThread();
+		return *sTimerThread;
+	}
+
+	/// Sets a timer, replacing its previous deadline.
+	void set(IOTimerDispatchSource* source, uint64_t deadline)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto entry = deadlines.find(source);
+		if (entry != deadlines.end())
+		{
+			entry->second = deadline;
+		}
+		else
+		{
+			source->retain();
+			deadlines.emplace(source, deadline);
+		}
+		condition.notify_one();
+	}
+
+	/// Clears a timer.
+	void clear(IOTimerDispatchSource* source)
+	{
+		bool wasSet = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			wasSet = (deadlines.erase(source) != 0);
+		}
+
+		if (wasSet == true)
+		{
+			source->release();
+		}
+	}
+};
+
+kern_return_t IOTimerDispatchSource::Create(IODispatchQueue* queue, IOTimerDispatchSource** source)
+{
+	IOTimerDispatchSource* created = new IOTimerDispatchSource();
+	queue->retain();
+	created->queue = queue;
+	*source = created;
+	return kIOReturnSuccess;
+}
+
+void IOTimerDispatchSource::free(void)
+{
+	OSSafeReleaseNULL(action);
+	OSSafeReleaseNULL(queue);
+	OSObject::free();
+}
+
+kern_return_t IOTimerDispatchSource::SetHandler(OSAction* newAction)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	newAction->retain();
+	OSSafeReleaseNULL(action);
+	action = newAction;
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOTimerDispatchSource::WakeAtTime(uint64_t options, uint64_t deadline, uint64_t leeway)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (canceled == true)
+		{
+			return kIOReturnOffline;
+		}
+	}
+
+	MockTimerThread::shared().set(this, deadline);
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOTimerDispatchSource::Cancel(IODispatchBlock handler)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		canceled = true;
+	}
+
+	MockTimerThread::shared().clear(this);
+
+	MockRetained<IOTimerDispatchSource> source(this);
+	IODispatchQueue::mockRuntimeQueue()->DispatchAsync([source, handler]()
+	{
+		if (handler)
+		{
+			handler();
+		}
+	});
+	return kIOReturnSuccess;
+}
+
+void IOTimerDispatchSource::mockFire(uint64_t time)
+{
+	OSAction* firedAction = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if ((canceled == true) || (action == nullptr))
+		{
+			return;
+		}
+		firedAction = action;
+		firedAction->retain();
+	}
+
+	firedAction->mockInvoke<uint64_t>(nullptr, time);
+	firedAction->release();
+}
+
+// MARK: HID Interface
+
+/// The report that the `ReportAvailable` call running on this thread is for.
+static thread_local const std::vector<uint8_t>* tCurrentReport = nullptr;
+
+IOHIDInterface* IOHIDInterface::mockCreate(const MockHIDElementDescription* descriptions, uint32_t elementCount, const uint8_t* descriptor, size_t descriptorLength)
+{
+	IOHIDInterface* interface = mockCreateService<IOHIDInterface>();
+	uint32_t reportBitOffsets[256] = {};
+	bool reportSeen[256] = {};
+
+	interface->elements = OSArray::withCapacity(elementCount);
+	for (uint32_t elementIndex = 0; elementIndex < elementCount; ++elementIndex)
+	{
+		IOHIDElement* element = new IOHIDElement();
+		element->description = descriptions[elementIndex];
+
+		// Input fields follow each other in descriptor order, after the report ID byte of numbered reports.
+		uint32_t reportID = element->description.reportID & 0xFF;
+		if ((element->description.type != kIOHIDElementTypeCollection) && (element->description.type < kIOHIDElementTypeOutput))
+		{
+			if (reportSeen[reportID] == false)
+			{
+				reportSeen[reportID] = true;
+				reportBitOffsets[reportID] = (reportID != 0) ? 8 : 0;
+			}
+			element->bitOffset = reportBitOffsets[reportID];
+			reportBitOffsets[reportID] += element->description.reportSize * element->description.reportCount;
+		}
+		interface->numberedReports |= (reportID != 0);
+
+		interface->elements->setObject(element);
+		element->release();
+	}
+
+	OSData* reportDescriptor = OSData::withBytes(descriptor, descriptorLength);
+	interface->mockSetProperty(kIOHIDReportDescriptorKey, reportDescriptor);
+	reportDescriptor->release();
+
+	return interface;
+}
+
+void IOHIDInterface::free(void)
+{
+	OSSafeReleaseNULL(reportAction);
+	OSSafeReleaseNULL(client);
+	OSSafeReleaseNULL(elements);
+	IOService::free();
+}
+
+kern_return_t IOHIDInterface::Open(IOService* forClient, IOOptionBits options, OSAction* action)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (client != nullptr)
+	{
+		return kIOReturnBusy;
+	}
+
+	forClient->retain();
+	client = forClient;
+	action->retain();
+	reportAction = action;
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOHIDInterface::Close(IOService* forClient, IOOptionBits options)
+{
+	OSAction* closedAction = nullptr;
+	IOService* closedClient = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (client != forClient)
+		{
+			return kIOReturnNotOpen;
+		}
+		closedAction = reportAction;
+		closedClient = client;
+		reportAction = nullptr;
+		client = nullptr;
+	}
+
+	OSSafeReleaseNULL(closedAction);
+	OSSafeReleaseNULL(closedClient);
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOHIDInterface::SetReport(IOMemoryDescriptor* report, IOHIDReportType reportType, IOOptionBits options, uint32_t completionTimeout, OSAction* action)
+{
+	std::function<kern_return_t(const uint8_t*, uint32_t)> handler;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (client == nullptr)
+		{
+			return kIOReturnNotOpen;
+		}
+		handler = outputReportHandler;
+	}
+
+	// Synchronous requests wait for the device on the queue of the caller.
+	if (action == nullptr)
+	{
+		return sendOutputReport(report, handler, nullptr);
+	}
+
+	// Asynchronous requests are sent from the queue of the interface, so a slow device only delays their completion.
+	// They always complete through their action, even when the device did not accept them.
+	IODispatchQueue* queue = nullptr;
+	CopyDispatchQueue(kIODispatchQueueDefaultQueueName, &queue);
+	MockRetained<IOHIDInterface> interface(this);
+	MockRetained<IOMemoryDescriptor> retainedReport(report);
+	MockRetained<OSAction> retainedAction(action);
+	queue->DispatchAsync([interface, retainedReport, retainedAction, handler]()
+	{
+		uint32_t reportLength = 0;
+		kern_return_t status = sendOutputReport(retainedReport.get(), handler, &reportLength);
+		retainedAction->mockInvoke<IOReturn, uint32_t>(nullptr, status, (status == kIOReturnSuccess) ? reportLength : 0);
+	});
+	queue->release();
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOHIDInterface::sendOutputReport(IOMemoryDescriptor* report, const std::function<kern_return_t(const uint8_t*, uint32_t)>& handler, uint32_t* reportLength)
+{
+	IOMemoryMap* map = nullptr;
+	report->CreateMapping(0, 0, 0, 0, 0, &map);
+	uint32_t length = uint32_t(map->GetLength());
+	kern_return_t status = handler ? handler(reinterpret_cast<const uint8_t*>(map->GetAddress()), length) : kIOReturnSuccess;
+	map->release();
+
+	if (reportLength != nullptr)
+	{
+		*reportLength = length;
+	}
+	return status;
+}
+
+void IOHIDInterface::mockSetOutputReportHandler(std::function<kern_return_t(const uint8_t*, uint32_t)> handler)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	outputReportHandler = handler;
+}
+
+void IOHIDInterface::updateElements(uint64_t timestamp, const std::vector<uint8_t>& report)
+{
+	uint32_t reportID = numberedReports ? report[0] : 0;
+
+	for (uint32_t elementIndex = 0; elementIndex < elements->getCount(); ++elementIndex)
+	{
+		IOHIDElement* element = OSDynamicCast(IOHIDElement, elements->getObject(elementIndex));
+		const MockHIDElementDescription& description = element->description;
+		if ((description.reportID != reportID) || (description.type == kIOHIDElementTypeCollection) || (description.type >= kIOHIDElementTypeOutput) ||
+			(description.reportSize == 0) || (description.reportSize > 32))
+		{
+			continue;
+		}
+
+		uint64_t value = 0;
+		for (uint32_t bit = 0; bit < description.reportSize; ++bit)
+		{
+			uint32_t position = element->bitOffset + bit;
+			if ((position / 8) < report.size())
+			{
+				value |= uint64_t((report[position / 8] >> (position % 8)) & 1) << bit;
+			}
+		}
+
+		// Signed fields are sign extended, like the values the OS parses.
+		if ((description.logicalMin < 0) && (description.reportSize < 32) && ((value >> (description.reportSize - 1)) & 1))
+		{
+			value |= ~((1ULL << description.reportSize) - 1);
+		}
+
+		element->value = uint32_t(value);
+		element->timestamp = timestamp;
+	}
+}
+
+bool IOHIDInterface::mockDeliverReport(uint64_t timestamp, const uint8_t* report, uint32_t reportLength)
+{
+	OSAction* action = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (reportAction == nullptr)
+		{
+			return false;
+		}
+		action = reportAction;
+		action->retain();
+	}
+
+	std::shared_ptr<std::vector<uint8_t>> bytes = std::make_shared<std::vector<uint8_t>>(report, report + reportLength);
+	uint32_t reportID = (numberedReports && (reportLength > 0)) ? report[0] : 0;
+	MockRetained<IOHIDInterface> interface(this);
+
+	// The elements are updated on the queue of the client, right before it is told about the report.
+	action->mockInvoke<uint64_t, uint32_t, uint32_t, IOHIDReportType>([interface, bytes, timestamp]()
+	{
+		interface->updateElements(timestamp, *bytes);
+		tCurrentReport = bytes.get();
+	}, timestamp, reportID, reportLength, IOHIDReportType(kIOHIDReportTypeInput));
+
+	action->release();
+	return true;
+}
+
+const std::vector<uint8_t>* IOHIDInterface::mockCurrentReport(void)
+{
+	return tCurrentReport;
+}
+
+// MARK: HID Event Service
+
+kern_return_t IOUserHIDEventService::Start_Impl(IOService* provider)
+{
+	if (OSDynamicCast(IOHIDInterface, provider) == nullptr)
+	{
+		return kIOReturnBadArgument;
+	}
+	return IOService::Start_Impl(provider);
+}
+
+OSArray* IOUserHIDEventService::getElements(void)
+{
+	IOHIDInterface* interface = OSDynamicCast(IOHIDInterface, GetProvider());
+	return (interface != nullptr) ? interface->mockElements() : nullptr;
+}
+
+void IOUserHIDEventService::ReportAvailable_Impl(uint64_t timestamp, uint32_t reportID, uint32_t reportLength, IOHIDReportType type, OSAction* action)
+{
+	const std::vector<uint8_t>* report = IOHIDInterface::mockCurrentReport();
+	if (report == nullptr)
+	{
+		mockFatal("ReportAvailable was called without a report", nullptr);
+	}
+
+	std::vector<uint8_t> copy = *report;
+	handleReport(timestamp, copy.data(), reportLength, type, reportID);
+}
+
+void IOUserHIDEventService::handleReport(uint64_t timestamp, uint8_t* report, uint32_t reportLength, IOHIDReportType type, uint32_t reportID)
+{
+	++passThroughCount;
+}
+
+kern_return_t IOUserHIDEventService::dispatchRelativePointerEvent(uint64_t timeStamp, IOFixed dx, IOFixed dy, uint32_t buttonState, IOOptionBits options, bool accelerate)
+{
+	if (eventHandler)
+	{
+		eventHandler({ false, timeStamp, dx, dy, buttonState });
+	}
+	return kIOReturnSuccess;
+}
+
+kern_return_t IOUserHIDEventService::dispatchRelativeScrollWheelEvent(uint64_t timeStamp, IOFixed dx, IOFixed dy, IOFixed dz, IOOptionBits options, bool accelerate)
+{
+	if (eventHandler)
+	{
+		eventHandler({ true, timeStamp, dx, dy, 0 });
+	}
+	return kIOReturnSuccess;
+}
@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+#
+#  generate_mock_sources.py
+#  DeliberateMouseDriverTests
+#
+# See the LICENSE.txt file for this sample’s licensing information.
+#
+# Abstract:
+# Turns the driver sources into sources that build against the mock DriverKit headers with a plain C++ compiler.
+# `header` does the work of the iig compiler: every RPC method is split into a virtual `_Impl` method and a wrapper
+# that can select the superclass implementation, and every method with a TYPE gets its `CreateAction` method.
+# `source` translates the blocks in a source file into lambdas, since only Clang supports blocks.
+#
+#   generate_mock_sources.py header DeliberateMouseDriver.iig DeliberateMouseDriver.h
+#   generate_mock_sources.py source DeliberateMouseDriver.cpp DeliberateMouseDriver.cpp
+#
+
+import re
+import sys
+
+
+def split_parameters(parameters):
+    """Splits a parameter list into (type, name) pairs, dropping the iig annotations."""
+    parameters = parameters.replace('TARGET', '').strip()
+    if parameters in ('', 'void'):
+        return []
+
+    result = []
+    for parameter in parameters.split(','):
+        match = re.match(r'\s*(.*?)\s*(\w+)\s*$', parameter)
+        result.append((match.group(1), match.group(2)))
+    return result
+
+
+def translate_method(line):
+    """Returns the declarations a method of the class turns into."""
+    if 'LOCALONLY' in line or re.search(r'\b(init|free)\(void\)', line):
+        return [re.sub(r'\s*LOCALONLY', '', line)]
+
+    match = re.match(r'(\s*)virtual\s+(.*?)\s*(\w+)\(([^)]*)\)\s*(.*?);\s*$', line)
+    if match is None:
+        return [line]
+
+    indent, result_type, name, parameter_list, attributes = match.groups()
+    parameters = split_parameters(parameter_list)
+    declaration = ', '.join('%s %s' % parameter for parameter in parameters)
+    arguments = ', '.join(parameter[1] for parameter in parameters)
+    wrapper_parameters = ', '.join(filter(None, [declaration, 'OSDispatchMethod supermethod = nullptr']))
+    returns = '' if result_type == 'void' else 'return '
+
+    # Like the iig compiler, only the wrapper of an override can select the superclass implementation.
+    if 'override' in attributes:
+        lines = ['%svirtual %s %s_Impl(%s) override;' % (indent, result_type, name, declaration)]
+        lines.append('%s%s %s(%s) { if (supermethod != nullptr) { %ssuper::%s_Impl(%s);%s } %s%s_Impl(%s); }' % (
+            indent, result_type, name, wrapper_parameters, returns, name, arguments, '' if returns else ' return;', returns, name, arguments))
+    else:
+        lines = ['%svirtual %s %s_Impl(%s);' % (indent, result_type, name, declaration)]
+        lines.append('%s%s %s(%s) { %s%s_Impl(%s); }' % (indent, result_type, name, wrapper_parameters, returns, name, arguments))
+
+    if re.search(r'\bTYPE\(', attributes):
+        queue = re.search(r'QUEUENAME\((\w+)\)', attributes)
+        queue_name = queue.group(1) if queue else 'Default'
+        handler_parameters = [parameter for parameter in parameters if parameter[0] != 'OSAction*']
+        handler_types = ', '.join(['OSAction*'] + [parameter[0] for parameter in handler_parameters])
+        handler_declaration = ', '.join(['OSAction* action'] + ['%s %s' % parameter for parameter in handler_parameters])
+        call_arguments = ', '.join('action' if parameter[0] == 'OSAction*' else parameter[1] for parameter in parameters)
+        lines.append('%skern_return_t CreateAction%s(size_t referenceSize, OSAction** action)' % (indent, name))
+        lines.append('%s{' % indent)
+        lines.append('%s\treturn OSAction::mockCreate(this, referenceSize, "%s", std::function<void(%s)>([this](%s) { %s_Impl(%s); }), action);' % (
+            indent, queue_name, handler_types, handler_declaration, name, call_arguments))
+        lines.append('%s}' % indent)
+
+    return lines
+
+
+def generate_header(source):
+    source = re.sub(r'#include <[^>]*\.iig>\n', '', source)
+    source = source.replace('#include <Availability.h>', '#include <Availability.h>\n#include <DriverKit/DriverKit.h>\n#include <HIDDriverKit/HIDDriverKit.h>')
+
+    def translate_class(match):
+        class_name, base_name, body = match.group(1), match.group(2), match.group(3)
+        lines = []
+        for line in body.split('\n'):
+            lines.extend(translate_method(line))
+            if line.strip() == 'public:':
+                lines.append('\tstruct %s_IVars* ivars = nullptr;' % class_name)
+                lines.append('\ttypedef %s super;' % base_name)
+        return 'class %s : public %s\n{%s\n};' % (class_name, base_name, '\n'.join(lines))
+
+    return re.sub(r'class (\w+)\s*:\s*public (\w+)\s*\n\{(.*?)\n\};', translate_class, source, flags=re.S)
+
+
+def tokens(source):
+    """Yields the positions of braces, blocks, and __block variables in a source file, skipping comments, strings, and characters."""
+    index = 0
+    while index < len(source):
+        if source.startswith('//', index):
+            index = source.find('\n', index)
+            if index < 0:
+                return
+            continue
+        if source.startswith('/*', index):
+            index = source.find('*/', index) + 2
+            continue
+        character = source[index]
+        if character in '"\'':
+            end = index + 1
+            while source[end] != character:
+                end += 2 if source[end] == '\\' else 1
+            index = end + 1
+            continue
+        if source.startswith('^{', index) or source.startswith('__block ', index) or character in '{}':
+            yield index
+        index += 1
+
+
+def block_end(source, start):
+    """Returns the position just after the brace that closes the block starting at `start`."""
+    depth = 0
+    for index in tokens(source[start:]):
+        character = source[start + index]
+        if character == '{':
+            depth += 1
+        elif character == '}':
+            depth -= 1
+            if depth == 0:
+                return start + index + 1
+    return len(source)
+
+
+def generate_source(source):
+    source = re.sub(r'\b_Atomic\s+', '', source)
+    source = source.replace('__c11_atomic_', '__atomic_')
+    source = re.sub(r'void \(\^(\w+)\)\(void\) =', r'IODispatchBlock \1 =', source)
+
+    # Every __block variable lives in a shared pointer that each block using it keeps alive, like the block runtime does.
+    # A variable is in scope until the brace it was declared in closes.
+    block_variable = re.compile(r'__block\s+([\w:]+(?:\s*\*)?)\s+(\w+)\s*=\s*(.*?);')
+    output = []
+    scopes = [[]]
+    position = 0
+    for index in tokens(source):
+        if index < position:
+            continue
+        output.append(source[position:index])
+        position = index
+        if source.startswith('__block', index):
+            match = block_variable.match(source, index)
+            variable_type, name, value = match.groups()
+            output.append('std::shared_ptr<%s> %s__block = std::make_shared<%s>(%s); %s& %s = *%s__block;' % (
+                variable_type, name, variable_type, value, variable_type, name, name))
+            scopes[-1].append(name)
+            position = match.end()
+        elif source.startswith('^{', index):
+            body = source[index:block_end(source, index)]
+            variables = [name for scope in scopes for name in scope if re.search(r'\b%s\b' % name, body)]
+            rebinds = ''.join(' auto& %s = *%s__block;' % (name, name) for name in variables)
+            output.append('[=, this]() {%s' % rebinds)
+            scopes.append([])
+            position = index + 2
+        elif source[index] == '{':
+            scopes.append([])
+        else:
+            scopes.pop()
+
+    output.append(source[position:])
+    return ''.join(output)
+
+
+def main():
+    mode, input_path, output_path = sys.argv[1:4]
+    with open(input_path, encoding='utf-8') as input_file:
+        source = input_file.read()
+
+    source = generate_header(source) if mode == 'header' else generate_source(source)
+    with open(output_path, 'w', encoding='utf-8') as output_file:
+        output_file.write(source)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,21 @@
+//
+//  log.h
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Stands in for <os/log.h>. Driver logs are printed when the DELIBERATE_MOUSE_LOG environment variable is set.
+//
+
+#ifndef MockDriverKit_log_h
+#define MockDriverKit_log_h
+
+#define OS_LOG_DEFAULT 0
+
+/// Prints a driver log message, if logging is enabled.
+void mockLog(const char* format, ...);
+
+#define os_log(log, format, ...) mockLog(format, ##__VA_ARGS__)
+
+#endif /* MockDriverKit_log_h */
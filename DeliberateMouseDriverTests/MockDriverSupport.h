@@ -0,0 +1,187 @@
+//
+//  MockDriverSupport.h
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Runs the real driver against the mock DriverKit in MockDriverKit: creates a mouse interface, starts and stops a driver
+// instance on it the way the OS does, and delivers reports to it. Used by the tests that cover the lifecycle of the driver.
+//
+
+#ifndef MockDriverSupport_h
+#define MockDriverSupport_h
+
+#include <initializer_list>
+#include <thread>
+#include <vector>
+
+#include <DriverKit/DriverKit.h>
+#include <HIDDriverKit/HIDDriverKit.h>
+#include "DeliberateMouseDriver.h"
+#include "DeliberateMouseUserClient.h"
+
+/// A wired mouse with 16 buttons, 16-bit X and Y, and 8-bit wheel and AC Pan, all in report 2.
+static const MockHIDElementDescription kMockMouseElements[] =
+{
+	{ kIOHIDElementTypeCollection, kHIDPage_GenericDesktop, kHIDUsage_GD_Mouse, 0, 0, 0, 0, 0, 0 },
+	{ kIOHIDElementTypeInput_Button, kHIDPage_Button, kHIDUsage_Button_1, 2, 1, 16, 0, 1, kIOHIDElementFlagsVariableMask },
+	{ kIOHIDElementTypeInput_Misc, kHIDPage_GenericDesktop, kHIDUsage_GD_X, 2, 16, 1, -32767, 32767, kIOHIDElementFlagsVariableMask },
+	{ kIOHIDElementTypeInput_Misc, kHIDPage_GenericDesktop, kHIDUsage_GD_Y, 2, 16, 1, -32767, 32767, kIOHIDElementFlagsVariableMask },
+	{ kIOHIDElementTypeInput_Misc, kHIDPage_GenericDesktop, kHIDUsage_GD_Wheel, 2, 8, 1, -127, 127, kIOHIDElementFlagsVariableMask },
+	{ kIOHIDElementTypeInput_Misc, kHIDPage_Consumer, kHIDUsage_Csmr_ACPan, 2, 8, 1, -127, 127, kIOHIDElementFlagsVariableMask },
+};
+
+/// The same mouse, with the vendor defined HID++ reports of a Logitech device.
+static const MockHIDElementDescription kMockHIDPPMouseElements[] =
+{
+	{ kIOHIDElementTypeCollection, kHIDPage_GenericDesktop, kHIDUsage_GD_Mouse, 0, 0, 0, 0, 0, 0 },
+	{ kIOHIDElementTypeInput_Button, kHIDPage_Button, kHIDUsage_Button_1, 2, 1, 16, 0, 1, kIOHIDElementFlagsVariableMask },
+	{ kIOHIDElementTypeInput_Misc, kHIDPage_GenericDesktop, kHIDUsage_GD_X, 2, 16, 1, -32767, 32767, kIOHIDElementFlagsVariableMask },
+	{ kIOHIDElementTypeInput_Misc, kHIDPage_GenericDesktop, kHIDUsage_GD_Y, 2, 16, 1, -32767, 32767, kIOHIDElementFlagsVariableMask },
+	{ kIOHIDElementTypeInput_Misc, kHIDPage_GenericDesktop, kHIDUsage_GD_Wheel, 2, 8, 1, -127, 127, kIOHIDElementFlagsVariableMask },
+	{ kIOHIDElementTypeInput_Misc, kHIDPage_Consumer, kHIDUsage_Csmr_ACPan, 2, 8, 1, -127, 127, kIOHIDElementFlagsVariableMask },
+	{ kIOHIDElementTypeInput_Misc, kHIDPage_VendorDefinedStart, 1, 0x10, 8, 6, 0, 255, 0 },
+	{ kIOHIDElementTypeInput_Misc, kHIDPage_VendorDefinedStart, 2, 0x11, 8, 19, 0, 255, 0 },
+};
+
+/// Stands in for the report descriptors. The driver reads the elements of an interface, never its descriptor.
+static const uint8_t kMockMouseDescriptor[] = { 0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02 };
+static const uint8_t kMockHIDPPMouseDescriptor[] = { 0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02, 0x06, 0x00, 0xFF, 0x85, 0x10 };
+
+/// The length of the mouse reports of the mock interfaces.
+constexpr uint32_t kMockMouseReportLength = 9;
+
+/// A driver instance started on a mock interface.
+struct MockMouse
+{
+	IOHIDInterface* interface;
+	DeliberateMouseDriver* driver;
+};
+
+/// Creates a mock interface.
+/// - Parameters:
+///   - hidpp: Whether the interface also carries HID++ reports
+/// - Returns: The interface, which the caller releases
+static inline IOHIDInterface* createMockInterface(bool hidpp)
+{
+	if (hidpp == true)
+	{
+		return IOHIDInterface::mockCreate(kMockHIDPPMouseElements, sizeof(kMockHIDPPMouseElements) / sizeof(kMockHIDPPMouseElements[0]),
+			kMockHIDPPMouseDescriptor, sizeof(kMockHIDPPMouseDescriptor));
+	}
+
+	return IOHIDInterface::mockCreate(kMockMouseElements, sizeof(kMockMouseElements) / sizeof(kMockMouseElements[0]),
+		kMockMouseDescriptor, sizeof(kMockMouseDescriptor));
+}
+
+/// A numeric property of the personality of a mock driver, or an array of numbers when `values` is not empty.
+struct MockProperty
+{
+	const char* key;
+	uint32_t value;
+	std::vector<uint32_t> values;
+};
+
+/// Creates a driver instance and starts it on an interface, on the default queue of the driver like the OS does.
+/// - Parameters:
+///   - interface: The provider of the driver
+///   - properties: Properties of the personality
+///   - mouse: The variable that stores the started driver
+/// - Returns: The result of `Start`
+static inline kern_return_t startMockMouse(IOHIDInterface* interface, std::initializer_list<MockProperty> properties, MockMouse* mouse)
+{
+	kern_return_t ret = kIOReturnSuccess;
+	DeliberateMouseDriver* driver = mockCreateService<DeliberateMouseDriver>();
+
+	for (const MockProperty& property : properties)
+	{
+		OSObject* value = OSNumber::withNumber(property.value, 32);
+		if (property.values.empty() == false)
+		{
+			OSArray* array = OSArray::withCapacity(uint32_t(property.values.size()));
+			for (uint32_t element : property.values)
+			{
+				OSNumber* number = OSNumber::withNumber(element, 32);
+				array->setObject(number);
+				number->release();
+			}
+			value->release();
+			value = array;
+		}
+		driver->mockSetProperty(property.key, value);
+		value->release();
+	}
+	driver->mockSetServiceFactory("UserClientProperties", []() -> IOService*
+	{
+		return mockCreateService<DeliberateMouseUserClient>();
+	});
+
+	mockCallOnDefaultQueue(driver, [&]()
+	{
+		ret = driver->Start(interface);
+	});
+
+	mouse->interface = interface;
+	mouse->driver = driver;
+	return ret;
+}
+
+/// Stops a driver instance, waits until it has finished stopping, and releases it.
+/// - Parameters:
+///   - mouse: The driver to stop
+/// - Returns: True if the driver stopped within a second
+static inline bool stopMockMouse(MockMouse* mouse)
+{
+	DeliberateMouseDriver* driver = mouse->driver;
+	IOHIDInterface* interface = mouse->interface;
+
+	mockCallOnDefaultQueue(driver, [=]()
+	{
+		driver->Stop(interface);
+	});
+
+	bool stopped = driver->mockWaitForStop(1000000000ULL);
+	driver->release();
+	mouse->driver = nullptr;
+	return stopped;
+}
+
+/// Waits until the number of live objects drops to a count, since the last references of a stopped driver are released by its cancel handlers.
+/// - Parameters:
+///   - objectCount: The count to wait for
+/// - Returns: True if the count was reached within a second
+static inline bool waitForLiveObjectCount(uint64_t objectCount)
+{
+	for (uint32_t attempt = 0; attempt < 20000; ++attempt)
+	{
+		if (mockLiveObjectCount() <= objectCount)
+		{
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	return mockLiveObjectCount() <= objectCount;
+}
+
+/// Builds a report of the mock mouse.
+/// - Parameters:
+///   - buttons: The state of the buttons
+///   - x: The X motion
+///   - y: The Y motion
+///   - wheel: The wheel motion
+///   - report: The buffer of `kMockMouseReportLength` bytes that receives the report
+static inline void buildMockMouseReport(uint16_t buttons, int16_t x, int16_t y, int8_t wheel, uint8_t* report)
+{
+	report[0] = 2;
+	report[1] = uint8_t(buttons);
+	report[2] = uint8_t(buttons >> 8);
+	report[3] = uint8_t(x);
+	report[4] = uint8_t(uint16_t(x) >> 8);
+	report[5] = uint8_t(y);
+	report[6] = uint8_t(uint16_t(y) >> 8);
+	report[7] = uint8_t(wheel);
+	report[8] = 0;
+}
+
+#endif /* MockDriverSupport_h */
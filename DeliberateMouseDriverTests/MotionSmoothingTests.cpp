@@ -0,0 +1,203 @@
+//
+//  MotionSmoothingTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Evaluates the latency of the motion smoothing filter offline, by replaying flicks at several polling rates
+// through the filter and the drain timer the way the driver schedules them, and checks that no motion is lost or left behind.
+//
+
+#include "TestSupport.h"
+#include "MouseMotionProcessing.h"
+
+/// Timestamps are in nanoseconds, which is what mach absolute time units are on Apple silicon.
+constexpr uint64_t kMillisecond = 1000000;
+
+/// The result of replaying one flick.
+struct SmoothingReplay
+{
+	int64_t inputX;
+	int64_t outputX;
+	/// The delay of the centroid of the output motion behind the centroid of the input motion
+	uint64_t centroidDelay;
+	/// The time from the last report until all motion was released, or UINT64_MAX if some never was
+	uint64_t tailDuration;
+	/// The number of times the drain timer stepped the filter after the last report
+	uint32_t drainSteps;
+};
+
+/// Replays a flick that accelerates and decelerates over `flickDuration`, then stops.
+/// After every step, the drain timer is set for `motionSmoothingDrainTime`, like `armMotionTimer`, and it fires if no report comes first.
+/// - Parameters:
+///   - timeConstant: The time constant of the filter
+///   - pollingInterval: The interval between reports
+///   - flickDuration: How long the mouse moves
+///   - drain: Whether the drain timer runs, which the driver did not have before
+static SmoothingReplay replayFlick(uint64_t timeConstant, uint64_t pollingInterval, uint64_t flickDuration, bool drain)
+{
+	MotionSmoothingState state = {};
+	MotionFilterFunction filter = configureMotionSmoothing(state, timeConstant);
+	SmoothingReplay replay = {};
+	long double inputMoment = 0;
+	long double outputMoment = 0;
+	uint64_t start = 1000 * kMillisecond;
+	uint64_t lastReport = start;
+	uint64_t released = 0;
+
+	state.lastTimestamp = start;
+
+	auto step = [&](uint64_t timestamp, int32_t motion)
+	{
+		int32_t dX = motion;
+		int32_t dY = 0;
+		filter(state, timestamp, &dX, &dY);
+
+		replay.inputX += motion;
+		replay.outputX += dX;
+		inputMoment += (long double)motion * (timestamp - start);
+		outputMoment += (long double)dX * (timestamp - start);
+		if ((state.lagX == 0) && (released == 0) && (timestamp > lastReport))
+		{
+			released = timestamp;
+		}
+	};
+
+	auto drainUntil = [&](uint64_t until)
+	{
+		for (uint64_t drainTime = motionSmoothingDrainTime(state); drain && (drainTime != 0) && (drainTime < until); drainTime = motionSmoothingDrainTime(state))
+		{
+			step(drainTime, 0);
+			++replay.drainSteps;
+		}
+	};
+
+	// A triangular velocity profile, peaking at 20 counts per millisecond, in 16.16 counts.
+	for (uint64_t timestamp = start + pollingInterval; timestamp <= (start + flickDuration); timestamp += pollingInterval)
+	{
+		uint64_t elapsed = timestamp - start;
+		uint64_t peak = flickDuration / 2;
+		uint64_t velocity = (elapsed < peak) ? elapsed : (flickDuration - elapsed);
+		int32_t motion = int32_t(((20LL << 16) * int64_t(velocity) / int64_t(peak)) * int64_t(pollingInterval) / int64_t(kMillisecond));
+
+		drainUntil(timestamp);
+		step(timestamp, motion);
+		lastReport = timestamp;
+		replay.drainSteps = 0;
+	}
+
+	drainUntil(UINT64_MAX);
+
+	replay.centroidDelay = uint64_t((outputMoment / replay.outputX) - (inputMoment / replay.inputX));
+	replay.tailDuration = ((state.lagX == 0) && (released != 0)) ? (released - lastReport) : UINT64_MAX;
+	return replay;
+}
+
+static void testSmoothingReleasesEveryFlickCompletely(void)
+{
+	static const uint64_t kTimeConstants[] = { 2 * kMillisecond, 4 * kMillisecond, 8 * kMillisecond, 16 * kMillisecond };
+	static const uint64_t kPollingIntervals[] = { 8 * kMillisecond, 1 * kMillisecond, kMillisecond / 8 };
+
+	printf("  time constant  polling   centroid delay  tail after last report  drain steps after it\n");
+	for (uint64_t timeConstant : kTimeConstants)
+	{
+		for (uint64_t pollingInterval : kPollingIntervals)
+		{
+			SmoothingReplay replay = replayFlick(timeConstant, pollingInterval, 80 * kMillisecond, true);
+
+			printf("  %8.1f ms  %7.0f Hz  %10.2f ms  %17.2f ms  %11u\n", timeConstant / 1e6, 1e9 / pollingInterval, replay.centroidDelay / 1e6,
+				replay.tailDuration / 1e6, replay.drainSteps);
+
+			// No motion is lost, and the tail ends within the drain steps, one time constant apart.
+			CHECK_EQUAL(replay.outputX, replay.inputX);
+			CHECK(replay.tailDuration <= (kMotionSmoothingDrainSteps * timeConstant));
+			CHECK(replay.drainSteps <= kMotionSmoothingDrainSteps);
+
+			// The filter adds about one time constant of latency, whatever the polling rate.
+			CHECK(replay.centroidDelay <= ((timeConstant * 3) / 2));
+			CHECK(replay.centroidDelay >= (timeConstant / 2));
+		}
+	}
+}
+
+static void testSmoothingWithoutDrainLeavesTheTailBehind(void)
+{
+	// This is the behavior the drain timer fixes: once reports stop, the lag stays in the filter until the mouse moves again.
+	SmoothingReplay replay = replayFlick(8 * kMillisecond, 1 * kMillisecond, 80 * kMillisecond, false);
+
+	CHECK(replay.outputX < replay.inputX);
+	CHECK_EQUAL(replay.tailDuration, UINT64_MAX);
+	CHECK_EQUAL(replay.drainSteps, 0);
+}
+
+static void testSmoothingReleasesAfterLongPause(void)
+{
+	MotionSmoothingState state = {};
+	MotionFilterFunction filter = configureMotionSmoothing(state, 4 * kMillisecond);
+	int32_t dX = 100 << 16;
+	int32_t dY = -(100 << 16);
+
+	state.lastTimestamp = 1000 * kMillisecond;
+	filter(state, state.lastTimestamp + kMillisecond, &dX, &dY);
+	CHECK(dX < (100 << 16));
+	CHECK(motionSmoothingDrainTime(state) == (state.lastTimestamp + (4 * kMillisecond)));
+
+	// A report long after the previous one releases everything the filter held, along with its own motion.
+	int64_t heldX = state.lagX;
+	dX = 1 << 16;
+	dY = 0;
+	filter(state, state.lastTimestamp + (kMotionSmoothingSettleFactor * 4 * kMillisecond), &dX, &dY);
+	CHECK_EQUAL(dX, heldX + (1 << 16));
+	CHECK_EQUAL(motionSmoothingDrainTime(state), 0);
+}
+
+static void testReconfiguringKeepsHeldMotion(void)
+{
+	MotionSmoothingState state = {};
+	MotionFilterFunction filter = configureMotionSmoothing(state, 8 * kMillisecond);
+	int32_t dX = 100 << 16;
+	int32_t dY = 0;
+
+	state.lastTimestamp = 1000 * kMillisecond;
+	filter(state, state.lastTimestamp + kMillisecond, &dX, &dY);
+	int64_t heldX = state.lagX;
+	CHECK(heldX != 0);
+
+	// A new time constant keeps the lag, and releases it at the new rate.
+	filter = configureMotionSmoothing(state, 2 * kMillisecond);
+	CHECK_EQUAL(state.lagX, heldX);
+	CHECK_EQUAL(motionSmoothingDrainTime(state), state.lastTimestamp + (2 * kMillisecond));
+
+	// Before smoothing is disabled, one step releases everything, however soon it comes.
+	releaseMotionSmoothing(state);
+	dX = 0;
+	filter(state, state.lastTimestamp + 1, &dX, &dY);
+	CHECK_EQUAL(dX, heldX);
+	CHECK_EQUAL(motionSmoothingDrainTime(state), 0);
+	CHECK(configureMotionSmoothing(state, 0) == passthroughMotion);
+}
+
+static void testPassthroughNeverHoldsMotion(void)
+{
+	MotionSmoothingState state = {};
+	MotionFilterFunction filter = configureMotionSmoothing(state, 0);
+	int32_t dX = 5 << 16;
+	int32_t dY = 7 << 16;
+
+	filter(state, 1000, &dX, &dY);
+	CHECK_EQUAL(dX, 5 << 16);
+	CHECK_EQUAL(dY, 7 << 16);
+	CHECK_EQUAL(motionSmoothingDrainTime(state), 0);
+}
+
+int main(void)
+{
+	RUN_TEST(testSmoothingReleasesEveryFlickCompletely);
+	RUN_TEST(testSmoothingWithoutDrainLeavesTheTailBehind);
+	RUN_TEST(testSmoothingReleasesAfterLongPause);
+	RUN_TEST(testReconfiguringKeepsHeldMotion);
+	RUN_TEST(testPassthroughNeverHoldsMotion);
+
+	return finishTests();
+}
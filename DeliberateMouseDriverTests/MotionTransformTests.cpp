@@ -0,0 +1,168 @@
+//
+//  MotionTransformTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Checks that building and applying the motion transform matrix never overflows, by comparing it with 128-bit
+// reference arithmetic at the extremes of every input, and that the matrix rotates, swaps, inverts, and scales as configured.
+//
+
+#include "TestSupport.h"
+#include "MouseMotionProcessing.h"
+
+/// The limit of every matrix entry, which keeps `applyMotionTransform` within 64 bits.
+constexpr int64_t kEntryLimit = 1 << 30;
+
+static int64_t clampEntry(__int128 value)
+{
+	return int64_t((value > kEntryLimit) ? kEntryLimit : ((value < -kEntryLimit) ? -kEntryLimit : value));
+}
+
+static int32_t clampFixed(__int128 value)
+{
+	return int32_t((value > INT32_MAX) ? INT32_MAX : ((value < INT32_MIN) ? INT32_MIN : value));
+}
+
+static __int128 referenceMultiply(__int128 a, __int128 b)
+{
+	return ((a * b) + (1 << 15)) >> 16;
+}
+
+/// Builds the matrix with 128-bit intermediates, following the same steps as `buildMotionTransform`.
+static MotionTransform referenceTransform(const MotionTransformConfig& config)
+{
+	int32_t sine = 0;
+	int32_t cosine = 0;
+	sineAndCosine(config.rotationDegrees, &sine, &cosine);
+
+	__int128 r00 = cosine, r01 = -sine, r10 = sine, r11 = cosine;
+	if (config.swapAxes)
+	{
+		__int128 swap = r00; r00 = r01; r01 = swap;
+		swap = r10; r10 = r11; r11 = swap;
+	}
+
+	__int128 scaleX = (config.scaleX > kMotionTransformMaxScale) ? kMotionTransformMaxScale : ((config.scaleX < 0) ? 0 : config.scaleX);
+	__int128 scaleY = (config.scaleY > kMotionTransformMaxScale) ? kMotionTransformMaxScale : ((config.scaleY < 0) ? 0 : config.scaleY);
+	__int128 rowX = referenceMultiply(config.invertX ? -scaleX : scaleX, config.sensitivity);
+	__int128 rowY = referenceMultiply(config.invertY ? -scaleY : scaleY, config.sensitivity);
+
+	return
+	{
+		int32_t(clampEntry(referenceMultiply(rowX, r00))),
+		int32_t(clampEntry(referenceMultiply(rowX, r01))),
+		int32_t(clampEntry(referenceMultiply(rowY, r10))),
+		int32_t(clampEntry(referenceMultiply(rowY, r11))),
+	};
+}
+
+static void testExtremeConfigurationsMatchReference(void)
+{
+	static const int32_t kScales[] = { INT32_MIN, -1, 0, 1, 1 << 16, kMotionTransformMaxScale, kMotionTransformMaxScale + 1, INT32_MAX };
+	static const int32_t kSensitivities[] = { INT32_MIN, -(1 << 16), -1, 0, 1, 1 << 15, 1 << 16, 1 << 24, INT32_MAX };
+	static const int32_t kInputs[] = { INT32_MIN, INT32_MIN + 1, -(1 << 16), -1, 0, 1, 1 << 16, INT32_MAX };
+	uint32_t saturatedOutputs = 0;
+
+	for (int32_t rotation = -720; rotation <= 720; rotation += 15)
+	{
+		for (uint32_t scaleIndex = 0; scaleIndex < (sizeof(kScales) / sizeof(kScales[0])); ++scaleIndex)
+		{
+			int32_t scale = kScales[scaleIndex];
+			int32_t otherScale = kScales[(sizeof(kScales) / sizeof(kScales[0])) - 1 - scaleIndex];
+
+			for (int32_t sensitivity : kSensitivities)
+			{
+				for (uint32_t flags = 0; flags < 8; ++flags)
+				{
+					MotionTransformConfig config = { rotation, (flags & 1) != 0, (flags & 2) != 0, (flags & 4) != 0, scale, otherScale, sensitivity };
+					MotionTransform transform = buildMotionTransform(config);
+					MotionTransform expected = referenceTransform(config);
+
+					if ((transform.m00 != expected.m00) || (transform.m01 != expected.m01) || (transform.m10 != expected.m10) || (transform.m11 != expected.m11))
+					{
+						CHECK(false);
+						printf("  matrix differs for rotation %d, scale %d, sensitivity %d, flags %u\n", rotation, scale, sensitivity, flags);
+						return;
+					}
+
+					for (int32_t x : kInputs)
+					{
+						for (int32_t y : kInputs)
+						{
+							int32_t dX = 0;
+							int32_t dY = 0;
+							applyMotionTransform(transform, x, y, &dX, &dY);
+
+							int32_t expectedX = clampFixed((__int128(transform.m00) * x) + (__int128(transform.m01) * y));
+							int32_t expectedY = clampFixed((__int128(transform.m10) * x) + (__int128(transform.m11) * y));
+							saturatedOutputs += (dX == INT32_MAX) || (dX == INT32_MIN);
+
+							if ((dX != expectedX) || (dY != expectedY))
+							{
+								CHECK_EQUAL(dX, expectedX);
+								CHECK_EQUAL(dY, expectedY);
+								printf("  motion differs for %d, %d with rotation %d, scale %d, sensitivity %d\n", x, y, rotation, scale, sensitivity);
+								return;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// The extremes must really drive the output into saturation, or this test says nothing about it.
+	CHECK(saturatedOutputs > 0);
+}
+
+static void testMatrixEntriesStayWithinLimit(void)
+{
+	// The largest possible magnitudes of every factor still produce entries within 30 bits, so both products of a row and their sum fit in 64 bits.
+	MotionTransformConfig config = { 45, false, true, false, INT32_MAX, INT32_MAX, INT32_MIN };
+	MotionTransform transform = buildMotionTransform(config);
+
+	CHECK((transform.m00 >= -kEntryLimit) && (transform.m00 <= kEntryLimit));
+	CHECK((transform.m01 >= -kEntryLimit) && (transform.m01 <= kEntryLimit));
+	CHECK((transform.m10 >= -kEntryLimit) && (transform.m10 <= kEntryLimit));
+	CHECK((transform.m11 >= -kEntryLimit) && (transform.m11 <= kEntryLimit));
+	CHECK((__int128(kEntryLimit) * -__int128(INT32_MIN) * 2) <= __int128(INT64_MAX));
+}
+
+static void testTransformGeometry(void)
+{
+	int32_t dX = 0;
+	int32_t dY = 0;
+
+	// No rotation, unit scale, and unit sensitivity turns every count into one 16.16 point.
+	MotionTransform identity = buildMotionTransform({ 0, false, false, false, 1 << 16, 1 << 16, 1 << 16 });
+	applyMotionTransform(identity, 3, -4, &dX, &dY);
+	CHECK_EQUAL(dX, 3 << 16);
+	CHECK_EQUAL(dY, -(4 << 16));
+
+	// Rotating clockwise by 90 degrees on a screen, where Y points down, turns motion to the right into motion down.
+	MotionTransform quarter = buildMotionTransform({ 90, false, false, false, 1 << 16, 1 << 16, 1 << 16 });
+	applyMotionTransform(quarter, 1000, 0, &dX, &dY);
+	CHECK_EQUAL(dX, 0);
+	CHECK_EQUAL(dY, 1000 << 16);
+
+	// Swapping, then inverting X, with a half sensitivity and a double Y scale.
+	MotionTransform swapped = buildMotionTransform({ 0, true, true, false, 1 << 16, 2 << 16, 1 << 15 });
+	applyMotionTransform(swapped, 10, 20, &dX, &dY);
+	CHECK_EQUAL(dX, -(10 << 16));
+	CHECK_EQUAL(dY, 10 << 16);
+
+	// Rotations are taken modulo a full turn, in either direction.
+	MotionTransform negative = buildMotionTransform({ -270, false, false, false, 1 << 16, 1 << 16, 1 << 16 });
+	CHECK((negative.m00 == quarter.m00) && (negative.m01 == quarter.m01) && (negative.m10 == quarter.m10) && (negative.m11 == quarter.m11));
+}
+
+int main(void)
+{
+	RUN_TEST(testExtremeConfigurationsMatchReference);
+	RUN_TEST(testMatrixEntriesStayWithinLimit);
+	RUN_TEST(testTransformGeometry);
+
+	return finishTests();
+}
@@ -0,0 +1,125 @@
+//
+//  MouseReportDecoderBenchmark.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Measures the time to decode one report with each specialized decode kernel, against the generic decoder
+// on the same layout. Both are called through the function pointer the driver uses, over a buffer of random reports
+// that is larger than the L1 cache, and their results are compared so the benchmark also checks every kernel.
+//
+
+#include <vector>
+
+#include "TestSupport.h"
+#include "MouseReportDecoder.h"
+
+/// The number of distinct reports decoded in a loop, which is 256 KiB of reports.
+constexpr uint32_t kBenchmarkReportCount = 16384;
+constexpr uint32_t kBenchmarkReportStride = 16;
+/// How long each measurement runs.
+constexpr uint64_t kBenchmarkNanoseconds = 200000000;
+
+/// A layout as `parseMouseElements` computes it for a descriptor with packed buttons, X, Y, and optional wheel and pan.
+static MouseReportLayout buildLayout(bool reportID, uint32_t buttonBits, uint32_t buttonCount, uint32_t axisBits, bool wheel, bool pan)
+{
+	MouseReportLayout layout = {};
+	uint32_t offset = reportID ? 8 : 0;
+
+	layout.reportID = reportID ? 2 : 0;
+	for (uint32_t buttonIndex = 0; buttonIndex < buttonCount; ++buttonIndex)
+	{
+		addMouseReportButton(layout, buttonIndex, { uint16_t(offset + buttonIndex), 1, 0 });
+	}
+	offset += buttonBits;
+
+	layout.x = { uint16_t(offset), uint8_t(axisBits), 1 };
+	layout.y = { uint16_t(offset + axisBits), uint8_t(axisBits), 1 };
+	offset += 2 * axisBits;
+
+	if (wheel)
+	{
+		layout.wheel = { uint16_t(offset), 8, 1 };
+		offset += 8;
+	}
+	if (pan)
+	{
+		layout.pan = { uint16_t(offset), 8, 1 };
+	}
+
+	finalizeMouseReportLayout(layout);
+	return layout;
+}
+
+/// Decodes every report in the buffer once per iteration through the given function pointer.
+static double measureDecode(MouseDecodeFunction volatile* decode, const MouseReportLayout& layout, const std::vector<uint8_t>& reports, int64_t* checksum)
+{
+	int64_t sum = 0;
+	double nanoseconds = measureNanoseconds(kBenchmarkNanoseconds, [&](uint64_t iteration)
+	{
+		const uint8_t* report = &reports[(iteration % kBenchmarkReportCount) * kBenchmarkReportStride];
+		MouseReport mouseReport;
+		(*decode)(layout, report, layout.minimumLength, &mouseReport);
+		sum += mouseReport.x + mouseReport.y + mouseReport.wheel + mouseReport.pan + mouseReport.buttons;
+	});
+
+	*checksum = sum;
+	return nanoseconds;
+}
+
+static void benchmarkLayout(const char* name, const MouseReportLayout& layout, const std::vector<uint8_t>& reports)
+{
+	CHECK(layout.decode != decodeGenericMouseReport);
+
+	// Every kernel must agree with the generic decoder before its speed means anything.
+	for (uint32_t reportIndex = 0; reportIndex < kBenchmarkReportCount; ++reportIndex)
+	{
+		const uint8_t* report = &reports[reportIndex * kBenchmarkReportStride];
+		MouseReport specialized = {};
+		MouseReport generic = {};
+		layout.decode(layout, report, layout.minimumLength, &specialized);
+		decodeGenericMouseReport(layout, report, layout.minimumLength, &generic);
+
+		if ((specialized.x != generic.x) || (specialized.y != generic.y) || (specialized.wheel != generic.wheel) ||
+			(specialized.pan != generic.pan) || (specialized.buttons != generic.buttons))
+		{
+			CHECK(false);
+			printf("  %s disagrees with the generic decoder on report %u\n", name, reportIndex);
+			return;
+		}
+	}
+
+	MouseDecodeFunction volatile specializedDecode = layout.decode;
+	MouseDecodeFunction volatile genericDecode = decodeGenericMouseReport;
+	int64_t specializedChecksum = 0;
+	int64_t genericChecksum = 0;
+	double specializedNanoseconds = measureDecode(&specializedDecode, layout, reports, &specializedChecksum);
+	double genericNanoseconds = measureDecode(&genericDecode, layout, reports, &genericChecksum);
+
+	printf("  %-58s %6.2f ns specialized, %6.2f ns generic, %5.2fx\n", layout.decodeName, specializedNanoseconds, genericNanoseconds,
+		genericNanoseconds / specializedNanoseconds);
+}
+
+static void benchmarkDecodeKernels(void)
+{
+	TestRandom random = { 0x9E3779B97F4A7C15ULL };
+	std::vector<uint8_t> reports(kBenchmarkReportCount * kBenchmarkReportStride);
+	for (uint8_t& byte : reports)
+	{
+		byte = uint8_t(random.next());
+	}
+
+	benchmarkLayout("boot", buildLayout(false, 8, 3, 8, false, false), reports);
+	benchmarkLayout("boot + wheel", buildLayout(false, 8, 5, 8, true, false), reports);
+	benchmarkLayout("8-bit buttons + 12-bit X/Y + wheel + pan", buildLayout(true, 8, 8, 12, true, true), reports);
+	benchmarkLayout("16-bit buttons + 12-bit X/Y + wheel + pan", buildLayout(true, 16, 16, 12, true, true), reports);
+	benchmarkLayout("16-bit buttons + 16-bit X/Y + wheel + pan", buildLayout(false, 16, 16, 16, true, true), reports);
+}
+
+int main(void)
+{
+	RUN_TEST(benchmarkDecodeKernels);
+
+	return finishTests();
+}
@@ -0,0 +1,311 @@
+//
+//  MouseReportDecoderTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Fuzzes the report decoder against a bit by bit reference, and checks that a computed layout
+// keeps being verified until every one of its fields has been seen to change.
+//
+
+#include "TestSupport.h"
+#include "MouseReportDecoder.h"
+
+/// The number of random layouts and reports each fuzz test tries.
+constexpr uint32_t kFuzzIterations = 200000;
+
+/// Reads a field one bit at a time. Bits past the end of the report read as 0, like the decoder.
+static int32_t referenceField(const uint8_t* report, uint32_t reportLength, MouseReportField field)
+{
+	uint64_t value = 0;
+	for (uint32_t bit = 0; bit < field.bitSize; ++bit)
+	{
+		uint32_t position = field.bitOffset + bit;
+		uint64_t set = ((position / 8) < reportLength) ? ((report[position / 8] >> (position % 8)) & 1) : 0;
+		value |= set << bit;
+	}
+
+	if (field.isSigned && (field.bitSize < 64) && ((value >> (field.bitSize - 1)) & 1))
+	{
+		value |= ~0ULL << field.bitSize;
+	}
+
+	return int32_t(uint32_t(value));
+}
+
+/// Decodes a report with `referenceField`, for comparison with the decode function selected for the layout.
+static MouseReport referenceDecode(const MouseReportLayout& layout, const uint8_t* report, uint32_t reportLength)
+{
+	MouseReport mouseReport = {};
+	mouseReport.x = (layout.x.bitSize != 0) ? referenceField(report, reportLength, layout.x) : 0;
+	mouseReport.y = (layout.y.bitSize != 0) ? referenceField(report, reportLength, layout.y) : 0;
+	mouseReport.wheel = (layout.wheel.bitSize != 0) ? referenceField(report, reportLength, layout.wheel) : 0;
+	mouseReport.pan = (layout.pan.bitSize != 0) ? referenceField(report, reportLength, layout.pan) : 0;
+
+	for (uint32_t buttonIndex = 0; buttonIndex < layout.buttonCount; ++buttonIndex)
+	{
+		uint32_t pressed = (referenceField(report, reportLength, layout.buttonFields[buttonIndex]) != 0);
+		mouseReport.buttons |= pressed << layout.buttonIndices[buttonIndex];
+	}
+	mouseReport.buttonMask = layout.buttonMask;
+
+	return mouseReport;
+}
+
+static void fillRandom(TestRandom& random, uint8_t* bytes, uint32_t length)
+{
+	for (uint32_t index = 0; index < length; ++index)
+	{
+		bytes[index] = uint8_t(random.next());
+	}
+}
+
+/// Builds a layout like the ones `parseMouseElements` computes, with every field at the sum of the sizes before it.
+/// Half of the layouts use the shapes of the specialized kernels, so every kernel is exercised.
+static MouseReportLayout randomLayout(TestRandom& random)
+{
+	MouseReportLayout layout = {};
+	bool wellKnown = (random.below(2) == 0);
+
+	layout.reportID = random.below(2) ? (1 + random.below(255)) : 0;
+	uint32_t offset = (layout.reportID != 0) ? 8 : 0;
+
+	static const uint32_t kButtonBits[] = { 8, 16 };
+	static const uint32_t kAxisBits[] = { 8, 12, 16 };
+	uint32_t buttonBits = wellKnown ? kButtonBits[random.below(2)] : (1 + random.below(24));
+	uint32_t buttonCount = 1 + random.below((buttonBits < kMouseReportMaxButtons) ? buttonBits : kMouseReportMaxButtons);
+	uint32_t buttonSize = wellKnown ? 1 : (1 + random.below(2));
+	buttonCount = ((buttonCount * buttonSize) <= buttonBits) ? buttonCount : (buttonBits / buttonSize);
+
+	for (uint32_t buttonIndex = 0; buttonIndex < buttonCount; ++buttonIndex)
+	{
+		addMouseReportButton(layout, buttonIndex, { uint16_t(offset + (buttonIndex * buttonSize)), uint8_t(buttonSize), 0 });
+	}
+	offset += buttonBits;
+
+	uint32_t axisBits = wellKnown ? kAxisBits[random.below(3)] : (1 + random.below(32));
+	layout.x = { uint16_t(offset), uint8_t(axisBits), 1 };
+	layout.y = { uint16_t(offset + axisBits), uint8_t(axisBits), uint8_t(wellKnown ? 1 : random.below(2)) };
+	offset += 2 * axisBits;
+
+	if (random.below(3) != 0)
+	{
+		uint32_t wheelBits = wellKnown ? 8 : (1 + random.below(16));
+		layout.wheel = { uint16_t(offset), uint8_t(wheelBits), 1 };
+		offset += wheelBits;
+
+		if (random.below(2) != 0)
+		{
+			layout.pan = { uint16_t(offset), uint8_t(wheelBits), 1 };
+		}
+	}
+
+	finalizeMouseReportLayout(layout);
+	return layout;
+}
+
+static bool reportsEqual(const MouseReport& a, const MouseReport& b)
+{
+	return (a.x == b.x) && (a.y == b.y) && (a.wheel == b.wheel) && (a.pan == b.pan) && (a.buttons == b.buttons) && (a.buttonMask == b.buttonMask);
+}
+
+static void testExtractReportFieldMatchesReference(void)
+{
+	TestRandom random = { 0x0123456789ABCDEFULL };
+	uint8_t report[80];
+
+	for (uint32_t iteration = 0; iteration < kFuzzIterations; ++iteration)
+	{
+		uint32_t reportLength = 1 + random.below(64);
+		fillRandom(random, report, sizeof(report));
+
+		// Fields may run past the end of the report, which only happens for reports shorter than their layout.
+		MouseReportField field = { uint16_t(random.below(reportLength * 8 + 16)), uint8_t(1 + random.below(32)), uint8_t(random.below(2)) };
+
+		int32_t expected = referenceField(report, reportLength, field);
+		int32_t actual = extractReportField(report, reportLength, field);
+		if (actual != expected)
+		{
+			CHECK_EQUAL(actual, expected);
+			printf("  field at bit %u, %u bits, signed %u, report length %u\n", field.bitOffset, field.bitSize, field.isSigned, reportLength);
+			return;
+		}
+	}
+}
+
+static void testDecodeFunctionsMatchReference(void)
+{
+	TestRandom random = { 0xFEEDFACECAFEBEEFULL };
+	uint8_t report[32];
+	uint32_t specializedLayouts = 0;
+
+	for (uint32_t iteration = 0; iteration < kFuzzIterations; ++iteration)
+	{
+		MouseReportLayout layout = randomLayout(random);
+		specializedLayouts += (layout.decode != decodeGenericMouseReport);
+
+		fillRandom(random, report, sizeof(report));
+		CHECK(layout.minimumLength <= sizeof(report));
+
+		MouseReport expected = referenceDecode(layout, report, layout.minimumLength);
+		MouseReport selected = {};
+		MouseReport generic = {};
+		bool decoded = layout.decode(layout, report, layout.minimumLength, &selected);
+		decodeGenericMouseReport(layout, report, layout.minimumLength, &generic);
+
+		if ((decoded == false) || !reportsEqual(selected, expected) || !reportsEqual(generic, expected))
+		{
+			CHECK(decoded);
+			CHECK(reportsEqual(selected, expected));
+			CHECK(reportsEqual(generic, expected));
+			printf("  layout decoded by %s, iteration %u\n", layout.decodeName, iteration);
+			return;
+		}
+
+		// A report that is too short for the layout is never decoded.
+		if (layout.minimumLength > 0)
+		{
+			CHECK(layout.decode(layout, report, layout.minimumLength - 1, &selected) == false);
+		}
+	}
+
+	// The well known shapes must actually select the specialized kernels, or this test says nothing about them.
+	printf("  %u of %u layouts used a specialized kernel\n", specializedLayouts, kFuzzIterations);
+	CHECK(specializedLayouts > (kFuzzIterations / 10));
+}
+
+/// Builds an 8-bit button, 16-bit X/Y, 8-bit wheel, 8-bit pan report.
+static void buildWideReport(uint8_t (&report)[7], uint8_t buttons, int16_t x, int16_t y, int8_t wheel, int8_t pan)
+{
+	report[0] = buttons;
+	report[1] = uint8_t(x);
+	report[2] = uint8_t(uint16_t(x) >> 8);
+	report[3] = uint8_t(y);
+	report[4] = uint8_t(uint16_t(y) >> 8);
+	report[5] = uint8_t(wheel);
+	report[6] = uint8_t(pan);
+}
+
+static MouseDecodePlan wideReportPlan(uint16_t wheelOffset)
+{
+	MouseDecodePlan plan = {};
+	MouseReportLayout& layout = plan.layouts[0];
+	plan.layoutCount = 1;
+
+	for (uint32_t buttonIndex = 0; buttonIndex < 3; ++buttonIndex)
+	{
+		addMouseReportButton(layout, buttonIndex, { uint16_t(buttonIndex), 1, 0 });
+	}
+	layout.x = { 8, 16, 1 };
+	layout.y = { 24, 16, 1 };
+	layout.wheel = { wheelOffset, 8, 1 };
+	layout.pan = { 48, 8, 1 };
+	finalizeMouseReportLayout(layout);
+
+	return plan;
+}
+
+static void testVerificationContinuesUntilEveryFieldChanges(void)
+{
+	MouseDecodePlan plan = wideReportPlan(40);
+	const MouseReportLayout& layout = plan.layouts[0];
+	MouseDecodeState state = {};
+	uint8_t report[7];
+	MouseReport decoded = {};
+
+	initializeMouseDecodeState(state, plan, 1000);
+	CHECK_EQUAL(state.unverifiedFields[0], 0x7ULL | kMouseReportFieldX | kMouseReportFieldY | kMouseReportFieldWheel | kMouseReportFieldPan);
+
+	// Far more reports than the old fixed verification window, but only the sensor moves.
+	for (int16_t step = 1; step <= 100; ++step)
+	{
+		buildWideReport(report, 0, step, int16_t(-step), 0, 0);
+		layout.decode(layout, report, sizeof(report), &decoded);
+		recordVerifiedMouseReport(state, layout, 0, decoded);
+	}
+	CHECK(mouseReportNeedsVerification(state, 0));
+	CHECK_EQUAL(state.unverifiedFields[0], 0x7ULL | kMouseReportFieldWheel | kMouseReportFieldPan);
+
+	// Releasing a button is a change as well as pressing it.
+	buildWideReport(report, 0x5, 0, 0, 1, -1);
+	layout.decode(layout, report, sizeof(report), &decoded);
+	recordVerifiedMouseReport(state, layout, 0, decoded);
+	CHECK_EQUAL(state.unverifiedFields[0], 0x2ULL);
+
+	buildWideReport(report, 0x2, 0, 0, 0, 0);
+	layout.decode(layout, report, sizeof(report), &decoded);
+	recordVerifiedMouseReport(state, layout, 0, decoded);
+	CHECK_EQUAL(state.unverifiedFields[0], 0ULL);
+	CHECK(mouseReportNeedsVerification(state, 0) == false);
+}
+
+static void testVerificationStopsAtReportLimit(void)
+{
+	MouseDecodePlan plan = wideReportPlan(40);
+	const MouseReportLayout& layout = plan.layouts[0];
+	MouseDecodeState state = {};
+	uint8_t report[7];
+	MouseReport decoded = {};
+
+	// Button 3 never changes, like a button the mouse does not have.
+	initializeMouseDecodeState(state, plan, 8);
+	for (int16_t step = 1; step <= 8; ++step)
+	{
+		CHECK(mouseReportNeedsVerification(state, 0));
+		buildWideReport(report, uint8_t(step & 3), step, step, int8_t(step), int8_t(step));
+		layout.decode(layout, report, sizeof(report), &decoded);
+		recordVerifiedMouseReport(state, layout, 0, decoded);
+	}
+
+	CHECK_EQUAL(state.unverifiedFields[0], 0x4ULL);
+	CHECK(mouseReportNeedsVerification(state, 0) == false);
+}
+
+static void testVerificationFindsMisplacedFieldAfterManyReports(void)
+{
+	// The computed wheel overlaps the pan field, which only moves long after the mouse started moving.
+	MouseDecodePlan truePlan = wideReportPlan(40);
+	MouseDecodePlan wrongPlan = wideReportPlan(48);
+	const MouseReportLayout& trueLayout = truePlan.layouts[0];
+	const MouseReportLayout& wrongLayout = wrongPlan.layouts[0];
+	MouseDecodeState state = {};
+	uint8_t report[7];
+	uint32_t mismatchReport = 0;
+
+	initializeMouseDecodeState(state, wrongPlan, 65536);
+	for (uint32_t reportIndex = 1; (reportIndex <= 1000) && (mismatchReport == 0); ++reportIndex)
+	{
+		int8_t pan = (reportIndex >= 500) ? 1 : 0;
+		buildWideReport(report, 0, int16_t(reportIndex), 0, 0, pan);
+
+		// The element values stand in for the values the OS parsed.
+		MouseReport decoded = {};
+		MouseReport elements = {};
+		wrongLayout.decode(wrongLayout, report, sizeof(report), &decoded);
+		trueLayout.decode(trueLayout, report, sizeof(report), &elements);
+
+		CHECK(mouseReportNeedsVerification(state, 0));
+		if (mouseReportsMatch(wrongLayout, decoded, elements) == false)
+		{
+			mismatchReport = reportIndex;
+		}
+		else
+		{
+			recordVerifiedMouseReport(state, wrongLayout, 0, decoded);
+		}
+	}
+
+	CHECK_EQUAL(mismatchReport, 500);
+}
+
+int main(void)
+{
+	RUN_TEST(testExtractReportFieldMatchesReference);
+	RUN_TEST(testDecodeFunctionsMatchReference);
+	RUN_TEST(testVerificationContinuesUntilEveryFieldChanges);
+	RUN_TEST(testVerificationStopsAtReportLimit);
+	RUN_TEST(testVerificationFindsMisplacedFieldAfterManyReports);
+
+	return finishTests();
+}
@@ -0,0 +1,146 @@
+//
+//  RegionLayoutBenchmark.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Measures what a concurrent writer costs the report path, with the report state, the configuration it reads,
+// and the counters another queue writes packed together like the ivars were, and split into cache line aligned
+// hot, warm, and cold regions like they are now. False sharing needs the two threads on different cores at once,
+// so on a machine with a single CPU the benchmark still runs, but can only show the cost of the extra thread.
+//
+
+#include <stddef.h>
+
+#include <atomic>
+#include <thread>
+
+#include "TestSupport.h"
+
+/// The cache line size the driver aligns its regions to, the size of a cache line on Apple silicon.
+constexpr size_t kRegionAlignment = 128;
+/// How long each measurement runs.
+constexpr uint64_t kBenchmarkNanoseconds = 200000000;
+
+/// The state the report path writes on every report.
+struct HotFields
+{
+	uint32_t buttonState;
+	int32_t remainderX;
+	int32_t remainderY;
+	uint64_t lastTimestamp;
+	uint64_t reportCount;
+};
+
+/// The configuration the report path reads on every report.
+struct WarmFields
+{
+	int32_t scale;
+	uint32_t swallowedButtons;
+};
+
+/// The fields another queue writes, like the memory footprint and the lifecycle state.
+struct ColdFields
+{
+	std::atomic<uint64_t> writes;
+};
+
+/// Every field in one allocation, the layout of the ivars before they were split into regions.
+struct PackedLayout
+{
+	HotFields hot;
+	WarmFields warm;
+	ColdFields cold;
+};
+
+/// Each region on its own cache lines, the layout of the ivars now.
+struct SplitLayout
+{
+	alignas(kRegionAlignment) HotFields hot;
+	alignas(kRegionAlignment) WarmFields warm;
+	alignas(kRegionAlignment) ColdFields cold;
+};
+
+/// Does the work of the report path on the fields of one report.
+static inline void updateReportState(HotFields& hot, const WarmFields& warm, uint64_t iteration)
+{
+	int64_t scaledX = (int64_t(int32_t(iteration & 7) - 3) * warm.scale) + hot.remainderX;
+	int64_t scaledY = (int64_t(int32_t((iteration >> 3) & 7) - 3) * warm.scale) + hot.remainderY;
+	hot.remainderX = int32_t(scaledX & 0xFFFF);
+	hot.remainderY = int32_t(scaledY & 0xFFFF);
+	hot.buttonState = uint32_t(iteration >> 6) & ~warm.swallowedButtons;
+	hot.lastTimestamp = iteration;
+	++hot.reportCount;
+}
+
+/// Measures the report path on a layout, optionally while another thread keeps writing its cold fields.
+/// - Parameters:
+///   - layout: The layout to measure
+///   - concurrentWriter: Whether another thread writes the cold fields during the measurement
+/// - Returns: The average duration of one report, in nanoseconds
+template <typename Layout>
+static double measureLayout(Layout& layout, bool concurrentWriter)
+{
+	std::atomic<bool> running { true };
+	std::thread writer;
+	if (concurrentWriter == true)
+	{
+		writer = std::thread([&]()
+		{
+			while (running.load(std::memory_order_relaxed) == true)
+			{
+				layout.cold.writes.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+
+	double nanoseconds = measureNanoseconds(kBenchmarkNanoseconds, [&](uint64_t iteration)
+	{
+		updateReportState(layout.hot, layout.warm, iteration);
+		// Keeps the compiler from folding the updates of a batch into one.
+		__asm__ volatile("" : : "r"(&layout.hot) : "memory");
+	});
+
+	running.store(false);
+	if (writer.joinable())
+	{
+		writer.join();
+	}
+	return nanoseconds;
+}
+
+static void benchmarkRegionLayout(void)
+{
+	static PackedLayout packed = {};
+	static SplitLayout split = {};
+	packed.warm = { 1 << 16, 0 };
+	split.warm = { 1 << 16, 0 };
+
+	// The regions really are on separate cache lines, and the packed fields really share one.
+	CHECK((offsetof(SplitLayout, warm) - offsetof(SplitLayout, hot)) >= kRegionAlignment);
+	CHECK((offsetof(SplitLayout, cold) - offsetof(SplitLayout, warm)) >= kRegionAlignment);
+	CHECK(sizeof(PackedLayout) <= kRegionAlignment);
+
+	unsigned int processorCount = std::thread::hardware_concurrency();
+	printf("  %u processors%s\n", processorCount, (processorCount < 2) ? ", so the threads never run at once and nothing is falsely shared" : "");
+
+	double packedIdle = measureLayout(packed, false);
+	double packedWriter = measureLayout(packed, true);
+	double splitIdle = measureLayout(split, false);
+	double splitWriter = measureLayout(split, true);
+	printf("  packed: %.2f ns per report, %.2f ns with a concurrent writer\n", packedIdle, packedWriter);
+	printf("  split:  %.2f ns per report, %.2f ns with a concurrent writer\n", splitIdle, splitWriter);
+
+	// Both the report path and the writer really ran.
+	CHECK((packed.hot.reportCount > 0) && (split.hot.reportCount > 0));
+	CHECK(packed.cold.writes.load() > 0);
+	CHECK(split.cold.writes.load() > 0);
+}
+
+int main(void)
+{
+	RUN_TEST(benchmarkRegionLayout);
+
+	return finishTests();
+}
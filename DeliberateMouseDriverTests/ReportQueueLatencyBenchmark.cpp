@@ -0,0 +1,199 @@
+//
+//  ReportQueueLatencyBenchmark.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Measures how long a report waits between arriving and being dispatched as an event, with the driver handling reports on
+// its default queue, like it did before it had a report queue, and on its own report queue. Each layout is measured idle and
+// while a client keeps reconfiguring the driver and opening user clients, which are RPCs that run on the default queue.
+//
+
+#include <algorithm>
+#include <vector>
+
+#include "TestSupport.h"
+#include "MockDriverSupport.h"
+
+/// The number of reports delivered in each measurement, at the 1 kHz of a gaming mouse.
+constexpr uint32_t kLatencyReportCount = 3000;
+constexpr uint64_t kLatencyReportIntervalNanoseconds = 1000000;
+
+/// The percentiles of the delay of the reports of a measurement.
+struct LatencyResult
+{
+	uint64_t reportCount;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+	uint64_t configurationCalls;
+};
+
+/// Reconfigures the driver with the properties a settings app sends when a slider moves.
+/// - Parameters:
+///   - driver: The driver to configure
+///   - iteration: Varies the values, so every call changes the configuration
+static void sendConfiguration(DeliberateMouseDriver* driver, uint32_t iteration)
+{
+	OSDictionary* properties = OSDictionary::withCapacity(4);
+	OSArray* curve = OSArray::withCapacity(8);
+	OSArray* stages = OSArray::withCapacity(4);
+	// Half turns keep the motion on the X axis, so every report still moves the pointer.
+	OSNumber* rotation = OSNumber::withNumber(((iteration & 1) != 0) ? 180 : 0, 32);
+
+	for (uint32_t point = 0; point < 8; ++point)
+	{
+		OSNumber* percent = OSNumber::withNumber(100 + (point * (10 + (iteration % 20))), 32);
+		curve->setObject(percent);
+		percent->release();
+	}
+	for (uint32_t stage = 0; stage < 4; ++stage)
+	{
+		OSNumber* percent = OSNumber::withNumber(50 + (stage * 50) + (iteration % 10), 32);
+		stages->setObject(percent);
+		percent->release();
+	}
+	properties->setObject("ScrollAccelerationCurvePercent", curve);
+	properties->setObject("SensitivityStagesPercent", stages);
+	properties->setObject("MotionRotationDegrees", rotation);
+
+	mockCallOnDefaultQueue(driver, [=]()
+	{
+		driver->SetProperties(properties);
+	});
+
+	rotation->release();
+	stages->release();
+	curve->release();
+	properties->release();
+}
+
+/// Opens and closes a user client, which creates and starts a service on the default queue of the driver.
+static void cycleUserClient(DeliberateMouseDriver* driver)
+{
+	IOUserClient* client = nullptr;
+	mockCallOnDefaultQueue(driver, [&]()
+	{
+		driver->NewUserClient(0, &client);
+	});
+
+	if (client != nullptr)
+	{
+		mockCallOnDefaultQueue(client, [=]()
+		{
+			client->Stop(driver);
+		});
+		client->release();
+	}
+}
+
+/// Delivers reports to a driver at 1 kHz and measures their delay.
+/// - Parameters:
+///   - sharedQueue: Whether reports are handled on the default queue instead of a report queue
+///   - configurationLoad: Whether a client reconfigures the driver while the reports arrive
+/// - Returns: The delays of the reports, in nanoseconds
+static LatencyResult measureReportLatency(bool sharedQueue, bool configurationLoad)
+{
+	IOHIDInterface* interface = createMockInterface(false);
+	MockMouse mouse = {};
+	std::mutex samplesMutex;
+	std::vector<uint64_t> samples;
+	samples.reserve(kLatencyReportCount);
+
+	IODispatchQueue::mockSetCreateReturnsCurrentQueue(sharedQueue);
+	kern_return_t ret = startMockMouse(interface, {}, &mouse);
+	IODispatchQueue::mockSetCreateReturnsCurrentQueue(false);
+	CHECK_EQUAL(ret, kIOReturnSuccess);
+
+	mouse.driver->mockSetEventHandler([&](const MockHIDEvent& event)
+	{
+		if ((event.scroll == false) && (event.dx != 0))
+		{
+			uint64_t now = mach_absolute_time();
+			std::lock_guard<std::mutex> lock(samplesMutex);
+			samples.push_back(now - event.timestamp);
+		}
+	});
+
+	std::atomic<bool> running { true };
+	std::atomic<uint64_t> configurationCalls { 0 };
+	std::thread client;
+	if (configurationLoad == true)
+	{
+		client = std::thread([&]()
+		{
+			for (uint32_t iteration = 0; running.load() == true; ++iteration)
+			{
+				sendConfiguration(mouse.driver, iteration);
+				if ((iteration % 8) == 0)
+				{
+					cycleUserClient(mouse.driver);
+				}
+				++configurationCalls;
+			}
+		});
+	}
+
+	uint64_t deadline = mach_absolute_time();
+	for (uint32_t reportIndex = 0; reportIndex < kLatencyReportCount; ++reportIndex)
+	{
+		deadline += kLatencyReportIntervalNanoseconds;
+		while (mach_absolute_time() < deadline)
+		{
+			std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - mach_absolute_time()));
+		}
+
+		// The configuration scales motion down to half, so each report moves far enough that its motion is never rounded away.
+		uint8_t report[kMockMouseReportLength];
+		buildMockMouseReport(0, ((reportIndex & 1) != 0) ? 4 : -4, 0, 0, report);
+		interface->mockDeliverReport(mach_absolute_time(), report, kMockMouseReportLength);
+	}
+
+	running.store(false);
+	if (client.joinable())
+	{
+		client.join();
+	}
+
+	CHECK(stopMockMouse(&mouse));
+	interface->release();
+
+	std::sort(samples.begin(), samples.end());
+	LatencyResult result = { samples.size(), 0, 0, 0, 0, configurationCalls.load() };
+	if (samples.empty() == false)
+	{
+		result.p50 = samples[samples.size() / 2];
+		result.p99 = samples[(samples.size() * 99) / 100];
+		result.p999 = samples[(samples.size() * 999) / 1000];
+		result.max = samples.back();
+	}
+	return result;
+}
+
+static void benchmarkReportQueueLatency(void)
+{
+	for (bool configurationLoad : { false, true })
+	{
+		for (bool sharedQueue : { true, false })
+		{
+			LatencyResult result = measureReportLatency(sharedQueue, configurationLoad);
+			printf("  %s queue, %s: p50 %llu us, p99 %llu us, p99.9 %llu us, max %llu us, %llu configuration calls\n",
+				sharedQueue ? "default" : "report", configurationLoad ? "configuration load" : "idle",
+				(unsigned long long)(result.p50 / 1000), (unsigned long long)(result.p99 / 1000), (unsigned long long)(result.p999 / 1000),
+				(unsigned long long)(result.max / 1000), (unsigned long long)result.configurationCalls);
+
+			// Every report must be dispatched, whichever queue handles it.
+			CHECK_EQUAL(result.reportCount, kLatencyReportCount);
+			CHECK((configurationLoad == false) || (result.configurationCalls > 0));
+		}
+	}
+}
+
+int main(void)
+{
+	RUN_TEST(benchmarkReportQueueLatency);
+
+	return finishTests();
+}
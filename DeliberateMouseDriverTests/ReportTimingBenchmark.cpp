@@ -0,0 +1,63 @@
+//
+//  ReportTimingBenchmark.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Measures what the interval statistics and incident detection add to each report, which is the latency they add to the
+// report path, with the 1/1 timebase of Intel Macs and the 125/3 timebase of Apple silicon.
+//
+
+#include <vector>
+
+#include "TestSupport.h"
+#include "ReportTimingStatistics.h"
+
+/// The number of precomputed timestamps replayed in a loop.
+constexpr uint32_t kBenchmarkTimestampCount = 65536;
+/// How long each measurement runs.
+constexpr uint64_t kBenchmarkNanoseconds = 200000000;
+
+static void benchmarkReportTiming(void)
+{
+	static const mach_timebase_info_data_t kTimebases[] = { { 1, 1 }, { 125, 3 } };
+
+	for (const mach_timebase_info_data_t& timebase : kTimebases)
+	{
+		// 8 kHz reports with 2 microseconds of jitter, and a lost report every 1000 reports, in ticks of this timebase.
+		std::vector<uint64_t> intervals(kBenchmarkTimestampCount);
+		TestRandom random = { 8000 };
+		for (uint32_t intervalIndex = 0; intervalIndex < kBenchmarkTimestampCount; ++intervalIndex)
+		{
+			uint64_t nanoseconds = ((intervalIndex % 1000) == 999) ? 625000 : (123000 + random.below(4000));
+			intervals[intervalIndex] = (nanoseconds * timebase.denom) / timebase.numer;
+		}
+
+		ReportIntervalStatistics statistics = {};
+		ReportIncidentLog incidents = {};
+		uint64_t timestamp = 1;
+
+		double nanoseconds = measureNanoseconds(kBenchmarkNanoseconds, [&](uint64_t iteration)
+		{
+			timestamp += intervals[iteration % kBenchmarkTimestampCount];
+			uint64_t interval = recordReportInterval(statistics, timebase, timestamp);
+			detectReportIncidents(incidents, statistics, interval, timestamp, 100000, 8);
+		});
+
+		DeliberateMouseIntervalStatistics snapshot = {};
+		snapshotReportIntervalStatistics(statistics, &snapshot);
+		printf("  timebase %u/%u: %.2f ns per report, mean interval %llu ns, %llu gaps\n", timebase.numer, timebase.denom, nanoseconds,
+			(unsigned long long)snapshot.meanNanoseconds, (unsigned long long)incidents.gapCount);
+
+		CHECK((snapshot.meanNanoseconds > 123000) && (snapshot.meanNanoseconds < 126000));
+		CHECK(incidents.gapCount > 0);
+	}
+}
+
+int main(void)
+{
+	RUN_TEST(benchmarkReportTiming);
+
+	return finishTests();
+}
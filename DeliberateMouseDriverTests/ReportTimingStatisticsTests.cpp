@@ -0,0 +1,266 @@
+//
+//  ReportTimingStatisticsTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Replays report timestamps at 1, 2, 4, and 8 kHz with jitter, in the 24 MHz ticks of Apple silicon, and checks that the
+// integer-only interval statistics match a floating point reference and that the histogram finds the polling rate.
+// Also replays slow motion, pauses, lost reports, and stalls, and checks that only the lost reports and stalls are gaps.
+//
+
+#include <math.h>
+
+#include "TestSupport.h"
+#include "ReportTimingStatistics.h"
+
+/// The timebase of Apple silicon, where one tick is 125/3 nanoseconds.
+static const mach_timebase_info_data_t kTimebase = { 125, 3 };
+
+/// The statistics of the same intervals in double precision.
+struct ReferenceStatistics
+{
+	uint64_t count;
+	double mean;
+	double m2;
+
+	void add(double interval)
+	{
+		++count;
+		double delta = interval - mean;
+		mean += delta / double(count);
+		m2 += delta * (interval - mean);
+	}
+};
+
+/// Replays a polling interval with uniform jitter, and compares the statistics with the reference.
+/// - Parameters:
+///   - pollingNanoseconds: The polling interval of the simulated device
+///   - jitterNanoseconds: The largest difference of any interval from the polling interval
+///   - intervalCount: The number of intervals to replay
+static void checkPollingRate(uint64_t pollingNanoseconds, uint64_t jitterNanoseconds, uint32_t intervalCount)
+{
+	ReportIntervalStatistics statistics = {};
+	ReferenceStatistics reference = {};
+	TestRandom random = { pollingNanoseconds };
+
+	// Timestamps are generated in nanoseconds and rounded to ticks, as the hardware does, so the reference measures the same rounded intervals.
+	uint64_t nanoseconds = 1000000000;
+	uint64_t lastTicks = 0;
+	for (uint32_t intervalIndex = 0; intervalIndex <= intervalCount; ++intervalIndex)
+	{
+		uint64_t ticks = (nanoseconds * 3) / 125;
+		recordReportInterval(statistics, kTimebase, ticks);
+		if (lastTicks != 0)
+		{
+			reference.add(double(absoluteTimeToNanoseconds(kTimebase, ticks - lastTicks)));
+		}
+		lastTicks = ticks;
+		nanoseconds += pollingNanoseconds - jitterNanoseconds + random.below(uint32_t(2 * jitterNanoseconds + 1));
+	}
+
+	DeliberateMouseIntervalStatistics snapshot = {};
+	snapshotReportIntervalStatistics(statistics, &snapshot);
+
+	double referenceVariance = reference.m2 / double(reference.count - 1);
+	printf("  %5llu Hz: mean %llu ns (reference %.2f), jitter %.1f ns (reference %.1f)\n", (unsigned long long)(1000000000 / pollingNanoseconds),
+		(unsigned long long)snapshot.meanNanoseconds, reference.mean, sqrt(double(snapshot.varianceNanoseconds)), sqrt(referenceVariance));
+
+	CHECK_EQUAL(snapshot.reportCount, intervalCount + 1);
+	CHECK_EQUAL(snapshot.intervalCount, intervalCount);
+	CHECK_EQUAL(snapshot.idleCount, 0);
+	CHECK(fabs(double(snapshot.meanNanoseconds) - reference.mean) <= 1.0);
+	CHECK(fabs(double(snapshot.varianceNanoseconds) - referenceVariance) <= (referenceVariance * 0.001) + 1.0);
+	CHECK(snapshot.minimumNanoseconds >= pollingNanoseconds - jitterNanoseconds - 42);
+	CHECK(snapshot.maximumNanoseconds <= pollingNanoseconds + jitterNanoseconds + 42);
+
+	// The fullest bucket of the histogram holds the polling interval.
+	uint32_t fullestBucket = 0;
+	for (uint32_t bucketIndex = 0; bucketIndex < kDeliberateMouseIntervalBucketCount; ++bucketIndex)
+	{
+		fullestBucket = (snapshot.buckets[bucketIndex] > snapshot.buckets[fullestBucket]) ? bucketIndex : fullestBucket;
+	}
+	CHECK(DeliberateMouseIntervalBucketLowerBound(fullestBucket) <= pollingNanoseconds + jitterNanoseconds);
+	CHECK(DeliberateMouseIntervalBucketLowerBound(fullestBucket + 1) > pollingNanoseconds - jitterNanoseconds);
+}
+
+static void testPollingRatesMatchReference(void)
+{
+	checkPollingRate(1000000, 20000, 200000);
+	checkPollingRate(500000, 10000, 200000);
+	checkPollingRate(250000, 5000, 200000);
+	checkPollingRate(125000, 2000, 200000);
+
+	// A device without jitter has no variance, apart from the rounding of its timestamps to ticks.
+	checkPollingRate(125000, 0, 10000);
+}
+
+static void testRateChangeAfterLongRun(void)
+{
+	// The fixed point mean must keep moving after millions of intervals, when each interval only moves it by a fraction of a nanosecond.
+	ReportIntervalStatistics statistics = {};
+	ReferenceStatistics reference = {};
+
+	uint64_t timestamp = 1;
+	for (uint32_t intervalIndex = 0; intervalIndex < 3000000; ++intervalIndex)
+	{
+		uint64_t interval = (intervalIndex < 2000000) ? 1000000 : 125000;
+		timestamp += interval;
+		recordReportInterval(statistics, { 1, 1 }, timestamp);
+		reference.add(double(interval));
+	}
+
+	DeliberateMouseIntervalStatistics snapshot = {};
+	snapshotReportIntervalStatistics(statistics, &snapshot);
+
+	printf("  mean %llu ns (reference %.2f), jitter %.1f ns (reference %.1f)\n", (unsigned long long)snapshot.meanNanoseconds, reference.mean, sqrt(double(snapshot.varianceNanoseconds)), sqrt(reference.m2 / double(reference.count - 1)));
+	CHECK(fabs(double(snapshot.meanNanoseconds) - reference.mean) <= 1.0);
+	CHECK(fabs(sqrt(double(snapshot.varianceNanoseconds)) - sqrt(reference.m2 / double(reference.count - 1))) <= 1.0);
+	CHECK_EQUAL(snapshot.minimumNanoseconds, 125000);
+	CHECK_EQUAL(snapshot.maximumNanoseconds, 1000000);
+}
+
+static void testPausesAndReorderedReports(void)
+{
+	ReportIntervalStatistics statistics = {};
+	const mach_timebase_info_data_t timebase = { 1, 1 };
+
+	CHECK_EQUAL(recordReportInterval(statistics, timebase, 1000000), 0);
+	CHECK_EQUAL(recordReportInterval(statistics, timebase, 2000000), 1000000);
+	// A pause while the mouse is at rest only goes into the histogram.
+	CHECK_EQUAL(recordReportInterval(statistics, timebase, 502000000), 500000000);
+	// A queued report with an older timestamp is counted, but measures no interval.
+	CHECK_EQUAL(recordReportInterval(statistics, timebase, 501000000), 0);
+	CHECK_EQUAL(recordReportInterval(statistics, timebase, 502000000), 1000000);
+
+	DeliberateMouseIntervalStatistics snapshot = {};
+	snapshotReportIntervalStatistics(statistics, &snapshot);
+	CHECK_EQUAL(snapshot.reportCount, 5);
+	CHECK_EQUAL(snapshot.intervalCount, 2);
+	CHECK_EQUAL(snapshot.idleCount, 1);
+	CHECK_EQUAL(snapshot.meanNanoseconds, 1000000);
+	CHECK_EQUAL(snapshot.varianceNanoseconds, 0);
+	CHECK_EQUAL(snapshot.buckets[DeliberateMouseIntervalBucket(500000000)], 1);
+	CHECK_EQUAL(snapshot.buckets[DeliberateMouseIntervalBucket(1000000)], 2);
+}
+
+static void testBucketBoundaries(void)
+{
+	// Every bucket begins where the previous one ends, and each interval falls into the bucket whose range contains it.
+	for (uint32_t bucketIndex = 1; bucketIndex < kDeliberateMouseIntervalBucketCount; ++bucketIndex)
+	{
+		uint64_t lowerBound = DeliberateMouseIntervalBucketLowerBound(bucketIndex);
+		CHECK_EQUAL(DeliberateMouseIntervalBucket(lowerBound), bucketIndex);
+		CHECK_EQUAL(DeliberateMouseIntervalBucket(lowerBound - 1), bucketIndex - 1);
+	}
+	CHECK_EQUAL(DeliberateMouseIntervalBucket(0), 0);
+	CHECK_EQUAL(DeliberateMouseIntervalBucket(UINT64_MAX), kDeliberateMouseIntervalBucketCount - 1);
+}
+
+/// Replays the reports of a 1 kHz mouse, where every report arrives a whole number of polls after the previous one, with jitter.
+struct IncidentReplay
+{
+	ReportIntervalStatistics statistics;
+	ReportIncidentLog log;
+	TestRandom random;
+	uint64_t pollTimestamp;
+
+	/// Replays one report.
+	/// - Parameters:
+	///   - polls: The number of polls since the previous report
+	///   - counts: The motion of the report
+	///   - offset: How far the report is from the polling schedule, in nanoseconds
+	void report(uint32_t polls, uint32_t counts, int64_t offset = 0)
+	{
+		pollTimestamp += uint64_t(polls) * 1000000;
+		uint64_t timestamp = uint64_t(int64_t(pollTimestamp) + offset) - 5000 + random.below(10001);
+		uint64_t interval = recordReportInterval(statistics, { 1, 1 }, timestamp);
+		detectReportIncidents(log, statistics, interval, timestamp, 0, counts);
+	}
+
+	/// Replays fast motion, one report per poll.
+	void moveFast(uint32_t reportCount)
+	{
+		for (uint32_t reportIndex = 0; reportIndex < reportCount; ++reportIndex)
+		{
+			report(1, 8);
+		}
+	}
+};
+
+static void testSlowMotionAndPausesAreNotGaps(void)
+{
+	IncidentReplay replay = { {}, {}, { 34 }, 1000000000 };
+	replay.moveFast(200);
+
+	// Moving slowly, the mouse only has a count to report every few polls. Those intervals are longer than 4 polls, but not gaps.
+	for (uint32_t reportIndex = 0; reportIndex < 2000; ++reportIndex)
+	{
+		replay.report(2 + replay.random.below(20), 1);
+	}
+
+	// Slowing down to rest, then moving again after a pause, is not a gap either.
+	replay.moveFast(100);
+	replay.report(1, 4);
+	replay.report(1, 1);
+	replay.report(20, 6);
+	replay.moveFast(100);
+
+	CHECK_EQUAL(replay.log.gapCount, 0);
+	CHECK_EQUAL(replay.log.incidentCount, 0);
+
+	// The polling interval is still a single poll, while the mean counts the skipped polls.
+	CHECK((replay.log.pollingNanoseconds > 990000) && (replay.log.pollingNanoseconds < 1010000));
+	CHECK((replay.statistics.mean >> kReportIntervalMeanFractionBits) > 5000000);
+}
+
+static void testLostReportsAndStallsAreGaps(void)
+{
+	IncidentReplay replay = { {}, {}, { 35 }, 1000000000 };
+	replay.moveFast(200);
+
+	// Reports lost while the mouse kept moving fast.
+	replay.report(6, 8);
+	replay.moveFast(50);
+	CHECK_EQUAL(replay.log.gapCount, 1);
+	CHECK((replay.log.longestGapNanoseconds > 5980000) && (replay.log.longestGapNanoseconds < 6020000));
+
+	// Fewer lost reports than the multiplier are not counted.
+	replay.report(3, 8);
+	replay.moveFast(50);
+	CHECK_EQUAL(replay.log.gapCount, 1);
+
+	// A stall that breaks the polling schedule is a gap, even when the mouse was moving slowly.
+	replay.report(1, 1);
+	replay.report(8, 1, 500000);
+	replay.moveFast(50);
+	CHECK_EQUAL(replay.log.gapCount, 2);
+	CHECK_EQUAL(replay.log.incidents[1].kind, kDeliberateMouseIncidentGap);
+	CHECK((replay.log.incidents[1].durationNanoseconds > 8480000) && (replay.log.incidents[1].durationNanoseconds < 8520000));
+
+	// A pause longer than the idle limit is never a gap.
+	replay.report(40, 8);
+	CHECK_EQUAL(replay.log.gapCount, 2);
+}
+
+static void testReportMotionCounts(void)
+{
+	CHECK_EQUAL(reportMotionCounts(0, 0), 0);
+	CHECK_EQUAL(reportMotionCounts(-3, 2), 5);
+	CHECK_EQUAL(reportMotionCounts(INT32_MIN, INT32_MIN), UINT32_MAX);
+	CHECK_EQUAL(reportMotionCounts(INT32_MAX, 0), INT32_MAX);
+}
+
+int main(void)
+{
+	RUN_TEST(testPollingRatesMatchReference);
+	RUN_TEST(testRateChangeAfterLongRun);
+	RUN_TEST(testPausesAndReorderedReports);
+	RUN_TEST(testBucketBoundaries);
+	RUN_TEST(testSlowMotionAndPausesAreNotGaps);
+	RUN_TEST(testLostReportsAndStallsAreGaps);
+	RUN_TEST(testReportMotionCounts);
+
+	return finishTests();
+}
@@ -0,0 +1,161 @@
+//
+//  ScrollCurveTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Checks the scroll acceleration curve against golden values: the table built from a set of points, and the wheel motion
+// dispatched for recorded traces of a standard and a high resolution wheel. The curve only depends on the reports,
+// so these values must never change unless the curve itself is meant to.
+//
+
+#include "TestSupport.h"
+#include "MouseMotionProcessing.h"
+
+/// Timestamps are in nanoseconds, which is what mach absolute time units are on Apple silicon.
+constexpr uint64_t kMillisecond = 1000000;
+
+/// One wheel report of a recorded trace.
+struct ScrollTraceReport
+{
+	/// The time of the report, in milliseconds from the start of the trace
+	uint32_t milliseconds;
+	/// The wheel counts of the report
+	int32_t wheel;
+	/// The golden 16.16 wheel motion in detents, after the gain
+	int32_t expected;
+};
+
+/// Builds the curve the driver builds for `ScrollAccelerationCurve` = [100, 200, 400], with the rest interval of the driver.
+static ScrollCurve makeTestCurve(void)
+{
+	static const int32_t kPoints[] = { 1 << 16, 2 << 16, 4 << 16 };
+	ScrollCurve curve = {};
+	curve.timestampFrequency = 1000 * kMillisecond;
+	curve.restInterval = 250 * kMillisecond;
+	buildScrollCurve(kPoints, 3, curve);
+	return curve;
+}
+
+/// Replays a trace through the curve, and checks the motion dispatched for every report.
+/// - Parameters:
+///   - curve: The scroll curve
+///   - trace: The reports of the trace
+///   - reportCount: The number of reports
+///   - resolution: The number of counts per detent of the wheel
+static void replayScrollTrace(const ScrollCurve& curve, const ScrollTraceReport* trace, uint32_t reportCount, uint32_t resolution)
+{
+	ScrollAccelerationState state = {};
+	uint64_t start = 1000 * kMillisecond;
+
+	for (uint32_t index = 0; index < reportCount; ++index)
+	{
+		int32_t detents = accelerateScroll(curve, state, start + (trace[index].milliseconds * kMillisecond), trace[index].wheel, resolution);
+		if (detents != trace[index].expected)
+		{
+			CHECK_EQUAL(detents, trace[index].expected);
+			printf("  report %u at %u ms\n", index, trace[index].milliseconds);
+		}
+	}
+}
+
+static void testCurveTableIsGolden(void)
+{
+	ScrollCurve curve = makeTestCurve();
+
+	// The points are spread evenly over the 63 intervals of the table, so the middle point falls between entries 31 and 32.
+	CHECK_EQUAL(curve.gains[0], 65536);
+	CHECK_EQUAL(curve.gains[1], 67616);
+	CHECK_EQUAL(curve.gains[10], 86341);
+	CHECK_EQUAL(curve.gains[31], 130031);
+	CHECK_EQUAL(curve.gains[32], 133152);
+	CHECK_EQUAL(curve.gains[40], 166440);
+	CHECK_EQUAL(curve.gains[62], 257982);
+	CHECK_EQUAL(curve.gains[63], 262144);
+
+	for (uint32_t entry = 1; entry < kScrollCurveEntries; ++entry)
+	{
+		CHECK(curve.gains[entry] >= curve.gains[entry - 1]);
+	}
+
+	// A single point is a flat curve.
+	static const int32_t kFlat[] = { 3 << 15 };
+	buildScrollCurve(kFlat, 1, curve);
+	for (uint32_t entry = 0; entry < kScrollCurveEntries; ++entry)
+	{
+		CHECK_EQUAL(curve.gains[entry], 3 << 15);
+	}
+}
+
+static void testStandardWheelTraceIsGolden(void)
+{
+	// Flicking the wheel down faster and faster, until the gain reaches the end of the curve, then turning it up,
+	// and after a pause, up again. A change of direction and a pause both start again from the gain at rest.
+	static const ScrollTraceReport kTrace[] =
+	{
+		{ 0, -1, -65536 }, { 100, -1, -75938 }, { 160, -1, -86341 }, { 190, -1, -111307 }, { 210, -1, -149796 }, { 225, -1, -212211 },
+		{ 235, -1, -262144 }, { 243, -1, -262144 }, { 250, -1, -262144 }, { 256, -1, -262144 }, { 261, -1, -262144 }, { 265, -1, -262144 },
+		{ 280, 1, 65536 }, { 300, 1, 117548 }, { 700, 1, 65536 }, { 720, 1, 117548 },
+	};
+
+	replayScrollTrace(makeTestCurve(), kTrace, sizeof(kTrace) / sizeof(kTrace[0]), 0);
+}
+
+static void testHighResolutionWheelTraceIsGolden(void)
+{
+	// A high resolution wheel at 120 counts per detent, reporting every 4 milliseconds. Its velocity is measured in detents,
+	// not counts, and the fraction of a detent that the division by the resolution leaves is carried to the next report.
+	static const ScrollTraceReport kTrace[] =
+	{
+		{ 0, 30, 16384 }, { 4, 45, 71777 }, { 8, 60, 131072 }, { 12, 60, 131072 }, { 16, 90, 196608 }, { 20, 120, 262144 },
+		{ 24, 120, 262144 }, { 28, -40, -21845 },
+	};
+
+	replayScrollTrace(makeTestCurve(), kTrace, sizeof(kTrace) / sizeof(kTrace[0]), 120);
+}
+
+static void testSlowScrollingKeepsEveryCount(void)
+{
+	// With a flat curve, a high resolution wheel turned one count at a time dispatches exactly one detent per 120 counts,
+	// since no fraction is ever lost to rounding.
+	static const int32_t kFlat[] = { 1 << 16 };
+	ScrollCurve curve = makeTestCurve();
+	buildScrollCurve(kFlat, 1, curve);
+
+	ScrollAccelerationState state = {};
+	int64_t dispatched = 0;
+	for (uint32_t count = 1; count <= 1200; ++count)
+	{
+		dispatched += accelerateScroll(curve, state, count * 10 * kMillisecond, 1, 120);
+	}
+
+	CHECK_EQUAL(dispatched, 10 << 16);
+}
+
+static void testExtremeReportsSaturate(void)
+{
+	ScrollCurve curve = makeTestCurve();
+	ScrollAccelerationState state = {};
+
+	// The largest counts are clamped, and reports a nanosecond apart select the last entry without overflowing.
+	CHECK_EQUAL(accelerateScroll(curve, state, 1000, INT32_MAX, 0), INT32_MAX);
+	CHECK_EQUAL(accelerateScroll(curve, state, 1001, INT32_MAX, 0), INT32_MAX);
+	CHECK_EQUAL(accelerateScroll(curve, state, 1002, INT32_MIN, 1), INT32_MIN);
+	CHECK_EQUAL(accelerateScroll(curve, state, 1003, 0, 1), 0);
+
+	// A report with the same timestamp as the previous one starts from rest, rather than dividing by zero.
+	CHECK_EQUAL(accelerateScroll(curve, state, 1002, -1, 0), -65536);
+	CHECK_EQUAL(state.velocity, 0);
+}
+
+int main(void)
+{
+	RUN_TEST(testCurveTableIsGolden);
+	RUN_TEST(testStandardWheelTraceIsGolden);
+	RUN_TEST(testHighResolutionWheelTraceIsGolden);
+	RUN_TEST(testSlowScrollingKeepsEveryCount);
+	RUN_TEST(testExtremeReportsSaturate);
+
+	return finishTests();
+}
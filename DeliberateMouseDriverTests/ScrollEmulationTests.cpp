@@ -0,0 +1,232 @@
+//
+//  ScrollEmulationTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Replays pointer motion through scroll emulation while the scroll button is held, and checks that the motion inside the slop
+// does not scroll until it leaves it, that scrolling is locked to the axis it started on, that a press that never leaves the slop
+// is a tap, and that the fraction of a scroll unit each report leaves is carried over to the next one rather than lost.
+//
+
+#include "TestSupport.h"
+#include "MouseMotionProcessing.h"
+
+constexpr uint32_t kScrollButton = 1 << 2;
+
+/// One report of pointer motion while the scroll button is held, in 16.16.
+struct ScrollTraceReport
+{
+	int32_t dX;
+	int32_t dY;
+	/// The scroll the report should dispatch
+	int32_t vertical;
+	int32_t horizontal;
+};
+
+/// Replays a trace through scroll emulation, starting with the press of the scroll button, and checks the scroll of every report.
+/// - Parameters:
+///   - config: The scroll emulation configuration
+///   - state: The state of the scroll emulation, which is left as the trace ends
+///   - trace: The reports of the trace
+///   - reportCount: The number of reports
+static void replayScrollTrace(const ScrollEmulationConfig& config, ScrollEmulationState& state, const ScrollTraceReport* trace, uint32_t reportCount)
+{
+	beginScrollEmulation(state);
+
+	for (uint32_t index = 0; index < reportCount; ++index)
+	{
+		int32_t vertical = 0;
+		int32_t horizontal = 0;
+		emulateScroll(config, state, trace[index].dX, trace[index].dY, &vertical, &horizontal);
+		if ((vertical != trace[index].vertical) || (horizontal != trace[index].horizontal))
+		{
+			CHECK_EQUAL(vertical, trace[index].vertical);
+			CHECK_EQUAL(horizontal, trace[index].horizontal);
+			printf("  report %u\n", index);
+		}
+	}
+}
+
+static void testRemaindersCarryOverReports(void)
+{
+	// A quarter of a scroll unit per unit of motion. Leaving the slop scrolls the whole motion so far,
+	// then each report of 3 units scrolls 0.75 units, which only adds up to a whole unit with the fraction the previous report left.
+	static const ScrollEmulationConfig kConfig = { kScrollButton, 1 << 14, true };
+	static const ScrollTraceReport kTrace[] =
+	{
+		{ 0, 8 << 16, 2 << 16, 0 },
+		{ 0, 3 << 16, 0, 0 },
+		{ 0, 3 << 16, 1 << 16, 0 },
+		{ 0, 3 << 16, 1 << 16, 0 },
+		// Turning back uses up the fraction first, and then scrolls the other way, keeping fractions of the other sign.
+		{ 0, -(1 << 16), 0, 0 },
+		{ 0, -(3 << 16), 0, 0 },
+		{ 0, -(3 << 16), -(1 << 16), 0 },
+		{ 0, -(5 << 16), -(1 << 16), 0 },
+	};
+
+	ScrollEmulationState state = {};
+	replayScrollTrace(kConfig, state, kTrace, sizeof(kTrace) / sizeof(kTrace[0]));
+	CHECK_EQUAL(state.remainderVertical, -(3 << 14));
+	CHECK_EQUAL(state.remainderHorizontal, 0);
+
+	// At the default 20 percent, no scale is exact, and a long random motion still scrolls exactly what it measured, less the last fraction.
+	ScrollEmulationConfig config = { kScrollButton, (20 << 16) / 100, false };
+	TestRandom random = { 0x243F6A8885A308D3ULL };
+	int64_t measuredVertical = 0;
+	int64_t measuredHorizontal = 0;
+	int64_t scrolledVertical = 0;
+	int64_t scrolledHorizontal = 0;
+	uint32_t fractionalScrolls = 0;
+
+	beginScrollEmulation(state);
+	for (uint32_t index = 0; index < 10000; ++index)
+	{
+		int32_t dX = int32_t(random.below(16 << 16)) - (8 << 16);
+		int32_t dY = int32_t(random.below(12 << 16)) - (5 << 16);
+		int32_t vertical = 0;
+		int32_t horizontal = 0;
+		bool inSlop = (state.axis == kScrollEmulationAxisNone);
+		emulateScroll(config, state, dX, dY, &vertical, &horizontal);
+
+		// The first report out of the slop scrolls the motion of every report before it.
+		if ((inSlop == true) && (state.axis != kScrollEmulationAxisNone))
+		{
+			dX = state.slopX;
+			dY = state.slopY;
+		}
+		if (state.axis != kScrollEmulationAxisNone)
+		{
+			measuredVertical += multiplyFixed(dY, config.scale);
+			measuredHorizontal += multiplyFixed(dX, config.scale);
+		}
+		scrolledVertical += vertical;
+		scrolledHorizontal += horizontal;
+		fractionalScrolls += ((vertical % (1 << 16)) != 0) || ((horizontal % (1 << 16)) != 0);
+	}
+
+	CHECK_EQUAL(fractionalScrolls, 0);
+	CHECK_EQUAL(scrolledVertical + state.remainderVertical, measuredVertical);
+	CHECK_EQUAL(scrolledHorizontal + state.remainderHorizontal, measuredHorizontal);
+	CHECK((state.remainderVertical > -(1 << 16)) && (state.remainderVertical < (1 << 16)));
+	CHECK((state.remainderHorizontal > -(1 << 16)) && (state.remainderHorizontal < (1 << 16)));
+}
+
+static void testSlopAndAxisLock(void)
+{
+	// Nothing scrolls while the motion since the press stays within 4 units on both axes, wherever it wanders inside.
+	// The report that reaches 4 units on the X axis leaves the slop, with X just ahead of Y, so scrolling locks to the horizontal axis.
+	static const ScrollTraceReport kLockedTrace[] =
+	{
+		{ 3 << 16, 0, 0, 0 },
+		{ 0, -(3 << 16), 0, 0 },
+		{ -(2 << 16), 1 << 16, 0, 0 },
+		{ 2 << 16, -(1 << 16) - 65535, 0, 0 },
+		{ 1 << 16, 0, 0, 4 << 16 },
+		// Vertical motion no longer scrolls, however large.
+		{ 0, 10 << 16, 0, 0 },
+		{ -(2 << 16), -(20 << 16), 0, -(2 << 16) },
+	};
+
+	ScrollEmulationConfig config = { kScrollButton, 1 << 16, true };
+	ScrollEmulationState state = {};
+	replayScrollTrace(config, state, kLockedTrace, sizeof(kLockedTrace) / sizeof(kLockedTrace[0]));
+	CHECK_EQUAL(state.axis, kScrollEmulationAxisHorizontal);
+	CHECK_EQUAL(state.slopX, 4 << 16);
+	CHECK_EQUAL(state.slopY, -(4 << 16) + 1);
+
+	// Without the lock, the same motion scrolls both axes, and the fraction of a unit of Y the slop left is carried.
+	static const ScrollTraceReport kUnlockedTrace[] =
+	{
+		{ 3 << 16, 0, 0, 0 },
+		{ 0, -(3 << 16), 0, 0 },
+		{ -(2 << 16), 1 << 16, 0, 0 },
+		{ 2 << 16, -(1 << 16) - 65535, 0, 0 },
+		{ 1 << 16, 0, -(3 << 16), 4 << 16 },
+		{ 0, -1, -(1 << 16), 0 },
+		{ 0, 10 << 16, 10 << 16, 0 },
+	};
+
+	config.axisLock = false;
+	replayScrollTrace(config, state, kUnlockedTrace, sizeof(kUnlockedTrace) / sizeof(kUnlockedTrace[0]));
+	CHECK_EQUAL(state.axis, kScrollEmulationAxisBoth);
+	CHECK_EQUAL(state.remainderVertical, 0);
+
+	// Leaving the slop on Y locks to the vertical axis, and a tie goes to the vertical axis too.
+	static const ScrollTraceReport kVerticalTrace[] =
+	{
+		{ -(4 << 16), 4 << 16, 4 << 16, 0 },
+		{ 6 << 16, 0, 0, 0 },
+	};
+
+	config.axisLock = true;
+	replayScrollTrace(config, state, kVerticalTrace, sizeof(kVerticalTrace) / sizeof(kVerticalTrace[0]));
+	CHECK_EQUAL(state.axis, kScrollEmulationAxisVertical);
+}
+
+static void testTapInsideSlopClicks(void)
+{
+	ScrollEmulationConfig config = { kScrollButton, 1 << 16, true };
+	ScrollEmulationState state = {};
+
+	// A press that jitters a little, and even moves 3 units away and comes back, never scrolls, so releasing it is a tap.
+	static const ScrollTraceReport kTapTrace[] =
+	{
+		{ 1 << 16, -(1 << 16), 0, 0 },
+		{ 2 << 16, 0, 0, 0 },
+		{ -(3 << 16), 1 << 16, 0, 0 },
+		{ 0, 3 << 16, 0, 0 },
+	};
+	replayScrollTrace(config, state, kTapTrace, sizeof(kTapTrace) / sizeof(kTapTrace[0]));
+	CHECK(state.active);
+	CHECK(endScrollEmulation(state));
+	CHECK_EQUAL(state.active, false);
+
+	// A press that scrolled is not a tap, even once the motion is back where it started.
+	static const ScrollTraceReport kScrollTrace[] =
+	{
+		{ 0, 5 << 16, 5 << 16, 0 },
+		{ 0, -(5 << 16), -(5 << 16), 0 },
+	};
+	replayScrollTrace(config, state, kScrollTrace, sizeof(kScrollTrace) / sizeof(kScrollTrace[0]));
+	CHECK_EQUAL(endScrollEmulation(state), false);
+
+	// The next press starts over, with nothing left of the previous scroll.
+	state.remainderVertical = 1 << 15;
+	beginScrollEmulation(state);
+	CHECK(state.active);
+	CHECK_EQUAL(state.axis, kScrollEmulationAxisNone);
+	CHECK_EQUAL(state.slopX, 0);
+	CHECK_EQUAL(state.slopY, 0);
+	CHECK_EQUAL(state.remainderVertical, 0);
+	CHECK(endScrollEmulation(state));
+}
+
+static void testLargeMotionSaturates(void)
+{
+	// The largest motion at the largest scale saturates rather than overflowing, and keeps no fraction.
+	ScrollEmulationConfig config = { kScrollButton, INT32_MAX, false };
+	ScrollEmulationState state = {};
+	beginScrollEmulation(state);
+
+	int32_t vertical = 0;
+	int32_t horizontal = 0;
+	emulateScroll(config, state, INT32_MIN, INT32_MAX, &vertical, &horizontal);
+	CHECK_EQUAL(vertical, INT32_MAX);
+	CHECK_EQUAL(horizontal, INT32_MIN);
+	emulateScroll(config, state, INT32_MIN, INT32_MAX, &vertical, &horizontal);
+	CHECK_EQUAL(vertical, INT32_MAX);
+	CHECK_EQUAL(horizontal, INT32_MIN);
+}
+
+int main(void)
+{
+	RUN_TEST(testRemaindersCarryOverReports);
+	RUN_TEST(testSlopAndAxisLock);
+	RUN_TEST(testTapInsideSlopClicks);
+	RUN_TEST(testLargeMotionSaturates);
+
+	return finishTests();
+}
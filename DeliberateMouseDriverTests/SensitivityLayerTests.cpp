@@ -0,0 +1,242 @@
+//
+//  SensitivityLayerTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Checks that the sensitivity layer follows the stage and sniper buttons on the report that changes them, and replays
+// traces that switch layers in the middle of a motion through the transform and smoothing filter the way `dispatchMouseReport` does,
+// to check that the motion held back by the filter is carried over the switch at the sensitivity it was measured with.
+//
+
+#include "TestSupport.h"
+#include "MouseMotionProcessing.h"
+
+/// Timestamps are in nanoseconds, which is what mach absolute time units are on Apple silicon.
+constexpr uint64_t kMillisecond = 1000000;
+
+constexpr uint32_t kSniperButton = 1 << 3;
+constexpr uint32_t kStageButton = 1 << 4;
+
+/// Three stages at 1, 2, and 1/2 of the sensitivity, and a sniper button that quarters the stage.
+static const SensitivityLayerConfig kLayers = { 3, { 1 << 16, 2 << 16, 1 << 15, 1 << 16 }, kStageButton, 1 << 14, kSniperButton };
+
+/// One report of a recorded trace.
+struct LayerTraceReport
+{
+	uint32_t buttons;
+	int32_t x;
+	int32_t y;
+};
+
+/// The result of replaying a trace.
+struct LayerTraceReplay
+{
+	/// The 16.16 motion of every report after the transform of the layer it selected, before smoothing
+	int64_t transformedX;
+	int64_t transformedY;
+	/// The 16.16 motion that left the smoothing filter, including the drain steps after the last report
+	int64_t outputX;
+	int64_t outputY;
+	/// The number of reports whose transform did not scale the motion by the expected layer
+	uint32_t wrongLayerReports;
+};
+
+/// Returns the 16.16 scale of the layer for a stage, with or without the sniper scale.
+static int64_t layerScale(uint8_t stage, bool sniper)
+{
+	return sniper ? saturateFixed(multiplyFixed(kLayers.stageScales[stage], kLayers.sniperScale)) : kLayers.stageScales[stage];
+}
+
+/// Replays a trace with one report per millisecond. The layer is selected on a button edge, before the motion of the report is transformed,
+/// then the motion goes through the smoothing filter, and once the trace ends the drain timer steps the filter until it is empty.
+/// - Parameters:
+///   - trace: The reports of the trace
+///   - reportCount: The number of reports
+///   - sensitivity: The 16.16 sensitivity of the device
+///   - timeConstant: The time constant of the smoothing filter, or 0 to disable smoothing
+static LayerTraceReplay replayLayerTrace(const LayerTraceReport* trace, uint32_t reportCount, int32_t sensitivity, uint64_t timeConstant)
+{
+	MotionTransformConfig config = { 0, false, false, false, 1 << 16, 1 << 16, sensitivity };
+	MotionTransform transforms[kSensitivityLayerCount] = {};
+	buildSensitivityLayers(config, kLayers, transforms);
+
+	MotionSmoothingState smoothing = {};
+	MotionFilterFunction filter = configureMotionSmoothing(smoothing, timeConstant);
+	const MotionTransform* transform = &transforms[sensitivityLayerIndex(0, false)];
+	uint32_t buttonState = 0;
+	uint8_t stage = 0;
+	uint64_t timestamp = 1000 * kMillisecond;
+	LayerTraceReplay replay = {};
+
+	smoothing.lastTimestamp = timestamp;
+
+	for (uint32_t index = 0; index < reportCount; ++index)
+	{
+		const LayerTraceReport& report = trace[index];
+		timestamp += kMillisecond;
+
+		if (report.buttons != buttonState)
+		{
+			transform = &transforms[selectSensitivityLayer(kLayers, buttonState, report.buttons, &stage)];
+			buttonState = report.buttons;
+		}
+
+		int32_t dX = 0;
+		int32_t dY = 0;
+		applyMotionTransform(*transform, report.x, report.y, &dX, &dY);
+
+		// The motion of the edge report itself already uses the new layer.
+		int64_t scale = multiplyFixed(sensitivity, layerScale(stage, (buttonState & kSniperButton) != 0));
+		replay.wrongLayerReports += (dX != (int64_t(report.x) * scale)) || (dY != (int64_t(report.y) * scale));
+		replay.transformedX += dX;
+		replay.transformedY += dY;
+
+		filter(smoothing, timestamp, &dX, &dY);
+		replay.outputX += dX;
+		replay.outputY += dY;
+	}
+
+	for (uint64_t drainTime = motionSmoothingDrainTime(smoothing); drainTime != 0; drainTime = motionSmoothingDrainTime(smoothing))
+	{
+		int32_t dX = 0;
+		int32_t dY = 0;
+		filter(smoothing, drainTime, &dX, &dY);
+		replay.outputX += dX;
+		replay.outputY += dY;
+	}
+
+	return replay;
+}
+
+static void testLayerFollowsButtonEdges(void)
+{
+	struct LayerStep
+	{
+		uint32_t buttons;
+		uint8_t stage;
+		bool sniper;
+	};
+
+	static const LayerStep kSteps[] =
+	{
+		// Pressing the stage button moves to the next stage, and holding or releasing it does not.
+		{ kStageButton, 1, false },
+		{ kStageButton | 1, 1, false },
+		{ 1, 1, false },
+		// The sniper layer of the current stage is selected for as long as the sniper button is held.
+		{ kSniperButton, 1, true },
+		{ kSniperButton | kStageButton, 2, true },
+		{ kStageButton, 2, false },
+		{ 0, 2, false },
+		// The stages wrap around after the last one.
+		{ kStageButton, 0, false },
+		{ 0, 0, false },
+		{ kStageButton | kSniperButton, 1, true },
+		{ 0, 1, false },
+	};
+
+	uint32_t buttonState = 0;
+	uint8_t stage = 0;
+	for (const LayerStep& step : kSteps)
+	{
+		uint32_t layer = selectSensitivityLayer(kLayers, buttonState, step.buttons, &stage);
+		buttonState = step.buttons;
+
+		CHECK_EQUAL(stage, step.stage);
+		CHECK_EQUAL(layer, sensitivityLayerIndex(step.stage, step.sniper));
+	}
+
+	// A single stage never moves, whatever is pressed.
+	SensitivityLayerConfig single = kLayers;
+	single.stageCount = 1;
+	stage = 0;
+	CHECK_EQUAL(selectSensitivityLayer(single, 0, kStageButton, &stage), sensitivityLayerIndex(0, false));
+	CHECK_EQUAL(stage, 0);
+}
+
+static void testLayersScaleTheSensitivity(void)
+{
+	MotionTransformConfig config = { 90, true, false, true, 1 << 16, 3 << 16, 1 << 16 };
+	MotionTransform transforms[kSensitivityLayerCount] = {};
+	buildSensitivityLayers(config, kLayers, transforms);
+
+	for (uint8_t stage = 0; stage < kSensitivityStageMax; ++stage)
+	{
+		for (uint32_t sniper = 0; sniper < 2; ++sniper)
+		{
+			// Every layer is the transform of the device with its scale folded into the sensitivity, so the rest of the configuration still applies.
+			MotionTransformConfig layerConfig = config;
+			layerConfig.sensitivity = saturateFixed(multiplyFixed(config.sensitivity, layerScale(stage, sniper != 0)));
+			MotionTransform expected = buildMotionTransform(layerConfig);
+			const MotionTransform& layer = transforms[sensitivityLayerIndex(stage, sniper != 0)];
+
+			CHECK((layer.m00 == expected.m00) && (layer.m01 == expected.m01) && (layer.m10 == expected.m10) && (layer.m11 == expected.m11));
+		}
+	}
+
+	// The sniper layer of the second stage is half the sensitivity: twice the stage, a quarter for the sniper.
+	// Swapping the axes and rotating by 90 degrees cancel out, so sensor Y stays pointer Y, inverted, and scaled by the Y scale of 3.
+	int32_t dX = 0;
+	int32_t dY = 0;
+	applyMotionTransform(transforms[sensitivityLayerIndex(1, true)], 0, 100, &dX, &dY);
+	CHECK_EQUAL(dX, 0);
+	CHECK_EQUAL(dY, -(150 << 16));
+
+	// The largest scales on top of the largest sensitivity saturate rather than overflow.
+	SensitivityLayerConfig extreme = { kSensitivityStageMax, { INT32_MAX, INT32_MIN, 0, INT32_MAX }, kStageButton, INT32_MAX, kSniperButton };
+	config.sensitivity = INT32_MAX;
+	buildSensitivityLayers(config, extreme, transforms);
+	CHECK_EQUAL(transforms[sensitivityLayerIndex(2, true)].m01, 0);
+}
+
+static void testLayerSwitchMidMotionCarriesRemainders(void)
+{
+	// A steady diagonal motion, with the sniper button held in the middle of it, then a stage change while still moving.
+	LayerTraceReport trace[60] = {};
+	for (uint32_t index = 0; index < 60; ++index)
+	{
+		trace[index] = { 0, 7, -3 };
+	}
+	for (uint32_t index = 20; index < 35; ++index)
+	{
+		trace[index].buttons = kSniperButton;
+	}
+	for (uint32_t index = 45; index < 50; ++index)
+	{
+		trace[index].buttons = kStageButton;
+	}
+
+	// A sensitivity with a long fraction leaves a fractional remainder in the filter on every report, across every switch.
+	static const int32_t kSensitivities[] = { 1 << 16, 19661, (5 << 16) + 12345 };
+	static const uint64_t kTimeConstants[] = { 0, 2 * kMillisecond, 8 * kMillisecond };
+
+	for (int32_t sensitivity : kSensitivities)
+	{
+		for (uint64_t timeConstant : kTimeConstants)
+		{
+			LayerTraceReplay replay = replayLayerTrace(trace, 60, sensitivity, timeConstant);
+
+			// Every report is scaled by its own layer, and everything the filter held back at a switch is released unchanged,
+			// rather than rescaled by the new layer or dropped.
+			CHECK_EQUAL(replay.wrongLayerReports, 0);
+			CHECK_EQUAL(replay.outputX, replay.transformedX);
+			CHECK_EQUAL(replay.outputY, replay.transformedY);
+		}
+	}
+
+	// Without smoothing, the exact totals of the trace: 20 reports at stage 0, 15 sniper reports, 10 more at stage 0, then 15 at stage 1.
+	LayerTraceReplay replay = replayLayerTrace(trace, 60, 1 << 16, 0);
+	CHECK_EQUAL(replay.outputX, (20 * 7LL << 16) + (15 * 7LL << 14) + (10 * 7LL << 16) + (15 * 7LL << 17));
+	CHECK_EQUAL(replay.outputY, -((20 * 3LL << 16) + (15 * 3LL << 14) + (10 * 3LL << 16) + (15 * 3LL << 17)));
+}
+
+int main(void)
+{
+	RUN_TEST(testLayerFollowsButtonEdges);
+	RUN_TEST(testLayersScaleTheSensitivity);
+	RUN_TEST(testLayerSwitchMidMotionCarriesRemainders);
+
+	return finishTests();
+}
@@ -0,0 +1,38 @@
+//
+//  mach_time.h
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// The parts of <mach/mach_time.h> the driver headers use, for building the host tests on platforms other than macOS.
+// Absolute time units are nanoseconds here, which matches a timebase of 1/1.
+//
+
+#ifndef DeliberateMouseDriverTests_mach_time_h
+#define DeliberateMouseDriverTests_mach_time_h
+
+#include <stdint.h>
+#include <time.h>
+
+typedef struct mach_timebase_info
+{
+	uint32_t numer;
+	uint32_t denom;
+} mach_timebase_info_data_t;
+
+static inline uint64_t mach_absolute_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t(now.tv_sec) * 1000000000ULL) + uint64_t(now.tv_nsec);
+}
+
+static inline int mach_timebase_info(mach_timebase_info_data_t* info)
+{
+	info->numer = 1;
+	info->denom = 1;
+	return 0;
+}
+
+#endif /* DeliberateMouseDriverTests_mach_time_h */
@@ -0,0 +1,85 @@
+//
+//  TestSupport.h
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// A minimal test harness for the host tests, so they build with nothing but a C++ compiler and CMake.
+// Each test executable calls `RUN_TEST` for every test function, and returns `finishTests()` from `main`.
+//
+
+#ifndef TestSupport_h
+#define TestSupport_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+
+/// The number of checks that failed in the current test executable.
+static uint32_t sFailedChecks = 0;
+
+/// Fails the current test, without stopping it, when the condition is false.
+#define CHECK(condition) do { if (!(condition)) { ++sFailedChecks; printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); } } while (0)
+
+/// Fails the current test, without stopping it, when the values differ. Both values are printed as 64-bit integers.
+#define CHECK_EQUAL(actual, expected) do { long long actualValue = (long long)(actual); long long expectedValue = (long long)(expected); \
+	if (actualValue != expectedValue) { ++sFailedChecks; printf("%s:%d: CHECK_EQUAL(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #actual, #expected, actualValue, expectedValue); } } while (0)
+
+/// Runs a test function, and prints whether it passed.
+#define RUN_TEST(test) do { uint32_t failedBefore = sFailedChecks; test(); printf("%s %s\n", (sFailedChecks == failedBefore) ? "PASS" : "FAIL", #test); } while (0)
+
+/// Returns the exit code of the test executable.
+static inline int finishTests(void)
+{
+	printf("%u failed checks\n", sFailedChecks);
+	return (sFailedChecks == 0) ? 0 : 1;
+}
+
+/// A deterministic pseudo random generator, so every failure can be reproduced.
+struct TestRandom
+{
+	uint64_t state;
+
+	uint64_t next(void)
+	{
+		// xorshift64*
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545F4914F6CDD1DULL;
+	}
+
+	/// Returns a value from 0 to `bound` - 1.
+	uint32_t below(uint32_t bound)
+	{
+		return uint32_t(next() % bound);
+	}
+};
+
+/// Measures the average time of a function over enough iterations to run for at least the given duration.
+/// - Parameters:
+///   - minimumNanoseconds: How long to keep running the function
+///   - function: The function to measure, called with the index of the iteration
+/// - Returns: The average duration of one call, in nanoseconds
+template <typename Function>
+static double measureNanoseconds(uint64_t minimumNanoseconds, Function function)
+{
+	using Clock = std::chrono::steady_clock;
+	uint64_t iterations = 0;
+	Clock::time_point begin = Clock::now();
+	uint64_t elapsed = 0;
+
+	while (elapsed < minimumNanoseconds)
+	{
+		for (uint32_t batch = 0; batch < 1024; ++batch)
+		{
+			function(iterations++);
+		}
+		elapsed = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+	}
+
+	return double(elapsed) / double(iterations);
+}
+
+#endif /* TestSupport_h */
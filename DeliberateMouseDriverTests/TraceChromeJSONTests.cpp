@@ -0,0 +1,193 @@
+//
+//  TraceChromeJSONTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Converts a synthetic trace to Chrome trace event JSON, and checks that the document is valid JSON,
+// that every report slice is closed, and that the stage durations use the timebase of the trace.
+//
+
+#include <string>
+#include <vector>
+
+#include "TestSupport.h"
+#include "TraceChromeJSON.h"
+
+/// A minimal JSON validator, which is enough to know that the Perfetto UI will parse the document.
+struct JSONValidator
+{
+	const char* position;
+
+	void skipSpace(void)
+	{
+		while ((*position == ' ') || (*position == '\n') || (*position == '\t') || (*position == '\r'))
+		{
+			++position;
+		}
+	}
+
+	bool string(void)
+	{
+		if (*position++ != '"')
+		{
+			return false;
+		}
+		while ((*position != '"') && (*position != 0))
+		{
+			position += (*position == '\\') ? 2 : 1;
+		}
+		return *position++ == '"';
+	}
+
+	bool value(void)
+	{
+		skipSpace();
+		switch (*position)
+		{
+			case '{': return container('}', true);
+			case '[': return container(']', false);
+			case '"': return string();
+			case 't': position += 4; return true;
+			case 'f': position += 5; return true;
+			default:
+			{
+				char* end = nullptr;
+				strtod(position, &end);
+				bool parsed = (end != position);
+				position = end;
+				return parsed;
+			}
+		}
+	}
+
+	bool container(char close, bool object)
+	{
+		++position;
+		skipSpace();
+		if (*position == close)
+		{
+			++position;
+			return true;
+		}
+
+		while (true)
+		{
+			skipSpace();
+			if (object)
+			{
+				if (string() == false)
+				{
+					return false;
+				}
+				skipSpace();
+				if (*position++ != ':')
+				{
+					return false;
+				}
+			}
+			if (value() == false)
+			{
+				return false;
+			}
+			skipSpace();
+			if (*position == close)
+			{
+				++position;
+				return true;
+			}
+			if (*position++ != ',')
+			{
+				return false;
+			}
+		}
+	}
+};
+
+static uint32_t countOccurrences(const std::string& text, const char* pattern)
+{
+	uint32_t count = 0;
+	for (size_t found = text.find(pattern); found != std::string::npos; found = text.find(pattern, found + 1))
+	{
+		++count;
+	}
+	return count;
+}
+
+static std::string convert(const std::vector<DeliberateMouseTraceRecord>& records, uint32_t numer, uint32_t denom, uint32_t* sliceCount)
+{
+	FILE* file = tmpfile();
+	*sliceCount = writeTraceChromeJSON(file, records.data(), uint32_t(records.size()), numer, denom);
+
+	std::string text(size_t(ftell(file)), '\0');
+	rewind(file);
+	size_t length = fread(&text[0], 1, text.size(), file);
+	fclose(file);
+	text.resize(length);
+
+	return text;
+}
+
+static void testTraceConvertsToValidJSON(void)
+{
+	// Timestamps in the 24 MHz ticks of Apple silicon, whose timebase is 125/3, so 24 ticks are 1 microsecond.
+	std::vector<DeliberateMouseTraceRecord> records =
+	{
+		// The tail of a report that began before the trace did.
+		{ 1000, kDeliberateMouseTraceDispatchScroll, 0, 0, 0 },
+		// A mouse report that took 12 microseconds to go through every stage.
+		{ 2400, kDeliberateMouseTraceReportBegin, 0, 2352, (uint64_t(2) << 32) | 8 },
+		{ 2448, kDeliberateMouseTraceDecode, 0, 5, uint64_t(-3) },
+		{ 2496, kDeliberateMouseTraceScale, 0, uint64_t(5 << 15), uint64_t(-(3 << 15)) },
+		{ 2640, kDeliberateMouseTraceDispatchPointer, 0, 1, 0 },
+		{ 2688, kDeliberateMouseTraceDispatchScroll, 0, 0, 0 },
+		// A consumer key report handed to the superclass.
+		{ 4800, kDeliberateMouseTraceReportBegin, 0, 4800, (uint64_t(3) << 32) | 3 },
+		{ 4896, kDeliberateMouseTracePassThrough, 0, 3, 0 },
+		// Motion released by the smoothing timer, without a report of its own.
+		{ 9600, kDeliberateMouseTraceScale, 0, uint64_t(1 << 14), 0 },
+		{ 9648, kDeliberateMouseTraceDispatchPointer, 0, 0, 0 },
+		{ 9696, kDeliberateMouseTraceDispatchScroll, 0, 0, 0 },
+	};
+
+	uint32_t sliceCount = 0;
+	std::string json = convert(records, 125, 3, &sliceCount);
+
+	JSONValidator validator = { json.c_str() };
+	CHECK(validator.value());
+	validator.skipSpace();
+	CHECK(*validator.position == 0);
+
+	CHECK_EQUAL(sliceCount, 3);
+	CHECK_EQUAL(countOccurrences(json, "\"ph\":\"B\""), 3);
+	CHECK_EQUAL(countOccurrences(json, "\"ph\":\"E\""), 3);
+	CHECK_EQUAL(countOccurrences(json, "\"deferred motion\":true"), 1);
+	CHECK_EQUAL(countOccurrences(json, "\"name\":\"pass through\""), 1);
+	CHECK_EQUAL(countOccurrences(json, "\"name\":\"dispatch scroll\""), 2);
+
+	// The report begins 58.333 microseconds after the first record, decodes in 2, and its pointer dispatch takes 6.
+	CHECK(json.find("\"name\":\"report\",\"ph\":\"B\",\"pid\":1,\"tid\":1,\"ts\":58.333,\"args\":{\"reportID\":2,\"length\":8}") != std::string::npos);
+	CHECK(json.find("\"name\":\"decode\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":58.333,\"dur\":2.000,\"args\":{\"payload0\":5,\"payload1\":-3}") != std::string::npos);
+	CHECK(json.find("\"name\":\"dispatch pointer\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":62.333,\"dur\":6.000") != std::string::npos);
+	CHECK(json.find("\"args\":{\"dX\":2.5000,\"dY\":-1.5000}") != std::string::npos);
+	CHECK(json.find("\"args\":{\"age\":2.000}") != std::string::npos);
+}
+
+static void testEmptyTraceIsValidJSON(void)
+{
+	uint32_t sliceCount = 0;
+	std::string json = convert({}, 1, 1, &sliceCount);
+
+	JSONValidator validator = { json.c_str() };
+	CHECK(validator.value());
+	CHECK_EQUAL(sliceCount, 0);
+}
+
+int main(void)
+{
+	RUN_TEST(testTraceConvertsToValidJSON);
+	RUN_TEST(testEmptyTraceIsValidJSON);
+
+	return finishTests();
+}
@@ -0,0 +1,136 @@
+//
+//  WheelFilterTests.cpp
+//  DeliberateMouseDriverTests
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Replays recorded wheel traces through the reverse tick filter, and checks that isolated ticks against the direction
+// of a jittery wheel are suppressed, while real reversals, slow scrolling, and high resolution wheels pass through.
+//
+
+#include "TestSupport.h"
+#include "MouseMotionProcessing.h"
+
+/// Timestamps are in nanoseconds, which is what mach absolute time units are on Apple silicon.
+constexpr uint64_t kMillisecond = 1000000;
+/// A window that is typical for a worn encoder, in the range of `WheelReverseWindowMilliseconds`.
+constexpr uint64_t kWindow = 30 * kMillisecond;
+
+/// One wheel report of a recorded trace.
+struct WheelTraceReport
+{
+	/// The time of the report, in milliseconds from the start of the trace
+	uint32_t milliseconds;
+	/// The wheel counts of the report
+	int32_t wheel;
+	/// The wheel counts the filter should dispatch for the report
+	int32_t expected;
+};
+
+/// Replays a trace through the filter, and checks the counts dispatched for every report.
+/// - Parameters:
+///   - trace: The reports of the trace
+///   - reportCount: The number of reports
+///   - window: The window of the filter
+/// - Returns: The sum of the dispatched counts
+static int64_t replayWheelTrace(const WheelTraceReport* trace, uint32_t reportCount, uint64_t window)
+{
+	WheelFilterState state = {};
+	uint64_t start = 1000 * kMillisecond;
+	int64_t dispatched = 0;
+
+	for (uint32_t index = 0; index < reportCount; ++index)
+	{
+		int32_t wheel = filterWheel(window, state, start + (trace[index].milliseconds * kMillisecond), trace[index].wheel);
+		if (wheel != trace[index].expected)
+		{
+			CHECK_EQUAL(wheel, trace[index].expected);
+			printf("  report %u at %u ms\n", index, trace[index].milliseconds);
+		}
+		dispatched += wheel;
+	}
+
+	return dispatched;
+}
+
+static void testIsolatedReverseTicksAreSuppressed(void)
+{
+	// A worn encoder scrolling down at about 25 detents per second, which bounces back once in a while.
+	static const WheelTraceReport kTrace[] =
+	{
+		{ 0, -1, -1 }, { 40, -1, -1 }, { 80, -1, -1 }, { 95, 1, 0 }, { 120, -1, -1 }, { 160, -1, -1 },
+		{ 200, -1, -1 }, { 212, 1, 0 }, { 240, -1, -1 }, { 251, 1, 0 }, { 280, -1, -1 }, { 320, -1, -1 },
+	};
+
+	CHECK_EQUAL(replayWheelTrace(kTrace, sizeof(kTrace) / sizeof(kTrace[0]), kWindow), -9);
+}
+
+static void testRealReversalsPassThrough(void)
+{
+	// Scrolling down, then back up past the point of interest. The first tick up is held until the second confirms it,
+	// then both are dispatched together. A bounce on the way up is suppressed like any other.
+	static const WheelTraceReport kTrace[] =
+	{
+		{ 0, -1, -1 }, { 20, -1, -1 }, { 40, -1, -1 }, { 55, 1, 0 }, { 70, 1, 2 }, { 85, 1, 1 },
+		{ 100, 1, 1 }, { 108, -1, 0 }, { 115, 1, 1 }, { 130, 1, 1 },
+	};
+
+	CHECK_EQUAL(replayWheelTrace(kTrace, sizeof(kTrace) / sizeof(kTrace[0]), kWindow), 3);
+}
+
+static void testSlowReversalsAreNotHeld(void)
+{
+	// A reverse tick after the window is a deliberate change of direction, and is dispatched at once.
+	// A held tick that is not confirmed within the window is dropped, even if the wheel later turns the same way.
+	static const WheelTraceReport kTrace[] =
+	{
+		{ 0, 1, 1 }, { 10, 1, 1 }, { 50, -1, -1 }, { 60, -1, -1 }, { 70, 1, 0 }, { 150, 1, 1 }, { 155, -1, 0 }, { 200, -1, -1 },
+	};
+
+	CHECK_EQUAL(replayWheelTrace(kTrace, sizeof(kTrace) / sizeof(kTrace[0]), kWindow), 0);
+}
+
+static void testHighResolutionWheel(void)
+{
+	// A high resolution wheel at 8 counts per detent, reporting every 2 milliseconds, with a one count flicker against it.
+	// The flicker is suppressed, and the reversal at the end is confirmed by the report after it, with every count kept.
+	static const WheelTraceReport kTrace[] =
+	{
+		{ 0, 3, 3 }, { 2, 5, 5 }, { 4, 4, 4 }, { 6, -1, 0 }, { 8, 6, 6 }, { 10, 2, 2 }, { 12, -2, 0 }, { 14, -7, -9 }, { 16, -4, -4 },
+	};
+
+	CHECK_EQUAL(replayWheelTrace(kTrace, sizeof(kTrace) / sizeof(kTrace[0]), kWindow), 7);
+}
+
+static void testDisabledWindowPassesEveryTick(void)
+{
+	static const WheelTraceReport kTrace[] =
+	{
+		{ 0, -1, -1 }, { 5, 1, 1 }, { 10, -1, -1 }, { 11, 0, 0 }, { 12, 1, 1 },
+	};
+
+	CHECK_EQUAL(replayWheelTrace(kTrace, sizeof(kTrace) / sizeof(kTrace[0]), 0), 0);
+}
+
+static void testHeldMotionSaturates(void)
+{
+	// A confirmed reversal of the largest counts saturates rather than overflowing.
+	WheelFilterState state = {};
+	CHECK_EQUAL(filterWheel(kWindow, state, 1000, INT32_MIN), INT32_MIN);
+	CHECK_EQUAL(filterWheel(kWindow, state, 2000, INT32_MAX), 0);
+	CHECK_EQUAL(filterWheel(kWindow, state, 3000, INT32_MAX), INT32_MAX);
+	CHECK_EQUAL(state.heldWheel, 0);
+}
+
+int main(void)
+{
+	RUN_TEST(testIsolatedReverseTicksAreSuppressed);
+	RUN_TEST(testRealReversalsPassThrough);
+	RUN_TEST(testSlowReversalsAreNotHeld);
+	RUN_TEST(testHighResolutionWheel);
+	RUN_TEST(testDisabledWindowPassesEveryTick);
+	RUN_TEST(testHeldMotionSaturates);
+
+	return finishTests();
+}
@@ -0,0 +1,153 @@
+//
+//  TraceChromeJSON.h
+//  DeliberateMouseTrace
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// Converts the binary trace of the report path into the Chrome trace event JSON format, which the Perfetto UI
+// (ui.perfetto.dev) and chrome://tracing open directly. Every report becomes a slice with one child slice per stage,
+// so the latency of each stage of every report can be read off a timeline.
+//
+
+#ifndef TraceChromeJSON_h
+#define TraceChromeJSON_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "DeliberateMouseShared.h"
+
+/// The name of each trace point, as the slice that ends at it.
+/// - Parameters:
+///   - event: One of the `kDeliberateMouseTrace` values
+/// - Returns: The name of the stage, or nullptr for an unknown trace point
+static inline const char* traceStageName(uint32_t event)
+{
+	switch (event)
+	{
+		case kDeliberateMouseTraceDecode: return "decode";
+		case kDeliberateMouseTraceScale: return "transform and filter";
+		case kDeliberateMouseTraceDispatchPointer: return "dispatch pointer";
+		case kDeliberateMouseTraceDispatchScroll: return "dispatch scroll";
+		case kDeliberateMouseTracePassThrough: return "pass through";
+		default: return nullptr;
+	}
+}
+
+/// Converts a duration in mach absolute time units to microseconds, which is the time unit of the trace event format.
+static inline double traceMicroseconds(uint64_t absoluteTime, uint32_t numer, uint32_t denom)
+{
+	return (double(absoluteTime) * numer) / (double(denom) * 1000.0);
+}
+
+/// Writes trace records as a Chrome trace event JSON document.
+///
+/// Each `kDeliberateMouseTraceReportBegin` opens a "report" slice, and every following record closes a stage slice
+/// that started at the previous record. Motion that is dispatched without a report of its own, such as merged reports
+/// and motion released by the smoothing timer, starts a "deferred motion" slice instead. The dispatched motion and the age
+/// of every report are also written as counter tracks.
+/// - Parameters:
+///   - output: The file to write to
+///   - records: The trace records, oldest first, as copied by `kDeliberateMouseMethodCopyTrace`
+///   - recordCount: The number of records
+///   - numer: The numerator of the mach timebase of the machine that recorded the trace
+///   - denom: The denominator of the mach timebase
+/// - Returns: The number of report and deferred motion slices written
+static inline uint32_t writeTraceChromeJSON(FILE* output, const DeliberateMouseTraceRecord* records, uint32_t recordCount, uint32_t numer, uint32_t denom)
+{
+	// Timestamps are written relative to the first record, which keeps them short and exact as doubles.
+	uint64_t origin = (recordCount > 0) ? records[0].timestamp : 0;
+	uint32_t sliceCount = 0;
+	bool sliceOpen = false;
+	uint32_t lastEvent = 0;
+	uint64_t stageBegin = 0;
+	uint64_t lastTimestamp = origin;
+	const char* separator = "\n";
+
+	auto time = [&](uint64_t timestamp)
+	{
+		return traceMicroseconds(timestamp - origin, numer, denom);
+	};
+
+	auto closeSlice = [&]()
+	{
+		if (sliceOpen)
+		{
+			fprintf(output, "%s{\"name\":\"report\",\"ph\":\"E\",\"pid\":1,\"tid\":1,\"ts\":%.3f}", separator, time(lastTimestamp));
+			separator = ",\n";
+			sliceOpen = false;
+		}
+	};
+
+	fprintf(output, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	fprintf(output, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"ReportQueue\"}}", separator);
+	separator = ",\n";
+
+	for (uint32_t recordIndex = 0; recordIndex < recordCount; ++recordIndex)
+	{
+		const DeliberateMouseTraceRecord& record = records[recordIndex];
+		uint64_t timestamp = (record.timestamp > lastTimestamp) ? record.timestamp : lastTimestamp;
+
+		if (record.event == kDeliberateMouseTraceReportBegin)
+		{
+			closeSlice();
+
+			uint64_t age = (timestamp > record.payload0) ? (timestamp - record.payload0) : 0;
+			fprintf(output, "%s{\"name\":\"report\",\"ph\":\"B\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"args\":{\"reportID\":%u,\"length\":%u}}",
+				separator, time(timestamp), uint32_t(record.payload1 >> 32), uint32_t(record.payload1));
+			fprintf(output, "%s{\"name\":\"report age (us)\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"age\":%.3f}}",
+				separator, time(timestamp), traceMicroseconds(age, numer, denom));
+
+			sliceOpen = true;
+			++sliceCount;
+			lastEvent = record.event;
+			stageBegin = timestamp;
+			lastTimestamp = timestamp;
+			continue;
+		}
+
+		const char* stage = traceStageName(record.event);
+		if (stage == nullptr)
+		{
+			continue;
+		}
+
+		// Motion that reaches the filter a second time without a new report was deferred, and is its own slice.
+		if ((record.event == kDeliberateMouseTraceScale) && ((sliceOpen == false) || (lastEvent >= kDeliberateMouseTraceScale)))
+		{
+			closeSlice();
+			fprintf(output, "%s{\"name\":\"report\",\"ph\":\"B\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"args\":{\"deferred motion\":true}}", separator, time(timestamp));
+			sliceOpen = true;
+			++sliceCount;
+			stageBegin = timestamp;
+		}
+
+		// A record without an open slice is the tail of a report that began before the trace did.
+		if (sliceOpen == false)
+		{
+			lastTimestamp = timestamp;
+			continue;
+		}
+
+		fprintf(output, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"payload0\":%lld,\"payload1\":%lld}}",
+			separator, stage, time(stageBegin), traceMicroseconds(timestamp - stageBegin, numer, denom), (long long)record.payload0, (long long)record.payload1);
+
+		if (record.event == kDeliberateMouseTraceScale)
+		{
+			fprintf(output, "%s{\"name\":\"motion\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"dX\":%.4f,\"dY\":%.4f}}",
+				separator, time(timestamp), double(int64_t(record.payload0)) / 65536.0, double(int64_t(record.payload1)) / 65536.0);
+		}
+
+		lastEvent = record.event;
+		stageBegin = timestamp;
+		lastTimestamp = timestamp;
+	}
+
+	closeSlice();
+	fprintf(output, "\n]}\n");
+
+	return sliceCount;
+}
+
+#endif /* TraceChromeJSON_h */
@@ -0,0 +1,188 @@
+//
+//  main.cpp
+//  DeliberateMouseTrace
+//
+// See the LICENSE.txt file for this sample’s licensing information.
+//
+// Abstract:
+// A command line tool that captures the binary trace of the report path and converts it to Chrome trace event JSON,
+// which opens in the Perfetto UI. On macOS it reads the trace straight from the driver through its user client,
+// and on any platform it converts a trace that was saved as raw `DeliberateMouseTraceRecord`s.
+//
+//   DeliberateMouseTrace [--save trace.bin] > trace.json       Captures the trace of the first driver instance (macOS only)
+//   DeliberateMouseTrace --timebase 125/3 trace.bin > trace.json   Converts a saved trace, recorded with the given mach timebase
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__APPLE__)
+#include <IOKit/IOKitLib.h>
+#include <mach/mach_time.h>
+#endif
+
+#include "DeliberateMouseShared.h"
+#include "TraceChromeJSON.h"
+
+#if defined(__APPLE__)
+/// Copies the trace of the first DeliberateMouseDriver instance, which must have `TraceEnabled` set.
+/// - Parameters:
+///   - records: The vector that receives the records, oldest first
+/// - Returns: True if the trace was copied
+static bool captureTrace(std::vector<DeliberateMouseTraceRecord>& records)
+{
+	CFMutableDictionaryRef matching = IOServiceMatching("IOService");
+	CFMutableDictionaryRef properties = CFDictionaryCreateMutable(kCFAllocatorDefault, 1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+	CFDictionarySetValue(properties, CFSTR("IOUserClass"), CFSTR("DeliberateMouseDriver"));
+	CFDictionarySetValue(matching, CFSTR(kIOPropertyMatchKey), properties);
+	CFRelease(properties);
+
+	// IOServiceGetMatchingService consumes the matching dictionary.
+	io_service_t service = IOServiceGetMatchingService(kIOMainPortDefault, matching);
+	if (service == IO_OBJECT_NULL)
+	{
+		fprintf(stderr, "No DeliberateMouseDriver instance is running.\n");
+		return false;
+	}
+
+	io_connect_t connection = IO_OBJECT_NULL;
+	kern_return_t ret = IOServiceOpen(service, mach_task_self(), 0, &connection);
+	IOObjectRelease(service);
+	if (ret != KERN_SUCCESS)
+	{
+		fprintf(stderr, "Failed to open the driver with error 0x%08x. The tool needs the driverkit.userclient-access entitlement.\n", ret);
+		return false;
+	}
+
+	records.resize(kDeliberateMouseTraceCapacity);
+	uint64_t scalars[2] = {};
+	uint32_t scalarCount = 2;
+	size_t size = records.size() * sizeof(DeliberateMouseTraceRecord);
+	ret = IOConnectCallMethod(connection, kDeliberateMouseMethodCopyTrace, nullptr, 0, nullptr, 0, scalars, &scalarCount, records.data(), &size);
+	IOServiceClose(connection);
+
+	if (ret != KERN_SUCCESS)
+	{
+		fprintf(stderr, "Failed to copy the trace with error 0x%08x. Set TraceEnabled on the driver first.\n", ret);
+		return false;
+	}
+
+	records.resize(uint32_t(scalars[0]));
+	fprintf(stderr, "Copied %llu of the %llu records written since tracing was enabled.\n", scalars[0], scalars[1]);
+	return true;
+}
+#endif
+
+/// Reads a trace that was saved as raw records.
+static bool readTrace(const char* path, std::vector<DeliberateMouseTraceRecord>& records)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Failed to open %s.\n", path);
+		return false;
+	}
+
+	DeliberateMouseTraceRecord record;
+	while (fread(&record, sizeof(record), 1, file) == 1)
+	{
+		records.push_back(record);
+	}
+	fclose(file);
+
+	return true;
+}
+
+static void printUsage(void)
+{
+	fprintf(stderr, "usage: DeliberateMouseTrace [--timebase numer/denom] [--save trace.bin] [trace.bin]\n");
+}
+
+int main(int argc, const char* argv[])
+{
+	std::vector<DeliberateMouseTraceRecord> records;
+	const char* inputPath = nullptr;
+	const char* savePath = nullptr;
+	uint32_t numer = 1;
+	uint32_t denom = 1;
+	bool timebaseSet = false;
+
+	for (int argumentIndex = 1; argumentIndex < argc; ++argumentIndex)
+	{
+		if ((strcmp(argv[argumentIndex], "--timebase") == 0) && ((argumentIndex + 1) < argc))
+		{
+			if ((sscanf(argv[++argumentIndex], "%u/%u", &numer, &denom) != 2) || (numer == 0) || (denom == 0))
+			{
+				printUsage();
+				return 1;
+			}
+			timebaseSet = true;
+		}
+		else if ((strcmp(argv[argumentIndex], "--save") == 0) && ((argumentIndex + 1) < argc))
+		{
+			savePath = argv[++argumentIndex];
+		}
+		else if (argv[argumentIndex][0] != '-')
+		{
+			inputPath = argv[argumentIndex];
+		}
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+#if defined(__APPLE__)
+	// A trace captured on this machine uses its timebase, unless another one is given.
+	if (timebaseSet == false)
+	{
+		mach_timebase_info_data_t timebase = {};
+		mach_timebase_info(&timebase);
+		numer = timebase.numer;
+		denom = timebase.denom;
+	}
+#else
+	(void)timebaseSet;
+#endif
+
+	if (inputPath != nullptr)
+	{
+		if (readTrace(inputPath, records) == false)
+		{
+			return 1;
+		}
+	}
+	else
+	{
+#if defined(__APPLE__)
+		if (captureTrace(records) == false)
+		{
+			return 1;
+		}
+#else
+		fprintf(stderr, "Capturing the trace needs macOS. Pass a saved trace instead.\n");
+		printUsage();
+		return 1;
+#endif
+	}
+
+	if (savePath != nullptr)
+	{
+		FILE* file = fopen(savePath, "wb");
+		bool saved = (file != nullptr) && (fwrite(records.data(), sizeof(DeliberateMouseTraceRecord), records.size(), file) == records.size());
+		saved = (file != nullptr) && (fclose(file) == 0) && saved;
+		if (saved == false)
+		{
+			fprintf(stderr, "Failed to save the trace to %s.\n", savePath);
+			return 1;
+		}
+	}
+
+	uint32_t sliceCount = writeTraceChromeJSON(stdout, records.data(), uint32_t(records.size()), numer, denom);
+	fprintf(stderr, "Wrote %u report slices.\n", sliceCount);
+
+	return 0;
+}